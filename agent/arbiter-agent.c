@@ -18,20 +18,32 @@
 
 #include "config.h"
 
+#ifdef HAVE_MEMFD_CREATE
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#endif
+
 #include "arbiter-agent.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <execinfo.h>
 #include <json-glib/json-glib.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gunixfdlist.h>
 
+#include <chamge/common.h>
 #include <chamge/enumtypes.h>
 #include <chamge/arbiter.h>
 #include <chamge/dbus/arbiter-manager-generated.h>
 
+#include "command-batch.h"
+
 struct _ChamgeArbiterAgent
 {
   GApplication parent;
@@ -39,13 +51,21 @@ struct _ChamgeArbiterAgent
   ChamgeBackend backend;
   ChamgeArbiter *arbiter;
 
-  /* TODO: belows are using temporaryily.
-   * mySQL would be use for management data.
-   */
-  GList *edges;
-  GList *hubs;
+  guint snapshot_source;
+  guint command_concurrency;
+
+  /* id -> the last change of the device, sent with the next flush */
+  GHashTable *changes;
+  guint changes_source;
+  guint64 registry_version;
 };
 
+/* how long changes are gathered before they are sent */
+#define CHANGES_INTERVAL_MS 500
+
+/* the most devices ListDevices returns at once */
+#define LIST_DEVICES_MAX_LIMIT 1000
+
 typedef enum
 {
   PROP_HOST = 1,
@@ -128,11 +148,17 @@ chamge_arbiter_agent_dispose (GObject * object)
 {
   ChamgeArbiterAgent *self = CHAMGE_ARBITER_AGENT (object);
 
-  g_list_foreach (self->edges, (GFunc) g_free, NULL);
-  g_list_free (self->edges);
+  if (self->snapshot_source > 0) {
+    g_source_remove (self->snapshot_source);
+    self->snapshot_source = 0;
+  }
+
+  if (self->changes_source > 0) {
+    g_source_remove (self->changes_source);
+    self->changes_source = 0;
+  }
 
-  g_list_foreach (self->hubs, (GFunc) g_free, NULL);
-  g_list_free (self->hubs);
+  g_clear_pointer (&self->changes, g_hash_table_unref);
 
   g_clear_object (&self->arbiter_manager);
 
@@ -324,35 +350,111 @@ chamge_arbiter_agent_handle_deactivate (ChamgeDBusArbiterManager * manager,
 }
 
 static gboolean
-_is_enrolled (GList * list, const char *id)
-{
-  GList *edge;
-  for (edge = list; edge != NULL; edge = g_list_next (edge)) {
-    const gchar *data = (gchar *) edge->data;
-    if (!g_strcmp0 (id, data)) {
-      g_debug ("found id (%s) in enrolled list.", id);
-      return TRUE;
-    }
-  }
-  return FALSE;
+_is_enrolled (ChamgeArbiterAgent * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  return chamge_registry_contains (chamge_arbiter_get_registry (self->arbiter),
+      id, type);
 }
 
 static gboolean
-chamge_arbiter_agent_handle_user_command (ChamgeDBusArbiterManager *
-    manager, GDBusMethodInvocation * invocation, gchar * user_cmd,
+_is_edge_method (const gchar * method)
+{
+  return !g_strcmp0 (method, "streamingStart")
+      || !g_strcmp0 (method, "streamingStop")
+      || !g_strcmp0 (method, "getUrl");
+}
+
+/* a D-Bus call waiting for the reply of a peer */
+typedef struct
+{
+  ChamgeArbiterAgent *self;
+  GDBusMethodInvocation *invocation;
+} PendingCall;
+
+static PendingCall *
+_pending_call_new (ChamgeArbiterAgent * self,
+    GDBusMethodInvocation * invocation)
+{
+  PendingCall *call = g_new0 (PendingCall, 1);
+
+  /* keep serving until the call is completed */
+  g_application_hold (G_APPLICATION (self));
+
+  /* the invocation is consumed when the call is completed */
+  call->self = g_object_ref (self);
+  call->invocation = invocation;
+
+  return call;
+}
+
+static void
+_pending_call_free (PendingCall * call)
+{
+  g_application_release (G_APPLICATION (call->self));
+
+  g_object_unref (call->self);
+  g_clear_object (&call->invocation);
+  g_free (call);
+}
+
+/* escapes @result, which may come from anywhere, e.g. an error message */
+static gchar *
+_result_to_json (const gchar * result)
+{
+  g_autoptr (JsonBuilder) builder = json_builder_new ();
+  g_autoptr (JsonGenerator) generator = json_generator_new ();
+  g_autoptr (JsonNode) root = NULL;
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "result");
+  json_builder_add_string_value (builder, result);
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  json_generator_set_root (generator, root);
+
+  return json_generator_to_data (generator, NULL);
+}
+
+static void
+_user_command_done (GObject * source, GAsyncResult * result,
     gpointer user_data)
 {
-  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
-  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+  PendingCall *call = user_data;
+  ChamgeReturn ret;
   g_autofree gchar *response = NULL;
   g_autoptr (GError) error = NULL;
 
+  ret = chamge_arbiter_user_command_finish (CHAMGE_ARBITER (source), result,
+      &response, &error);
+  if (ret != CHAMGE_RETURN_OK) {
+    g_warning ("arbiter user command failure >> %s",
+        error ? error->message : "");
+    if (response == NULL)
+      response = _result_to_json (error ? error->message : "nok");
+  } else if (response == NULL) {
+    response = _result_to_json ("ok");
+  }
+
+  g_debug ("response >> %s (%d)", response, ret);
+
+  chamge_dbus_arbiter_manager_complete_user_command
+      (call->self->arbiter_manager, g_steal_pointer (&call->invocation), ret,
+      response);
+
+  _pending_call_free (call);
+}
+
+/* returns the response to a command which cannot be sent, or NULL */
+static gchar *
+_check_user_command (ChamgeArbiterAgent * self, const gchar * user_cmd)
+{
+  g_autoptr (GError) error = NULL;
+
   JsonNode *root = NULL;
   JsonObject *json_object = NULL;
   g_autoptr (JsonParser) parser = json_parser_new ();
-  g_autofree gchar *final_cmd = g_strdup (user_cmd);
-
-  g_debug ("user command >> %s", (gchar *) user_cmd);
 
   /* TODO
    * check user command and raplace "to" parameter to server
@@ -362,8 +464,7 @@ chamge_arbiter_agent_handle_user_command (ChamgeDBusArbiterManager *
    */
   if (!json_parser_load_from_data (parser, user_cmd, strlen (user_cmd), &error)) {
     g_debug ("failed to parse body: %s", error->message);
-    response = g_strdup ("{\"result\":\"failed to parse body\"}");
-    goto out;
+    return _result_to_json ("failed to parse body");
   }
 
   root = json_parser_get_root (parser);
@@ -372,22 +473,20 @@ chamge_arbiter_agent_handle_user_command (ChamgeDBusArbiterManager *
     JsonNode *node = json_object_get_member (json_object, "method");
     const gchar *method = json_node_get_string (node);
     /* send to edge */
-    if (!g_strcmp0 (method, "streamingStart")
-        || !g_strcmp0 (method, "streamingStop")
-        || !g_strcmp0 (method, "getUrl")) {
+    if (_is_edge_method (method)) {
       g_debug ("command for edge");
       if (json_object_has_member (json_object, "to")) {
         const gchar *edge_id =
             json_node_get_string (json_object_get_member (json_object, "to"));
-        gboolean enrolled = _is_enrolled (self->edges, edge_id);
+        gboolean enrolled =
+            _is_enrolled (self, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
 
         if (!enrolled) {
-          g_debug ("no edge (%s) is enrolled.\n", edge_id);
-          response =
-              g_strdup_printf
-              ("{\"result\":\"no edge is enrolled with edge id %s\"}", edge_id);
-          goto out;
+          g_autofree gchar *reason =
+              g_strdup_printf ("no edge is enrolled with edge id %s", edge_id);
 
+          g_debug ("no edge (%s) is enrolled.\n", edge_id);
+          return _result_to_json (reason);
         }
       }
     } else {
@@ -395,36 +494,379 @@ chamge_arbiter_agent_handle_user_command (ChamgeDBusArbiterManager *
       if (json_object_has_member (json_object, "to")) {
         const gchar *hub_id =
             json_node_get_string (json_object_get_member (json_object, "to"));
-        gboolean enrolled = _is_enrolled (self->hubs, hub_id);
+        gboolean enrolled =
+            _is_enrolled (self, hub_id, CHAMGE_DEVICE_TYPE_HUB);
 
         if (!enrolled) {
+          g_autofree gchar *reason =
+              g_strdup_printf ("no hub is enrolled with hub id %s", hub_id);
+
           g_debug ("no hub (%s) is enrolled\n", hub_id);
-          response =
-              g_strdup_printf
-              ("{\"result\":\"no hub is enrolled with hub id %s\"}", hub_id);
-          goto out;
+          return _result_to_json (reason);
         }
       }
     }
   }
 
-  ret =
-      chamge_node_user_command (CHAMGE_NODE (self->arbiter),
-      (gchar *) final_cmd, &response, &error);
-  if (ret != CHAMGE_RETURN_OK) {
-    g_warning ("arbiter user command failure >> %s",
+  return NULL;
+}
+
+static gboolean
+chamge_arbiter_agent_handle_user_command (ChamgeDBusArbiterManager *
+    manager, GDBusMethodInvocation * invocation, gchar * user_cmd,
+    gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  g_autofree gchar *response = NULL;
+
+  g_debug ("user command >> %s", (gchar *) user_cmd);
+
+  response = _check_user_command (self, user_cmd);
+  if (response != NULL) {
+    g_debug ("response >> %s (%d)", response, CHAMGE_RETURN_FAIL);
+
+    chamge_dbus_arbiter_manager_complete_user_command (manager,
+        invocation, CHAMGE_RETURN_FAIL, response);
+
+    return TRUE;
+  }
+
+  /* the invocation is completed once the peer replies */
+  chamge_arbiter_user_command_async (self->arbiter, user_cmd, NULL,
+      _user_command_done, _pending_call_new (self, invocation));
+
+  return TRUE;
+}
+
+static gchar *
+_batch_check (const gchar * command, gpointer user_data)
+{
+  return _check_user_command (user_data, command);
+}
+
+static void
+_batch_send (const gchar * command, GAsyncReadyCallback callback,
+    gpointer callback_data, gpointer user_data)
+{
+  ChamgeArbiterAgent *self = user_data;
+
+  chamge_arbiter_user_command_async (self->arbiter, command, NULL, callback,
+      callback_data);
+}
+
+static ChamgeReturn
+_batch_finish (GObject * source, GAsyncResult * result, gchar ** response,
+    GError ** error)
+{
+  return chamge_arbiter_user_command_finish (CHAMGE_ARBITER (source), result,
+      response, error);
+}
+
+static const ChamgeCommandBatchFuncs batch_funcs = {
+  _batch_check,
+  _batch_send,
+  _batch_finish,
+};
+
+static void
+_user_command_batch_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  PendingCall *call = user_data;
+  g_autoptr (GVariant) results = NULL;
+
+  results = chamge_command_batch_run_finish (result, NULL);
+
+  chamge_dbus_arbiter_manager_complete_user_command_batch
+      (call->self->arbiter_manager, g_steal_pointer (&call->invocation),
+      results);
+
+  _pending_call_free (call);
+}
+
+static gboolean
+chamge_arbiter_agent_handle_user_command_batch (ChamgeDBusArbiterManager *
+    manager, GDBusMethodInvocation * invocation,
+    const gchar * const *commands, gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+
+  g_debug ("user command batch >> %u commands",
+      g_strv_length ((gchar **) commands));
+
+  /* at most command-concurrency commands are in flight at once */
+  chamge_command_batch_run_async (commands, self->command_concurrency,
+      &batch_funcs, self, _user_command_batch_done,
+      _pending_call_new (self, invocation));
+
+  return TRUE;
+}
+
+static void
+_complete_send_command (ChamgeArbiterAgent * self,
+    GDBusMethodInvocation * invocation, ChamgeReturn ret, GVariant * reply,
+    const gchar * message)
+{
+  g_autoptr (GVariant) empty = NULL;
+
+  if (reply == NULL) {
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    if (message != NULL)
+      g_variant_builder_add (&builder, "{sv}", "result",
+          g_variant_new_string (message));
+    reply = empty = g_variant_ref_sink (g_variant_builder_end (&builder));
+  }
+
+  chamge_dbus_arbiter_manager_complete_send_command (self->arbiter_manager,
+      invocation, ret, reply);
+}
+
+static void
+_send_command_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  PendingCall *call = user_data;
+  ChamgeReturn ret;
+  g_autoptr (GVariant) reply = NULL;
+  g_autoptr (GError) error = NULL;
+
+  ret = chamge_arbiter_send_command_finish (CHAMGE_ARBITER (source), result,
+      &reply, &error);
+  if (ret != CHAMGE_RETURN_OK)
+    g_warning ("arbiter send command failure >> %s",
         error ? error->message : "");
-    if (response == NULL) {
-      response =
-          g_strdup_printf ("{\"result\":\"%s\"}",
-          error ? error->message : "nok");
+
+  _complete_send_command (call->self, g_steal_pointer (&call->invocation),
+      ret, reply, ret != CHAMGE_RETURN_OK ?
+      (error ? error->message : "nok") : NULL);
+
+  _pending_call_free (call);
+}
+
+static gboolean
+chamge_arbiter_agent_handle_send_command (ChamgeDBusArbiterManager *
+    manager, GDBusMethodInvocation * invocation, const gchar * target,
+    const gchar * method, GVariant * arguments, gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  g_autofree gchar *message = NULL;
+  gboolean for_edge = _is_edge_method (method);
+
+  g_debug ("send command >> %s to %s", method, target);
+
+  if (!_is_enrolled (self, target,
+          for_edge ? CHAMGE_DEVICE_TYPE_EDGE : CHAMGE_DEVICE_TYPE_HUB)) {
+    message = g_strdup_printf ("no %s is enrolled with %s id %s",
+        for_edge ? "edge" : "hub", for_edge ? "edge" : "hub", target);
+    _complete_send_command (self, invocation, CHAMGE_RETURN_FAIL, NULL,
+        message);
+    return TRUE;
+  }
+
+  chamge_arbiter_send_command_async (self->arbiter, target, method, arguments,
+      NULL, _send_command_done, _pending_call_new (self, invocation));
+
+  return TRUE;
+}
+
+static const gchar *
+_device_type_to_string (ChamgeDeviceType type)
+{
+  return type == CHAMGE_DEVICE_TYPE_HUB ? "hub" : "edge";
+}
+
+static const gchar *
+_device_state_to_string (ChamgeDeviceState state)
+{
+  return state == CHAMGE_DEVICE_STATE_ACTIVATED ? "activated" : "enrolled";
+}
+
+typedef struct
+{
+  /* filters, -1 or NULL to match any */
+  gint type;
+  gint state;
+  const gchar *hub_id;
+
+  guint limit;
+  guint count;
+  gboolean more;
+  gchar *last_id;
+
+  GVariantBuilder builder;
+} DeviceQuery;
+
+static gboolean
+_list_device (const ChamgeRegistryDevice * device, gpointer user_data)
+{
+  DeviceQuery *query = user_data;
+
+  if ((query->type >= 0 && (gint) device->type != query->type)
+      || (query->state >= 0 && (gint) device->state != query->state)
+      || (query->hub_id != NULL && g_strcmp0 (device->hub_id,
+              query->hub_id)))
+    return TRUE;
+
+  if (query->count == query->limit) {
+    query->more = TRUE;
+    return FALSE;
+  }
+
+  g_variant_builder_add (&query->builder, "(ssss)", device->id,
+      _device_type_to_string (device->type),
+      _device_state_to_string (device->state),
+      device->hub_id ? device->hub_id : "");
+
+  g_free (query->last_id);
+  query->last_id = g_strdup (device->id);
+  query->count++;
+
+  return TRUE;
+}
+
+static gboolean
+chamge_arbiter_agent_handle_list_devices (ChamgeDBusArbiterManager *
+    manager, GDBusMethodInvocation * invocation, GVariant * filter,
+    const gchar * cursor, guint limit, gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  DeviceQuery query = { -1, -1 };
+  const gchar *value;
+
+  if (g_variant_lookup (filter, "type", "&s", &value)) {
+    if (!g_strcmp0 (value, "edge"))
+      query.type = CHAMGE_DEVICE_TYPE_EDGE;
+    else if (!g_strcmp0 (value, "hub"))
+      query.type = CHAMGE_DEVICE_TYPE_HUB;
+    else
+      goto invalid;
+  }
+
+  if (g_variant_lookup (filter, "state", "&s", &value)) {
+    if (!g_strcmp0 (value, "enrolled"))
+      query.state = CHAMGE_DEVICE_STATE_ENROLLED;
+    else if (!g_strcmp0 (value, "activated"))
+      query.state = CHAMGE_DEVICE_STATE_ACTIVATED;
+    else
+      goto invalid;
+  }
+
+  g_variant_lookup (filter, "hub", "&s", &query.hub_id);
+
+  query.limit = limit == 0 ? LIST_DEVICES_MAX_LIMIT :
+      MIN (limit, LIST_DEVICES_MAX_LIMIT);
+  g_variant_builder_init (&query.builder, G_VARIANT_TYPE ("a(ssss)"));
+
+  chamge_registry_foreach (chamge_arbiter_get_registry (self->arbiter),
+      cursor[0] != '\0' ? cursor : NULL, _list_device, &query);
+
+  chamge_dbus_arbiter_manager_complete_list_devices (manager, invocation,
+      g_variant_builder_end (&query.builder),
+      query.more ? query.last_id : "");
+
+  g_free (query.last_id);
+
+  return TRUE;
+
+invalid:
+  g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+      G_DBUS_ERROR_INVALID_ARGS, "invalid filter value %s", value);
+
+  return TRUE;
+}
+
+static gboolean
+_dump_device (const ChamgeRegistryDevice * device, gpointer user_data)
+{
+  g_variant_builder_add (user_data, "(syys)", device->id,
+      (guchar) device->type, (guchar) device->state,
+      device->hub_id ? device->hub_id : "");
+
+  return TRUE;
+}
+
+static gint
+_open_memory_file (GError ** error)
+{
+  gint fd;
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("chamge-devices", MFD_CLOEXEC);
+  if (fd < 0)
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+        "failed to create a memory file: %s", g_strerror (errno));
+#else
+  g_autofree gchar *path = NULL;
+
+  fd = g_file_open_tmp ("chamge-devices-XXXXXX", &path, error);
+  if (fd >= 0)
+    g_unlink (path);
+#endif
+
+  return fd;
+}
+
+static gboolean
+chamge_arbiter_agent_handle_dump_devices (ChamgeDBusArbiterManager *
+    manager, GDBusMethodInvocation * invocation, GUnixFDList * unused,
+    gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  ChamgeRegistry *registry = chamge_arbiter_get_registry (self->arbiter);
+  g_autoptr (GUnixFDList) fd_list = NULL;
+  g_autoptr (GVariant) snapshot = NULL;
+  g_autoptr (GError) error = NULL;
+  GVariantBuilder builder;
+  const gchar *data;
+  gsize size, written = 0;
+  guint64 version;
+  gint fd;
+
+  /* a client resumes from the version, so that it must be the one of the
+   * devices dumped */
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(syys)"));
+  version = chamge_registry_snapshot (registry, _dump_device, &builder);
+
+  snapshot = g_variant_ref_sink (g_variant_new ("(t@a(syys))", version,
+          g_variant_builder_end (&builder)));
+
+  fd = _open_memory_file (&error);
+  if (fd < 0)
+    goto error;
+
+  data = g_variant_get_data (snapshot);
+  size = g_variant_get_size (snapshot);
+
+  while (written < size) {
+    gssize n = write (fd, data + written, size - written);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n < 0) {
+      g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errno),
+          "failed to write the devices: %s", g_strerror (errno));
+      close (fd);
+      goto error;
     }
+
+    written += n;
   }
-out:
-  g_debug ("response >> %s (%d)", response, ret);
 
-  chamge_dbus_arbiter_manager_complete_user_command (manager,
-      invocation, ret, response);
+  lseek (fd, 0, SEEK_SET);
+
+  /* takes the fd */
+  fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+
+  chamge_dbus_arbiter_manager_complete_dump_devices (manager, invocation,
+      fd_list, g_variant_new_handle (0));
+
+  return TRUE;
+
+error:
+  g_dbus_method_invocation_return_gerror (invocation, error);
 
   return TRUE;
 }
@@ -433,6 +875,8 @@ static void
 chamge_arbiter_agent_init (ChamgeArbiterAgent * self)
 {
   self->arbiter_manager = chamge_dbus_arbiter_manager_skeleton_new ();
+  self->changes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
 
   g_signal_connect (self->arbiter_manager, "handle-enroll",
       G_CALLBACK (chamge_arbiter_agent_handle_enroll), self);
@@ -448,6 +892,18 @@ chamge_arbiter_agent_init (ChamgeArbiterAgent * self)
 
   g_signal_connect (self->arbiter_manager, "handle-user-command",
       G_CALLBACK (chamge_arbiter_agent_handle_user_command), self);
+
+  g_signal_connect (self->arbiter_manager, "handle-user-command-batch",
+      G_CALLBACK (chamge_arbiter_agent_handle_user_command_batch), self);
+
+  g_signal_connect (self->arbiter_manager, "handle-list-devices",
+      G_CALLBACK (chamge_arbiter_agent_handle_list_devices), self);
+
+  g_signal_connect (self->arbiter_manager, "handle-dump-devices",
+      G_CALLBACK (chamge_arbiter_agent_handle_dump_devices), self);
+
+  g_signal_connect (self->arbiter_manager, "handle-send-command",
+      G_CALLBACK (chamge_arbiter_agent_handle_send_command), self);
 }
 
 static gint
@@ -484,90 +940,165 @@ handle_local_options (GApplication * app, GVariantDict * options,
   return -1;                    /* continue to prcess */
 }
 
-static GList *
-_find_list (GList * list, const char *id)
+/* a later change of the same device replaces an earlier one, so that an
+ * expiry overrides the delisting the arbiter emits for it */
+static void
+_queue_change (ChamgeArbiterAgent * self, const gchar * id,
+    const gchar * change)
 {
-  GList *edge;
+  g_hash_table_replace (self->changes, g_strdup (id), (gpointer) change);
+}
 
-  /* TODO : if the number of egde increase huge, it should be improved */
-  for (edge = list; edge != NULL; edge = g_list_next (edge)) {
-    const gchar *data = (gchar *) edge->data;
-    if (!g_strcmp0 (id, data)) {
-      g_debug ("found id (%s) in enrolled list.", id);
-      return edge;
-    }
-  }
-  return NULL;
+static gboolean
+_flush_changes (gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  ChamgeRegistry *registry = chamge_arbiter_get_registry (self->arbiter);
+  guint64 version = chamge_registry_get_version (registry);
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer id, change;
+
+  if (version == self->registry_version
+      && g_hash_table_size (self->changes) == 0)
+    return G_SOURCE_CONTINUE;
+
+  self->registry_version = version;
+
+  chamge_dbus_arbiter_manager_set_edges (self->arbiter_manager,
+      chamge_registry_count_by_type (registry, CHAMGE_DEVICE_TYPE_EDGE));
+  chamge_dbus_arbiter_manager_set_hubs (self->arbiter_manager,
+      chamge_registry_count_by_type (registry, CHAMGE_DEVICE_TYPE_HUB));
+  chamge_dbus_arbiter_manager_set_enrolled_devices (self->arbiter_manager,
+      chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ENROLLED));
+  chamge_dbus_arbiter_manager_set_activated_devices (self->arbiter_manager,
+      chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ACTIVATED));
+  chamge_dbus_arbiter_manager_set_registry_version (self->arbiter_manager,
+      version);
+
+  if (g_hash_table_size (self->changes) == 0)
+    return G_SOURCE_CONTINUE;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+
+  g_hash_table_iter_init (&iter, self->changes);
+  while (g_hash_table_iter_next (&iter, &id, &change))
+    g_variant_builder_add (&builder, "(ss)", id, change);
+
+  g_hash_table_remove_all (self->changes);
+
+  chamge_dbus_arbiter_manager_emit_devices_changed (self->arbiter_manager,
+      g_variant_builder_end (&builder), version);
+
+  return G_SOURCE_CONTINUE;
 }
 
+/* the arbiter keeps its registry up to date before emitting these */
 void
 edge_enrolled_cb (ChamgeArbiter * arbiter, const gchar * edge_id,
     ChamgeArbiterAgent * agent)
 {
-  GList *edge = _find_list (agent->edges, edge_id);
-
   printf ("[AGENT] edge enroll callback >> edge_id: %s\n", edge_id);
-  if (!edge) {
-    agent->edges = g_list_append (agent->edges, g_strdup (edge_id));
-  } else {
-    g_debug ("edge_id is duplicated. already enrolled.");
-  }
+  _queue_change (agent, edge_id, "edge-enrolled");
 }
 
 void
 edge_delisted_cb (ChamgeArbiter * arbiter, const gchar * edge_id,
     ChamgeArbiterAgent * agent)
 {
-  GList *edge = _find_list (agent->edges, edge_id);
-
   printf ("[AGENT] edge delisted callback >>  edge_id: %s\n", edge_id);
-  if (edge) {
-    g_free (edge->data);
-    agent->edges = g_list_delete_link (agent->edges, edge);
-  } else {
-    g_debug ("edge_id %s is not enrolled.", edge_id);
-  }
-
+  _queue_change (agent, edge_id, "edge-delisted");
 }
 
 void
 hub_enrolled_cb (ChamgeArbiter * arbiter, const gchar * hub_id,
     ChamgeArbiterAgent * agent)
 {
-  GList *hub = _find_list (agent->hubs, hub_id);
-
   printf ("[AGENT] hub enroll callback >> hub_id: %s\n", hub_id);
-  if (!hub) {
-    agent->hubs = g_list_append (agent->hubs, g_strdup (hub_id));
-  } else {
-    g_debug ("hub_id is duplicated. already enrolled.");
-  }
-
+  _queue_change (agent, hub_id, "hub-enrolled");
 }
 
 void
 hub_delisted_cb (ChamgeArbiter * arbiter, const gchar * hub_id,
     ChamgeArbiterAgent * agent)
 {
-  GList *hub = _find_list (agent->hubs, hub_id);
-
   printf ("[AGENT] hub delisted callback  >> hub_id: %s\n", hub_id);
-  if (hub) {
-    g_free (hub->data);
-    agent->hubs = g_list_delete_link (agent->hubs, hub);
-  } else {
-    g_debug ("hub_id %s is not enrolled.", hub_id);
+  _queue_change (agent, hub_id, "hub-delisted");
+}
+
+static void
+device_expired_cb (ChamgeRegistry * registry, const gchar * id,
+    ChamgeDeviceType type, ChamgeArbiterAgent * agent)
+{
+  _queue_change (agent, id, type == CHAMGE_DEVICE_TYPE_EDGE ?
+      "edge-expired" : "hub-expired");
+}
+
+static gboolean
+_compact_registry (gpointer user_data)
+{
+  ChamgeArbiterAgent *self = (ChamgeArbiterAgent *) user_data;
+  g_autoptr (GError) error = NULL;
+
+  if (!chamge_registry_compact (chamge_arbiter_get_registry (self->arbiter),
+          &error))
+    g_warning ("failed to compact the registry (reason: %s)", error->message);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* restores the devices enrolled before a restart, so that they do not have
+ * to enroll again */
+static void
+chamge_arbiter_agent_open_registry (ChamgeArbiterAgent * self)
+{
+  g_autoptr (GSettings) settings = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *dirname = NULL;
+  guint interval;
+
+  settings =
+      chamge_common_gsettings_new ("org.hwangsaeul.Chamge1.Arbiter.AMQP");
+
+  path = g_settings_get_string (settings, "registry-path");
+  if (path[0] == '\0') {
+    g_free (path);
+    path =
+        g_build_filename (g_get_user_data_dir (), "chamge", "registry", NULL);
+  }
+
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+
+  if (!chamge_registry_open_journal (chamge_arbiter_get_registry
+          (self->arbiter), path, &error)) {
+    g_warning ("failed to open the registry journal (reason: %s)",
+        error->message);
+    return;
   }
 
+  interval = g_settings_get_uint (settings, "registry-snapshot-interval");
+  if (interval > 0)
+    self->snapshot_source =
+        g_timeout_add_seconds (interval, _compact_registry, self);
 }
 
 static void
 chamge_arbiter_agent_startup (GApplication * app)
 {
   ChamgeArbiterAgent *self = CHAMGE_ARBITER_AGENT (app);
+  g_autoptr (GSettings) settings = NULL;
   g_autofree gchar *uid = NULL;
   ChamgeReturn ret = CHAMGE_RETURN_FAIL;
 
+  settings =
+      chamge_common_gsettings_new ("org.hwangsaeul.Chamge1.Arbiter.AMQP");
+  self->command_concurrency =
+      MAX (g_settings_get_uint (settings, "command-concurrency"), 1);
+
   uid = g_uuid_string_random ();
   uid = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uid, strlen (uid));
 
@@ -577,6 +1108,8 @@ chamge_arbiter_agent_startup (GApplication * app)
   }
   g_debug ("arbiter is created :%p ->  %p", self, self->arbiter);
 
+  chamge_arbiter_agent_open_registry (self);
+
   g_signal_connect (self->arbiter, "edge-enrolled",
       G_CALLBACK (edge_enrolled_cb), self);
   g_signal_connect (self->arbiter, "edge-delisted",
@@ -585,6 +1118,11 @@ chamge_arbiter_agent_startup (GApplication * app)
       G_CALLBACK (hub_enrolled_cb), self);
   g_signal_connect (self->arbiter, "hub-delisted",
       G_CALLBACK (hub_delisted_cb), self);
+  g_signal_connect (chamge_arbiter_get_registry (self->arbiter),
+      "device-expired", G_CALLBACK (device_expired_cb), self);
+
+  self->changes_source =
+      g_timeout_add (CHANGES_INTERVAL_MS, _flush_changes, self);
   ret = chamge_arbiter_agent_enroll (self);
   if (ret != CHAMGE_RETURN_OK) {
     g_error ("failed to enroll");
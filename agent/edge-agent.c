@@ -22,6 +22,7 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <chamge/enumtypes.h>
 #include <chamge/edge.h>
@@ -32,15 +33,19 @@ struct _ChamgeEdgeAgent
   GApplication parent;
   ChamgeDBusEdgeManager *edge_manager;
   ChamgeBackend backend;
+  gchar *uid;
+
+  ChamgeEdge *edge;
 };
 
 typedef enum
 {
   PROP_HOST = 1,
   PROP_BACKEND,
+  PROP_UID,
 
   /*< private > */
-  PROP_LAST = PROP_BACKEND
+  PROP_LAST = PROP_UID
 } _ChamgeEdgeAgentProperty;
 
 static GParamSpec *properties[PROP_LAST + 1];
@@ -102,11 +107,25 @@ chamge_edge_agent_dispose (GObject * object)
 {
   ChamgeEdgeAgent *self = CHAMGE_EDGE_AGENT (object);
 
+  if (self->edge != NULL)
+    g_signal_handlers_disconnect_by_data (self->edge, self);
+
+  g_clear_object (&self->edge);
   g_clear_object (&self->edge_manager);
 
   G_OBJECT_CLASS (chamge_edge_agent_parent_class)->dispose (object);
 }
 
+static void
+chamge_edge_agent_finalize (GObject * object)
+{
+  ChamgeEdgeAgent *self = CHAMGE_EDGE_AGENT (object);
+
+  g_free (self->uid);
+
+  G_OBJECT_CLASS (chamge_edge_agent_parent_class)->finalize (object);
+}
+
 static void
 chamge_edge_agent_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -118,6 +137,9 @@ chamge_edge_agent_get_property (GObject * object,
     case PROP_BACKEND:
       g_value_set_enum (value, self->backend);
       break;
+    case PROP_UID:
+      g_value_set_string (value, self->uid);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -136,6 +158,10 @@ chamge_edge_agent_set_property (GObject * object,
     case PROP_BACKEND:
       self->backend = g_value_get_enum (value);
       break;
+    case PROP_UID:
+      g_free (self->uid);
+      self->uid = g_value_dup_string (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -151,12 +177,15 @@ chamge_edge_agent_class_init (ChamgeEdgeAgentClass * klass)
   object_class->get_property = chamge_edge_agent_get_property;
   object_class->set_property = chamge_edge_agent_set_property;
   object_class->dispose = chamge_edge_agent_dispose;
+  object_class->finalize = chamge_edge_agent_finalize;
 
   properties[PROP_HOST] = g_param_spec_string ("host", "host", "host",
       NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
   properties[PROP_BACKEND] = g_param_spec_enum ("backend", "backend", "backend",
       CHAMGE_TYPE_BACKEND, CHAMGE_BACKEND_UNKNOWN,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  properties[PROP_UID] = g_param_spec_string ("uid", "uid", "uid",
+      NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
   g_object_class_install_properties (object_class, G_N_ELEMENTS (properties),
       properties);
@@ -166,48 +195,209 @@ chamge_edge_agent_class_init (ChamgeEdgeAgentClass * klass)
   app_class->dbus_unregister = chamge_edge_agent_dbus_unregister;
 }
 
+/* a D-Bus call waiting for the edge */
+typedef struct
+{
+  ChamgeEdgeAgent *self;
+  GDBusMethodInvocation *invocation;
+
+  /* for lifecycle methods */
+  ChamgeReturn (*finish) (ChamgeNode * node, GAsyncResult * result,
+      GError ** error);
+  void (*complete) (ChamgeDBusEdgeManager * manager,
+      GDBusMethodInvocation * invocation);
+} PendingCall;
+
+static PendingCall *
+_pending_call_new (ChamgeEdgeAgent * self, GDBusMethodInvocation * invocation)
+{
+  PendingCall *call = g_new0 (PendingCall, 1);
+
+  /* keep serving until the call is completed */
+  g_application_hold (G_APPLICATION (self));
+
+  /* the invocation is consumed when the call is completed */
+  call->self = g_object_ref (self);
+  call->invocation = invocation;
+
+  return call;
+}
+
+static void
+_pending_call_free (PendingCall * call)
+{
+  g_application_release (G_APPLICATION (call->self));
+
+  g_object_unref (call->self);
+  g_clear_object (&call->invocation);
+  g_free (call);
+}
+
+static void
+edge_state_changed_cb (ChamgeEdge * edge, ChamgeNodeState state,
+    ChamgeEdgeAgent * self)
+{
+  g_debug ("edge state is changed to %d", state);
+
+  chamge_dbus_edge_manager_set_state (self->edge_manager, state);
+}
+
+static void
+_operation_done (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  PendingCall *call = user_data;
+  g_autoptr (GError) error = NULL;
+  ChamgeReturn ret;
+
+  ret = call->finish (CHAMGE_NODE (source), result, &error);
+  if (ret == CHAMGE_RETURN_FAIL) {
+    g_warning ("%s", error->message);
+    g_dbus_method_invocation_return_gerror (g_steal_pointer
+        (&call->invocation), error);
+  } else {
+    call->complete (call->self->edge_manager,
+        g_steal_pointer (&call->invocation));
+  }
+
+  _pending_call_free (call);
+}
+
+/* the edge changes its state in this context, which keeps serving while the
+ * backend waits for the broker */
 static gboolean
-chamge_edge_agent_handle_enroll (ChamgeDBusEdgeManager * manager,
-    GDBusMethodInvocation * invocation, gpointer user_data)
+_dispatch_operation (ChamgeEdgeAgent * self,
+    GDBusMethodInvocation * invocation,
+    void (*start) (ChamgeNode * node, GCancellable * cancellable,
+        GAsyncReadyCallback callback, gpointer user_data),
+    ChamgeReturn (*finish) (ChamgeNode * node, GAsyncResult * result,
+        GError ** error),
+    void (*complete) (ChamgeDBusEdgeManager * manager,
+        GDBusMethodInvocation * invocation))
 {
-  chamge_dbus_edge_manager_complete_enroll (manager, invocation);
+  PendingCall *call;
+
+  if (self->edge == NULL) {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+        G_DBUS_ERROR_FAILED, "edge is not created");
+    return TRUE;
+  }
+
+  call = _pending_call_new (self, invocation);
+  call->finish = finish;
+  call->complete = complete;
+
+  start (CHAMGE_NODE (self->edge), NULL, _operation_done, call);
 
   return TRUE;
 }
 
 static gboolean
-chamge_edge_agent_handle_delist (ChamgeDBusEdgeManager * manager,
+chamge_edge_agent_handle_enroll (ChamgeDBusEdgeManager * manager,
     GDBusMethodInvocation * invocation, gpointer user_data)
 {
-  chamge_dbus_edge_manager_complete_delist (manager, invocation);
+  return _dispatch_operation (CHAMGE_EDGE_AGENT (user_data), invocation,
+      chamge_node_enroll_async, chamge_node_enroll_finish,
+      chamge_dbus_edge_manager_complete_enroll);
+}
 
-  return TRUE;
+static gboolean
+chamge_edge_agent_handle_delist (ChamgeDBusEdgeManager * manager,
+    GDBusMethodInvocation * invocation, gpointer user_data)
+{
+  return _dispatch_operation (CHAMGE_EDGE_AGENT (user_data), invocation,
+      chamge_node_delist_async, chamge_node_delist_finish,
+      chamge_dbus_edge_manager_complete_delist);
 }
 
 static gboolean
 chamge_edge_agent_handle_activate (ChamgeDBusEdgeManager * manager,
     GDBusMethodInvocation * invocation, gpointer user_data)
 {
-  chamge_dbus_edge_manager_complete_activate (manager, invocation);
-
-  return TRUE;
+  return _dispatch_operation (CHAMGE_EDGE_AGENT (user_data), invocation,
+      chamge_node_activate_async, chamge_node_activate_finish,
+      chamge_dbus_edge_manager_complete_activate);
 }
 
 static gboolean
 chamge_edge_agent_handle_deactivate (ChamgeDBusEdgeManager * manager,
     GDBusMethodInvocation * invocation, gpointer user_data)
 {
-  chamge_dbus_edge_manager_complete_deactivate (manager, invocation);
+  return _dispatch_operation (CHAMGE_EDGE_AGENT (user_data), invocation,
+      chamge_node_deactivate_async, chamge_node_deactivate_finish,
+      chamge_dbus_edge_manager_complete_deactivate);
+}
 
-  return TRUE;
+static gboolean
+chamge_edge_agent_handle_enroll_activate (ChamgeDBusEdgeManager * manager,
+    GDBusMethodInvocation * invocation, gpointer user_data)
+{
+  return _dispatch_operation (CHAMGE_EDGE_AGENT (user_data), invocation,
+      chamge_node_enroll_activate_async, chamge_node_enroll_activate_finish,
+      chamge_dbus_edge_manager_complete_enroll_activate);
+}
+
+static void
+_request_target_uri (GTask * task, gpointer source, gpointer task_data,
+    GCancellable * cancellable)
+{
+  gchar *uri;
+  GError *error = NULL;
+
+  uri = chamge_edge_request_target_uri (CHAMGE_EDGE (source), &error);
+  if (uri == NULL) {
+    if (error == NULL)
+      g_set_error (&error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+          "failed to request target uri");
+    g_task_return_error (task, error);
+    return;
+  }
+
+  g_task_return_pointer (task, uri, g_free);
+}
+
+static void
+_request_target_uri_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  PendingCall *call = user_data;
+  g_autofree gchar *uri = NULL;
+  g_autoptr (GError) error = NULL;
+
+  uri = g_task_propagate_pointer (G_TASK (result), &error);
+  if (uri == NULL) {
+    g_warning ("failed to request target uri (reason: %s)", error->message);
+    g_dbus_method_invocation_return_gerror (g_steal_pointer
+        (&call->invocation), error);
+  } else {
+    chamge_dbus_edge_manager_complete_request_srtconnection_uri
+        (call->self->edge_manager, g_steal_pointer (&call->invocation), uri);
+  }
+
+  _pending_call_free (call);
 }
 
 static gboolean
 chamge_edge_agent_handle_request_srtconnection_uri (ChamgeDBusEdgeManager *
     manager, GDBusMethodInvocation * invocation, gpointer user_data)
 {
-  chamge_dbus_edge_manager_complete_request_srtconnection_uri (manager,
-      invocation, NULL);
+  ChamgeEdgeAgent *self = CHAMGE_EDGE_AGENT (user_data);
+  ChamgeNodeState state = CHAMGE_NODE_STATE_NULL;
+  g_autoptr (GTask) task = NULL;
+
+  if (self->edge != NULL)
+    g_object_get (self->edge, "state", &state, NULL);
+
+  if (state != CHAMGE_NODE_STATE_ACTIVATED) {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+        G_DBUS_ERROR_FAILED, "edge is not activated");
+    return TRUE;
+  }
+
+  /* a cache miss waits for the arbiter; the backend asks on a connection of
+   * its own, which is safe from any thread */
+  task = g_task_new (self->edge, NULL, _request_target_uri_done,
+      _pending_call_new (self, invocation));
+  g_task_run_in_thread (task, _request_target_uri);
 
   return TRUE;
 }
@@ -229,10 +419,36 @@ chamge_edge_agent_init (ChamgeEdgeAgent * self)
   g_signal_connect (self->edge_manager, "handle-deactivate",
       G_CALLBACK (chamge_edge_agent_handle_deactivate), self);
 
+  g_signal_connect (self->edge_manager, "handle-enroll-activate",
+      G_CALLBACK (chamge_edge_agent_handle_enroll_activate), self);
+
   g_signal_connect (self->edge_manager, "handle-request-srtconnection-uri",
       G_CALLBACK (chamge_edge_agent_handle_request_srtconnection_uri), self);
 }
 
+static void
+chamge_edge_agent_startup (GApplication * app)
+{
+  ChamgeEdgeAgent *self = CHAMGE_EDGE_AGENT (app);
+
+  /* the host name is stable across restarts unless it is given explicitly */
+  if (self->uid == NULL)
+    self->uid = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+        g_get_host_name (), -1);
+
+  self->edge = chamge_edge_new_full (self->uid, self->backend);
+  if (self->edge == NULL) {
+    g_error ("failed to create edge");
+  }
+  g_debug ("edge is created :%p ->  %p", self, self->edge);
+
+  g_signal_connect (self->edge, "state-changed",
+      G_CALLBACK (edge_state_changed_cb), self);
+
+  chamge_dbus_edge_manager_set_state (self->edge_manager,
+      CHAMGE_NODE_STATE_NULL);
+}
+
 static gint
 handle_local_options (GApplication * app, GVariantDict * options,
     gpointer user_data)
@@ -240,6 +456,7 @@ handle_local_options (GApplication * app, GVariantDict * options,
   gboolean b;
   const gchar *host;
   const gchar *backend;
+  const gchar *uid;
 
   if (g_variant_dict_lookup (options, "version", "b", &b)) {
     g_print ("version %s\n", VERSION);
@@ -250,6 +467,10 @@ handle_local_options (GApplication * app, GVariantDict * options,
     g_object_set (G_OBJECT (app), "host", host, NULL);
   }
 
+  if (g_variant_dict_lookup (options, "uid", "&s", &uid)) {
+    g_object_set (G_OBJECT (app), "uid", uid, NULL);
+  }
+
   if (g_variant_dict_lookup (options, "backend", "s", &backend)) {
     GEnumClass *c = g_type_class_ref (CHAMGE_TYPE_BACKEND);
     GEnumValue *v = g_enum_get_value_by_nick (c, backend);
@@ -278,6 +499,8 @@ main (int argc, char *argv[])
         "Set the arbiter host", NULL},
     {"backend", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, NULL,
         "Set the backend type {amqp,mock}", NULL},
+    {"uid", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, NULL,
+        "Set the edge id (default: derived from the host name)", NULL},
     {NULL}
   };
 
@@ -290,6 +513,8 @@ main (int argc, char *argv[])
 
   g_signal_connect (app, "handle-local-options",
       G_CALLBACK (handle_local_options), NULL);
+  g_signal_connect (app, "startup",
+      G_CALLBACK (chamge_edge_agent_startup), app);
 
   g_application_set_inactivity_timeout (app, 10000);
 
@@ -20,6 +20,15 @@
 #include "config.h"
 
 #include "amqp-arbiter-backend.h"
+#include "amqp-arbiter-cluster.h"
+#include "amqp-message.h"
+#include "amqp-source.h"
+#include "batch.h"
+#include "command.h"
+#include "enumtypes.h"
+#include "messages-generated.h"
+#include "token-bucket.h"
+#include "reply-cache.h"
 #include "common.h"
 #include "glib-compat.h"
 
@@ -32,6 +41,9 @@
 #define AMQP_ARBITER_BACKEND_SCHEMA_ID "org.hwangsaeul.Chamge1.Arbiter.AMQP"
 #define DEFAULT_CONTENT_TYPE "application/json"
 
+#define RPC_TIMEOUT_SECONDS     4
+#define RPC_ATTEMPTS            3
+
 struct _ChamgeAmqpArbiterBackend
 {
   ChamgeArbiterBackend parent;
@@ -41,7 +53,38 @@ struct _ChamgeAmqpArbiterBackend
   amqp_socket_t *amqp_socket;
 
   gboolean activated;
-  guint process_id;
+  GSource *process_source;
+
+  /* requests are handled by single-threaded pools picked by device id, so
+   * that the requests of a device are handled in order; their replies are
+   * sent from the context of the broker connection */
+  GThreadPool **workers;
+  guint n_workers;
+  GMainContext *context;
+
+  ChamgeHubStrategy hub_strategy;
+  guint rtt_candidates;
+
+  GMutex lock;
+  ChamgeTokenBucket *enroll_bucket;
+  guint enroll_rate;
+
+  /* replies to the latest requests, by correlation id */
+  ChamgeReplyCache *replies;
+
+  /* session tokens are keyed by "session-key", which all the arbiters of a
+   * cluster share, or else by the epoch of the registry; only a digest of
+   * the key is ever sent */
+  gchar *epoch;
+  gchar *epoch_id;
+
+  /* NULL unless the registry is shared with other arbiters */
+  ChamgeArbiterCluster *cluster;
+
+  /* commands may be sent from any thread, each on its own connection */
+  gchar *rpc_uri;
+  gint rpc_channel;
+  gchar *rpc_exchange;
 };
 
 /* *INDENT-OFF* */
@@ -91,6 +134,7 @@ chamge_amqp_arbiter_backend_enroll (ChamgeArbiterBackend * arbiter_backend)
   g_autofree gchar *amqp_uri = NULL;
   g_autofree gchar *amqp_enroll_q_name = NULL;
   g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *state_exchange_name = NULL;
   gint amqp_channel;
 
   struct amqp_connection_info amqp_c_info;
@@ -167,15 +211,45 @@ chamge_amqp_arbiter_backend_enroll (ChamgeArbiterBackend * arbiter_backend)
   g_debug ("binding a queue (exchange: %s, bind_key: %s)", amqp_exchange_name,
       amqp_enroll_q_name);
 
+  /* arbiters sharing the queue compete for its messages; acknowledging each
+   * one after it is handled keeps the busy ones from being handed more */
+  if (amqp_basic_qos (self->amqp_conn, amqp_channel, 0,
+          g_settings_get_uint (self->settings, "prefetch-count"), 0) == NULL) {
+    g_error ("basic qos failure >> %s",
+        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (self->amqp_conn)));
+    goto out;
+  }
+
   /* FIXME: A empty consuming MUST be called after binding, but it blocks until
      a message is coming. This consuming call should be revised to accept timeout */
   if (amqp_basic_consume (self->amqp_conn, amqp_channel, amqp_declare_r->queue,
-          amqp_empty_bytes, 0, 1, 0, amqp_empty_table) == NULL) {
+          amqp_empty_bytes, 0, 0, 0, amqp_empty_table) == NULL) {
     g_error ("basic consume failure >> %s",
         _amqp_get_rpc_reply_string (amqp_get_rpc_reply (self->amqp_conn)));
     goto out;
   }
   amqp_get_rpc_reply (self->amqp_conn);
+
+  state_exchange_name =
+      g_settings_get_string (self->settings, "state-exchange-name");
+  if (*state_exchange_name != '\0') {
+    g_autoptr (GError) error = NULL;
+    guint expiry = g_settings_get_uint (self->settings, "device-expiry");
+
+    /* peers must hear of a device several times before it expires */
+    self->cluster =
+        chamge_arbiter_cluster_new (chamge_arbiter_backend_get_registry
+        (arbiter_backend), self->amqp_conn, amqp_channel,
+        state_exchange_name, expiry > 0 ? MAX (expiry / 3, 1) : 0,
+        self->context, &error);
+    if (self->cluster == NULL) {
+      g_warning ("failed to join the arbiter cluster (reason: %s)",
+          error->message);
+      goto out;
+    }
+    chamge_arbiter_cluster_sync (self->cluster);
+  }
+
   ret = CHAMGE_RETURN_OK;
 
 out:
@@ -188,8 +262,67 @@ chamge_amqp_arbiter_backend_delist (ChamgeArbiterBackend * arbiter_backend)
   return CHAMGE_RETURN_OK;
 }
 
+typedef void (*DeferredFunc) (ChamgeAmqpArbiterBackend * self,
+    const gchar * id);
+
+typedef struct
+{
+  ChamgeAmqpArbiterBackend *self;
+  DeferredFunc func;
+  gchar *id;
+} DeferredCall;
+
+static gboolean
+_deferred_call_cb (gpointer user_data)
+{
+  DeferredCall *call = user_data;
+
+  call->func (call->self, call->id);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
-_handle_edge_enroll (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
+_deferred_call_free (gpointer user_data)
+{
+  DeferredCall *call = user_data;
+
+  g_object_unref (call->self);
+  g_free (call->id);
+  g_free (call);
+}
+
+/* runs @func in the context which owns the agent and the broker connection */
+static void
+_defer (ChamgeAmqpArbiterBackend * self, DeferredFunc func, const gchar * id)
+{
+  DeferredCall *call = g_new0 (DeferredCall, 1);
+
+  call->self = g_object_ref (self);
+  call->func = func;
+  call->id = g_strdup (id);
+
+  g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+      _deferred_call_cb, call, _deferred_call_free);
+}
+
+static void
+_share_device (ChamgeAmqpArbiterBackend * self, const gchar * id)
+{
+  if (self->cluster != NULL)
+    chamge_arbiter_cluster_share_device (self->cluster, id);
+}
+
+static void
+_touch_device (ChamgeAmqpArbiterBackend * self, const gchar * id)
+{
+  if (chamge_registry_touch (chamge_arbiter_backend_get_registry
+          (CHAMGE_ARBITER_BACKEND (self)), id) && self->cluster != NULL)
+    chamge_arbiter_cluster_touch (self->cluster, id);
+}
+
+static void
+_notify_edge_enrolled (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
 {
   ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
 
@@ -197,181 +330,1099 @@ _handle_edge_enroll (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
     klass->edge_enrolled (CHAMGE_ARBITER_BACKEND (self), edge_id);
 }
 
+static void
+_notify_edge_delisted (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
+{
+  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+
+  if (klass->edge_delisted != NULL)
+    klass->edge_delisted (CHAMGE_ARBITER_BACKEND (self), edge_id);
+}
+
+static void
+_notify_hub_enrolled (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+
+  if (klass->hub_enrolled != NULL)
+    klass->hub_enrolled (CHAMGE_ARBITER_BACKEND (self), hub_id);
+}
+
+static void
+_notify_hub_delisted (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+
+  if (klass->hub_delisted != NULL)
+    klass->hub_delisted (CHAMGE_ARBITER_BACKEND (self), hub_id);
+}
+
+/* the registry is updated right away, so that the next request of the same
+ * device already sees it, and the agent is told later */
+static void
+_enroll_device (ChamgeAmqpArbiterBackend * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+
+  if (!chamge_registry_add (registry, id, type))
+    chamge_registry_set_state (registry, id, CHAMGE_DEVICE_STATE_ENROLLED);
+
+  _defer (self, type == CHAMGE_DEVICE_TYPE_EDGE ? _notify_edge_enrolled :
+      _notify_hub_enrolled, id);
+}
+
+/* no other request sees the device enrolled but not activated yet */
+static void
+_enroll_activate_device (ChamgeAmqpArbiterBackend * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  chamge_registry_put (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), id, type,
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+
+  _defer (self, type == CHAMGE_DEVICE_TYPE_EDGE ? _notify_edge_enrolled :
+      _notify_hub_enrolled, id);
+}
+
+static void
+_delist_device (ChamgeAmqpArbiterBackend * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  chamge_registry_remove (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), id);
+
+  _defer (self, type == CHAMGE_DEVICE_TYPE_EDGE ? _notify_edge_delisted :
+      _notify_hub_delisted, id);
+}
+
+typedef struct
+{
+  ChamgeAmqpArbiterBackend *self;
+  const gchar *hub_id;
+} TargetChange;
+
+static gboolean
+_push_target_changed (const ChamgeRegistryDevice * device, gpointer user_data)
+{
+  TargetChange *change = user_data;
+  ChamgeAmqpArbiterBackend *self = change->self;
+  g_autofree gchar *body = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeMsgTargetUri changed = { 0 };
+
+  if (device->type != CHAMGE_DEVICE_TYPE_EDGE
+      || device->state != CHAMGE_DEVICE_STATE_ACTIVATED
+      || g_strcmp0 (device->hub_id, change->hub_id))
+    return TRUE;
+
+  /* no uri, so that the edge asks for a new hub when it needs one */
+  changed.result = "reassigned";
+  body = chamge_msg_target_uri_to_json (&changed);
+  chamge_amqp_headers_add_string (&amqp_headers, CHAMGE_AMQP_HEADER_METHOD,
+      "targetChanged");
+
+  if (!chamge_amqp_publish_oneway (self->amqp_conn, self->rpc_channel,
+          self->rpc_exchange, device->id, body, &amqp_headers, &error))
+    g_debug ("failed to tell %s that its target is changed: %s", device->id,
+        error->message);
+
+  return TRUE;
+}
+
+/* edges cache the relay uri of their hub, tell them when it is gone */
+static void
+_invalidate_targets (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  TargetChange change = { self, hub_id };
+
+  chamge_registry_foreach (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), NULL, _push_target_changed, &change);
+}
+
+static void
+_handle_edge_enroll (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
+{
+  _enroll_device (self, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+}
+
 static void
 _handle_edge_activate (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
 {
-  /* TODO : check whether manager need to handle activate request of edge */
+  chamge_registry_set_state (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), edge_id, CHAMGE_DEVICE_STATE_ACTIVATED);
+}
+
+static void
+_handle_edge_enroll_activate (ChamgeAmqpArbiterBackend * self,
+    const gchar * edge_id)
+{
+  _enroll_activate_device (self, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
 }
 
 static void
 _handle_edge_deactivate (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
 {
-  /* TODO : nothing to do now */
+  chamge_registry_set_state (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), edge_id, CHAMGE_DEVICE_STATE_ENROLLED);
+}
+
+static void
+_handle_edge_delist (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
+{
+  _delist_device (self, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+}
+
+static void
+_handle_hub_enroll (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  _enroll_device (self, hub_id, CHAMGE_DEVICE_TYPE_HUB);
+}
+
+static void
+_handle_hub_activate (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  chamge_registry_set_state (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), hub_id, CHAMGE_DEVICE_STATE_ACTIVATED);
+}
+
+static void
+_handle_hub_enroll_activate (ChamgeAmqpArbiterBackend * self,
+    const gchar * hub_id)
+{
+  _enroll_activate_device (self, hub_id, CHAMGE_DEVICE_TYPE_HUB);
+}
+
+static void
+_handle_hub_deactivate (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  chamge_registry_set_state (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), hub_id, CHAMGE_DEVICE_STATE_ENROLLED);
+
+  _defer (self, _invalidate_targets, hub_id);
+}
+
+static void
+_handle_hub_delist (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+{
+  _delist_device (self, hub_id, CHAMGE_DEVICE_TYPE_HUB);
+
+  _defer (self, _invalidate_targets, hub_id);
+}
+
+static gchar *
+_reply (const gchar * result)
+{
+  ChamgeMsgResult reply = { result };
+
+  return chamge_msg_result_to_json (&reply);
+}
+
+/* devices unknown to the registry are admitted at "enroll-rate", so that an
+ * enroll storm cannot starve the devices which are already enrolled */
+static gchar *
+_admit_enroll (ChamgeAmqpArbiterBackend * self, const gchar * const *ids,
+    guint n_ids, ChamgeAmqpStatus * status)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+  ChamgeMsgThrottled reply = { "throttled" };
+  gboolean admitted;
+  guint wait_ms = 0;
+  guint i, n_new = 0;
+  guint64 n_devices;
+
+  if (self->enroll_bucket == NULL)
+    return NULL;
+
+  for (i = 0; i < n_ids; i++) {
+    if (!chamge_registry_lookup (registry, ids[i], NULL, NULL, NULL, NULL))
+      n_new++;
+  }
+
+  if (n_new == 0)
+    return NULL;
+
+  g_mutex_lock (&self->lock);
+  admitted = chamge_token_bucket_take (self->enroll_bucket, n_new,
+      g_get_monotonic_time (), &wait_ms);
+  g_mutex_unlock (&self->lock);
+
+  if (admitted)
+    return NULL;
+
+  /* spread the devices told to come back over as long again */
+  reply.retry_after_ms = wait_ms + g_random_int_range (0, wait_ms + 1);
+
+  /* and their later enrolls over the time it takes to admit the whole fleet,
+   * never narrower than the default window of the nodes */
+  n_devices = chamge_registry_count_by_type (registry, CHAMGE_DEVICE_TYPE_EDGE)
+      + chamge_registry_count_by_type (registry, CHAMGE_DEVICE_TYPE_HUB)
+      + n_new;
+  reply.window_ms = MAX (100000, n_devices * 1000 / self->enroll_rate);
+
+  g_debug ("throttling %u enrolls for %" G_GINT64_FORMAT " ms in %"
+      G_GINT64_FORMAT " ms", n_new, reply.retry_after_ms, reply.window_ms);
+
+  *status = CHAMGE_AMQP_STATUS_TOO_MANY_REQUESTS;
+  return chamge_msg_throttled_to_json (&reply);
+}
+
+static void
+_update_hub_load (ChamgeAmqpArbiterBackend * self, const gchar * hub_id,
+    const gchar * body, gssize len)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgHubHeartbeat heartbeat;
+
+  /* a hub which does not report its load is never considered full */
+  if (!chamge_msg_hub_heartbeat_parse_json (&heartbeat, parser, body, len,
+          &error)) {
+    g_debug ("no load reported by %s: %s", hub_id, error->message);
+    return;
+  }
+
+  chamge_registry_set_hub_load (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), hub_id,
+      CLAMP (heartbeat.capacity, 0, G_MAXUINT),
+      CLAMP (heartbeat.load, 0, G_MAXUINT), heartbeat.uri);
+
+  if (self->cluster != NULL)
+    chamge_arbiter_cluster_share_load (self->cluster, hub_id,
+        CLAMP (heartbeat.capacity, 0, G_MAXUINT),
+        CLAMP (heartbeat.load, 0, G_MAXUINT), heartbeat.uri);
+}
+
+static void
+_update_edge_latencies (ChamgeAmqpArbiterBackend * self, const gchar * edge_id,
+    const gchar * body, gssize len)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GPtrArray) hub_ids = NULL;
+  g_autoptr (GArray) rtts = NULL;
+  g_auto (GStrv) items = NULL;
+  ChamgeMsgEdgeHeartbeat heartbeat;
+  guint i;
+
+  if (!chamge_msg_edge_heartbeat_parse_json (&heartbeat, parser, body, len,
+          &error)) {
+    g_debug ("no latency reported by %s: %s", edge_id, error->message);
+    return;
+  }
+
+  /* an edge which has not measured anything yet keeps what it reported */
+  if (heartbeat.rtt == NULL)
+    return;
+
+  hub_ids = g_ptr_array_new ();
+  rtts = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  items = g_strsplit (heartbeat.rtt, ",", -1);
+  for (i = 0; items[i] != NULL; i++) {
+    gchar *value = strchr (items[i], '=');
+    gchar *end = NULL;
+    guint64 value_ms;
+    guint rtt;
+
+    if (value == NULL || value == items[i])
+      continue;
+
+    *value++ = '\0';
+    value_ms = g_ascii_strtoull (value, &end, 10);
+    if (end == value || *end != '\0')
+      continue;
+
+    rtt = MIN (value_ms, G_MAXUINT);
+    g_ptr_array_add (hub_ids, items[i]);
+    g_array_append_val (rtts, rtt);
+  }
+
+  chamge_registry_set_latencies (chamge_arbiter_backend_get_registry
+      (CHAMGE_ARBITER_BACKEND (self)), edge_id,
+      (const gchar * const *) hub_ids->pdata, (const guint *) rtts->data,
+      hub_ids->len);
+}
+
+static gchar *
+_handle_heartbeat (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * uid, const gchar * body, gssize len,
+    ChamgeAmqpStatus * status)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+
+  /* already refreshed by any message */
+  if (!chamge_registry_lookup (registry, uid, NULL, NULL, NULL, NULL)) {
+    gchar *throttled;
+
+    /* devices coming back count against "enroll-rate" like enrolls, and
+     * one which is not admitted is taken back with a later heartbeat */
+    throttled = _admit_enroll (self, &uid, 1, status);
+    if (throttled != NULL)
+      return throttled;
+
+    /* take back a device which expired while it was still running */
+    g_debug ("%s %s is back", device_type, uid);
+    if (!g_strcmp0 (device_type, "edge"))
+      _handle_edge_enroll_activate (self, uid);
+    else
+      _handle_hub_enroll_activate (self, uid);
+
+    _share_device (self, uid);
+  }
+
+  if (!g_strcmp0 (device_type, "hub"))
+    _update_hub_load (self, uid, body, len);
+  else
+    _update_edge_latencies (self, uid, body, len);
+
+  return _reply ("alive");
+}
+
+/* the assigned hub first, so that the edge keeps measuring it, and a random
+ * sample of the others, so that every hub gets measured over time */
+static gchar *
+_list_candidates (ChamgeAmqpArbiterBackend * self, const gchar * hub_id,
+    const gchar * uri)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+  guint max = self->rtt_candidates;
+  g_auto (GStrv) hub_ids = NULL;
+  g_autoptr (GPtrArray) sample = NULL;
+  GString *str;
+  guint i, n = 0;
+
+  if (max == 0)
+    return NULL;
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, "%s=%s", hub_id, uri);
+
+  sample = g_ptr_array_new ();
+  hub_ids = chamge_registry_list_by_type (registry, CHAMGE_DEVICE_TYPE_HUB);
+  for (i = 0; hub_ids[i] != NULL && max > 1; i++) {
+    if (!g_strcmp0 (hub_ids[i], hub_id))
+      continue;
+
+    if (sample->len < max - 1)
+      g_ptr_array_add (sample, hub_ids[i]);
+    else if (g_random_int_range (0, n + 1) < (gint) sample->len)
+      g_ptr_array_index (sample, g_random_int_range (0, sample->len)) =
+          hub_ids[i];
+    n++;
+  }
+
+  for (i = 0; i < sample->len; i++) {
+    g_autofree gchar *other_uri =
+        chamge_registry_dup_hub_uri (registry, g_ptr_array_index (sample, i));
+
+    if (other_uri != NULL)
+      g_string_append_printf (str, ",%s=%s",
+          (gchar *) g_ptr_array_index (sample, i), other_uri);
+  }
+
+  return g_string_free (str, FALSE);
+}
+
+static gchar *
+_handle_edge_request_target_uri (ChamgeAmqpArbiterBackend * self,
+    const gchar * edge_id, ChamgeAmqpStatus * status)
+{
+  g_autofree gchar *hub_id = NULL;
+  g_autofree gchar *uri = NULL;
+  g_autofree gchar *reason = NULL;
+  g_autofree gchar *candidates = NULL;
+  g_autofree gchar *prev_hub_id = NULL;
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+  ChamgeMsgTargetUri reply = { 0 };
+
+  chamge_registry_lookup (registry, edge_id, NULL, NULL, NULL, &prev_hub_id);
+  hub_id = chamge_registry_assign_hub (registry, edge_id, self->hub_strategy,
+      &uri);
+
+  if (hub_id == NULL) {
+    *status = CHAMGE_AMQP_STATUS_SERVICE_UNAVAILABLE;
+    return _reply ("no hub is available");
+  }
+
+  if (uri == NULL) {
+    *status = CHAMGE_AMQP_STATUS_SERVICE_UNAVAILABLE;
+    reason = g_strconcat ("hub(", hub_id, ") reported no relay uri", NULL);
+    return _reply (reason);
+  }
+
+  g_debug ("%s is assigned to %s (uri: %s)", edge_id, hub_id, uri);
+  if (g_strcmp0 (prev_hub_id, hub_id))
+    _share_device (self, edge_id);
+
+  candidates = _list_candidates (self, hub_id, uri);
+
+  reply.result = "assigned";
+  reply.uri = uri;
+  reply.hub_id = hub_id;
+  reply.candidates = candidates;
+
+  return chamge_msg_target_uri_to_json (&reply);
+}
+
+/* a token only the holders of the key could have issued to @uid as long as
+ * it is registered, so that it is checked against the generation of the
+ * device, which a delist drops and the cluster shares, rather than any state
+ * of its own */
+static gchar *
+_issue_session_token (ChamgeAmqpArbiterBackend * self,
+    const gchar * device_type, const gchar * uid, guint32 generation)
+{
+  g_autofree gchar *subject = g_strdup_printf ("%s:%s:%08x", device_type, uid,
+      generation);
+
+  return g_compute_hmac_for_string (G_CHECKSUM_SHA256,
+      (const guchar *) self->epoch, strlen (self->epoch), subject, -1);
+}
+
+/* compares in constant time, not to tell how much of a token is right */
+static gboolean
+_session_token_equal (const gchar * a, const gchar * b)
+{
+  gsize i, len = strlen (a);
+  guchar diff = 0;
+
+  if (strlen (b) != len)
+    return FALSE;
+
+  for (i = 0; i < len; i++)
+    diff |= a[i] ^ b[i];
+
+  return diff == 0;
+}
+
+/* a session is only issued to a device which the registry has activated */
+static gchar *
+_reply_session (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * uid)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+  g_autofree gchar *token = NULL;
+  ChamgeMsgSession reply = { 0 };
+  ChamgeDeviceState state;
+  guint32 generation;
+
+  if (!chamge_registry_lookup (registry, uid, NULL, &state, NULL, NULL)
+      || state != CHAMGE_DEVICE_STATE_ACTIVATED
+      || !chamge_registry_get_generation (registry, uid, &generation))
+    return _reply ("activated");
+
+  token = _issue_session_token (self, device_type, uid, generation);
+
+  reply.result = "activated";
+  reply.token = token;
+  reply.epoch = self->epoch_id;
+
+  return chamge_msg_session_to_json (&reply);
+}
+
+/* a device which is still registered since it was activated in this epoch
+ * comes back activated, without being throttled or announced as a new
+ * enroll; one which was delisted or has expired meanwhile enrolls again */
+static gchar *
+_handle_resume (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * uid, const gchar * body, gssize len,
+    ChamgeAmqpStatus * status)
+{
+  ChamgeRegistry *registry =
+      chamge_arbiter_backend_get_registry (CHAMGE_ARBITER_BACKEND (self));
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *token = NULL;
+  ChamgeMsgDeviceRequest request;
+  ChamgeDeviceType type = !g_strcmp0 (device_type, "edge") ?
+      CHAMGE_DEVICE_TYPE_EDGE : CHAMGE_DEVICE_TYPE_HUB;
+  guint32 generation;
+
+  if (uid == NULL
+      || !chamge_msg_device_request_parse_json (&request, parser, body, len,
+          &error)) {
+    *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+    return _reply ("malformed resume request");
+  }
+
+  if (!chamge_registry_contains (registry, uid, type)
+      || !chamge_registry_get_generation (registry, uid, &generation)) {
+    g_debug ("%s %s is not registered", device_type, uid);
+    *status = CHAMGE_AMQP_STATUS_NOT_FOUND;
+    return _reply ("unknown session");
+  }
+
+  token = _issue_session_token (self, device_type, uid, generation);
+  if (g_strcmp0 (request.epoch, self->epoch_id) || request.session_token == NULL
+      || !_session_token_equal (request.session_token, token)) {
+    g_debug ("%s %s has no session in this epoch", device_type, uid);
+    *status = CHAMGE_AMQP_STATUS_NOT_FOUND;
+    return _reply ("unknown session");
+  }
+
+  /* delisted meanwhile */
+  if (!chamge_registry_set_state (registry, uid,
+          CHAMGE_DEVICE_STATE_ACTIVATED)) {
+    *status = CHAMGE_AMQP_STATUS_NOT_FOUND;
+    return _reply ("unknown session");
+  }
+
+  _share_device (self, uid);
+
+  return _reply_session (self, device_type, uid);
+}
+
+/* returns the result of a lifecycle @method, or NULL if it is not one */
+static const gchar *
+_dispatch_lifecycle (ChamgeAmqpArbiterBackend * self,
+    const gchar * device_type, const gchar * method, const gchar * uid)
+{
+  if (!g_strcmp0 (device_type, "edge")) {
+    if (!g_strcmp0 (method, "enroll")) {
+      _handle_edge_enroll (self, uid);
+      return "enrolled";
+    } else if (!g_strcmp0 (method, "activate")) {
+      _handle_edge_activate (self, uid);
+      return "activated";
+    } else if (!g_strcmp0 (method, "enrollActivate")) {
+      _handle_edge_enroll_activate (self, uid);
+      return "activated";
+    } else if (!g_strcmp0 (method, "deactivate")) {
+      _handle_edge_deactivate (self, uid);
+      return "deactivated";
+    } else if (!g_strcmp0 (method, "delist")) {
+      _handle_edge_delist (self, uid);
+      return "delisted";
+    }
+  } else if (!g_strcmp0 (device_type, "hub")) {
+    if (!g_strcmp0 (method, "enroll")) {
+      _handle_hub_enroll (self, uid);
+      return "enrolled";
+    } else if (!g_strcmp0 (method, "activate")) {
+      _handle_hub_activate (self, uid);
+      return "activated";
+    } else if (!g_strcmp0 (method, "enrollActivate")) {
+      _handle_hub_enroll_activate (self, uid);
+      return "activated";
+    } else if (!g_strcmp0 (method, "deactivate")) {
+      _handle_hub_deactivate (self, uid);
+      return "deactivated";
+    } else if (!g_strcmp0 (method, "delist")) {
+      _handle_hub_delist (self, uid);
+      return "delisted";
+    }
+  }
+
+  return NULL;
+}
+
+static gchar *
+_dispatch_request (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * method, const gchar * uid, const gchar * body, gssize len,
+    ChamgeAmqpStatus * status)
+{
+  g_autofree gchar *reason = NULL;
+  gchar *throttled;
+  const gchar *result;
+
+  g_debug ("device type : %s, method: %s, id: %s", device_type, method, uid);
+
+  *status = CHAMGE_AMQP_STATUS_OK;
+
+  if (uid != NULL)
+    _touch_device (self, uid);
+
+  if (!g_strcmp0 (method, "heartbeat") && uid != NULL
+      && (!g_strcmp0 (device_type, "edge") || !g_strcmp0 (device_type, "hub")))
+    return _handle_heartbeat (self, device_type, uid, body, len, status);
+
+  if (g_strcmp0 (device_type, "edge") && g_strcmp0 (device_type, "hub")) {
+    *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+    reason = g_strconcat ("unknown device type (", device_type, ")", NULL);
+    return _reply (reason);
+  }
+
+  if (!g_strcmp0 (method, "resume"))
+    return _handle_resume (self, device_type, uid, body, len, status);
+
+  if ((!g_strcmp0 (method, "enroll") || !g_strcmp0 (method, "enrollActivate"))
+      && (throttled = _admit_enroll (self, &uid, 1, status)) != NULL)
+    return throttled;
+
+  result = _dispatch_lifecycle (self, device_type, method, uid);
+  if (result != NULL) {
+    _share_device (self, uid);
+    if (!g_strcmp0 (result, "activated"))
+      return _reply_session (self, device_type, uid);
+    return _reply (result);
+  }
+
+  if (!g_strcmp0 (device_type, "edge")
+      && !g_strcmp0 (method, "requestTargetUri"))
+    return _handle_edge_request_target_uri (self, uid, status);
+
+  *status = CHAMGE_AMQP_STATUS_NOT_IMPLEMENTED;
+  reason = g_strconcat ("method(", method, ") is not supported", NULL);
+  return _reply (reason);
+}
+
+/* returns the reply refusing a batch, or NULL if it is admitted; a batch is
+ * admitted or throttled as a whole */
+static gchar *
+_check_batch (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * method, GPtrArray * ids, ChamgeAmqpStatus * status)
+{
+  g_autofree gchar *reason = NULL;
+
+  if (g_strcmp0 (device_type, "edge") && g_strcmp0 (device_type, "hub")) {
+    *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+    reason = g_strconcat ("unknown device type (", device_type, ")", NULL);
+    return _reply (reason);
+  }
+
+  if (g_strcmp0 (method, "enroll") && g_strcmp0 (method, "activate")
+      && g_strcmp0 (method, "enrollActivate")
+      && g_strcmp0 (method, "deactivate") && g_strcmp0 (method, "delist")) {
+    *status = CHAMGE_AMQP_STATUS_NOT_IMPLEMENTED;
+    reason = g_strconcat ("method(", method, ") is not supported in a batch",
+        NULL);
+    return _reply (reason);
+  }
+
+  if (!g_strcmp0 (method, "enroll") || !g_strcmp0 (method, "enrollActivate"))
+    return _admit_enroll (self, (const gchar * const *) ids->pdata, ids->len,
+        status);
+
+  return NULL;
+}
+
+static const gchar *
+_dispatch_batch_item (ChamgeAmqpArbiterBackend * self,
+    const gchar * device_type, const gchar * method, const gchar * uid)
+{
+  const gchar *result;
+
+  _touch_device (self, uid);
+  result = _dispatch_lifecycle (self, device_type, method, uid);
+  _share_device (self, uid);
+
+  return result;
+}
+
+/* a gateway enrolls or activates all of its devices in one request, which is
+ * answered once with the result of each device */
+static gchar *
+_dispatch_batch (ChamgeAmqpArbiterBackend * self, const gchar * device_type,
+    const gchar * method, GPtrArray * ids, ChamgeAmqpStatus * status)
+{
+  g_autoptr (GPtrArray) results = NULL;
+  gchar *refused;
+  guint i;
+
+  g_debug ("device type : %s, method: %s, %u devices", device_type, method,
+      ids->len);
+
+  refused = _check_batch (self, device_type, method, ids, status);
+  if (refused != NULL)
+    return refused;
+
+  results = g_ptr_array_sized_new (ids->len);
+  for (i = 0; i < ids->len; i++)
+    g_ptr_array_add (results, (gpointer) _dispatch_batch_item (self,
+            device_type, method, g_ptr_array_index (ids, i)));
+
+  *status = CHAMGE_AMQP_STATUS_OK;
+
+  return chamge_batch_reply_to_json (ids, results);
+}
+
+typedef struct _Batch Batch;
+
+/* a request taken from the enroll queue, handled by a worker */
+typedef struct
+{
+  ChamgeAmqpArbiterBackend *self;
+
+  amqp_channel_t channel;
+  guint64 delivery_tag;
+  gchar *reply_queue;
+  gchar *correlation_id;
+  gboolean accepts_gzip;
+
+  /* from the headers, if the peer sent them */
+  gchar *device_type;
+  gchar *method;
+  gchar *uid;
+
+  gchar *body;
+
+  gchar *response;
+  ChamgeAmqpStatus status;
+
+  /* set if this is the part of a batch for one worker, with the indices of
+   * its devices in the batch */
+  Batch *batch;
+  GArray *items;
+} Request;
+
+/* a batch split by the workers of its devices, so that it keeps the order of
+ * the requests of each device and the workers share it; the last part done
+ * answers the batch */
+struct _Batch
+{
+  Request *request;
+  GPtrArray *ids;
+  GPtrArray *results;
+  gint pending;
+};
+
+static void
+_request_free (gpointer user_data)
+{
+  Request *request = user_data;
+
+  g_object_unref (request->self);
+  g_free (request->reply_queue);
+  g_free (request->correlation_id);
+  g_free (request->device_type);
+  g_free (request->method);
+  g_free (request->uid);
+  g_free (request->body);
+  g_free (request->response);
+  if (request->items != NULL)
+    g_array_unref (request->items);
+  g_free (request);
+}
+
+static void
+_batch_free (Batch * batch)
+{
+  g_ptr_array_unref (batch->ids);
+  g_ptr_array_unref (batch->results);
+  g_free (batch);
+}
+
+static gchar *
+_process_json_message (ChamgeAmqpArbiterBackend * self, Request * req,
+    ChamgeAmqpStatus * status)
+{
+  g_autoptr (JsonParser) parser = NULL;
+  g_autoptr (GPtrArray) ids = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgDeviceRequest request;
+  const gchar *body = req->body;
+  gssize len = strlen (req->body);
+  const gchar *uid = NULL;
+
+  /* route by headers and leave the body untouched when a peer provides them */
+  if (req->device_type != NULL && req->method != NULL && req->uid != NULL)
+    return _dispatch_request (self, req->device_type, req->method, req->uid,
+        body, len, status);
+
+  *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+
+  parser = json_parser_new ();
+  if (!chamge_msg_device_request_parse_json (&request, parser, body, len,
+          &error)) {
+    g_debug ("failed to parse body: %s", error->message);
+    return _reply (error->message);
+  }
+
+  ids = chamge_batch_request_get_ids (json_node_get_object
+      (json_parser_get_root (parser)), &error);
+  if (error != NULL)
+    return _reply (error->message);
+  if (ids != NULL)
+    return _dispatch_batch (self, request.device_type, request.method, ids,
+        status);
+
+  if (!g_strcmp0 (request.device_type, "edge")) {
+    uid = request.edge_id;
+    if (uid == NULL)
+      return _reply ("edgeId does not exist");
+  } else if (!g_strcmp0 (request.device_type, "hub")) {
+    uid = request.hub_id;
+    if (uid == NULL)
+      return _reply ("hubId does not exist");
+  }
+
+  return _dispatch_request (self, request.device_type, request.method, uid,
+      body, len, status);
+}
+
+static ChamgeReturn
+_is_queue_existed (const amqp_connection_state_t conn, guint channel,
+    const gchar * queue_name, GError ** error)
+{
+  amqp_queue_declare_ok_t *amqp_declar_r = NULL;
+
+  g_return_val_if_fail (conn != NULL, CHAMGE_RETURN_FAIL);
+
+  if (queue_name == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "queue name is null");
+    return CHAMGE_RETURN_FAIL;
+  } else {
+    amqp_declar_r =
+        amqp_queue_declare (conn, channel, amqp_cstring_bytes (queue_name), 1,
+        0, 0, 1, amqp_empty_table);
+  }
+  if (amqp_declar_r == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "passive queue declare failure >> %s",
+        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (conn)));
+    return CHAMGE_RETURN_FAIL;
+  }
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+_send_reply (ChamgeAmqpArbiterBackend * self, Request * request)
+{
+  amqp_basic_properties_t amqp_props;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  g_autoptr (GBytes) payload = NULL;
+  g_autoptr (GError) error = NULL;
+
+  memset (&amqp_props, 0, sizeof (amqp_basic_properties_t));
+  amqp_props._flags =
+      AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+  amqp_props.content_type = amqp_cstring_bytes (DEFAULT_CONTENT_TYPE);
+  amqp_props.delivery_mode = 2; /* persistent delivery mode */
+
+  if (request->correlation_id != NULL) {
+    amqp_props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
+    amqp_props.correlation_id = amqp_cstring_bytes (request->correlation_id);
+  }
+
+  chamge_amqp_headers_add_int (&amqp_headers, CHAMGE_AMQP_HEADER_STATUS,
+      request->status);
+  chamge_amqp_headers_apply (&amqp_headers, &amqp_props);
+
+  if (_is_queue_existed (self->amqp_conn, request->channel,
+          request->reply_queue, &error)) {
+    g_debug ("%s", error ? error->message : "there is no queue for reply");
+    return;
+  }
+
+  payload = chamge_amqp_message_encode_body (request->response,
+      g_settings_get_uint (self->settings, "compression-threshold"),
+      request->accepts_gzip, &amqp_props);
+
+  /*
+   * publish
+   */
+  g_debug ("publishing to [%s] channel [%d]", request->reply_queue,
+      request->channel);
+  g_debug ("      correlation id [%s] body [%s]", request->correlation_id,
+      request->response);
+  amqp_basic_publish (self->amqp_conn, request->channel,
+      amqp_cstring_bytes (""), amqp_cstring_bytes (request->reply_queue), 0, 0,
+      &amqp_props, chamge_amqp_bytes_from_gbytes (payload));
 }
 
-static void
-_handle_edge_delist (ChamgeAmqpArbiterBackend * self, const gchar * edge_id)
+static gboolean
+_finish_request (gpointer user_data)
 {
-  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+  Request *request = user_data;
+  ChamgeAmqpArbiterBackend *self = request->self;
 
-  if (klass->edge_delisted != NULL)
-    klass->edge_delisted (CHAMGE_ARBITER_BACKEND (self), edge_id);
-}
+  if (self->amqp_conn == NULL)
+    return G_SOURCE_REMOVE;
 
-static void
-_handle_hub_enroll (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
-{
-  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+  if (request->reply_queue != NULL)
+    _send_reply (self, request);
 
-  if (klass->hub_enrolled != NULL)
-    klass->hub_enrolled (CHAMGE_ARBITER_BACKEND (self), hub_id);
+  /* a request is settled once handled, so that another arbiter takes it
+   * over only if this one dies meanwhile */
+  amqp_basic_ack (self->amqp_conn, request->channel, request->delivery_tag, 0);
+
+  if (self->cluster != NULL)
+    chamge_arbiter_cluster_flush (self->cluster);
+
+  return G_SOURCE_REMOVE;
 }
 
-static void
-_handle_hub_activate (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+/* returns the scope of the reply to @request in the cache, or NULL if it must
+ * not be cached; a correlation id is only unique to the peer which chose it,
+ * so that the device of the request is in the scope, but not its reply queue,
+ * which a peer declares again when it reconnects; a reply which carries a
+ * session token is never kept */
+static gchar *
+_reply_scope (Request * request)
 {
-  /* TODO : check whether manager need to handle activate request of edge */
+  if (request->reply_queue == NULL || request->uid == NULL)
+    return NULL;
+
+  if (!g_strcmp0 (request->method, "activate")
+      || !g_strcmp0 (request->method, "enrollActivate")
+      || !g_strcmp0 (request->method, "resume"))
+    return NULL;
+
+  return g_strconcat (request->device_type, "/", request->uid, NULL);
 }
 
 static void
-_handle_hub_deactivate (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+_handle_batch_part (ChamgeAmqpArbiterBackend * self, Request * part)
 {
-  /* TODO : nothing to do now */
+  Batch *batch = part->batch;
+  Request *request;
+  guint i;
+
+  for (i = 0; i < part->items->len; i++) {
+    guint item = g_array_index (part->items, guint, i);
+
+    batch->results->pdata[item] = (gpointer) _dispatch_batch_item (self,
+        part->device_type, part->method,
+        g_ptr_array_index (batch->ids, item));
+  }
+
+  if (!g_atomic_int_dec_and_test (&batch->pending))
+    return;
+
+  request = batch->request;
+  request->response = chamge_batch_reply_to_json (batch->ids, batch->results);
+  request->status = CHAMGE_AMQP_STATUS_OK;
+  _batch_free (batch);
+
+  g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+      _finish_request, request, _request_free);
 }
 
 static void
-_handle_hub_delist (ChamgeAmqpArbiterBackend * self, const gchar * hub_id)
+_handle_request (gpointer data, gpointer user_data)
 {
-  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+  Request *request = data;
+  ChamgeAmqpArbiterBackend *self = request->self;
+  g_autofree gchar *scope = NULL;
+  gint status;
+
+  if (request->batch != NULL) {
+    _handle_batch_part (self, request);
+    _request_free (request);
+    return;
+  }
 
-  if (klass->hub_delisted != NULL)
-    klass->hub_delisted (CHAMGE_ARBITER_BACKEND (self), hub_id);
-}
+  scope = _reply_scope (request);
 
-static gchar *
-_process_json_message (ChamgeAmqpArbiterBackend * self, const gchar * body,
-    gssize len)
-{
-  g_autoptr (JsonParser) parser = json_parser_new ();
-  g_autoptr (GError) error = NULL;
+  /* a retried request lands on the same worker, after the first one */
+  if (self->replies != NULL && scope != NULL
+      && chamge_reply_cache_lookup (self->replies, scope,
+          request->correlation_id, &request->response, &status)) {
+    g_debug ("replying again to %s", request->correlation_id);
+    request->status = status;
+    goto out;
+  }
 
-  JsonNode *root = NULL;
-  JsonObject *json_object = NULL;
+  request->response = _process_json_message (self, request, &request->status);
 
-  const gchar *device_type = NULL;
-  const gchar *uid = NULL;
-  const gchar *method = NULL;
-  gchar *response = NULL;
+  if (request->response == NULL)
+    g_error ("response is NULL. response should be non null");
 
-  if (!json_parser_load_from_data (parser, body, len, &error)) {
-    g_debug ("failed to parse body: %s", error->message);
-    return g_strdup_printf ("{\"result\":\"failed to parse body\"}");
-  }
+  if (self->replies != NULL && scope != NULL
+      && chamge_amqp_status_is_final (request->status))
+    chamge_reply_cache_insert (self->replies, scope, request->correlation_id,
+        request->response, request->status);
 
-  root = json_parser_get_root (parser);
-  json_object = json_node_get_object (root);
-  if (json_object_has_member (json_object, "deviceType")) {
-    JsonNode *node = json_object_get_member (json_object, "deviceType");
-    device_type = json_node_get_string (node);
-  }
-  if (device_type == NULL) {
-    g_debug ("device type is missing");
-    return g_strdup ("{\"result\":\"device type is missing\"}");
-  }
+out:
+  g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+      _finish_request, request, _request_free);
+}
 
-  if (json_object_has_member (json_object, "method")) {
-    JsonNode *node = json_object_get_member (json_object, "method");
-    method = json_node_get_string (node);
-  }
-  if (method == NULL) {
-    return g_strdup ("{\"result\":\"method is missing\"}");
+/* splits an admitted batch by the workers of its devices, or answers it at
+ * once if it is refused */
+static void
+_split_batch (ChamgeAmqpArbiterBackend * self, Request * request,
+    const gchar * device_type, const gchar * method, GPtrArray * ids)
+{
+  g_autofree Request **parts = NULL;
+  Batch *batch;
+  guint i;
+
+  g_debug ("device type : %s, method: %s, %u devices", device_type, method,
+      ids->len);
+
+  request->response = _check_batch (self, device_type, method, ids,
+      &request->status);
+  if (request->response != NULL) {
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+        _finish_request, request, _request_free);
+    return;
   }
 
-  if (!g_strcmp0 (device_type, "edge")) {
-    if (json_object_has_member (json_object, "edgeId")) {
-      JsonNode *node = json_object_get_member (json_object, "edgeId");
-      uid = json_node_get_string (node);
-    }
-    if (uid == NULL)
-      return g_strdup ("{\"result\":\"edgeId does not exist\"}");
-
-    g_debug ("device type : %s, method: %s, id: %s", device_type, method, uid);
-    if (!g_strcmp0 (method, "enroll")) {
-      _handle_edge_enroll (self, uid);
-      response = g_strdup ("{\"result\":\"enrolled\"}");
-    } else if (!g_strcmp0 (method, "activate")) {
-      _handle_edge_activate (self, uid);
-      response = g_strdup ("{\"result\":\"activated\"}");
-    } else if (!g_strcmp0 (method, "deactivate")) {
-      _handle_edge_deactivate (self, uid);
-      response = g_strdup ("{\"result\":\"deactivated\"}");
-    } else if (!g_strcmp0 (method, "delist")) {
-      _handle_edge_delist (self, uid);
-      response = g_strdup ("{\"result\":\"delisted\"}");
-    } else {
-      response =
-          g_strdup_printf ("{\"result\":\"method(%s) is not supported\"}",
-          method);
-    }
-  } else if (!g_strcmp0 (device_type, "hub")) {
-    if (json_object_has_member (json_object, "hubId")) {
-      JsonNode *node = json_object_get_member (json_object, "hubId");
-      uid = json_node_get_string (node);
+  batch = g_new0 (Batch, 1);
+  batch->request = request;
+  batch->ids = g_ptr_array_new_full (ids->len, g_free);
+  batch->results = g_ptr_array_new ();
+  g_ptr_array_set_size (batch->results, ids->len);
+
+  parts = g_new0 (Request *, self->n_workers);
+  for (i = 0; i < ids->len; i++) {
+    const gchar *uid = g_ptr_array_index (ids, i);
+    guint shard = g_str_hash (uid) % self->n_workers;
+
+    g_ptr_array_add (batch->ids, g_strdup (uid));
+
+    if (parts[shard] == NULL) {
+      parts[shard] = g_new0 (Request, 1);
+      parts[shard]->self = g_object_ref (self);
+      parts[shard]->device_type = g_strdup (device_type);
+      parts[shard]->method = g_strdup (method);
+      parts[shard]->batch = batch;
+      parts[shard]->items = g_array_new (FALSE, FALSE, sizeof (guint));
+      batch->pending++;
     }
-    if (uid == NULL)
-      return g_strdup ("{\"result\":\"hubId does not exist\"}");
+    g_array_append_val (parts[shard]->items, i);
+  }
 
-    g_debug ("device type : %s, method: %s, id: %s", device_type, method, uid);
-    if (!g_strcmp0 (method, "enroll")) {
-      _handle_hub_enroll (self, uid);
-      response = g_strdup ("{\"result\":\"enrolled\"}");
-    } else if (!g_strcmp0 (method, "activate")) {
-      _handle_hub_activate (self, uid);
-      response = g_strdup ("{\"result\":\"activated\"}");
-    } else if (!g_strcmp0 (method, "deactivate")) {
-      _handle_hub_deactivate (self, uid);
-      response = g_strdup ("{\"result\":\"deactivated\"}");
-    } else if (!g_strcmp0 (method, "delist")) {
-      _handle_hub_delist (self, uid);
-      response = g_strdup ("{\"result\":\"delisted\"}");
-    } else {
-      response =
-          g_strdup_printf ("{\"result\":\"method(%s) is not supported\"}",
-          method);
-    }
-  } else {
-    response =
-        g_strdup_printf ("{\"result\":\"unknown device type (%s)\"}",
-        device_type);
+  /* pushed once all of them are counted, any of them may be the last done */
+  for (i = 0; i < self->n_workers; i++) {
+    if (parts[i] != NULL)
+      g_thread_pool_push (self->workers[i], parts[i], NULL);
   }
-  return response;
 }
 
-static ChamgeReturn
-_is_queue_existed (const amqp_connection_state_t conn, guint channel,
-    const gchar * queue_name, GError ** error)
+/* hands @request to the worker of its device, which is read from the body if
+ * an older peer sent no headers; a batch is split by device */
+static void
+_route_request (ChamgeAmqpArbiterBackend * self, Request * request)
 {
-  amqp_queue_declare_ok_t *amqp_declar_r = NULL;
-
-  g_return_val_if_fail (conn != NULL, CHAMGE_RETURN_FAIL);
+  g_autoptr (JsonParser) parser = NULL;
+  g_autoptr (GPtrArray) ids = NULL;
+  ChamgeMsgDeviceRequest body;
+  const gchar *uid = request->uid;
+  guint shard;
+
+  if (uid == NULL) {
+    parser = json_parser_new ();
+    if (chamge_msg_device_request_parse_json (&body, parser, request->body, -1,
+            NULL)) {
+      ids = chamge_batch_request_get_ids (json_node_get_object
+          (json_parser_get_root (parser)), NULL);
+      if (ids != NULL && ids->len > 0) {
+        _split_batch (self, request, body.device_type, body.method, ids);
+        return;
+      }
 
-  if (queue_name == NULL) {
-    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "queue name is null");
-    return CHAMGE_RETURN_FAIL;
-  } else {
-    amqp_declar_r =
-        amqp_queue_declare (conn, channel, amqp_cstring_bytes (queue_name), 1,
-        0, 0, 1, amqp_empty_table);
-  }
-  if (amqp_declar_r == NULL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
-        "passive queue declare failure >> %s",
-        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (conn)));
-    return CHAMGE_RETURN_FAIL;
+      if (!g_strcmp0 (body.device_type, "edge"))
+        uid = body.edge_id;
+      else if (!g_strcmp0 (body.device_type, "hub"))
+        uid = body.hub_id;
+    }
   }
-  return CHAMGE_RETURN_OK;
+
+  /* whatever can't be read is refused by the first worker */
+  shard = uid != NULL ? g_str_hash (uid) % self->n_workers : 0;
+  g_thread_pool_push (self->workers[shard], request, NULL);
 }
 
 static gboolean
@@ -382,11 +1433,18 @@ _process_amqp_message (ChamgeAmqpArbiterBackend * self)
   g_autofree gchar *reply_queue = NULL;
   g_autofree gchar *correlation_id = NULL;
   struct timeval timeout = { 1, 0 };
-  g_autofree gchar *response = NULL;
+  g_autofree gchar *body = NULL;
+  g_autoptr (GError) error = NULL;
+  const amqp_basic_properties_t *props;
+  Request *request;
+  gboolean ack = FALSE;
 
   if (!self->activated)
     return G_SOURCE_REMOVE;
 
+  if (self->cluster != NULL)
+    chamge_arbiter_cluster_flush (self->cluster);
+
   amqp_maybe_release_buffers (self->amqp_conn);
 
   amqp_rpc_res = amqp_consume_message (self->amqp_conn, &envelope, &timeout, 0);
@@ -401,6 +1459,18 @@ _process_amqp_message (ChamgeAmqpArbiterBackend * self)
     goto out;
   }
 
+  if (self->cluster != NULL
+      && chamge_arbiter_cluster_owns (self->cluster, &envelope)) {
+    body = chamge_amqp_message_decode_body (&envelope.message, &error);
+    if (body != NULL)
+      chamge_arbiter_cluster_receive (self->cluster, body);
+    goto out;
+  }
+
+  /* dropped requests are settled right away */
+  ack = TRUE;
+  props = &envelope.message.properties;
+
   if (envelope.message.body.bytes == NULL) {
     g_debug ("no reply queue in request message");
     goto out;
@@ -412,100 +1482,183 @@ _process_amqp_message (ChamgeAmqpArbiterBackend * self)
       (char *) envelope.routing_key.bytes);
 
   /* if the content-type isn't 'application/json', let's drop */
-  if (!(envelope.message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
-      || strlen (DEFAULT_CONTENT_TYPE) !=
-      envelope.message.properties.content_type.len
+  if (!(props->_flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
+      || strlen (DEFAULT_CONTENT_TYPE) != props->content_type.len
       || g_ascii_strncasecmp (DEFAULT_CONTENT_TYPE,
-          envelope.message.properties.content_type.bytes,
-          envelope.message.properties.content_type.len)
+          props->content_type.bytes, props->content_type.len)
       ) {
-    g_debug ("invalid content type %s",
-        (gchar *) envelope.message.properties.content_type.bytes);
+    g_debug ("invalid content type %s", (gchar *) props->content_type.bytes);
 
     goto out;
   }
 
-  if ((envelope.message.properties._flags & AMQP_BASIC_REPLY_TO_FLAG) &&
-      envelope.message.properties.reply_to.len > 0 &&
-      (strlen (envelope.message.properties.reply_to.bytes) >=
-          envelope.message.properties.reply_to.len)) {
-    reply_queue = g_strndup (envelope.message.properties.reply_to.bytes,
-        envelope.message.properties.reply_to.len);
+  if ((props->_flags & AMQP_BASIC_REPLY_TO_FLAG) &&
+      props->reply_to.len > 0 &&
+      (strlen (props->reply_to.bytes) >= props->reply_to.len)) {
+    reply_queue = g_strndup (props->reply_to.bytes, props->reply_to.len);
   } else {
-    g_debug ("not exist replay_to in request message's property");
-    goto out;
+    g_debug ("one-way message without reply_to");
   }
 
-  if ((envelope.message.properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) &&
-      envelope.message.properties.correlation_id.len > 0 &&
-      (strlen (envelope.message.properties.correlation_id.bytes) >=
-          envelope.message.properties.correlation_id.len)) {
+  if ((props->_flags & AMQP_BASIC_CORRELATION_ID_FLAG) &&
+      props->correlation_id.len > 0 &&
+      (strlen (props->correlation_id.bytes) >= props->correlation_id.len)) {
     correlation_id =
-        g_strndup (envelope.message.properties.correlation_id.bytes,
-        envelope.message.properties.correlation_id.len);
+        g_strndup (props->correlation_id.bytes, props->correlation_id.len);
   }
 
   g_debug ("Content-type: %.*s, replay_to : %s, correlation_id : %s",
-      (int) envelope.message.properties.content_type.len,
-      (char *) envelope.message.properties.content_type.bytes,
+      (int) props->content_type.len, (char *) props->content_type.bytes,
       reply_queue, correlation_id);
 
-  response = _process_json_message (self, envelope.message.body.bytes,
-      envelope.message.body.len);
-
-  if (response == NULL) {
-    g_error ("response is NULL. response should be non null");
+  body = chamge_amqp_message_decode_body (&envelope.message, &error);
+  if (body == NULL) {
+    g_debug ("failed to decode body: %s", error->message);
+
+    /* rejected at once, the requester would retry it until it gives up */
+    if (reply_queue != NULL) {
+      request = g_new0 (Request, 1);
+      request->self = g_object_ref (self);
+      request->channel = envelope.channel;
+      request->reply_queue = g_steal_pointer (&reply_queue);
+      request->correlation_id = g_steal_pointer (&correlation_id);
+      request->response = _reply (error->message);
+      request->status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+      _send_reply (self, request);
+      _request_free (request);
+    }
     goto out;
   }
-  {
-    amqp_basic_properties_t amqp_props;
-
-    memset (&amqp_props, 0, sizeof (amqp_basic_properties_t));
-    amqp_props._flags =
-        AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
-    amqp_props.content_type = amqp_cstring_bytes (DEFAULT_CONTENT_TYPE);
-    amqp_props.delivery_mode = 2;       /* persistent delivery mode */
 
-    if (correlation_id != NULL) {
-      amqp_props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-      amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
-    }
-
-    {
-      g_autoptr (GError) error = NULL;
-      if (_is_queue_existed (self->amqp_conn, envelope.channel, reply_queue,
-              &error)) {
-        g_debug ("%s", error ? error->message : "there is no queue for reply");
-        goto out;
-      }
-    }
-
-    /*
-     * publish
-     */
-    g_debug ("publishing to [%s] channel [%d]", reply_queue, envelope.channel);
-    g_debug ("      correlation id [%s] body [%s]", correlation_id, response);
-    amqp_basic_publish (self->amqp_conn, envelope.channel,
-        amqp_cstring_bytes (""), amqp_cstring_bytes (reply_queue), 0, 0,
-        &amqp_props, amqp_cstring_bytes (response));
-  }
+  request = g_new0 (Request, 1);
+  request->self = g_object_ref (self);
+  request->channel = envelope.channel;
+  request->delivery_tag = envelope.delivery_tag;
+  request->reply_queue = g_steal_pointer (&reply_queue);
+  request->correlation_id = g_steal_pointer (&correlation_id);
+  request->accepts_gzip = chamge_amqp_message_accepts_encoding (props,
+      CHAMGE_AMQP_ENCODING_GZIP);
+  request->device_type =
+      chamge_amqp_headers_dup_string (props, CHAMGE_AMQP_HEADER_DEVICE_TYPE);
+  request->method =
+      chamge_amqp_headers_dup_string (props, CHAMGE_AMQP_HEADER_METHOD);
+  request->uid =
+      chamge_amqp_headers_dup_string (props, CHAMGE_AMQP_HEADER_DEVICE_ID);
+  request->body = g_steal_pointer (&body);
+
+  _route_request (self, request);
+
+  /* the worker acknowledges it */
+  ack = FALSE;
 
 out:
+  if (ack)
+    amqp_basic_ack (self->amqp_conn, envelope.channel, envelope.delivery_tag,
+        0);
   amqp_destroy_envelope (&envelope);
 
   return G_SOURCE_CONTINUE;
 }
 
+static void
+_stop_workers (ChamgeAmqpArbiterBackend * self)
+{
+  guint i;
+
+  /* let the queued requests be handled, their replies follow on the main
+   * context */
+  for (i = 0; i < self->n_workers; i++)
+    g_thread_pool_free (self->workers[i], FALSE, TRUE);
+
+  g_clear_pointer (&self->workers, g_free);
+  self->n_workers = 0;
+}
+
+/* the broker connection is only read in the context the arbiter was made in,
+ * whichever thread the node has called from */
+static gboolean
+_stop_processing_func (gpointer user_data)
+{
+  ChamgeAmqpArbiterBackend *self = user_data;
+
+  self->activated = FALSE;
+  chamge_clear_source (&self->process_source);
+
+  return G_SOURCE_REMOVE;
+}
+
 static ChamgeReturn
 chamge_amqp_arbiter_backend_activate (ChamgeArbiterBackend * arbiter_backend)
 {
   ChamgeAmqpArbiterBackend *self =
       CHAMGE_AMQP_ARBITER_BACKEND (arbiter_backend);
+  g_autofree gchar *hub_strategy = NULL;
+  GEnumClass *enum_class;
+  GEnumValue *value;
+  guint i;
+
+  hub_strategy = g_settings_get_string (self->settings, "hub-strategy");
+  enum_class = g_type_class_ref (CHAMGE_TYPE_HUB_STRATEGY);
+  value = g_enum_get_value_by_nick (enum_class, hub_strategy);
+  self->hub_strategy =
+      value != NULL ? value->value : CHAMGE_HUB_STRATEGY_LEAST_LOADED;
+  g_type_class_unref (enum_class);
+
+  g_clear_pointer (&self->enroll_bucket, chamge_token_bucket_free);
+  self->enroll_rate = g_settings_get_uint (self->settings, "enroll-rate");
+  if (self->enroll_rate > 0)
+    self->enroll_bucket =
+        chamge_token_bucket_new (self->enroll_rate,
+        g_settings_get_uint (self->settings, "enroll-burst"),
+        g_get_monotonic_time ());
+
+  self->rtt_candidates = g_settings_get_uint (self->settings, "rtt-candidates");
+
+  _stop_workers (self);
+
+  g_free (self->epoch);
+  self->epoch = g_settings_get_string (self->settings, "session-key");
+  if (self->epoch[0] == '\0') {
+    if (self->cluster != NULL)
+      g_warning ("session-key is not set, a session is only resumed with the "
+          "arbiter which issued it");
+
+    g_free (self->epoch);
+    self->epoch =
+        chamge_registry_dup_epoch (chamge_arbiter_backend_get_registry
+        (arbiter_backend));
+  }
+  g_free (self->epoch_id);
+  self->epoch_id = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+      self->epoch, -1);
+  self->epoch_id[16] = '\0';
 
-  g_debug ("waiting for message");
+  g_clear_pointer (&self->replies, chamge_reply_cache_free);
+  if (g_settings_get_uint (self->settings, "reply-cache-size") > 0)
+    self->replies =
+        chamge_reply_cache_new (g_settings_get_uint (self->settings,
+            "reply-cache-size"));
+
+  self->n_workers = g_settings_get_uint (self->settings, "worker-threads");
+  if (self->n_workers == 0)
+    self->n_workers = g_get_num_processors ();
+
+  self->workers = g_new0 (GThreadPool *, self->n_workers);
+  for (i = 0; i < self->n_workers; i++)
+    self->workers[i] = g_thread_pool_new (_handle_request, NULL, 1, FALSE,
+        NULL);
+
+  g_debug ("waiting for message (%u workers)", self->n_workers);
 
-  self->process_id = g_idle_add ((GSourceFunc) _process_amqp_message, self);
   self->activated = TRUE;
+  if (self->process_source == NULL)
+    self->process_source = chamge_idle_add (self->context,
+        (GSourceFunc) _process_amqp_message, self);
+
+  /* devices are only refreshed while messages are processed */
+  chamge_registry_set_expiry (chamge_arbiter_backend_get_registry
+      (arbiter_backend), g_settings_get_uint (self->settings,
+          "device-expiry"));
 
   return CHAMGE_RETURN_OK;
 }
@@ -516,65 +1669,65 @@ chamge_amqp_arbiter_backend_deactivate (ChamgeArbiterBackend * arbiter_backend)
   ChamgeAmqpArbiterBackend *self =
       CHAMGE_AMQP_ARBITER_BACKEND (arbiter_backend);
 
-  self->activated = FALSE;
+  chamge_main_context_invoke_sync (self->context, _stop_processing_func,
+      self);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  _stop_workers (self);
+
+  chamge_registry_set_expiry (chamge_arbiter_backend_get_registry
+      (arbiter_backend), 0);
 
   return CHAMGE_RETURN_OK;
 }
 
-gchar *
-_get_queue_name (const gchar * request)
+static gchar *
+_parse_route (const gchar * request, gchar ** method)
 {
   g_autoptr (JsonParser) parser = json_parser_new ();
   g_autoptr (GError) error = NULL;
-  const gchar *name = NULL;
+  ChamgeMsgRoute route;
 
-  JsonNode *root = NULL;
-  JsonObject *json_object = NULL;
-
-  if (!json_parser_load_from_data (parser, request, strlen (request), &error)) {
+  if (!chamge_msg_route_parse_json (&route, parser, request, -1, &error)) {
     g_debug ("failed to parse body: %s", error->message);
     return NULL;
   }
 
-  root = json_parser_get_root (parser);
-  json_object = json_node_get_object (root);
-  if (json_object_has_member (json_object, "to")) {
-    JsonNode *node = json_object_get_member (json_object, "to");
-    name = json_node_get_string (node);
-    return g_strdup (name);
-  }
-  return NULL;
+  if (method != NULL)
+    *method = g_strdup (route.method);
+
+  return g_strdup (route.to);
+}
+
+gchar *
+_get_queue_name (const gchar * request)
+{
+  return _parse_route (request, NULL);
 }
 
+/* the reply queue is declared by the first attempt and kept in
+ * @amqp_reply_queue for the retries, which are sent with the same
+ * @correlation_id; @timed_out tells whether a retry may be answered */
 static ChamgeReturn
 _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
-    const gchar * request, const gchar * exchange, gchar ** response,
+    const gchar * queue_name, const gchar * method, const gchar * request,
+    const gchar * exchange, const gchar * correlation_id,
+    amqp_bytes_t * amqp_reply_queue, gboolean * timed_out, gchar ** response,
     GError ** error)
 {
-  amqp_bytes_t amqp_reply_queue = { 0 };
   amqp_basic_properties_t amqp_props = { 0 };
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeMsgRoute route = { 0 };
   amqp_queue_declare_ok_t *amqp_declar_r = NULL;
-  g_autofree gchar *correlation_id = NULL;
   ChamgeReturn ret = CHAMGE_RETURN_FAIL;
-  g_autofree gchar *queue_name = NULL;
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
 
   g_return_val_if_fail (amqp_conn != NULL, CHAMGE_RETURN_FAIL);
   g_return_val_if_fail (channel != 0, CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (queue_name != NULL, CHAMGE_RETURN_FAIL);
   g_return_val_if_fail (request != NULL, CHAMGE_RETURN_FAIL);
   g_return_val_if_fail (response != NULL, CHAMGE_RETURN_FAIL);
 
-  queue_name = _get_queue_name (request);
-  if (queue_name == NULL) {
-    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_MISSING_PARAMETER,
-        "json parsing failure to get \"to\"");
-    return CHAMGE_RETURN_FAIL;
-  }
+  *timed_out = FALSE;
 
   /* check where queue_name queue exist */
   if (_is_queue_existed (amqp_conn, channel, queue_name,
@@ -583,19 +1736,31 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
   }
 
   g_debug ("queue name : %s ", queue_name);
-  amqp_declar_r =
-      amqp_queue_declare (amqp_conn, channel, amqp_empty_bytes, 0, 0, 0,
-      1, amqp_empty_table);
-  if (amqp_declar_r == NULL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "declare queue failure >> %s",
-        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    return CHAMGE_RETURN_FAIL;
+  if (amqp_reply_queue->len == 0) {
+    amqp_declar_r =
+        amqp_queue_declare (amqp_conn, channel, amqp_empty_bytes, 0, 0, 0,
+        1, amqp_empty_table);
+    if (amqp_declar_r == NULL) {
+      g_set_error (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "declare queue failure >> %s",
+          _amqp_get_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
+      return CHAMGE_RETURN_FAIL;
+    }
+    *amqp_reply_queue = amqp_bytes_malloc_dup (amqp_declar_r->queue);
+
+    /* wait an answer */
+    if (amqp_basic_consume (amqp_conn, channel, *amqp_reply_queue,
+            amqp_empty_bytes, 0, 1, 0, amqp_empty_table) == NULL) {
+      g_set_error (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+          "basic consume failure >> %s",
+          _amqp_get_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
+      goto out;
+    }
   }
-  amqp_reply_queue.bytes = amqp_declar_r->queue.bytes;
-  amqp_reply_queue.len = amqp_declar_r->queue.len;
 
-  g_debug ("queue for reply : %s", (gchar *) amqp_reply_queue.bytes);
+  g_debug ("queue for reply : %.*s", (gint) amqp_reply_queue->len,
+      (gchar *) amqp_reply_queue->bytes);
 
   /* property setting to send rpc request */
   amqp_props._flags =
@@ -605,15 +1770,21 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
   amqp_props.delivery_mode = 2; /* persistent delivery mode */
 
   amqp_props._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-  amqp_props.reply_to = amqp_reply_queue;
+  amqp_props.reply_to = *amqp_reply_queue;
 
   amqp_props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-  correlation_id = g_uuid_string_random ();
-  correlation_id =
-      g_compute_checksum_for_string (G_CHECKSUM_SHA256, correlation_id,
-      strlen (correlation_id));
   amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
 
+  /* let the receiver route without parsing the command */
+  route.to = queue_name;
+  route.method = method;
+  chamge_msg_route_encode_headers (&route, &amqp_headers);
+
+  /* let the peer compress a large reply */
+  chamge_amqp_headers_add_string (&amqp_headers,
+      CHAMGE_AMQP_HEADER_ACCEPT_ENCODING, CHAMGE_AMQP_ENCODING_GZIP);
+  chamge_amqp_headers_apply (&amqp_headers, &amqp_props);
+
   /* send requst to queue_name */
   {
     gint r = amqp_basic_publish (amqp_conn, channel,
@@ -631,32 +1802,23 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
         exchange, request);
   }
 
-  /* wait an answer */
-  if (amqp_basic_consume (amqp_conn, channel, amqp_reply_queue,
-          amqp_empty_bytes, 0, 1, 0, amqp_empty_table) == NULL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "basic consume failure >> %s",
-        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-
   /* wait an answer */
   do {
     amqp_rpc_reply_t amqp_r;
     amqp_envelope_t envelope;
-    struct timeval timeout = { 10, 0 };
+    struct timeval timeout = { RPC_TIMEOUT_SECONDS, 0 };
 
     amqp_maybe_release_buffers (amqp_conn);
 
-    g_debug ("Wait for response message from [%s]",
-        (gchar *) amqp_reply_queue.bytes);
+    g_debug ("Wait for response message from [%.*s]",
+        (gint) amqp_reply_queue->len, (gchar *) amqp_reply_queue->bytes);
     amqp_r = amqp_consume_message (amqp_conn, &envelope, &timeout, 0);
 
     if (amqp_r.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
         && amqp_r.library_error == AMQP_STATUS_TIMEOUT) {
       g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
           CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg timeout");
+      *timed_out = TRUE;
       break;
     }
 
@@ -675,6 +1837,7 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
     if ((envelope.message.properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) ==
         0) {
       g_debug ("discard >> correaltion id is not exist");
+      amqp_destroy_envelope (&envelope);
       continue;
     }
 
@@ -685,6 +1848,7 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
       g_debug ("discard >> correaltion id is not matched [%s] [%.*s]",
           correlation_id, (gint) envelope.message.properties.correlation_id.len,
           (gchar *) envelope.message.properties.correlation_id.bytes);
+      amqp_destroy_envelope (&envelope);
       continue;
     }
 
@@ -701,35 +1865,49 @@ _handle_rpc_user_command (amqp_connection_state_t amqp_conn, gint channel,
       g_free (*response);
       *response = NULL;
     }
-    *response =
-        g_strndup (envelope.message.body.bytes, envelope.message.body.len);
+    *response = chamge_amqp_message_decode_body (&envelope.message, error);
+    status = chamge_amqp_message_get_status (&envelope.message.properties);
 
     amqp_destroy_envelope (&envelope);
+
+    /* the reply came but can't be read */
+    if (*response == NULL)
+      goto out;
     break;
   } while (1);
 
+  if (status != CHAMGE_AMQP_STATUS_NONE && status != CHAMGE_AMQP_STATUS_OK
+      && (error == NULL || *error == NULL)) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "user command failure >> status %d", status);
+    goto out;
+  }
+
   ret = CHAMGE_RETURN_OK;
 out:
   return ret;
 }
 
 static ChamgeReturn
-chamge_amqp_arbiter_backend_user_command (ChamgeArbiterBackend *
-    arbiter_backend, const gchar * cmd, gchar ** out, GError ** error)
+_rpc_call (ChamgeAmqpArbiterBackend * self, const gchar * queue_name,
+    const gchar * method, const gchar * cmd, gchar ** out, GError ** error)
 {
-  ChamgeAmqpArbiterBackend *self =
-      CHAMGE_AMQP_ARBITER_BACKEND (arbiter_backend);
-  g_autofree gchar *amqp_uri = NULL;
+  g_autofree gchar *amqp_uri = g_strdup (self->rpc_uri);
   struct amqp_connection_info connection_info;
   amqp_rpc_reply_t amqp_r;
   amqp_connection_state_t amqp_conn;
   amqp_socket_t *amqp_socket = NULL;
+  amqp_bytes_t amqp_reply_queue = { 0 };
+  g_autofree gchar *correlation_id = NULL;
+  g_autoptr (GError) rpc_error = NULL;
+  gboolean timed_out = FALSE;
+  guint attempt;
 
-  g_autofree gchar *amqp_exchange_name = NULL;
-  gint amqp_channel = 0;
+  const gchar *amqp_exchange_name = self->rpc_exchange;
+  gint amqp_channel = self->rpc_channel;
   ChamgeReturn ret = CHAMGE_RETURN_FAIL;
 
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
   g_assert_nonnull (amqp_uri);
 
   if (amqp_parse_url (amqp_uri, &connection_info) != AMQP_STATUS_OK) {
@@ -738,10 +1916,6 @@ chamge_amqp_arbiter_backend_user_command (ChamgeArbiterBackend *
     goto out;
   }
 
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
   g_debug ("[config] channel : %d, enroll-exchange-name : %s",
       amqp_channel, amqp_exchange_name);
 
@@ -778,11 +1952,29 @@ chamge_amqp_arbiter_backend_user_command (ChamgeArbiterBackend *
       connection_info.host, connection_info.port,
       connection_info.vhost, connection_info.user, connection_info.password);
 
-  ret =
-      _handle_rpc_user_command (amqp_conn, amqp_channel, cmd,
-      amqp_exchange_name, out, error);
-  if (ret != CHAMGE_RETURN_OK && *error != NULL) {
-    g_debug ("rpc request failure >> %s", (*error)->message);
+  /* a retry is sent with the same correlation id to the same reply queue,
+   * so that the peer answers it from its cache if it has run the command
+   * already */
+  correlation_id = g_uuid_string_random ();
+  for (attempt = 0; attempt < RPC_ATTEMPTS; attempt++) {
+    if (attempt > 0) {
+      g_debug ("retrying %s >> %s", correlation_id,
+          rpc_error ? rpc_error->message : "no reply");
+      g_clear_error (&rpc_error);
+    }
+
+    ret =
+        _handle_rpc_user_command (amqp_conn, amqp_channel, queue_name, method,
+        cmd, amqp_exchange_name, correlation_id, &amqp_reply_queue, &timed_out,
+        out, &rpc_error);
+    if (ret == CHAMGE_RETURN_OK || !timed_out)
+      break;
+  }
+  amqp_bytes_free (amqp_reply_queue);
+
+  if (ret != CHAMGE_RETURN_OK && rpc_error != NULL) {
+    g_debug ("rpc request failure >> %s", rpc_error->message);
+    g_propagate_error (error, g_steal_pointer (&rpc_error));
     goto out;
   }
 
@@ -819,6 +2011,46 @@ out:
   return ret;
 }
 
+static ChamgeReturn
+chamge_amqp_arbiter_backend_user_command (ChamgeArbiterBackend *
+    arbiter_backend, const gchar * cmd, gchar ** out, GError ** error)
+{
+  ChamgeAmqpArbiterBackend *self =
+      CHAMGE_AMQP_ARBITER_BACKEND (arbiter_backend);
+  g_autofree gchar *queue_name = NULL;
+  g_autofree gchar *method = NULL;
+
+  queue_name = _parse_route (cmd, &method);
+  if (queue_name == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_MISSING_PARAMETER,
+        "json parsing failure to get \"to\"");
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  return _rpc_call (self, queue_name, method, cmd, out, error);
+}
+
+static ChamgeReturn
+chamge_amqp_arbiter_backend_send_command (ChamgeArbiterBackend *
+    arbiter_backend, const gchar * target, const gchar * method,
+    GVariant * arguments, GVariant ** reply, GError ** error)
+{
+  ChamgeAmqpArbiterBackend *self =
+      CHAMGE_AMQP_ARBITER_BACKEND (arbiter_backend);
+  g_autofree gchar *cmd = NULL;
+  g_autofree gchar *response = NULL;
+  ChamgeReturn ret;
+
+  /* the route is known, only the peer needs the body */
+  cmd = chamge_command_to_json (target, method, arguments);
+  ret = _rpc_call (self, target, method, cmd, &response, error);
+
+  if (reply != NULL && response != NULL)
+    *reply = chamge_command_reply_from_json (response, NULL);
+
+  return ret;
+}
 
 static void
 chamge_amqp_arbiter_backend_approve (ChamgeArbiterBackend * arbiter_backend,
@@ -833,12 +2065,19 @@ chamge_amqp_arbiter_backend_dispose (GObject * object)
 {
   ChamgeAmqpArbiterBackend *self = CHAMGE_AMQP_ARBITER_BACKEND (object);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  chamge_clear_source (&self->process_source);
+
+  _stop_workers (self);
+  g_clear_pointer (&self->context, g_main_context_unref);
 
   g_clear_object (&self->settings);
+  g_clear_pointer (&self->rpc_uri, g_free);
+  g_clear_pointer (&self->rpc_exchange, g_free);
+  g_clear_pointer (&self->enroll_bucket, chamge_token_bucket_free);
+  g_clear_pointer (&self->replies, chamge_reply_cache_free);
+  g_clear_pointer (&self->cluster, chamge_arbiter_cluster_free);
+  g_clear_pointer (&self->epoch, g_free);
+  g_clear_pointer (&self->epoch_id, g_free);
 
   if (self->amqp_conn != NULL) {
     amqp_destroy_connection (self->amqp_conn);
@@ -848,6 +2087,16 @@ chamge_amqp_arbiter_backend_dispose (GObject * object)
   G_OBJECT_CLASS (chamge_amqp_arbiter_backend_parent_class)->dispose (object);
 }
 
+static void
+chamge_amqp_arbiter_backend_finalize (GObject * object)
+{
+  ChamgeAmqpArbiterBackend *self = CHAMGE_AMQP_ARBITER_BACKEND (object);
+
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (chamge_amqp_arbiter_backend_parent_class)->finalize (object);
+}
+
 static void
 chamge_amqp_arbiter_backend_class_init (ChamgeAmqpArbiterBackendClass * klass)
 {
@@ -856,12 +2105,14 @@ chamge_amqp_arbiter_backend_class_init (ChamgeAmqpArbiterBackendClass * klass)
       CHAMGE_ARBITER_BACKEND_CLASS (klass);
 
   object_class->dispose = chamge_amqp_arbiter_backend_dispose;
+  object_class->finalize = chamge_amqp_arbiter_backend_finalize;
 
   backend_class->enroll = chamge_amqp_arbiter_backend_enroll;
   backend_class->delist = chamge_amqp_arbiter_backend_delist;
   backend_class->activate = chamge_amqp_arbiter_backend_activate;
   backend_class->deactivate = chamge_amqp_arbiter_backend_deactivate;
   backend_class->user_command = chamge_amqp_arbiter_backend_user_command;
+  backend_class->send_command = chamge_amqp_arbiter_backend_send_command;
   backend_class->approve = chamge_amqp_arbiter_backend_approve;
 }
 
@@ -871,8 +2122,17 @@ chamge_amqp_arbiter_backend_init (ChamgeAmqpArbiterBackend * self)
   /* TODO: load settings from schema source */
   self->settings = chamge_common_gsettings_new (AMQP_ARBITER_BACKEND_SCHEMA_ID);
 
+  self->rpc_uri = g_settings_get_string (self->settings, "amqp-uri");
+  self->rpc_channel = g_settings_get_int (self->settings, "amqp-channel");
+  self->rpc_exchange =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
   self->amqp_conn = amqp_new_connection ();
   self->amqp_socket = amqp_tcp_socket_new (self->amqp_conn);
 
   g_assert_nonnull (self->amqp_socket);
+
+  self->context = g_main_context_ref_thread_default ();
+
+  g_mutex_init (&self->lock);
 }
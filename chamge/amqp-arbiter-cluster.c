@@ -0,0 +1,512 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "amqp-arbiter-cluster.h"
+#include "amqp-message.h"
+#include "amqp-source.h"
+#include "messages-generated.h"
+
+#include <unistd.h>
+#include <string.h>
+
+#define CONTENT_TYPE "application/json"
+
+/* keeps a touch well below the frame size of the broker */
+#define TOUCH_MAX_LENGTH 65536
+
+struct _ChamgeArbiterCluster
+{
+  ChamgeRegistry *registry;
+
+  ChamgeArbiterClusterSendFunc send_func;
+  gpointer send_data;
+
+  /* NULL unless the cluster is consumed through the broker */
+  amqp_connection_state_t conn;
+  gint channel;
+
+  gchar *exchange;
+  gchar *queue;
+  gchar *consumer_tag;
+
+  /* tells our own changes apart, as the exchange sends them back to us */
+  gchar *origin;
+
+  /* "origin\nid" -> the version of the last change of the device applied
+   * from the origin, kept after a remove as well; used by receive only */
+  GHashTable *applied;
+
+  /* ids seen since the last touch, joined by commas */
+  GString *touched;
+  GSource *touch_source;
+
+  /* changes are shared from any thread but published from the main one */
+  GMutex lock;
+  GQueue outbox;
+};
+
+typedef struct
+{
+  gchar *exchange;
+  gchar *routing_key;
+  gchar *body;
+} Pending;
+
+static void
+_pending_free (gpointer user_data)
+{
+  Pending *pending = user_data;
+
+  g_free (pending->exchange);
+  g_free (pending->routing_key);
+  g_free (pending->body);
+  g_free (pending);
+}
+
+static const gchar *
+_type_to_string (ChamgeDeviceType type)
+{
+  return type == CHAMGE_DEVICE_TYPE_HUB ? "hub" : "edge";
+}
+
+static const gchar *
+_state_to_string (ChamgeDeviceState state)
+{
+  return state == CHAMGE_DEVICE_STATE_ACTIVATED ? "activated" : "enrolled";
+}
+
+static gchar *
+_bytes_dup (amqp_bytes_t bytes)
+{
+  return g_strndup (bytes.bytes, bytes.len);
+}
+
+static void
+_publish (ChamgeArbiterCluster * self, const gchar * exchange,
+    const gchar * routing_key, ChamgeMsgStateUpdate * update)
+{
+  Pending *pending = g_new0 (Pending, 1);
+
+  update->origin = self->origin;
+
+  pending->exchange = g_strdup (exchange);
+  pending->routing_key = g_strdup (routing_key);
+  pending->body = chamge_msg_state_update_to_json (update);
+
+  g_mutex_lock (&self->lock);
+  g_queue_push_tail (&self->outbox, pending);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+_put_device (ChamgeArbiterCluster * self, const gchar * exchange,
+    const gchar * routing_key, const gchar * id)
+{
+  g_autofree gchar *hub_id = NULL;
+  ChamgeMsgStateUpdate update = { 0 };
+  ChamgeDeviceType type;
+  ChamgeDeviceState state;
+  guint32 generation;
+
+  /* read before the lookup, so that the state shared is never older than its
+   * version; a change meanwhile is shared again with a later version */
+  update.version = chamge_registry_get_version (self->registry);
+  update.device_id = id;
+
+  if (chamge_registry_lookup (self->registry, id, &type, &state, NULL,
+          &hub_id)) {
+    update.op = "put";
+    update.device_type = _type_to_string (type);
+    update.state = _state_to_string (state);
+    update.hub_id = hub_id;
+
+    /* the sessions of the device are checked against it by every peer */
+    if (chamge_registry_get_generation (self->registry, id, &generation))
+      update.generation = generation;
+  } else {
+    update.op = "remove";
+  }
+
+  _publish (self, exchange, routing_key, &update);
+}
+
+static void
+_publish_touched (ChamgeArbiterCluster * self, const gchar * ids)
+{
+  ChamgeMsgStateUpdate update = { 0 };
+
+  update.op = "touch";
+  update.ids = ids;
+  _publish (self, self->exchange, "", &update);
+}
+
+static gboolean
+_touch_timeout (gpointer user_data)
+{
+  ChamgeArbiterCluster *self = user_data;
+  g_autofree gchar *ids = NULL;
+
+  g_mutex_lock (&self->lock);
+  if (self->touched->len > 0) {
+    ids = g_strdup (self->touched->str);
+    g_string_truncate (self->touched, 0);
+  }
+  g_mutex_unlock (&self->lock);
+
+  if (ids != NULL)
+    _publish_touched (self, ids);
+
+  chamge_arbiter_cluster_flush (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+_amqp_send (const gchar * exchange, const gchar * routing_key,
+    const gchar * body, gpointer user_data)
+{
+  ChamgeArbiterCluster *self = user_data;
+  amqp_basic_properties_t props = { 0 };
+
+  props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG;
+  props.content_type = amqp_cstring_bytes (CONTENT_TYPE);
+
+  if (amqp_basic_publish (self->conn, self->channel,
+          amqp_cstring_bytes (exchange), amqp_cstring_bytes (routing_key), 0,
+          0, &props, amqp_cstring_bytes (body)) != AMQP_STATUS_OK)
+    g_debug ("failed to share %s", body);
+}
+
+ChamgeArbiterCluster *
+chamge_arbiter_cluster_new_full (ChamgeRegistry * registry,
+    const gchar * exchange, const gchar * queue, guint touch_interval,
+    GMainContext * context, ChamgeArbiterClusterSendFunc func,
+    gpointer user_data)
+{
+  ChamgeArbiterCluster *self;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (registry), NULL);
+  g_return_val_if_fail (exchange != NULL && *exchange != '\0', NULL);
+  g_return_val_if_fail (queue != NULL, NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  self = g_new0 (ChamgeArbiterCluster, 1);
+  self->registry = g_object_ref (registry);
+  self->send_func = func;
+  self->send_data = user_data;
+  self->exchange = g_strdup (exchange);
+  self->queue = g_strdup (queue);
+  self->origin = g_strdup_printf ("%s-%d-%08x", g_get_host_name (),
+      (gint) getpid (), g_random_int ());
+  self->applied = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  self->touched = g_string_new (NULL);
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->outbox);
+
+  if (touch_interval > 0)
+    self->touch_source = chamge_timeout_add_seconds (context, touch_interval,
+        _touch_timeout, self);
+
+  return self;
+}
+
+ChamgeArbiterCluster *
+chamge_arbiter_cluster_new (ChamgeRegistry * registry,
+    amqp_connection_state_t conn, gint channel, const gchar * exchange,
+    guint touch_interval, GMainContext * context, GError ** error)
+{
+  ChamgeArbiterCluster *self;
+  g_autofree gchar *queue = NULL;
+  amqp_queue_declare_ok_t *declare_r;
+  amqp_basic_consume_ok_t *consume_r;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (registry), NULL);
+  g_return_val_if_fail (conn != NULL, NULL);
+  g_return_val_if_fail (exchange != NULL && *exchange != '\0', NULL);
+
+  if (amqp_exchange_declare (conn, channel, amqp_cstring_bytes (exchange),
+          amqp_cstring_bytes ("fanout"), 0, 0, 0, 0, amqp_empty_table) == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "failed to declare the state exchange %s", exchange);
+    return NULL;
+  }
+
+  /* a private queue, gone with the connection */
+  declare_r = amqp_queue_declare (conn, channel, amqp_empty_bytes, 0, 0, 1, 1,
+      amqp_empty_table);
+  if (declare_r == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "failed to declare the state queue");
+    return NULL;
+  }
+
+  queue = _bytes_dup (declare_r->queue);
+  self = chamge_arbiter_cluster_new_full (registry, exchange, queue,
+      touch_interval, context, _amqp_send, NULL);
+  self->send_data = self;
+  self->conn = conn;
+  self->channel = channel;
+
+  if (amqp_queue_bind (conn, channel, declare_r->queue,
+          amqp_cstring_bytes (exchange), amqp_empty_bytes,
+          amqp_empty_table) == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "failed to bind the state queue to %s", exchange);
+    goto error;
+  }
+
+  /* the changes are idempotent and need no ack; a put lost to a crash is
+   * made good by the next change or touch of the device, but a lost remove
+   * leaves the device at the peer until it expires there */
+  consume_r = amqp_basic_consume (conn, channel, declare_r->queue,
+      amqp_empty_bytes, 1, 1, 1, amqp_empty_table);
+  if (consume_r == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "failed to consume the state queue");
+    goto error;
+  }
+  self->consumer_tag = _bytes_dup (consume_r->consumer_tag);
+
+  g_debug ("sharing the registry through %s as %s", exchange, self->origin);
+
+  return self;
+
+error:
+  chamge_arbiter_cluster_free (self);
+  return NULL;
+}
+
+void
+chamge_arbiter_cluster_free (ChamgeArbiterCluster * self)
+{
+  chamge_clear_source (&self->touch_source);
+
+  g_queue_foreach (&self->outbox, (GFunc) _pending_free, NULL);
+  g_queue_clear (&self->outbox);
+  g_mutex_clear (&self->lock);
+  g_string_free (self->touched, TRUE);
+  g_hash_table_unref (self->applied);
+  g_object_unref (self->registry);
+  g_free (self->exchange);
+  g_free (self->queue);
+  g_free (self->consumer_tag);
+  g_free (self->origin);
+  g_free (self);
+}
+
+gboolean
+chamge_arbiter_cluster_owns (ChamgeArbiterCluster * self,
+    const amqp_envelope_t * envelope)
+{
+  return self->consumer_tag != NULL
+      && strlen (self->consumer_tag) == envelope->consumer_tag.len
+      && !memcmp (self->consumer_tag, envelope->consumer_tag.bytes,
+      envelope->consumer_tag.len);
+}
+
+/* a fanout keeps the changes of an origin in order, but a sync reply comes
+ * through another route and the changes of an origin may be queued by
+ * several threads, so that they are applied by the version of the origin; the
+ * versions of the peers are unrelated, and only compared with their own */
+static gboolean
+_is_newer (ChamgeArbiterCluster * self, ChamgeMsgStateUpdate * update)
+{
+  g_autofree gchar *key = NULL;
+  guint64 *applied;
+
+  if (update->version <= 0)
+    return TRUE;
+
+  key = g_strconcat (update->origin, "\n", update->device_id, NULL);
+  applied = g_hash_table_lookup (self->applied, key);
+  if (applied != NULL && (guint64) update->version <= *applied) {
+    g_debug ("dropping %s of %s from %s, older than version %"
+        G_GUINT64_FORMAT, update->op, update->device_id, update->origin,
+        *applied);
+    return FALSE;
+  }
+
+  if (applied == NULL) {
+    applied = g_new (guint64, 1);
+    g_hash_table_insert (self->applied, g_steal_pointer (&key), applied);
+  }
+  *applied = update->version;
+
+  return TRUE;
+}
+
+static void
+_apply_put (ChamgeArbiterCluster * self, ChamgeMsgStateUpdate * update)
+{
+  ChamgeDeviceType type;
+
+  if (!g_strcmp0 (update->device_type, "edge"))
+    type = CHAMGE_DEVICE_TYPE_EDGE;
+  else if (!g_strcmp0 (update->device_type, "hub"))
+    type = CHAMGE_DEVICE_TYPE_HUB;
+  else
+    return;
+
+  chamge_registry_add (self->registry, update->device_id, type);
+  chamge_registry_set_state (self->registry, update->device_id,
+      !g_strcmp0 (update->state, "activated") ?
+      CHAMGE_DEVICE_STATE_ACTIVATED : CHAMGE_DEVICE_STATE_ENROLLED);
+  chamge_registry_set_hub (self->registry, update->device_id, update->hub_id);
+  if (update->generation > 0 && update->generation <= G_MAXUINT32)
+    chamge_registry_set_generation (self->registry, update->device_id,
+        update->generation);
+}
+
+static void
+_reply_sync (ChamgeArbiterCluster * self, const gchar * reply_to)
+{
+  ChamgeDeviceType types[] = { CHAMGE_DEVICE_TYPE_HUB,
+    CHAMGE_DEVICE_TYPE_EDGE
+  };
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (types); i++) {
+    g_auto (GStrv) ids = chamge_registry_list_by_type (self->registry,
+        types[i]);
+
+    for (j = 0; ids[j] != NULL; j++)
+      _put_device (self, "", reply_to, ids[j]);
+  }
+}
+
+void
+chamge_arbiter_cluster_receive (ChamgeArbiterCluster * self,
+    const gchar * body)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgStateUpdate update;
+
+  if (!chamge_msg_state_update_parse_json (&update, parser, body, -1, &error)) {
+    g_debug ("failed to parse a state update: %s", error->message);
+    return;
+  }
+
+  if (update.origin == NULL || !g_strcmp0 (update.origin, self->origin))
+    return;
+
+  if (!g_strcmp0 (update.op, "touch") && update.ids != NULL) {
+    g_auto (GStrv) ids = g_strsplit (update.ids, ",", -1);
+    guint i;
+
+    for (i = 0; ids[i] != NULL; i++)
+      chamge_registry_touch (self->registry, ids[i]);
+  } else if (!g_strcmp0 (update.op, "sync") && update.reply_to != NULL) {
+    _reply_sync (self, update.reply_to);
+    chamge_arbiter_cluster_flush (self);
+  } else if (update.device_id == NULL) {
+    g_debug ("dropping %s from %s without a device id", update.op,
+        update.origin);
+  } else if (!g_strcmp0 (update.op, "put")) {
+    if (_is_newer (self, &update))
+      _apply_put (self, &update);
+  } else if (!g_strcmp0 (update.op, "remove")) {
+    if (_is_newer (self, &update))
+      chamge_registry_remove (self->registry, update.device_id);
+  } else if (!g_strcmp0 (update.op, "load")) {
+    chamge_registry_set_hub_load (self->registry, update.device_id,
+        CLAMP (update.capacity, 0, G_MAXUINT), CLAMP (update.load, 0,
+            G_MAXUINT), update.uri);
+  }
+}
+
+void
+chamge_arbiter_cluster_sync (ChamgeArbiterCluster * self)
+{
+  ChamgeMsgStateUpdate update = { 0 };
+
+  update.op = "sync";
+  update.reply_to = self->queue;
+  _publish (self, self->exchange, "", &update);
+
+  chamge_arbiter_cluster_flush (self);
+}
+
+void
+chamge_arbiter_cluster_flush (ChamgeArbiterCluster * self)
+{
+  GQueue outbox = G_QUEUE_INIT;
+  Pending *pending;
+
+  g_mutex_lock (&self->lock);
+  outbox = self->outbox;
+  g_queue_init (&self->outbox);
+  g_mutex_unlock (&self->lock);
+
+  while ((pending = g_queue_pop_head (&outbox)) != NULL) {
+    self->send_func (pending->exchange, pending->routing_key, pending->body,
+        self->send_data);
+    _pending_free (pending);
+  }
+}
+
+void
+chamge_arbiter_cluster_share_device (ChamgeArbiterCluster * self,
+    const gchar * id)
+{
+  _put_device (self, self->exchange, "", id);
+}
+
+void
+chamge_arbiter_cluster_share_load (ChamgeArbiterCluster * self,
+    const gchar * hub_id, guint capacity, guint load, const gchar * uri)
+{
+  ChamgeMsgStateUpdate update = { 0 };
+
+  update.op = "load";
+  update.device_id = hub_id;
+  update.capacity = capacity;
+  update.load = load;
+  update.uri = uri;
+  _publish (self, self->exchange, "", &update);
+}
+
+void
+chamge_arbiter_cluster_touch (ChamgeArbiterCluster * self, const gchar * id)
+{
+  g_autofree gchar *ids = NULL;
+
+  if (self->touch_source == NULL)
+    return;
+
+  g_mutex_lock (&self->lock);
+  if (self->touched->len > 0)
+    g_string_append_c (self->touched, ',');
+  g_string_append (self->touched, id);
+
+  if (self->touched->len >= TOUCH_MAX_LENGTH) {
+    ids = g_strdup (self->touched->str);
+    g_string_truncate (self->touched, 0);
+  }
+  g_mutex_unlock (&self->lock);
+
+  if (ids != NULL)
+    _publish_touched (self, ids);
+}
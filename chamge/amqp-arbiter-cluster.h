@@ -0,0 +1,99 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_AMQP_ARBITER_CLUSTER_H__
+#define __CHAMGE_AMQP_ARBITER_CLUSTER_H__
+
+#include <chamge/registry.h>
+
+#include <amqp.h>
+
+G_BEGIN_DECLS
+
+/* keeps the registries of the arbiters consuming the same enroll queue in
+ * step, by exchanging their changes through a fanout exchange */
+typedef struct _ChamgeArbiterCluster ChamgeArbiterCluster;
+
+/* sends @body to @routing_key through @exchange, or directly to the queue
+ * @routing_key if @exchange is empty */
+typedef void (*ChamgeArbiterClusterSendFunc) (const gchar              *exchange,
+                                              const gchar              *routing_key,
+                                              const gchar              *body,
+                                              gpointer                  user_data);
+
+/* declares @exchange and a private queue bound to it, consumed on @channel;
+ * the devices seen are shared every @touch_interval seconds, or never if 0,
+ * from @context, or from the global default context if it is %NULL */
+ChamgeArbiterCluster   *chamge_arbiter_cluster_new      (ChamgeRegistry         *registry,
+                                                         amqp_connection_state_t conn,
+                                                         gint                    channel,
+                                                         const gchar            *exchange,
+                                                         guint                   touch_interval,
+                                                         GMainContext           *context,
+                                                         GError                **error);
+
+/* leaves the transport to @func, which is called by
+ * chamge_arbiter_cluster_flush (); the peers are expected to send the devices
+ * they are asked for to @queue */
+ChamgeArbiterCluster   *chamge_arbiter_cluster_new_full (ChamgeRegistry         *registry,
+                                                         const gchar            *exchange,
+                                                         const gchar            *queue,
+                                                         guint                   touch_interval,
+                                                         GMainContext           *context,
+                                                         ChamgeArbiterClusterSendFunc
+                                                                                 func,
+                                                         gpointer                user_data);
+
+void                    chamge_arbiter_cluster_free     (ChamgeArbiterCluster   *self);
+
+/* whether @envelope was delivered to the queue of the cluster */
+gboolean                chamge_arbiter_cluster_owns     (ChamgeArbiterCluster   *self,
+                                                         const amqp_envelope_t  *envelope);
+
+/* applies a change received from a peer, unless a later change of the same
+ * device from the same peer has been applied already */
+void                    chamge_arbiter_cluster_receive  (ChamgeArbiterCluster   *self,
+                                                         const gchar            *body);
+
+/* publishes the changes queued since the last flush; the other functions
+ * may be called from any thread, but this one only from the thread owning
+ * the connection */
+void                    chamge_arbiter_cluster_flush    (ChamgeArbiterCluster   *self);
+
+/* asks the peers for their devices */
+void                    chamge_arbiter_cluster_sync     (ChamgeArbiterCluster   *self);
+
+/* shares the state of @id, or its removal if @id is no longer registered */
+void                    chamge_arbiter_cluster_share_device
+                                                        (ChamgeArbiterCluster   *self,
+                                                         const gchar            *id);
+
+void                    chamge_arbiter_cluster_share_load
+                                                        (ChamgeArbiterCluster   *self,
+                                                         const gchar            *hub_id,
+                                                         guint                   capacity,
+                                                         guint                   load,
+                                                         const gchar            *uri);
+
+/* queues @id to be shared as seen with the next touch */
+void                    chamge_arbiter_cluster_touch    (ChamgeArbiterCluster   *self,
+                                                         const gchar            *id);
+
+G_END_DECLS
+
+#endif // __CHAMGE_AMQP_ARBITER_CLUSTER_H__
@@ -20,11 +20,18 @@
 #include "config.h"
 
 #include "amqp-edge-backend.h"
+#include "amqp-message.h"
+#include "amqp-rpc.h"
+#include "reply-cache.h"
+#include "messages-generated.h"
 #include "amqp-source.h"
+#include "batch.h"
+#include "latency-probe.h"
 #include "common.h"
 #include "glib-compat.h"
 
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <amqp.h>
 #include <amqp_tcp_socket.h>
 #include <json-glib/json-glib.h>
@@ -39,11 +46,44 @@ struct _ChamgeAmqpEdgeBackend
   ChamgeEdgeBackend parent;
   GSettings *settings;
 
+  /* consumes the command queue, in @context only */
   amqp_connection_state_t amqp_conn;
   amqp_socket_t *amqp_socket;
+  gboolean logged_in;
+
+  /* replies to the latest requests, by correlation id */
+  ChamgeReplyCache *replies;
 
   gboolean activated;
-  guint process_id;
+  gboolean subscribed;
+  GSource *process_source;
+
+  gchar *edge_id;
+  GSource *heartbeat_source;
+
+  ChamgeLatencyProbe *latency_probe;
+  GSource *probe_source;
+
+  /* the context the edge is made in, where its sources are attached */
+  GMainContext *context;
+
+  /* the relay uri assigned by the arbiter, so that a stream starts without
+   * a round trip to it; the lock also guards @edge_id */
+  GMutex target_lock;
+  gchar *target_uri;
+  gchar *target_hub_id;
+  gint64 target_expiry;
+  GSource *target_refresh_source;
+  gboolean target_fetching;
+
+  /* a connection of its own for the requests whose replies are waited for,
+   * so that the consumer of the command queue loses nothing to them */
+  ChamgeAmqpRpc *rpc;
+
+  /* issued by the arbiter at activation, and kept in a file, so that an edge
+   * which reconnects resumes in the activated state */
+  gchar *session_token;
+  gchar *session_epoch;
 };
 
 /* *INDENT-OFF* */
@@ -227,158 +267,6 @@ _is_queue_existed (const amqp_connection_state_t conn, guint channel,
   return CHAMGE_RETURN_OK;
 }
 
-static ChamgeReturn
-_amqp_rpc_request (amqp_connection_state_t amqp_conn, guint channel,
-    const gchar * request, const gchar * exchange, const gchar * queue_name,
-    gchar ** response_body, GError ** error)
-{
-  amqp_bytes_t amqp_reply_queue = { 0 };
-  amqp_basic_properties_t amqp_props = { 0 };
-  g_autofree gchar *correlation_id = NULL;
-  guint retry_count = 0;
-  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
-
-  g_return_val_if_fail (amqp_conn != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (channel != 0, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (queue_name != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (request != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (response_body != NULL, CHAMGE_RETURN_FAIL);
-
-  /* check where queue_name queue exist */
-  if (_is_queue_existed (amqp_conn, channel, queue_name,
-          error) != CHAMGE_RETURN_OK) {
-    goto out;
-  }
-
-  /* create private replay_to_queue and queue name is random that is supplied from amqp server */
-  if (_amqp_declare_queue (amqp_conn, channel, NULL,
-          &amqp_reply_queue, error) != CHAMGE_RETURN_OK)
-    return ret;
-
-  g_debug ("declare a queue for reply : %s", (gchar *) amqp_reply_queue.bytes);
-
-  /* property setting to send rpc request */
-  amqp_props._flags =
-      AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
-
-  amqp_props.content_type = amqp_cstring_bytes (DEFAULT_CONTENT_TYPE);
-  amqp_props.delivery_mode = 2; /* persistent delivery mode */
-
-  amqp_props._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-  amqp_props.reply_to = amqp_reply_queue;
-
-  amqp_props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-  correlation_id = g_uuid_string_random ();
-  correlation_id =
-      g_compute_checksum_for_string (G_CHECKSUM_SHA256, correlation_id,
-      strlen (correlation_id));
-  amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
-
-  /* send requst to queue_name */
-  {
-    gint r = amqp_basic_publish (amqp_conn, channel,
-        exchange ==
-        NULL ? amqp_cstring_bytes ("") : amqp_cstring_bytes (exchange),
-        amqp_cstring_bytes (queue_name), 0, 0, &amqp_props,
-        amqp_cstring_bytes (request));
-    if (r < 0) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "publish failure >> %s",
-          amqp_error_string2 (r));
-      goto out;
-    }
-    g_debug ("published to queue[%s], exchange[%s], request[%s]", queue_name,
-        exchange, request);
-  }
-
-  if (amqp_basic_consume (amqp_conn, channel, amqp_reply_queue,
-          amqp_empty_bytes, 0, 1, 0, amqp_empty_table) == NULL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "basic consume failure >> %s",
-        _amqp_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-
-  /* wait an answer */
-  do {
-    amqp_rpc_reply_t amqp_r;
-    amqp_envelope_t envelope;
-    struct timeval timeout = { 10, 0 };
-
-    if (retry_count > 10) {
-      g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
-          "no response to the request in 10 messages");
-      break;
-    }
-    amqp_maybe_release_buffers (amqp_conn);
-
-    g_debug ("Wait for response message from [%s]",
-        (gchar *) amqp_reply_queue.bytes);
-    amqp_r = amqp_consume_message (amqp_conn, &envelope, &timeout, 0);
-    retry_count++;
-
-    if (amqp_r.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
-        && amqp_r.library_error == AMQP_STATUS_TIMEOUT) {
-      g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg timeout");
-      break;
-    }
-
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg failure >> %s",
-          _amqp_rpc_reply_string (amqp_r));
-      break;
-    }
-
-    g_debug ("Delivery %u, exchange %.*s routingkey %.*s",
-        (unsigned) envelope.delivery_tag, (int) envelope.exchange.len,
-        (char *) envelope.exchange.bytes, (int) envelope.routing_key.len,
-        (char *) envelope.routing_key.bytes);
-
-    if ((envelope.message.properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) ==
-        0) {
-      g_debug ("discard >> correaltion id is not exist");
-      continue;
-    }
-
-    if (strncmp (correlation_id,
-            envelope.message.properties.correlation_id.bytes,
-            envelope.message.properties.correlation_id.len) != 0) {
-      g_debug ("discard >> correaltion id is not matched [%s] [%.*s]",
-          correlation_id, (gint) envelope.message.properties.correlation_id.len,
-          (gchar *) envelope.message.properties.correlation_id.bytes);
-      continue;
-    }
-
-    g_debug ("Correlation ID : %.*s",
-        (gint) envelope.message.properties.correlation_id.len,
-        (gchar *) envelope.message.properties.correlation_id.bytes);
-    if (envelope.message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG) {
-      g_debug ("Content-type: %.*s",
-          (int) envelope.message.properties.content_type.len,
-          (char *) envelope.message.properties.content_type.bytes);
-    }
-
-    if (*response_body != NULL) {
-      g_free (*response_body);
-      *response_body = NULL;
-    }
-    *response_body =
-        g_strndup (envelope.message.body.bytes, envelope.message.body.len);
-
-    amqp_destroy_envelope (&envelope);
-    break;
-  } while (1);
-  ret = CHAMGE_RETURN_OK;
-
-out:
-  amqp_bytes_free (amqp_reply_queue);
-  return ret;
-}
-
 static ChamgeReturn
 _amqp_rpc_subscribe (amqp_connection_state_t amqp_conn, guint channel,
     const gchar * exchange_name, const gchar * queue_name, GError ** error)
@@ -428,47 +316,211 @@ out:
   return ret;
 }
 
+/* the vfuncs of the node may be called from any thread, so that the replies
+ * are waited for on the rpc connection only */
+static gchar *
+_request_device (ChamgeAmqpEdgeBackend * self,
+    ChamgeMsgDeviceRequest * request, ChamgeAmqpStatus * status,
+    GError ** error)
+{
+  g_autofree gchar *amqp_enroll_q_name = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *request_body = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  request->device_type = "edge";
+  request_body = chamge_msg_device_request_to_json (request);
+  chamge_msg_device_request_encode_headers (request, &amqp_headers);
+
+  return chamge_amqp_rpc_call (self->rpc, amqp_exchange_name,
+      amqp_enroll_q_name, request_body, &amqp_headers, status, error);
+}
+
 static ChamgeReturn
-_validate_response (const gchar * response, const gchar * shouldbe)
+_validate_response (ChamgeAmqpStatus status, const gchar * response,
+    const gchar * shouldbe)
 {
-  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (JsonParser) parser = NULL;
   g_autoptr (GError) error = NULL;
-  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+  ChamgeMsgResult result;
+
+  if (status != CHAMGE_AMQP_STATUS_NONE)
+    return status == CHAMGE_AMQP_STATUS_OK ?
+        CHAMGE_RETURN_OK : CHAMGE_RETURN_FAIL;
+
+  /* an arbiter which does not send the status header */
+  if (response == NULL) {
+    g_debug ("failed to parse body: (null response)");
+    return CHAMGE_RETURN_FAIL;
+  }
 
-  JsonNode *root = NULL;
-  JsonObject *json_object = NULL;
+  parser = json_parser_new ();
+  if (!chamge_msg_result_parse_json (&result, parser, response, -1, &error)) {
+    g_debug ("failed to parse body: %s", error->message);
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  return g_strcmp0 (result.result, shouldbe) ?
+      CHAMGE_RETURN_FAIL : CHAMGE_RETURN_OK;
+}
+
+/* the arbiter sheds enrolls during a storm and tells when to come back, and
+ * over how long a window the devices it knows should spread their enrolls */
+static gboolean
+_is_throttled (ChamgeNode * node, ChamgeAmqpStatus status,
+    const gchar * response, guint * retry_after_ms)
+{
+  g_autoptr (JsonParser) parser = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgThrottled throttled;
+  guint window_ms = 0;
+
+  if (status != CHAMGE_AMQP_STATUS_TOO_MANY_REQUESTS || response == NULL)
+    return FALSE;
 
-  if (response == NULL
-      || !json_parser_load_from_data (parser, response, strlen (response),
+  parser = json_parser_new ();
+  if (!chamge_msg_throttled_parse_json (&throttled, parser, response, -1,
           &error)) {
-    g_debug ("failed to parse body: %s",
-        error == NULL ? "(null response)" : error->message);
-    return ret;
-  }
-
-  root = json_parser_get_root (parser);
-  json_object = json_node_get_object (root);
-  if (json_object_has_member (json_object, "result")) {
-    JsonNode *node = json_object_get_member (json_object, "result");
-    const gchar *result = json_node_get_string (node);
-    if (!g_strcmp0 (result, shouldbe)) {
-      ret = CHAMGE_RETURN_OK;
-    }
+    g_debug ("failed to parse body: %s", error->message);
+    return FALSE;
   }
 
-  return ret;
+  g_object_get (node, "enroll-window", &window_ms, NULL);
+  if (throttled.window_ms > window_ms)
+    g_object_set (node, "enroll-window",
+        (guint) MIN (throttled.window_ms, G_MAXUINT), NULL);
+
+  *retry_after_ms = MAX (throttled.retry_after_ms, 0);
+  return TRUE;
+}
+
+static gchar *
+_get_session_path (ChamgeAmqpEdgeBackend * self, const gchar * edge_id)
+{
+  g_autofree gchar *path = g_settings_get_string (self->settings,
+      "session-path");
+  g_autofree gchar *basename = NULL;
+
+  if (path[0] != '\0')
+    return g_steal_pointer (&path);
+
+  basename = g_strconcat (edge_id, ".session", NULL);
+  return g_build_filename (g_get_user_cache_dir (), "chamge", basename, NULL);
+}
+
+static void
+_load_session (ChamgeAmqpEdgeBackend * self, const gchar * edge_id)
+{
+  g_autoptr (GKeyFile) keyfile = g_key_file_new ();
+  g_autofree gchar *path = NULL;
+
+  if (self->session_token != NULL)
+    return;
+
+  path = _get_session_path (self, edge_id);
+  if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL))
+    return;
+
+  self->session_token = g_key_file_get_string (keyfile, "session", "token",
+      NULL);
+  self->session_epoch = g_key_file_get_string (keyfile, "session", "epoch",
+      NULL);
+}
+
+/* keeps the session the arbiter has issued along with an activation */
+static void
+_save_session (ChamgeAmqpEdgeBackend * self, const gchar * edge_id,
+    const gchar * response)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GKeyFile) keyfile = g_key_file_new ();
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *dirname = NULL;
+  g_autofree gchar *data = NULL;
+  gsize length;
+  ChamgeMsgSession session;
+
+  /* an arbiter which issues no session */
+  if (!chamge_msg_session_parse_json (&session, parser, response, -1, NULL)
+      || session.token == NULL || session.epoch == NULL)
+    return;
+
+  g_free (self->session_token);
+  self->session_token = g_strdup (session.token);
+  g_free (self->session_epoch);
+  self->session_epoch = g_strdup (session.epoch);
+
+  path = _get_session_path (self, edge_id);
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+
+  g_key_file_set_string (keyfile, "session", "token", self->session_token);
+  g_key_file_set_string (keyfile, "session", "epoch", self->session_epoch);
+
+  /* the token lets anyone resume the session of the edge */
+  data = g_key_file_to_data (keyfile, &length, NULL);
+  if (!g_file_set_contents_full (path, data, length,
+          G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error))
+    g_debug ("failed to keep the session: %s", error->message);
+}
+
+static void
+_forget_session (ChamgeAmqpEdgeBackend * self, const gchar * edge_id)
+{
+  g_autofree gchar *path = _get_session_path (self, edge_id);
+
+  g_clear_pointer (&self->session_token, g_free);
+  g_clear_pointer (&self->session_epoch, g_free);
+
+  g_unlink (path);
+}
+
+/* a single check by the arbiter instead of an enroll and an activation, which
+ * fails once the arbiter has lost the devices it knew; the session is kept
+ * unless the arbiter rejects it */
+static ChamgeReturn
+_resume_session (ChamgeAmqpEdgeBackend * self, const gchar * edge_id)
+{
+  g_autofree gchar *response_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+  g_autoptr (GError) error = NULL;
+
+  request.method = "resume";
+  request.edge_id = edge_id;
+  request.session_token = self->session_token;
+  request.epoch = self->session_epoch;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc request ERROR : %s", error->message);
+    return CHAMGE_RETURN_FAIL;
+  }
+  g_debug ("received response to resume : %s", response_body);
+  if (_validate_response (status, response_body, "activated") != CHAMGE_RETURN_OK) {
+    g_debug ("the session is not resumed, enrolling again");
+    _forget_session (self, edge_id);
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  _save_session (self, edge_id, response_body);
+
+  return CHAMGE_RETURN_OK;
 }
 
 static ChamgeReturn
 chamge_amqp_edge_backend_enroll (ChamgeEdgeBackend * edge_backend)
 {
-  g_autofree gchar *amqp_uri = NULL;
-  g_autofree gchar *amqp_enroll_q_name = NULL;
-  g_autofree gchar *amqp_exchange_name = NULL;
   g_autofree gchar *response_body = NULL;
-  g_autofree gchar *request_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
   g_autoptr (GError) error = NULL;
-  gint amqp_channel = 1;
+  guint retry_after_ms = 0;
 
   g_autofree gchar *edge_id = NULL;
   ChamgeEdge *edge = NULL;
@@ -488,42 +540,22 @@ chamge_amqp_edge_backend_enroll (ChamgeEdgeBackend * edge_backend)
     goto out;
   }
 
-  /* get configuration from gsetting */
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
-  g_assert_nonnull (amqp_uri);
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
-  g_debug
-      ("[config] channel : %d, enroll-queue-name : %s, enroll-exchange-name : %s",
-      amqp_channel, amqp_enroll_q_name, amqp_exchange_name);
-
-  if (_amqp_rpc_login (self->amqp_conn, self->amqp_socket,
-          amqp_uri, amqp_channel, &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("amqp_login ERROR : %s", error->message);
+  request.method = "enroll";
+  request.edge_id = edge_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc request ERROR : %s", error->message);
     goto out;
   }
-
-  /* TODO
-   * request-body need to be filled with real request data
-   */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"enroll\",\"deviceType\":\"edge\",\"edgeId\":\"%s\"}",
-      edge_id);
-  if (_amqp_rpc_request (self->amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc request ERROR : %s", error->message);
+  g_debug ("received response to enroll : %s", response_body);
+  if (_is_throttled (CHAMGE_NODE (edge), status, response_body,
+          &retry_after_ms)) {
+    g_debug ("enroll is throttled, retrying in %u ms", retry_after_ms);
+    chamge_node_enroll_later (CHAMGE_NODE (edge), retry_after_ms);
+    ret = CHAMGE_RETURN_ASYNC;
     goto out;
   }
-  g_debug ("received response to enroll : %s", response_body);
-  if (_validate_response (response_body, "enrolled") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "enrolled") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [enrolled] but [%s]", response_body);
     goto out;
   }
@@ -537,17 +569,9 @@ static ChamgeReturn
 chamge_amqp_edge_backend_delist (ChamgeEdgeBackend * edge_backend)
 {
   ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (edge_backend);
-  g_autofree gchar *amqp_uri = NULL;
-  struct amqp_connection_info connection_info;
-  amqp_rpc_reply_t amqp_r;
-  amqp_connection_state_t amqp_conn;
-  amqp_socket_t *amqp_socket = NULL;
-
-  g_autofree gchar *amqp_enroll_q_name = NULL;
-  g_autofree gchar *amqp_exchange_name = NULL;
-  gint amqp_channel = 0;
-  g_autofree gchar *request_body = NULL;
   g_autofree gchar *response_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
 
   ChamgeEdge *edge = NULL;
   g_autofree gchar *edge_id = NULL;
@@ -565,94 +589,23 @@ chamge_amqp_edge_backend_delist (ChamgeEdgeBackend * edge_backend)
     goto out;
   }
 
-
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
-  g_assert_nonnull (amqp_uri);
-
-  if (amqp_parse_url (amqp_uri, &connection_info) != AMQP_STATUS_OK) {
-    g_debug ("url pasring failure");
-    goto out;
-  }
-
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
-  g_debug ("[config] channel : %d, enroll-exchange-name : %s",
-      amqp_channel, amqp_exchange_name);
-
-  amqp_conn = amqp_new_connection ();
-  amqp_socket = amqp_tcp_socket_new (amqp_conn);
-  g_assert_nonnull (amqp_socket);
-
-  if (amqp_socket_open (amqp_socket,
-          connection_info.host, connection_info.port)) {
-    g_debug ("socket open failure");
-    goto out;
-  }
-
-  /* TODO: The authentication method should be EXTERNAL
-   * if we don't want to share user/passwd
-   */
-  amqp_r = amqp_login (amqp_conn, connection_info.vhost, 0, 131072, 0,
-      AMQP_SASL_METHOD_PLAIN, connection_info.user, connection_info.password);
-  if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-    g_debug ("login failure >> %s", _amqp_rpc_reply_string (amqp_r));
-    goto out;
-  }
-  if (!amqp_channel_open (amqp_conn, amqp_channel)) {
-    g_debug ("channel open failure >> %s",
-        _amqp_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-  g_debug ("success to login %s:%d/%s id[%s] pwd[%s]",
-      connection_info.host, connection_info.port,
-      connection_info.vhost, connection_info.user, connection_info.password);
-
   /* send delist */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"delist\",\"deviceType\":\"edge\",\"edgeId\":\"%s\"}",
-      edge_id);
-  if (_amqp_rpc_request (amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc_request ERROR : %s", error->message);
+  request.method = "delist";
+  request.edge_id = edge_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc_request ERROR : %s", error->message);
     goto out;
   }
 
   g_debug ("received response to delist: %s", response_body);
 
-  if (_validate_response (response_body, "delisted") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "delisted") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [delisted], but [%s]", response_body);
     goto out;
   }
 
-
-  if (amqp_conn != NULL) {
-    gint destroy_ret = 0;
-    amqp_r = amqp_channel_close (amqp_conn, amqp_channel, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_debug ("channel close failure >> %s", _amqp_rpc_reply_string (amqp_r));
-      goto out;
-    }
-    amqp_r = amqp_connection_close (amqp_conn, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_debug ("connection close failure >> %s",
-          _amqp_rpc_reply_string (amqp_r));
-      goto out;
-    }
-    destroy_ret = amqp_destroy_connection (amqp_conn);
-    if (destroy_ret < 0) {
-      g_debug ("connection destroy failure >> %s",
-          amqp_error_string2 (destroy_ret));
-      goto out;
-    }
-  }
+  _forget_session (self, edge_id);
 
   ret = CHAMGE_RETURN_OK;
 
@@ -661,72 +614,359 @@ out:
 }
 
 static gchar *
-_process_json_message (ChamgeAmqpEdgeBackend * self, const gchar * body,
-    gssize len)
+_process_json_message (ChamgeAmqpEdgeBackend * self,
+    const amqp_basic_properties_t * props, const gchar * body, gssize len,
+    ChamgeAmqpStatus * status)
 {
-  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (JsonParser) parser = NULL;
   g_autoptr (GError) error = NULL;
+  g_autofree gchar *method = NULL;
+  g_autofree gchar *command = NULL;
   gchar *response = NULL;
+  ChamgeReturn ret;
 
-  if (!json_parser_load_from_data (parser, body, len, &error)) {
-    g_debug ("failed to parse body: %s", error->message);
-    response = g_strdup ("{\"result\":\"failed to parse body\"}");
-    goto out;
+  /* a request carrying the method header is routed without parsing, the body
+   * is left to the application */
+  method = chamge_amqp_headers_dup_string (props, CHAMGE_AMQP_HEADER_METHOD);
+  if (method == NULL) {
+    ChamgeMsgRoute route;
+
+    parser = json_parser_new ();
+    if (!chamge_msg_route_parse_json (&route, parser, body, len, &error)) {
+      ChamgeMsgResult failure = { "failed to parse body" };
+
+      g_debug ("failed to parse body: %s", error->message);
+      *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+      return chamge_msg_result_to_json (&failure);
+    }
+    method = g_strdup (route.method);
   }
 
-  {
-    ChamgeEdgeBackendClass *backend_class =
-        CHAMGE_EDGE_BACKEND_GET_CLASS (&self->parent);
-    g_autofree gchar *command = g_strndup (body, len);
-    backend_class->user_command (&self->parent, command, &response, &error);
-    if (response == NULL)
-      response = g_strdup ("{\"result\":\"not ok\"}");
+  command = g_strndup (body, len);
+  ret = chamge_edge_backend_dispatch_command (&self->parent, method, command,
+      &response, &error);
+  *status = chamge_amqp_status_from_return (ret, error);
+
+  if (response == NULL) {
+    ChamgeMsgResult not_ok = { error != NULL ? error->message : "not ok" };
+
+    response = chamge_msg_result_to_json (&not_ok);
   }
 
-out:
   return response;
 }
 
-static gboolean
-_process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
-    amqp_envelope_t * envelope, gpointer user_data)
+static void
+_cache_target_uri (ChamgeAmqpEdgeBackend * self, const gchar * uri,
+    const gchar * hub_id)
 {
-  ChamgeAmqpEdgeBackend *self = user_data;
-  g_autofree gchar *reply_queue = NULL;
-  g_autofree gchar *correlation_id = NULL;
-  g_autofree gchar *response = NULL;
-
-  if (!self->activated)
-    return G_SOURCE_REMOVE;
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->target_lock);
+  guint ttl = g_settings_get_uint (self->settings, "target-uri-ttl");
+
+  g_free (self->target_uri);
+  g_free (self->target_hub_id);
+  self->target_uri = ttl > 0 ? g_strdup (uri) : NULL;
+  self->target_hub_id = ttl > 0 ? g_strdup (hub_id) : NULL;
+  self->target_expiry = g_get_monotonic_time () + ttl * G_USEC_PER_SEC;
+}
 
-  if (reply->reply_type != AMQP_RESPONSE_NORMAL) {
-    g_debug ("abnormal response: %x", reply->reply_type);
-    goto out;
-  }
+static gchar *
+_lookup_target_uri (ChamgeAmqpEdgeBackend * self)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->target_lock);
 
-  if (envelope->message.body.bytes == NULL) {
-    g_debug ("no reply queue in request message");
-    goto out;
-  }
+  if (self->target_uri == NULL
+      || g_get_monotonic_time () >= self->target_expiry)
+    return NULL;
 
-  g_debug ("Delivery %u, exchange %.*s routingkey %.*s",
-      (unsigned) envelope->delivery_tag, (int) envelope->exchange.len,
-      (char *) envelope->exchange.bytes, (int) envelope->routing_key.len,
-      (char *) envelope->routing_key.bytes);
+  return g_strdup (self->target_uri);
+}
 
-  /* if the content-type isn't 'application/json', let's drop */
-  if (!(envelope->message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
-      || strlen (DEFAULT_CONTENT_TYPE) !=
-      envelope->message.properties.content_type.len
-      || g_ascii_strncasecmp (DEFAULT_CONTENT_TYPE,
-          envelope->message.properties.content_type.bytes,
-          envelope->message.properties.content_type.len)
-      ) {
-    g_debug ("invalid content type %s",
-        (gchar *) envelope->message.properties.content_type.bytes);
+/* the id is set in the main context, while a stream may start from any
+ * thread */
+static gchar *
+_dup_edge_id (ChamgeAmqpEdgeBackend * self)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->target_lock);
 
-    goto out;
-  }
+  return g_strdup (self->edge_id);
+}
+
+/* @amqp_headers refer to @edge_id */
+static gchar *
+_target_uri_request_new (const gchar * edge_id,
+    ChamgeAmqpHeaders * amqp_headers, GError ** error)
+{
+  ChamgeMsgDeviceRequest request = { 0 };
+
+  if (edge_id == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INACCESSIBLE, "edge is not activated");
+    return NULL;
+  }
+
+  /* the arbiter picks a hub by load and keeps the edge assigned to it */
+  request.method = "requestTargetUri";
+  request.device_type = "edge";
+  request.edge_id = edge_id;
+  chamge_msg_device_request_encode_headers (&request, amqp_headers);
+  return chamge_msg_device_request_to_json (&request);
+}
+
+typedef struct
+{
+  ChamgeAmqpEdgeBackend *self;
+  gchar *candidates;
+} ProbeTargets;
+
+static void
+probe_targets_free (ProbeTargets * targets)
+{
+  g_object_unref (targets->self);
+  g_free (targets->candidates);
+  g_free (targets);
+}
+
+static gboolean
+_set_probe_targets (gpointer user_data)
+{
+  ProbeTargets *targets = user_data;
+  ChamgeAmqpEdgeBackend *self = targets->self;
+
+  /* measure the offered hubs right away, so that the next request can be
+   * placed by latency */
+  if (self->latency_probe != NULL) {
+    chamge_latency_probe_set_targets (self->latency_probe, targets->candidates);
+    chamge_latency_probe_run (self->latency_probe);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gchar *
+_apply_target_uri (ChamgeAmqpEdgeBackend * self, const gchar * response_body,
+    ChamgeAmqpStatus status, GError ** error)
+{
+  g_autoptr (JsonParser) parser = NULL;
+  ChamgeMsgTargetUri reply;
+
+  parser = json_parser_new ();
+  if (!chamge_msg_target_uri_parse_json (&reply, parser, response_body, -1,
+          error))
+    return NULL;
+
+  if ((status != CHAMGE_AMQP_STATUS_NONE && status != CHAMGE_AMQP_STATUS_OK)
+      || reply.uri == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "failed to get a target uri (reason: %s)", reply.result);
+    return NULL;
+  }
+
+  g_debug ("target uri: %s (hub: %s)", reply.uri, reply.hub_id);
+
+  _cache_target_uri (self, reply.uri, reply.hub_id);
+
+  /* the probe is only used in the context the edge was made in, whichever
+   * thread has asked for the uri */
+  if (reply.candidates != NULL) {
+    ProbeTargets *targets = g_new0 (ProbeTargets, 1);
+
+    targets->self = g_object_ref (self);
+    targets->candidates = g_strdup (reply.candidates);
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+        _set_probe_targets, targets, (GDestroyNotify) probe_targets_free);
+  }
+
+  return g_strdup (reply.uri);
+}
+
+static gchar *
+_fetch_target_uri (ChamgeAmqpEdgeBackend * self, GError ** error)
+{
+  g_autofree gchar *amqp_enroll_q_name = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *request_body = NULL;
+  g_autofree gchar *response_body = NULL;
+  g_autofree gchar *edge_id = _dup_edge_id (self);
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+
+  request_body = _target_uri_request_new (edge_id, &amqp_headers, error);
+  if (request_body == NULL)
+    return NULL;
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  response_body = chamge_amqp_rpc_call (self->rpc, amqp_exchange_name,
+      amqp_enroll_q_name, request_body, &amqp_headers, &status, error);
+  if (response_body == NULL)
+    return NULL;
+
+  return _apply_target_uri (self, response_body, status, error);
+}
+
+static void
+_fetch_target_uri_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  g_autoptr (ChamgeAmqpEdgeBackend) self = user_data;
+  g_autofree gchar *response_body = NULL;
+  g_autofree gchar *uri = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+
+  self->target_fetching = FALSE;
+
+  /* a failure keeps the cached uri until it expires */
+  response_body = chamge_amqp_rpc_call_finish (self->rpc, result, &status,
+      &error);
+  if (response_body != NULL)
+    uri = _apply_target_uri (self, response_body, status, &error);
+
+  if (uri == NULL)
+    g_debug ("failed to refresh the target uri: %s",
+        error ? error->message : "unknown");
+}
+
+/* the reply is waited for by the thread of the rpc connection, so that
+ * neither the main loop nor the commands of the edge wait for it */
+static void
+_fetch_target_uri_async (ChamgeAmqpEdgeBackend * self)
+{
+  g_autofree gchar *amqp_enroll_q_name = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *request_body = NULL;
+  g_autofree gchar *edge_id = _dup_edge_id (self);
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+
+  if (self->target_fetching)
+    return;
+
+  request_body = _target_uri_request_new (edge_id, &amqp_headers, NULL);
+  if (request_body == NULL)
+    return;
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  self->target_fetching = TRUE;
+  chamge_amqp_rpc_call_async (self->rpc, amqp_exchange_name,
+      amqp_enroll_q_name, request_body, &amqp_headers, NULL,
+      _fetch_target_uri_done, g_object_ref (self));
+}
+
+static gboolean
+_refresh_target_uri (gpointer user_data)
+{
+  _fetch_target_uri_async (CHAMGE_AMQP_EDGE_BACKEND (user_data));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+_start_target_refresh (ChamgeAmqpEdgeBackend * self)
+{
+  guint ttl = g_settings_get_uint (self->settings, "target-uri-ttl");
+
+  /* refreshed halfway, so that the cached one never runs out while the
+   * arbiter is reachable */
+  if (ttl > 0 && self->target_refresh_source == NULL)
+    self->target_refresh_source = chamge_timeout_add_seconds (self->context,
+        MAX (ttl / 2, 1), _refresh_target_uri, self);
+}
+
+static void
+_stop_target_refresh (ChamgeAmqpEdgeBackend * self)
+{
+  chamge_clear_source (&self->target_refresh_source);
+
+  _cache_target_uri (self, NULL, NULL);
+}
+
+/* the arbiter tells when the hub of the edge is gone or has changed */
+static void
+_process_target_changed (ChamgeAmqpEdgeBackend * self, const gchar * body)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgTargetUri changed;
+
+  if (!chamge_msg_target_uri_parse_json (&changed, parser, body, -1, &error)) {
+    g_debug ("failed to parse body: %s", error->message);
+    return;
+  }
+
+  g_debug ("target is changed: %s (hub: %s)", changed.uri, changed.hub_id);
+
+  /* without a new uri, the next request asks the arbiter again */
+  _cache_target_uri (self, changed.uri, changed.hub_id);
+}
+
+static gboolean
+_process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
+    amqp_envelope_t * envelope, gpointer user_data)
+{
+  ChamgeAmqpEdgeBackend *self = user_data;
+  g_autofree gchar *reply_queue = NULL;
+  g_autofree gchar *correlation_id = NULL;
+  g_autofree gchar *body = NULL;
+  g_autofree gchar *response = NULL;
+  g_autofree gchar *method = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+  gint cached_status;
+
+  if (!self->activated)
+    return G_SOURCE_REMOVE;
+
+  if (reply->reply_type != AMQP_RESPONSE_NORMAL) {
+    g_debug ("abnormal response: %x", reply->reply_type);
+    goto out;
+  }
+
+  if (envelope->message.body.bytes == NULL) {
+    g_debug ("no reply queue in request message");
+    goto out;
+  }
+
+  g_debug ("Delivery %u, exchange %.*s routingkey %.*s",
+      (unsigned) envelope->delivery_tag, (int) envelope->exchange.len,
+      (char *) envelope->exchange.bytes, (int) envelope->routing_key.len,
+      (char *) envelope->routing_key.bytes);
+
+  /* if the content-type isn't 'application/json', let's drop */
+  if (!(envelope->message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
+      || strlen (DEFAULT_CONTENT_TYPE) !=
+      envelope->message.properties.content_type.len
+      || g_ascii_strncasecmp (DEFAULT_CONTENT_TYPE,
+          envelope->message.properties.content_type.bytes,
+          envelope->message.properties.content_type.len)
+      ) {
+    g_debug ("invalid content type %s",
+        (gchar *) envelope->message.properties.content_type.bytes);
+
+    goto out;
+  }
+
+  /* a notification from the arbiter, which expects no reply */
+  method = chamge_amqp_headers_dup_string (&envelope->message.properties,
+      CHAMGE_AMQP_HEADER_METHOD);
+  if (!g_strcmp0 (method, "targetChanged")) {
+    body = chamge_amqp_message_decode_body (&envelope->message, &error);
+    if (body == NULL) {
+      g_debug ("failed to decode body: %s", error->message);
+      goto out;
+    }
+
+    _process_target_changed (self, body);
+    goto out;
+  }
 
   if ((envelope->message.properties._flags & AMQP_BASIC_REPLY_TO_FLAG) &&
       envelope->message.properties.reply_to.len > 0 &&
@@ -753,15 +993,38 @@ _process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
       (char *) envelope->message.properties.content_type.bytes,
       reply_queue, correlation_id);
 
-  response = _process_json_message (self, envelope->message.body.bytes,
-      envelope->message.body.len);
-
-  if (response == NULL) {
-    g_error ("response is NULL. response should be non null");
+  body = chamge_amqp_message_decode_body (&envelope->message, &error);
+  if (body == NULL) {
+    g_debug ("failed to decode body: %s", error->message);
     goto out;
   }
+
+  /* a retried request is answered again without being handled twice; the
+   * commands are all for this device, and their correlation ids are random,
+   * so that a retry is found even if the peer has reconnected meanwhile and
+   * waits on another reply queue */
+  if (self->replies != NULL
+      && chamge_reply_cache_lookup (self->replies, NULL,
+          correlation_id, &response, &cached_status)) {
+    g_debug ("replying again to %s", correlation_id);
+    status = cached_status;
+  } else {
+    response = _process_json_message (self, &envelope->message.properties,
+        body, strlen (body), &status);
+
+    if (response == NULL) {
+      g_error ("response is NULL. response should be non null");
+      goto out;
+    }
+
+    if (self->replies != NULL && chamge_amqp_status_is_final (status))
+      chamge_reply_cache_insert (self->replies, NULL, correlation_id,
+          response, status);
+  }
   {
     amqp_basic_properties_t amqp_props;
+    ChamgeAmqpHeaders amqp_headers = { 0 };
+    g_autoptr (GBytes) payload = NULL;
 
     memset (&amqp_props, 0, sizeof (amqp_basic_properties_t));
     amqp_props._flags =
@@ -774,6 +1037,10 @@ _process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
       amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
     }
 
+    chamge_amqp_headers_add_int (&amqp_headers, CHAMGE_AMQP_HEADER_STATUS,
+        status);
+    chamge_amqp_headers_apply (&amqp_headers, &amqp_props);
+
     {
       g_autoptr (GError) error = NULL;
       if (_is_queue_existed (self->amqp_conn, envelope->channel, reply_queue,
@@ -783,6 +1050,11 @@ _process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
       }
     }
 
+    payload = chamge_amqp_message_encode_body (response,
+        g_settings_get_uint (self->settings, "compression-threshold"),
+        chamge_amqp_message_accepts_encoding (&envelope->message.properties,
+            CHAMGE_AMQP_ENCODING_GZIP), &amqp_props);
+
     /*
      * publish
      */
@@ -790,21 +1062,210 @@ _process_amqp_message (amqp_connection_state_t state, amqp_rpc_reply_t * reply,
     g_debug ("      correlation id [%s] body [%s]", correlation_id, response);
     amqp_basic_publish (self->amqp_conn, envelope->channel,
         amqp_cstring_bytes (""), amqp_cstring_bytes (reply_queue), 0, 0,
-        &amqp_props, amqp_cstring_bytes (response));
+        &amqp_props, chamge_amqp_bytes_from_gbytes (payload));
   }
 
 out:
   return G_SOURCE_CONTINUE;
 }
 
-static ChamgeReturn
-chamge_amqp_edge_backend_activate (ChamgeEdgeBackend * edge_backend)
+static gboolean
+_send_heartbeat (gpointer user_data)
 {
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (user_data);
   g_autofree gchar *amqp_enroll_q_name = NULL;
   g_autofree gchar *amqp_exchange_name = NULL;
   g_autofree gchar *request_body = NULL;
+  g_autofree gchar *rtt = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeMsgEdgeHeartbeat request = { 0 };
+  g_autoptr (GError) error = NULL;
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  if (self->latency_probe != NULL)
+    rtt = chamge_latency_probe_to_string (self->latency_probe);
+
+  /* the round-trip times ride along, so that they cost no extra message */
+  request.method = "heartbeat";
+  request.device_type = "edge";
+  request.edge_id = self->edge_id;
+  request.rtt = rtt;
+  request_body = chamge_msg_edge_heartbeat_to_json (&request);
+  chamge_msg_edge_heartbeat_encode_headers (&request, &amqp_headers);
+
+  /* no reply is expected, so that a heartbeat never blocks */
+  if (!chamge_amqp_publish_oneway (self->amqp_conn,
+          g_settings_get_int (self->settings, "amqp-channel"),
+          amqp_exchange_name, amqp_enroll_q_name, request_body, &amqp_headers,
+          &error))
+    g_debug ("failed to send a heartbeat: %s", error->message);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+_probe_latency (gpointer user_data)
+{
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (user_data);
+
+  chamge_latency_probe_run (self->latency_probe);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* the queue named after the edge carries the commands sent to it, and lives
+ * as long as the connection */
+static ChamgeReturn
+_subscribe_commands (ChamgeAmqpEdgeBackend * self, guint amqp_channel,
+    const gchar * amqp_exchange_name, const gchar * edge_id)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (self->subscribed)
+    return CHAMGE_RETURN_OK;
+
+  if (_amqp_rpc_subscribe (self->amqp_conn, amqp_channel, amqp_exchange_name,
+          edge_id, &error) == CHAMGE_RETURN_FAIL) {
+    g_debug ("rpc_subscribe ERROR [ch:%d][exchange:%s][edge_id:%s]",
+        amqp_channel, amqp_exchange_name, edge_id);
+    if (error != NULL)
+      g_debug ("    %s", error->message);
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  self->subscribed = TRUE;
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+_reset_connection (ChamgeAmqpEdgeBackend * self)
+{
+  amqp_destroy_connection (self->amqp_conn);
+
+  self->amqp_conn = amqp_new_connection ();
+  self->amqp_socket = amqp_tcp_socket_new (self->amqp_conn);
+  g_assert_nonnull (self->amqp_socket);
+
+  self->logged_in = FALSE;
+  self->subscribed = FALSE;
+}
+
+typedef struct
+{
+  ChamgeAmqpEdgeBackend *self;
+  const gchar *edge_id;
+  ChamgeReturn ret;
+} StartActivated;
+
+/* serves the command queue and keeps the arbiter informed once the arbiter
+ * has activated the edge; the queue is only subscribed then, since the
+ * arbiter sends nothing to an edge which is not activated */
+static gboolean
+_start_activated_func (gpointer user_data)
+{
+  StartActivated *start = user_data;
+  ChamgeAmqpEdgeBackend *self = start->self;
+  g_autofree gchar *amqp_uri = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autoptr (GError) error = NULL;
+  guint amqp_channel;
+  guint heartbeat_interval;
+  guint probe_interval;
+
+  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
+  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  if (!self->logged_in) {
+    if (_amqp_rpc_login (self->amqp_conn, self->amqp_socket,
+            amqp_uri, amqp_channel, &error) != CHAMGE_RETURN_OK) {
+      g_debug ("amqp_login ERROR : %s", error->message);
+      _reset_connection (self);
+      return G_SOURCE_REMOVE;
+    }
+    self->logged_in = TRUE;
+  }
+
+  /* subscribe queue (queue name: edgeId) for streaming start */
+  if (_subscribe_commands (self, amqp_channel, amqp_exchange_name,
+          start->edge_id) != CHAMGE_RETURN_OK)
+    return G_SOURCE_REMOVE;
+
+  self->activated = TRUE;
+
+  /* process amqp message that comes from Mujachi */
+  if (self->process_source == NULL)
+    self->process_source = chamge_amqp_add_watch (self->amqp_conn,
+        self->context, _process_amqp_message, self);
+
+  /* let the arbiter know that this edge is alive */
+  g_mutex_lock (&self->target_lock);
+  g_free (self->edge_id);
+  self->edge_id = g_strdup (start->edge_id);
+  g_mutex_unlock (&self->target_lock);
+  heartbeat_interval =
+      g_settings_get_uint (self->settings, "heartbeat-interval");
+  if (heartbeat_interval > 0 && self->heartbeat_source == NULL)
+    self->heartbeat_source = chamge_timeout_add_seconds (self->context,
+        heartbeat_interval, _send_heartbeat, self);
+
+  /* hubs to measure are offered along with the target uri */
+  if (self->latency_probe == NULL)
+    self->latency_probe = chamge_latency_probe_new ();
+  probe_interval = g_settings_get_uint (self->settings, "probe-interval");
+  if (probe_interval > 0 && self->probe_source == NULL)
+    self->probe_source = chamge_timeout_add_seconds (self->context,
+        probe_interval, _probe_latency, self);
+
+  /* the relay is known before the first stream starts; an arbiter without
+   * any hub yet is asked again when a stream starts */
+  _fetch_target_uri_async (self);
+  _start_target_refresh (self);
+
+  start->ret = CHAMGE_RETURN_OK;
+  return G_SOURCE_REMOVE;
+}
+
+/* the command connection and the sources are only used in the context the
+ * edge was made in, whichever thread the node has called from */
+static ChamgeReturn
+_start_activated (ChamgeAmqpEdgeBackend * self, const gchar * edge_id)
+{
+  StartActivated start = { self, edge_id, CHAMGE_RETURN_FAIL };
+
+  chamge_main_context_invoke_sync (self->context, _start_activated_func,
+      &start);
+
+  return start.ret;
+}
+
+static gboolean
+_stop_activated_func (gpointer user_data)
+{
+  ChamgeAmqpEdgeBackend *self = user_data;
+
+  self->activated = FALSE;
+
+  chamge_clear_source (&self->process_source);
+  chamge_clear_source (&self->heartbeat_source);
+  chamge_clear_source (&self->probe_source);
+
+  _stop_target_refresh (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static ChamgeReturn
+chamge_amqp_edge_backend_activate (ChamgeEdgeBackend * edge_backend)
+{
   g_autofree gchar *response_body = NULL;
-  guint amqp_channel = 1;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
 
   g_autofree gchar *edge_id = NULL;
   ChamgeEdge *edge = NULL;
@@ -825,48 +1286,94 @@ chamge_amqp_edge_backend_activate (ChamgeEdgeBackend * edge_backend)
     goto out;
   }
 
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
   /* send activate */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"activate\",\"deviceType\":\"edge\",\"edgeId\":\"%s\"}",
-      edge_id);
-  if (_amqp_rpc_request (self->amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc_request ERROR : %s", error->message);
+  request.method = "activate";
+  request.edge_id = edge_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc_request ERROR : %s", error->message);
     goto out;
   }
 
   g_debug ("received response to activate: %s", response_body);
 
-  if (_validate_response (response_body, "activated") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "activated") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [activated], but [%s]", response_body);
     goto out;
   }
 
-  self->activated = TRUE;
+  _save_session (self, edge_id, response_body);
 
-  /* subscribe queue (queue name: edgeId) for streaming start */
-  if (_amqp_rpc_subscribe (self->amqp_conn, amqp_channel, amqp_exchange_name,
-          edge_id, &error) == CHAMGE_RETURN_FAIL) {
-    g_debug ("rpc_subscribe ERROR [ch:%d][exchange:%s][edge_id:%s]",
-        amqp_channel, amqp_exchange_name, edge_id);
-    if (error != NULL)
-      g_debug ("    %s", error->message);
+  ret = _start_activated (self, edge_id);
+
+out:
+  return ret;
+}
+
+/* a single request which the arbiter enrolls and activates the edge for, or
+ * resumes its session with */
+static ChamgeReturn
+chamge_amqp_edge_backend_enroll_activate (ChamgeEdgeBackend * edge_backend)
+{
+  g_autofree gchar *response_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+  g_autoptr (GError) error = NULL;
+  guint retry_after_ms = 0;
+
+  g_autofree gchar *edge_id = NULL;
+  ChamgeEdge *edge = NULL;
+  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (edge_backend);
+
+  g_object_get (self, "edge", &edge, NULL);
+
+  if (edge == NULL) {
+    g_debug ("failed to get edge");
     goto out;
   }
-  /* process amqp message that comes from Mujachi */
-  self->process_id = chamge_amqp_add_watch (self->amqp_conn,
-      _process_amqp_message, self);
 
-  ret = CHAMGE_RETURN_OK;
+  if (chamge_node_get_uid (CHAMGE_NODE (edge), &edge_id) != CHAMGE_RETURN_OK) {
+    g_debug ("failed to get edge_id from node(parent)");
+    goto out;
+  }
+
+  _load_session (self, edge_id);
+  if (self->session_token != NULL) {
+    if (_resume_session (self, edge_id) == CHAMGE_RETURN_OK) {
+      ret = _start_activated (self, edge_id);
+      goto out;
+    }
+
+    /* the arbiter is not reachable, so that enrolling would fail as well */
+    if (self->session_token != NULL)
+      goto out;
+  }
+
+  request.method = "enrollActivate";
+  request.edge_id = edge_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc request ERROR : %s", error->message);
+    goto out;
+  }
+  g_debug ("received response to enrollActivate : %s", response_body);
+  if (_is_throttled (CHAMGE_NODE (edge), status, response_body,
+          &retry_after_ms)) {
+    g_debug ("enroll is throttled, retrying in %u ms", retry_after_ms);
+    chamge_node_enroll_later (CHAMGE_NODE (edge), retry_after_ms);
+    ret = CHAMGE_RETURN_ASYNC;
+    goto out;
+  }
+  if (_validate_response (status, response_body, "activated") != CHAMGE_RETURN_OK) {
+    g_debug ("  received reponse must be [activated] but [%s]", response_body);
+    goto out;
+  }
+
+  _save_session (self, edge_id, response_body);
+
+  ret = _start_activated (self, edge_id);
 
 out:
   return ret;
@@ -877,24 +1384,63 @@ chamge_amqp_edge_backend_deactivate (ChamgeEdgeBackend * edge_backend)
 {
   ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (edge_backend);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  chamge_main_context_invoke_sync (self->context, _stop_activated_func, self);
 
   return CHAMGE_RETURN_OK;
 }
 
 
 static gchar *
-chamge_amqp_edge_backend_request_target_uri (ChamgeEdgeBackend * self,
+chamge_amqp_edge_backend_request_target_uri (ChamgeEdgeBackend * edge_backend,
     GError ** error)
 {
-  /* TODO
-   * Need to return real data that is gotten from server
-   */
-  g_autofree gchar *target_uri = g_strdup ("srt://localhost:8888");
-  return g_steal_pointer (&target_uri);
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (edge_backend);
+  gchar *uri;
+
+  uri = _lookup_target_uri (self);
+  if (uri != NULL)
+    return uri;
+
+  return _fetch_target_uri (self, error);
+}
+
+static GVariant *
+chamge_amqp_edge_backend_request_batch (ChamgeEdgeBackend * edge_backend,
+    const gchar * method, const gchar * const *edge_ids, GError ** error)
+{
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (edge_backend);
+  g_autofree gchar *amqp_enroll_q_name = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *request_body = NULL;
+  g_autofree gchar *response_body = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  /* without a device id header, the arbiter reads the ids from the body */
+  request.method = method;
+  request.device_type = "edge";
+  request_body = chamge_batch_request_to_json (method, "edge", edge_ids);
+  chamge_msg_device_request_encode_headers (&request, &amqp_headers);
+  response_body = chamge_amqp_rpc_call (self->rpc, amqp_exchange_name,
+      amqp_enroll_q_name, request_body, &amqp_headers, &status, error);
+  if (response_body == NULL)
+    return NULL;
+
+  if (status != CHAMGE_AMQP_STATUS_NONE && status != CHAMGE_AMQP_STATUS_OK) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "batch %s is rejected (status: %d, reply: %s)", method, status,
+        response_body);
+    return NULL;
+  }
+
+  return chamge_batch_reply_parse (response_body, error);
 }
 
 static void
@@ -902,10 +1448,18 @@ chamge_amqp_edge_backend_dispose (GObject * object)
 {
   ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (object);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  /* the sources are destroyed from whichever thread disposes the edge */
+  chamge_clear_source (&self->process_source);
+  chamge_clear_source (&self->heartbeat_source);
+  chamge_clear_source (&self->probe_source);
+
+  _stop_target_refresh (self);
+
+  g_clear_pointer (&self->latency_probe, chamge_latency_probe_free);
+  g_clear_pointer (&self->edge_id, g_free);
+
+  g_clear_pointer (&self->replies, chamge_reply_cache_free);
+  g_clear_pointer (&self->rpc, chamge_amqp_rpc_free);
 
   if (self->amqp_conn != NULL) {
     amqp_destroy_connection (self->amqp_conn);
@@ -915,6 +1469,19 @@ chamge_amqp_edge_backend_dispose (GObject * object)
   G_OBJECT_CLASS (chamge_amqp_edge_backend_parent_class)->dispose (object);
 }
 
+static void
+chamge_amqp_edge_backend_finalize (GObject * object)
+{
+  ChamgeAmqpEdgeBackend *self = CHAMGE_AMQP_EDGE_BACKEND (object);
+
+  g_mutex_clear (&self->target_lock);
+  g_main_context_unref (self->context);
+  g_free (self->session_token);
+  g_free (self->session_epoch);
+
+  G_OBJECT_CLASS (chamge_amqp_edge_backend_parent_class)->finalize (object);
+}
+
 
 static void
 chamge_amqp_edge_backend_class_init (ChamgeAmqpEdgeBackendClass * klass)
@@ -923,13 +1490,16 @@ chamge_amqp_edge_backend_class_init (ChamgeAmqpEdgeBackendClass * klass)
   ChamgeEdgeBackendClass *backend_class = CHAMGE_EDGE_BACKEND_CLASS (klass);
 
   object_class->dispose = chamge_amqp_edge_backend_dispose;
+  object_class->finalize = chamge_amqp_edge_backend_finalize;
 
   backend_class->enroll = chamge_amqp_edge_backend_enroll;
   backend_class->delist = chamge_amqp_edge_backend_delist;
   backend_class->activate = chamge_amqp_edge_backend_activate;
   backend_class->deactivate = chamge_amqp_edge_backend_deactivate;
+  backend_class->enroll_activate = chamge_amqp_edge_backend_enroll_activate;
   backend_class->request_target_uri =
       chamge_amqp_edge_backend_request_target_uri;
+  backend_class->request_batch = chamge_amqp_edge_backend_request_batch;
 
 }
 
@@ -939,8 +1509,25 @@ chamge_amqp_edge_backend_init (ChamgeAmqpEdgeBackend * self)
   self->settings = chamge_common_gsettings_new (AMQP_EDGE_BACKEND_SCHEMA_ID);
   g_assert_nonnull (self->settings);
 
+  self->context = g_main_context_ref_thread_default ();
+
   self->amqp_conn = amqp_new_connection ();
   self->amqp_socket = amqp_tcp_socket_new (self->amqp_conn);
 
   g_assert_nonnull (self->amqp_socket);
+
+  {
+    g_autofree gchar *amqp_uri =
+        g_settings_get_string (self->settings, "amqp-uri");
+
+    self->rpc = chamge_amqp_rpc_new (amqp_uri,
+        g_settings_get_int (self->settings, "amqp-channel"));
+  }
+
+  if (g_settings_get_uint (self->settings, "reply-cache-size") > 0)
+    self->replies =
+        chamge_reply_cache_new (g_settings_get_uint (self->settings,
+            "reply-cache-size"));
+
+  g_mutex_init (&self->target_lock);
 }
@@ -19,6 +19,11 @@
 #include "config.h"
 
 #include "amqp-hub-backend.h"
+#include "amqp-message.h"
+#include "amqp-rpc.h"
+#include "amqp-source.h"
+#include "reply-cache.h"
+#include "messages-generated.h"
 #include "common.h"
 
 #include <gio/gio.h>
@@ -34,11 +39,23 @@ struct _ChamgeAmqpHubBackend
   ChamgeHubBackend parent;
   GSettings *settings;
 
+  /* the connection commands are served with, used in @context only */
   amqp_connection_state_t amqp_conn;
   amqp_socket_t *amqp_socket;
+  gboolean logged_in;
+  GMainContext *context;
+
+  /* requests to the arbiter, from whichever thread the hub calls in */
+  ChamgeAmqpRpc *rpc;
+
+  /* replies to the latest requests, by correlation id */
+  ChamgeReplyCache *replies;
 
   gboolean activated;
-  guint process_id;
+  GSource *process_source;
+
+  gchar *hub_id;
+  GSource *heartbeat_source;
 };
 
 /* *INDENT-OFF* */
@@ -105,43 +122,6 @@ _amqp_rpc_reply_string (amqp_rpc_reply_t r)
   }
 }
 
-inline static const gchar *
-_amqp_get_rpc_reply_string (amqp_rpc_reply_t r)
-{
-  if (r.reply_type == AMQP_RESPONSE_NORMAL) {
-    return "response normal";
-  } else if (r.reply_type == AMQP_RESPONSE_NONE) {
-    return "reply type is missing";
-  } else if (r.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION) {
-    return amqp_error_string2 (r.library_error);
-  } else if (r.reply_type == AMQP_RESPONSE_SERVER_EXCEPTION) {
-    int ret = 0;
-    static char str[512] = { 0 };
-
-    if (r.reply.id == AMQP_CONNECTION_CLOSE_METHOD) {
-      amqp_connection_close_t *msg =
-          (amqp_connection_close_t *) r.reply.decoded;
-      ret =
-          g_snprintf (str, sizeof (str),
-          "server connection error %d, message: %.*s", msg->reply_code,
-          (int) msg->reply_text.len, (char *) msg->reply_text.bytes);
-    } else if (r.reply.id == AMQP_CHANNEL_CLOSE_METHOD) {
-      amqp_channel_close_t *msg = (amqp_channel_close_t *) r.reply.decoded;
-      ret =
-          g_snprintf (str, sizeof (str),
-          "server channel error %d, message: %.*s", msg->reply_code,
-          (int) msg->reply_text.len, (char *) msg->reply_text.bytes);
-    } else {
-      ret =
-          g_snprintf (str, sizeof (str),
-          "unknown server error, method id 0x%08X", r.reply.id);
-    }
-    return ret >= 0 ? str : NULL;
-  }
-  g_error ("rpc reply type is abnormal. 0x%x", r.reply_type);
-  return "rpc replay type is abnormal";
-}
-
 static ChamgeReturn
 _amqp_rpc_login (amqp_connection_state_t amqp_conn, amqp_socket_t * amqp_socket,
     const gchar * url, guint channel, GError ** error)
@@ -260,158 +240,6 @@ _is_queue_existed (const amqp_connection_state_t conn, guint channel,
 }
 
 
-static ChamgeReturn
-_amqp_rpc_request (amqp_connection_state_t amqp_conn, guint channel,
-    const gchar * request, const gchar * exchange, const gchar * queue_name,
-    gchar ** response_body, GError ** error)
-{
-  amqp_bytes_t amqp_reply_queue = { 0 };
-  amqp_basic_properties_t amqp_props = { 0 };
-  g_autofree gchar *correlation_id = NULL;
-  guint retry_count = 0;
-  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
-
-  g_return_val_if_fail (amqp_conn != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (channel != 0, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (queue_name != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (request != NULL, CHAMGE_RETURN_FAIL);
-  g_return_val_if_fail (response_body != NULL, CHAMGE_RETURN_FAIL);
-
-  /* check where queue_name queue exist */
-  if (_is_queue_existed (amqp_conn, channel, queue_name,
-          error) != CHAMGE_RETURN_OK) {
-    goto out;
-  }
-
-  /* create private replay_to_queue and queue name is random that is supplied from amqp server */
-  if (_amqp_declare_queue (amqp_conn, channel, NULL,
-          &amqp_reply_queue, error) != CHAMGE_RETURN_OK)
-    return ret;
-
-  g_debug ("declare a queue for reply : %s", (gchar *) amqp_reply_queue.bytes);
-
-  /* property setting to send rpc request */
-  amqp_props._flags =
-      AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
-
-  amqp_props.content_type = amqp_cstring_bytes (DEFAULT_CONTENT_TYPE);
-  amqp_props.delivery_mode = 2; /* persistent delivery mode */
-
-  amqp_props._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-  amqp_props.reply_to = amqp_reply_queue;
-
-  amqp_props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-  correlation_id = g_uuid_string_random ();
-  correlation_id =
-      g_compute_checksum_for_string (G_CHECKSUM_SHA256, correlation_id,
-      strlen (correlation_id));
-  amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
-
-  /* send requst to queue_name */
-  {
-    gint r = amqp_basic_publish (amqp_conn, channel,
-        exchange ==
-        NULL ? amqp_cstring_bytes ("") : amqp_cstring_bytes (exchange),
-        amqp_cstring_bytes (queue_name), 0, 0, &amqp_props,
-        amqp_cstring_bytes (request));
-    if (r < 0) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "publish failure >> %s",
-          amqp_error_string2 (r));
-      goto out;
-    }
-    g_debug ("published to queue[%s], exchange[%s], request[%s]", queue_name,
-        exchange, request);
-  }
-
-  if (amqp_basic_consume (amqp_conn, channel, amqp_reply_queue,
-          amqp_empty_bytes, 0, 1, 0, amqp_empty_table) == NULL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "basic consume failure >> %s",
-        _amqp_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-
-  /* wait an answer */
-  do {
-    amqp_rpc_reply_t amqp_r;
-    amqp_envelope_t envelope;
-    struct timeval timeout = { 10, 0 };
-
-    if (retry_count > 10) {
-      g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
-          "no response to the request in 10 messages");
-      break;
-    }
-    amqp_maybe_release_buffers (amqp_conn);
-
-    g_debug ("Wait for response message from [%s]",
-        (gchar *) amqp_reply_queue.bytes);
-    amqp_r = amqp_consume_message (amqp_conn, &envelope, &timeout, 0);
-    retry_count++;
-
-    if (amqp_r.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
-        && amqp_r.library_error == AMQP_STATUS_TIMEOUT) {
-      g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg timeout");
-      break;
-    }
-
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg failure >> %s",
-          _amqp_rpc_reply_string (amqp_r));
-      break;
-    }
-
-    g_debug ("Delivery %u, exchange %.*s routingkey %.*s",
-        (unsigned) envelope.delivery_tag, (int) envelope.exchange.len,
-        (char *) envelope.exchange.bytes, (int) envelope.routing_key.len,
-        (char *) envelope.routing_key.bytes);
-
-    if ((envelope.message.properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) ==
-        0) {
-      g_debug ("discard >> correaltion id is not exist");
-      continue;
-    }
-
-    if (strncmp (correlation_id,
-            envelope.message.properties.correlation_id.bytes,
-            envelope.message.properties.correlation_id.len) != 0) {
-      g_debug ("discard >> correaltion id is not matched [%s] [%.*s]",
-          correlation_id, (gint) envelope.message.properties.correlation_id.len,
-          (gchar *) envelope.message.properties.correlation_id.bytes);
-      continue;
-    }
-
-    g_debug ("Correlation ID : %.*s",
-        (gint) envelope.message.properties.correlation_id.len,
-        (gchar *) envelope.message.properties.correlation_id.bytes);
-    if (envelope.message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG) {
-      g_debug ("Content-type: %.*s",
-          (int) envelope.message.properties.content_type.len,
-          (char *) envelope.message.properties.content_type.bytes);
-    }
-
-    if (*response_body != NULL) {
-      g_free (*response_body);
-      *response_body = NULL;
-    }
-    *response_body =
-        g_strndup (envelope.message.body.bytes, envelope.message.body.len);
-
-    amqp_destroy_envelope (&envelope);
-    break;
-  } while (1);
-  ret = CHAMGE_RETURN_OK;
-
-out:
-  amqp_bytes_free (amqp_reply_queue);
-  return ret;
-}
-
 static ChamgeReturn
 _amqp_rpc_subscribe (amqp_connection_state_t amqp_conn, guint channel,
     const gchar * exchange_name, const gchar * queue_name, GError ** error)
@@ -461,44 +289,95 @@ out:
   return ret;
 }
 
+static gchar *
+_request_device (ChamgeAmqpHubBackend * self,
+    ChamgeMsgDeviceRequest * request, ChamgeAmqpStatus * status,
+    GError ** error)
+{
+  g_autofree gchar *amqp_enroll_q_name = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *request_body = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  request->device_type = "hub";
+  request_body = chamge_msg_device_request_to_json (request);
+  chamge_msg_device_request_encode_headers (request, &amqp_headers);
+
+  return chamge_amqp_rpc_call (self->rpc, amqp_exchange_name,
+      amqp_enroll_q_name, request_body, &amqp_headers, status, error);
+}
+
 static ChamgeReturn
-_validate_response (const gchar * response, const gchar * shouldbe)
+_validate_response (ChamgeAmqpStatus status, const gchar * response,
+    const gchar * shouldbe)
 {
-  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (JsonParser) parser = NULL;
   g_autoptr (GError) error = NULL;
-  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+  ChamgeMsgResult result;
 
-  JsonNode *root = NULL;
-  JsonObject *json_object = NULL;
+  if (status != CHAMGE_AMQP_STATUS_NONE)
+    return status == CHAMGE_AMQP_STATUS_OK ?
+        CHAMGE_RETURN_OK : CHAMGE_RETURN_FAIL;
 
-  if (!json_parser_load_from_data (parser, response, strlen (response), &error)) {
+  /* an arbiter which does not send the status header */
+  if (response == NULL) {
+    g_debug ("failed to parse body: (null response)");
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  parser = json_parser_new ();
+  if (!chamge_msg_result_parse_json (&result, parser, response, -1, &error)) {
     g_debug ("failed to parse body: %s", error->message);
-    return ret;
+    return CHAMGE_RETURN_FAIL;
   }
 
-  root = json_parser_get_root (parser);
-  json_object = json_node_get_object (root);
-  if (json_object_has_member (json_object, "result")) {
-    JsonNode *node = json_object_get_member (json_object, "result");
-    const gchar *result = json_node_get_string (node);
-    if (!g_strcmp0 (result, shouldbe)) {
-      ret = CHAMGE_RETURN_OK;
-    }
+  return g_strcmp0 (result.result, shouldbe) ?
+      CHAMGE_RETURN_FAIL : CHAMGE_RETURN_OK;
+}
+
+/* the arbiter sheds enrolls during a storm and tells when to come back, and
+ * over how long a window the devices it knows should spread their enrolls */
+static gboolean
+_is_throttled (ChamgeNode * node, ChamgeAmqpStatus status,
+    const gchar * response, guint * retry_after_ms)
+{
+  g_autoptr (JsonParser) parser = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeMsgThrottled throttled;
+  guint window_ms = 0;
+
+  if (status != CHAMGE_AMQP_STATUS_TOO_MANY_REQUESTS || response == NULL)
+    return FALSE;
+
+  parser = json_parser_new ();
+  if (!chamge_msg_throttled_parse_json (&throttled, parser, response, -1,
+          &error)) {
+    g_debug ("failed to parse body: %s", error->message);
+    return FALSE;
   }
 
-  return ret;
+  g_object_get (node, "enroll-window", &window_ms, NULL);
+  if (throttled.window_ms > window_ms)
+    g_object_set (node, "enroll-window",
+        (guint) MIN (throttled.window_ms, G_MAXUINT), NULL);
+
+  *retry_after_ms = MAX (throttled.retry_after_ms, 0);
+  return TRUE;
 }
 
 static ChamgeReturn
 chamge_amqp_hub_backend_enroll (ChamgeHubBackend * hub_backend)
 {
-  g_autofree gchar *amqp_uri = NULL;
-  g_autofree gchar *amqp_enroll_q_name = NULL;
-  g_autofree gchar *amqp_exchange_name = NULL;
   g_autofree gchar *response_body = NULL;
-  g_autofree gchar *request_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
   g_autoptr (GError) error = NULL;
-  gint amqp_channel = 1;
+  guint retry_after_ms = 0;
 
   g_autofree gchar *hub_id = NULL;
   ChamgeHub *hub = NULL;
@@ -518,42 +397,22 @@ chamge_amqp_hub_backend_enroll (ChamgeHubBackend * hub_backend)
     goto out;
   }
 
-  /* get configuration from gsetting */
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
-  g_assert_nonnull (amqp_uri);
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
-  g_debug
-      ("[config] channel : %d, enroll-queue-name : %s, enroll-exchange-name : %s",
-      amqp_channel, amqp_enroll_q_name, amqp_exchange_name);
-
-  if (_amqp_rpc_login (self->amqp_conn, self->amqp_socket,
-          amqp_uri, amqp_channel, &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("amqp_login ERROR : %s", error->message);
+  request.method = "enroll";
+  request.hub_id = hub_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc request ERROR : %s", error->message);
     goto out;
   }
-
-  /* TODO
-   * request-body need to be filled with real request data
-   */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"enroll\",\"deviceType\":\"hub\",\"hubId\":\"%s\"}",
-      hub_id);
-  if (_amqp_rpc_request (self->amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc request ERROR : %s", error->message);
+  g_debug ("received response to enroll : %s", response_body);
+  if (_is_throttled (CHAMGE_NODE (hub), status, response_body,
+          &retry_after_ms)) {
+    g_debug ("enroll is throttled, retrying in %u ms", retry_after_ms);
+    chamge_node_enroll_later (CHAMGE_NODE (hub), retry_after_ms);
+    ret = CHAMGE_RETURN_ASYNC;
     goto out;
   }
-  g_debug ("received response to enroll : %s", response_body);
-  if (_validate_response (response_body, "enrolled") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "enrolled") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [enrolled] but [%s]", response_body);
     goto out;
   }
@@ -567,17 +426,9 @@ static ChamgeReturn
 chamge_amqp_hub_backend_delist (ChamgeHubBackend * hub_backend)
 {
   ChamgeAmqpHubBackend *self = CHAMGE_AMQP_HUB_BACKEND (hub_backend);
-  g_autofree gchar *amqp_uri = NULL;
-  struct amqp_connection_info connection_info;
-  amqp_rpc_reply_t amqp_r;
-  amqp_connection_state_t amqp_conn;
-  amqp_socket_t *amqp_socket = NULL;
-
-  g_autofree gchar *amqp_enroll_q_name = NULL;
-  g_autofree gchar *amqp_exchange_name = NULL;
-  gint amqp_channel = 0;
-  g_autofree gchar *request_body = NULL;
   g_autofree gchar *response_body = NULL;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
 
   ChamgeHub *hub = NULL;
   g_autofree gchar *hub_id = NULL;
@@ -595,95 +446,22 @@ chamge_amqp_hub_backend_delist (ChamgeHubBackend * hub_backend)
     goto out;
   }
 
-
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
-  g_assert_nonnull (amqp_uri);
-
-  if (amqp_parse_url (amqp_uri, &connection_info) != AMQP_STATUS_OK) {
-    g_debug ("url pasring failure");
-    goto out;
-  }
-
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
-  g_debug ("[config] channel : %d, enroll-exchange-name : %s",
-      amqp_channel, amqp_exchange_name);
-
-  amqp_conn = amqp_new_connection ();
-  amqp_socket = amqp_tcp_socket_new (amqp_conn);
-  g_assert_nonnull (amqp_socket);
-
-  if (amqp_socket_open (amqp_socket,
-          connection_info.host, connection_info.port)) {
-    g_debug ("socket open failure");
-    goto out;
-  }
-
-  /* TODO: The authentication method should be EXTERNAL
-   * if we don't want to share user/passwd
-   */
-  amqp_r = amqp_login (amqp_conn, connection_info.vhost, 0, 131072, 0,
-      AMQP_SASL_METHOD_PLAIN, connection_info.user, connection_info.password);
-  if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-    g_debug ("login failure >> %s", _amqp_rpc_reply_string (amqp_r));
-    goto out;
-  }
-  if (!amqp_channel_open (amqp_conn, amqp_channel)) {
-    g_debug ("channel open failure >> %s",
-        _amqp_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-  g_debug ("success to login %s:%d/%s id[%s] pwd[%s]",
-      connection_info.host, connection_info.port,
-      connection_info.vhost, connection_info.user, connection_info.password);
-
   /* send delist */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"delist\",\"deviceType\":\"hub\",\"hubId\":\"%s\"}",
-      hub_id);
-  if (_amqp_rpc_request (amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc_request ERROR : %s", error->message);
+  request.method = "delist";
+  request.hub_id = hub_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc_request ERROR : %s", error->message);
     goto out;
   }
 
   g_debug ("received response to delist: %s", response_body);
 
-  if (_validate_response (response_body, "delisted") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "delisted") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [delisted], but [%s]", response_body);
     goto out;
   }
 
-
-  if (amqp_conn != NULL) {
-    gint destroy_ret = 0;
-    amqp_r = amqp_channel_close (amqp_conn, amqp_channel, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_debug ("channel close failure >> %s", _amqp_rpc_reply_string (amqp_r));
-      goto out;
-    }
-    amqp_r = amqp_connection_close (amqp_conn, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_debug ("connection close failure >> %s",
-          _amqp_rpc_reply_string (amqp_r));
-      goto out;
-    }
-    destroy_ret = amqp_destroy_connection (amqp_conn);
-    if (destroy_ret < 0) {
-      g_debug ("connection destroy failure >> %s",
-          amqp_error_string2 (destroy_ret));
-      goto out;
-    }
-  }
-
   ret = CHAMGE_RETURN_OK;
 
 out:
@@ -691,29 +469,45 @@ out:
 }
 
 static gchar *
-_process_json_message (ChamgeAmqpHubBackend * self, const gchar * body,
-    gssize len)
+_process_json_message (ChamgeAmqpHubBackend * self,
+    const amqp_basic_properties_t * props, const gchar * body, gssize len,
+    ChamgeAmqpStatus * status)
 {
-  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (JsonParser) parser = NULL;
   g_autoptr (GError) error = NULL;
+  g_autofree gchar *method = NULL;
+  g_autofree gchar *command = NULL;
   gchar *response = NULL;
+  ChamgeReturn ret;
 
-  if (!json_parser_load_from_data (parser, body, len, &error)) {
-    g_debug ("failed to parse body: %s", error->message);
-    response = g_strdup ("{\"result\":\"failed to parse body\"}");
-    goto out;
+  /* a request carrying the method header is routed without parsing, the body
+   * is left to the application */
+  method = chamge_amqp_headers_dup_string (props, CHAMGE_AMQP_HEADER_METHOD);
+  if (method == NULL) {
+    ChamgeMsgRoute route;
+
+    parser = json_parser_new ();
+    if (!chamge_msg_route_parse_json (&route, parser, body, len, &error)) {
+      ChamgeMsgResult failure = { "failed to parse body" };
+
+      g_debug ("failed to parse body: %s", error->message);
+      *status = CHAMGE_AMQP_STATUS_BAD_REQUEST;
+      return chamge_msg_result_to_json (&failure);
+    }
+    method = g_strdup (route.method);
   }
 
-  {
-    ChamgeHubBackendClass *backend_class =
-        CHAMGE_HUB_BACKEND_GET_CLASS (&self->parent);
-    g_autofree gchar *command = g_strndup (body, len);
-    backend_class->user_command (&self->parent, command, &response, &error);
-    if (response == NULL)
-      response = g_strdup ("{\"result\":\"not ok\"}");
+  command = g_strndup (body, len);
+  ret = chamge_hub_backend_dispatch_command (&self->parent, method, command,
+      &response, &error);
+  *status = chamge_amqp_status_from_return (ret, error);
+
+  if (response == NULL) {
+    ChamgeMsgResult not_ok = { error != NULL ? error->message : "not ok" };
+
+    response = chamge_msg_result_to_json (&not_ok);
   }
 
-out:
   return response;
 }
 
@@ -725,7 +519,11 @@ _process_amqp_message (ChamgeAmqpHubBackend * self)
   g_autofree gchar *reply_queue = NULL;
   g_autofree gchar *correlation_id = NULL;
   struct timeval timeout = { 1, 0 };
+  g_autofree gchar *body = NULL;
   g_autofree gchar *response = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+  gint cached_status;
 
   if (!self->activated)
     return G_SOURCE_REMOVE;
@@ -793,15 +591,38 @@ _process_amqp_message (ChamgeAmqpHubBackend * self)
       (char *) envelope.message.properties.content_type.bytes,
       reply_queue, correlation_id);
 
-  response = _process_json_message (self, envelope.message.body.bytes,
-      envelope.message.body.len);
-
-  if (response == NULL) {
-    g_error ("response is NULL. response should be non null");
+  body = chamge_amqp_message_decode_body (&envelope.message, &error);
+  if (body == NULL) {
+    g_debug ("failed to decode body: %s", error->message);
     goto out;
   }
+
+  /* a retried request is answered again without being handled twice; the
+   * commands are all for this device, and their correlation ids are random,
+   * so that a retry is found even if the peer has reconnected meanwhile and
+   * waits on another reply queue */
+  if (self->replies != NULL
+      && chamge_reply_cache_lookup (self->replies, NULL,
+          correlation_id, &response, &cached_status)) {
+    g_debug ("replying again to %s", correlation_id);
+    status = cached_status;
+  } else {
+    response = _process_json_message (self, &envelope.message.properties,
+        body, strlen (body), &status);
+
+    if (response == NULL) {
+      g_error ("response is NULL. response should be non null");
+      goto out;
+    }
+
+    if (self->replies != NULL && chamge_amqp_status_is_final (status))
+      chamge_reply_cache_insert (self->replies, NULL, correlation_id,
+          response, status);
+  }
   {
     amqp_basic_properties_t amqp_props;
+    ChamgeAmqpHeaders amqp_headers = { 0 };
+    g_autoptr (GBytes) payload = NULL;
 
     memset (&amqp_props, 0, sizeof (amqp_basic_properties_t));
     amqp_props._flags =
@@ -814,6 +635,10 @@ _process_amqp_message (ChamgeAmqpHubBackend * self)
       amqp_props.correlation_id = amqp_cstring_bytes (correlation_id);
     }
 
+    chamge_amqp_headers_add_int (&amqp_headers, CHAMGE_AMQP_HEADER_STATUS,
+        status);
+    chamge_amqp_headers_apply (&amqp_headers, &amqp_props);
+
     {
       g_autoptr (GError) error = NULL;
       if (_is_queue_existed (self->amqp_conn, envelope.channel, reply_queue,
@@ -823,6 +648,11 @@ _process_amqp_message (ChamgeAmqpHubBackend * self)
       }
     }
 
+    payload = chamge_amqp_message_encode_body (response,
+        g_settings_get_uint (self->settings, "compression-threshold"),
+        chamge_amqp_message_accepts_encoding (&envelope.message.properties,
+            CHAMGE_AMQP_ENCODING_GZIP), &amqp_props);
+
     /*
      * publish
      */
@@ -830,7 +660,7 @@ _process_amqp_message (ChamgeAmqpHubBackend * self)
     g_debug ("      correlation id [%s] body [%s]", correlation_id, response);
     amqp_basic_publish (self->amqp_conn, envelope.channel,
         amqp_cstring_bytes (""), amqp_cstring_bytes (reply_queue), 0, 0,
-        &amqp_props, amqp_cstring_bytes (response));
+        &amqp_props, chamge_amqp_bytes_from_gbytes (payload));
   }
 
 out:
@@ -839,14 +669,148 @@ out:
   return G_SOURCE_CONTINUE;
 }
 
-static ChamgeReturn
-chamge_amqp_hub_backend_activate (ChamgeHubBackend * hub_backend)
+static gboolean
+_send_heartbeat (gpointer user_data)
 {
+  ChamgeAmqpHubBackend *self = CHAMGE_AMQP_HUB_BACKEND (user_data);
   g_autofree gchar *amqp_enroll_q_name = NULL;
   g_autofree gchar *amqp_exchange_name = NULL;
+  g_autofree gchar *relay_uri = NULL;
   g_autofree gchar *request_body = NULL;
+  g_autoptr (ChamgeHub) hub = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeMsgHubHeartbeat request = { 0 };
+  guint capacity = 0, load = 0;
+  g_autoptr (GError) error = NULL;
+
+  amqp_enroll_q_name =
+      g_settings_get_string (self->settings, "enroll-queue-name");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+  relay_uri = g_settings_get_string (self->settings, "relay-uri");
+
+  g_object_get (self, "hub", &hub, NULL);
+  if (hub != NULL)
+    chamge_hub_get_load (hub, &capacity, &load);
+
+  /* the arbiter hands the relay uri out to the edges it assigns here */
+  request.method = "heartbeat";
+  request.device_type = "hub";
+  request.hub_id = self->hub_id;
+  request.capacity = capacity;
+  request.load = load;
+  request.uri = *relay_uri != '\0' ? relay_uri : NULL;
+  request_body = chamge_msg_hub_heartbeat_to_json (&request);
+  chamge_msg_hub_heartbeat_encode_headers (&request, &amqp_headers);
+
+  /* no reply is expected, so that a heartbeat never blocks */
+  if (!chamge_amqp_publish_oneway (self->amqp_conn,
+          g_settings_get_int (self->settings, "amqp-channel"),
+          amqp_exchange_name, amqp_enroll_q_name, request_body, &amqp_headers,
+          &error))
+    g_debug ("failed to send a heartbeat: %s", error->message);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+_reset_connection (ChamgeAmqpHubBackend * self)
+{
+  amqp_destroy_connection (self->amqp_conn);
+
+  self->amqp_conn = amqp_new_connection ();
+  self->amqp_socket = amqp_tcp_socket_new (self->amqp_conn);
+  g_assert_nonnull (self->amqp_socket);
+
+  self->logged_in = FALSE;
+}
+
+typedef struct
+{
+  ChamgeAmqpHubBackend *self;
+  const gchar *hub_id;
+  ChamgeReturn ret;
+} StartActivated;
+
+/* the command connection and the sources are only used in the context the
+ * hub was made in, whichever thread the node has called from */
+static gboolean
+_start_activated_func (gpointer user_data)
+{
+  StartActivated *start = user_data;
+  ChamgeAmqpHubBackend *self = start->self;
+  g_autofree gchar *amqp_uri = NULL;
+  g_autofree gchar *amqp_exchange_name = NULL;
+  g_autoptr (GError) error = NULL;
+  guint amqp_channel;
+  guint heartbeat_interval;
+
+  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
+  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
+  amqp_exchange_name =
+      g_settings_get_string (self->settings, "enroll-exchange-name");
+
+  if (!self->logged_in) {
+    if (_amqp_rpc_login (self->amqp_conn, self->amqp_socket,
+            amqp_uri, amqp_channel, &error) != CHAMGE_RETURN_OK) {
+      g_debug ("amqp_login ERROR : %s", error->message);
+      _reset_connection (self);
+      return G_SOURCE_REMOVE;
+    }
+    self->logged_in = TRUE;
+  }
+
+  /* subscribe queue (queue name: hubId) for streaming start */
+  if (_amqp_rpc_subscribe (self->amqp_conn, amqp_channel, amqp_exchange_name,
+          start->hub_id, &error) == CHAMGE_RETURN_FAIL) {
+    g_debug ("rpc_subscribe ERROR [ch:%d][exchange:%s][hub_id:%s]",
+        amqp_channel, amqp_exchange_name, start->hub_id);
+    if (error != NULL)
+      g_debug ("    %s", error->message);
+    return G_SOURCE_REMOVE;
+  }
+
+  self->activated = TRUE;
+
+  /* process amqp message that comes from Mujachi */
+  if (self->process_source == NULL)
+    self->process_source = chamge_idle_add (self->context,
+        (GSourceFunc) _process_amqp_message, self);
+
+  /* let the arbiter know that this hub is alive, and its relay at once */
+  g_free (self->hub_id);
+  self->hub_id = g_strdup (start->hub_id);
+  _send_heartbeat (self);
+  heartbeat_interval =
+      g_settings_get_uint (self->settings, "heartbeat-interval");
+  if (heartbeat_interval > 0 && self->heartbeat_source == NULL)
+    self->heartbeat_source = chamge_timeout_add_seconds (self->context,
+        heartbeat_interval, _send_heartbeat, self);
+
+  start->ret = CHAMGE_RETURN_OK;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_stop_activated_func (gpointer user_data)
+{
+  ChamgeAmqpHubBackend *self = user_data;
+
+  self->activated = FALSE;
+
+  chamge_clear_source (&self->process_source);
+  chamge_clear_source (&self->heartbeat_source);
+
+  return G_SOURCE_REMOVE;
+}
+
+static ChamgeReturn
+chamge_amqp_hub_backend_activate (ChamgeHubBackend * hub_backend)
+{
   g_autofree gchar *response_body = NULL;
-  guint amqp_channel = 1;
+  ChamgeMsgDeviceRequest request = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
+  StartActivated start = { NULL, NULL, CHAMGE_RETURN_FAIL };
 
   g_autofree gchar *hub_id = NULL;
   ChamgeHub *hub = NULL;
@@ -867,46 +831,27 @@ chamge_amqp_hub_backend_activate (ChamgeHubBackend * hub_backend)
     goto out;
   }
 
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
-  amqp_enroll_q_name =
-      g_settings_get_string (self->settings, "enroll-queue-name");
-  amqp_exchange_name =
-      g_settings_get_string (self->settings, "enroll-exchange-name");
-
   /* send activate */
-  request_body =
-      g_strdup_printf
-      ("{\"method\":\"activate\",\"deviceType\":\"hub\",\"hubId\":\"%s\"}",
-      hub_id);
-  if (_amqp_rpc_request (self->amqp_conn, amqp_channel, request_body,
-          amqp_exchange_name, amqp_enroll_q_name, &response_body,
-          &error) != CHAMGE_RETURN_OK) {
-    if (error != NULL)
-      g_debug ("rpc_request ERROR : %s", error->message);
+  request.method = "activate";
+  request.hub_id = hub_id;
+  response_body = _request_device (self, &request, &status, &error);
+  if (response_body == NULL) {
+    g_debug ("rpc_request ERROR : %s", error->message);
     goto out;
   }
 
   g_debug ("received response to activate: %s", response_body);
 
-  if (_validate_response (response_body, "activated") != CHAMGE_RETURN_OK) {
+  if (_validate_response (status, response_body, "activated") != CHAMGE_RETURN_OK) {
     g_debug ("  received reponse must be [activated], but [%s]", response_body);
     goto out;
   }
 
-  self->activated = TRUE;
-
-  /* subscribe queue (queue name: hubId) for streaming start */
-  if (_amqp_rpc_subscribe (self->amqp_conn, amqp_channel, amqp_exchange_name,
-          hub_id, &error) == CHAMGE_RETURN_FAIL) {
-    g_debug ("rpc_subscribe ERROR [ch:%d][exchange:%s][hub_id:%s]",
-        amqp_channel, amqp_exchange_name, hub_id);
-    if (error != NULL)
-      g_debug ("    %s", error->message);
-    goto out;
-  }
-  /* process amqp message that comes from Mujachi */
-  self->process_id = g_idle_add ((GSourceFunc) _process_amqp_message, self);
-  ret = CHAMGE_RETURN_OK;
+  start.self = self;
+  start.hub_id = hub_id;
+  chamge_main_context_invoke_sync (self->context, _start_activated_func,
+      &start);
+  ret = start.ret;
 
 out:
   return ret;
@@ -917,10 +862,7 @@ chamge_amqp_hub_backend_deactivate (ChamgeHubBackend * hub_backend)
 {
   ChamgeAmqpHubBackend *self = CHAMGE_AMQP_HUB_BACKEND (hub_backend);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  chamge_main_context_invoke_sync (self->context, _stop_activated_func, self);
 
   return CHAMGE_RETURN_OK;
 }
@@ -958,123 +900,67 @@ chamge_amqp_hub_backend_user_command (ChamgeHubBackend *
     hub_backend, const gchar * cmd, gchar ** out, GError ** error)
 {
   ChamgeAmqpHubBackend *self = CHAMGE_AMQP_HUB_BACKEND (hub_backend);
-  g_autofree gchar *amqp_uri = NULL;
-  struct amqp_connection_info connection_info;
-  amqp_rpc_reply_t amqp_r;
-  amqp_connection_state_t amqp_conn;
-  amqp_socket_t *amqp_socket = NULL;
-
   g_autofree gchar *amqp_exchange_name = NULL;
-  gint amqp_channel = 0;
+  g_autofree gchar *queue_name = NULL;
+  ChamgeAmqpHeaders amqp_headers = { 0 };
+  ChamgeAmqpStatus status = CHAMGE_AMQP_STATUS_NONE;
   ChamgeReturn ret = CHAMGE_RETURN_FAIL;
 
-  amqp_uri = g_settings_get_string (self->settings, "amqp-uri");
-  g_assert_nonnull (amqp_uri);
-
-  if (amqp_parse_url (amqp_uri, &connection_info) != AMQP_STATUS_OK) {
+  queue_name = _get_queue_name (cmd);
+  if (queue_name == NULL) {
     g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "url pasring failure");
+        CHAMGE_BACKEND_ERROR_MISSING_PARAMETER,
+        "json parsing failure to get \"to\"");
     goto out;
   }
+  chamge_amqp_headers_add_string (&amqp_headers, CHAMGE_AMQP_HEADER_TARGET,
+      queue_name);
 
-  amqp_channel = g_settings_get_int (self->settings, "amqp-channel");
   amqp_exchange_name =
       g_settings_get_string (self->settings, "enroll-exchange-name");
 
-  g_debug ("[config] channel : %d, enroll-exchange-name : %s",
-      amqp_channel, amqp_exchange_name);
-
-  amqp_conn = amqp_new_connection ();
-  amqp_socket = amqp_tcp_socket_new (amqp_conn);
-  g_assert_nonnull (amqp_socket);
-
-  if (amqp_socket_open (amqp_socket,
-          connection_info.host, connection_info.port)) {
-    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "socket open failure");
+  *out = chamge_amqp_rpc_call (self->rpc, amqp_exchange_name, queue_name, cmd,
+      &amqp_headers, &status, error);
+  if (*out == NULL) {
+    g_debug ("rpc request failure >> %s",
+        error != NULL && *error != NULL ? (*error)->message : "no reply");
     goto out;
   }
+  ret = CHAMGE_RETURN_OK;
 
-  /* TODO: The authentication method should be EXTERNAL
-   * if we don't want to share user/passwd
-   */
-  amqp_r = amqp_login (amqp_conn, connection_info.vhost, 0, 131072, 0,
-      AMQP_SASL_METHOD_PLAIN, connection_info.user, connection_info.password);
-  if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-    g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "login failure >> %s",
-        _amqp_get_rpc_reply_string (amqp_r));
-    goto out;
-  }
-  if (!amqp_channel_open (amqp_conn, amqp_channel)) {
+  if (status != CHAMGE_AMQP_STATUS_NONE && status != CHAMGE_AMQP_STATUS_OK
+      && (error == NULL || *error == NULL)) {
     g_set_error (error, CHAMGE_BACKEND_ERROR,
-        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "channel open failure >> %s",
-        _amqp_get_rpc_reply_string (amqp_get_rpc_reply (amqp_conn)));
-    goto out;
-  }
-
-  g_debug ("success to login %s:%d/%s id[%s] pwd[%s]",
-      connection_info.host, connection_info.port,
-      connection_info.vhost, connection_info.user, connection_info.password);
-
-  ret =
-      _amqp_rpc_request (amqp_conn, amqp_channel, cmd,
-      amqp_exchange_name, _get_queue_name (cmd), out, error);
-  if (ret != CHAMGE_RETURN_OK && *error != NULL) {
-    g_debug ("rpc request failure >> %s", (*error)->message);
-    goto out;
-  }
-
-  if (amqp_conn != NULL) {
-    gint destroy_ret = 0;
-    amqp_r = amqp_channel_close (amqp_conn, amqp_channel, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "channel close failure >> %s",
-          _amqp_get_rpc_reply_string (amqp_r));
-      ret = CHAMGE_RETURN_FAIL;
-      goto out;
-    }
-    amqp_r = amqp_connection_close (amqp_conn, AMQP_REPLY_SUCCESS);
-    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
-          "connection close failure >> %s",
-          _amqp_get_rpc_reply_string (amqp_r));
-      ret = CHAMGE_RETURN_FAIL;
-      goto out;
-    }
-    destroy_ret = amqp_destroy_connection (amqp_conn);
-    if (destroy_ret < 0) {
-      g_set_error (error, CHAMGE_BACKEND_ERROR,
-          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
-          "connection destroy failure >> %s", amqp_error_string2 (destroy_ret));
-      ret = CHAMGE_RETURN_FAIL;
-      goto out;
-    }
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "user command failure >> status %d", status);
+    ret = CHAMGE_RETURN_FAIL;
   }
 
 out:
   return ret;
 }
 
-
-
 static void
 chamge_amqp_hub_backend_dispose (GObject * object)
 {
   ChamgeAmqpHubBackend *self = CHAMGE_AMQP_HUB_BACKEND (object);
 
-  if (self->process_id != 0) {
-    g_source_remove (self->process_id);
-    self->process_id = 0;
-  }
+  chamge_clear_source (&self->process_source);
+  chamge_clear_source (&self->heartbeat_source);
+
+  g_clear_pointer (&self->rpc, chamge_amqp_rpc_free);
+
+  g_clear_pointer (&self->hub_id, g_free);
+
+  g_clear_pointer (&self->replies, chamge_reply_cache_free);
 
   if (self->amqp_conn != NULL) {
     amqp_destroy_connection (self->amqp_conn);
     self->amqp_conn = NULL;
   }
 
+  g_clear_pointer (&self->context, g_main_context_unref);
+
   G_OBJECT_CLASS (chamge_amqp_hub_backend_parent_class)->dispose (object);
 }
 
@@ -1105,4 +991,19 @@ chamge_amqp_hub_backend_init (ChamgeAmqpHubBackend * self)
   self->amqp_socket = amqp_tcp_socket_new (self->amqp_conn);
 
   g_assert_nonnull (self->amqp_socket);
+
+  self->context = g_main_context_ref_thread_default ();
+
+  {
+    g_autofree gchar *amqp_uri =
+        g_settings_get_string (self->settings, "amqp-uri");
+
+    self->rpc = chamge_amqp_rpc_new (amqp_uri,
+        g_settings_get_int (self->settings, "amqp-channel"));
+  }
+
+  if (g_settings_get_uint (self->settings, "reply-cache-size") > 0)
+    self->replies =
+        chamge_reply_cache_new (g_settings_get_uint (self->settings,
+            "reply-cache-size"));
 }
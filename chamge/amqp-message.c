@@ -0,0 +1,395 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "amqp-message.h"
+#include "types.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/* upper bound of a decoded body, to refuse gzip bombs */
+#define MAX_DECODED_BODY_SIZE   (16 * 1024 * 1024)
+
+void
+chamge_amqp_headers_add_string (ChamgeAmqpHeaders * headers,
+    const gchar * key, const gchar * value)
+{
+  amqp_table_entry_t *entry;
+
+  g_return_if_fail (headers != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (value != NULL);
+  g_return_if_fail (headers->n_entries < CHAMGE_AMQP_HEADERS_MAX);
+
+  entry = &headers->entries[headers->n_entries++];
+  entry->key = amqp_cstring_bytes (key);
+  entry->value.kind = AMQP_FIELD_KIND_UTF8;
+  entry->value.value.bytes = amqp_cstring_bytes (value);
+}
+
+void
+chamge_amqp_headers_add_int (ChamgeAmqpHeaders * headers,
+    const gchar * key, gint32 value)
+{
+  amqp_table_entry_t *entry;
+
+  g_return_if_fail (headers != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (headers->n_entries < CHAMGE_AMQP_HEADERS_MAX);
+
+  entry = &headers->entries[headers->n_entries++];
+  entry->key = amqp_cstring_bytes (key);
+  entry->value.kind = AMQP_FIELD_KIND_I32;
+  entry->value.value.i32 = value;
+}
+
+void
+chamge_amqp_headers_apply (ChamgeAmqpHeaders * headers,
+    amqp_basic_properties_t * props)
+{
+  g_return_if_fail (headers != NULL);
+  g_return_if_fail (props != NULL);
+
+  if (headers->n_entries == 0)
+    return;
+
+  props->_flags |= AMQP_BASIC_HEADERS_FLAG;
+  props->headers.num_entries = headers->n_entries;
+  props->headers.entries = headers->entries;
+}
+
+static const amqp_field_value_t *
+_headers_lookup (const amqp_basic_properties_t * props, const gchar * key)
+{
+  gsize key_len = strlen (key);
+  gint i;
+
+  if (!(props->_flags & AMQP_BASIC_HEADERS_FLAG))
+    return NULL;
+
+  for (i = 0; i < props->headers.num_entries; i++) {
+    const amqp_table_entry_t *entry = &props->headers.entries[i];
+
+    if (entry->key.len == key_len
+        && memcmp (entry->key.bytes, key, key_len) == 0)
+      return &entry->value;
+  }
+
+  return NULL;
+}
+
+gboolean
+chamge_amqp_headers_get_bytes (const amqp_basic_properties_t * props,
+    const gchar * key, amqp_bytes_t * value)
+{
+  const amqp_field_value_t *field;
+
+  g_return_val_if_fail (props != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  field = _headers_lookup (props, key);
+  if (field == NULL || (field->kind != AMQP_FIELD_KIND_UTF8
+          && field->kind != AMQP_FIELD_KIND_BYTES))
+    return FALSE;
+
+  *value = field->value.bytes;
+  return TRUE;
+}
+
+gboolean
+chamge_amqp_headers_get_int (const amqp_basic_properties_t * props,
+    const gchar * key, gint * value)
+{
+  const amqp_field_value_t *field;
+
+  g_return_val_if_fail (props != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  field = _headers_lookup (props, key);
+  if (field == NULL)
+    return FALSE;
+
+  /* brokers and other clients may widen or narrow integer fields */
+  switch (field->kind) {
+    case AMQP_FIELD_KIND_I8:
+      *value = field->value.i8;
+      break;
+    case AMQP_FIELD_KIND_U8:
+      *value = field->value.u8;
+      break;
+    case AMQP_FIELD_KIND_I16:
+      *value = field->value.i16;
+      break;
+    case AMQP_FIELD_KIND_U16:
+      *value = field->value.u16;
+      break;
+    case AMQP_FIELD_KIND_I32:
+      *value = field->value.i32;
+      break;
+    case AMQP_FIELD_KIND_U32:
+      *value = (gint) field->value.u32;
+      break;
+    case AMQP_FIELD_KIND_I64:
+      *value = (gint) field->value.i64;
+      break;
+    default:
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+gchar *
+chamge_amqp_headers_dup_string (const amqp_basic_properties_t * props,
+    const gchar * key)
+{
+  amqp_bytes_t value;
+
+  if (!chamge_amqp_headers_get_bytes (props, key, &value) || value.len == 0)
+    return NULL;
+
+  return g_strndup (value.bytes, value.len);
+}
+
+ChamgeAmqpStatus
+chamge_amqp_message_get_status (const amqp_basic_properties_t * props)
+{
+  gint status = CHAMGE_AMQP_STATUS_NONE;
+
+  if (!chamge_amqp_headers_get_int (props, CHAMGE_AMQP_HEADER_STATUS, &status))
+    return CHAMGE_AMQP_STATUS_NONE;
+
+  return (ChamgeAmqpStatus) status;
+}
+
+ChamgeAmqpStatus
+chamge_amqp_status_from_return (ChamgeReturn ret, const GError * error)
+{
+  if (ret != CHAMGE_RETURN_FAIL)
+    return CHAMGE_AMQP_STATUS_OK;
+
+  if (g_error_matches (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_NOT_SUPPORTED))
+    return CHAMGE_AMQP_STATUS_NOT_IMPLEMENTED;
+
+  if (g_error_matches (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_BUSY))
+    return CHAMGE_AMQP_STATUS_SERVICE_UNAVAILABLE;
+
+  return CHAMGE_AMQP_STATUS_INTERNAL_ERROR;
+}
+
+gboolean
+chamge_amqp_status_is_final (ChamgeAmqpStatus status)
+{
+  return status != CHAMGE_AMQP_STATUS_TOO_MANY_REQUESTS
+      && status != CHAMGE_AMQP_STATUS_SERVICE_UNAVAILABLE;
+}
+
+gboolean
+chamge_amqp_message_accepts_encoding (const amqp_basic_properties_t * props,
+    const gchar * encoding)
+{
+  amqp_bytes_t value;
+  g_autofree gchar *accepted = NULL;
+  g_auto (GStrv) tokens = NULL;
+  gchar **token;
+
+  g_return_val_if_fail (props != NULL, FALSE);
+  g_return_val_if_fail (encoding != NULL, FALSE);
+
+  if (!chamge_amqp_headers_get_bytes (props,
+          CHAMGE_AMQP_HEADER_ACCEPT_ENCODING, &value))
+    return FALSE;
+
+  accepted = g_strndup (value.bytes, value.len);
+  tokens = g_strsplit (accepted, ",", -1);
+
+  for (token = tokens; *token != NULL; token++) {
+    if (g_ascii_strcasecmp (g_strstrip (*token), encoding) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static GByteArray *
+_convert (GConverter * converter, const guint8 * data, gsize len,
+    GError ** error)
+{
+  g_autoptr (GByteArray) out = g_byte_array_sized_new (MAX (len, 256));
+  guint8 buf[4096];
+  gsize consumed = 0;
+
+  for (;;) {
+    gsize bytes_read = 0;
+    gsize bytes_written = 0;
+    GConverterResult res;
+
+    res = g_converter_convert (converter, data + consumed, len - consumed,
+        buf, sizeof (buf), G_CONVERTER_INPUT_AT_END, &bytes_read,
+        &bytes_written, error);
+    if (res == G_CONVERTER_ERROR)
+      return NULL;
+
+    consumed += bytes_read;
+    g_byte_array_append (out, buf, bytes_written);
+
+    if (out->len > MAX_DECODED_BODY_SIZE) {
+      g_set_error (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_INVALID_PARAMETER,
+          "converted body exceeds %d bytes", MAX_DECODED_BODY_SIZE);
+      return NULL;
+    }
+
+    if (res == G_CONVERTER_FINISHED)
+      break;
+  }
+
+  return g_steal_pointer (&out);
+}
+
+GBytes *
+chamge_amqp_message_encode_body (const gchar * body, guint threshold,
+    gboolean compress, amqp_basic_properties_t * props)
+{
+  g_autoptr (GZlibCompressor) compressor = NULL;
+  g_autoptr (GError) error = NULL;
+  GByteArray *compressed = NULL;
+  gsize len;
+
+  g_return_val_if_fail (body != NULL, NULL);
+  g_return_val_if_fail (props != NULL, NULL);
+
+  len = strlen (body);
+
+  /* threshold 0 turns compression off */
+  if (!compress || threshold == 0 || len <= threshold)
+    return g_bytes_new (body, len);
+
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+  compressed = _convert (G_CONVERTER (compressor), (const guint8 *) body, len,
+      &error);
+  if (compressed == NULL) {
+    g_debug ("failed to compress body: %s", error->message);
+    return g_bytes_new (body, len);
+  }
+
+  if (compressed->len >= len) {
+    g_byte_array_unref (compressed);
+    return g_bytes_new (body, len);
+  }
+
+  g_debug ("compressed body %" G_GSIZE_FORMAT " -> %u bytes", len,
+      compressed->len);
+
+  props->_flags |= AMQP_BASIC_CONTENT_ENCODING_FLAG;
+  props->content_encoding = amqp_cstring_bytes (CHAMGE_AMQP_ENCODING_GZIP);
+
+  return g_byte_array_free_to_bytes (compressed);
+}
+
+gchar *
+chamge_amqp_message_decode_body (const amqp_message_t * message,
+    GError ** error)
+{
+  const amqp_basic_properties_t *props;
+  g_autoptr (GZlibDecompressor) decompressor = NULL;
+  GByteArray *decoded = NULL;
+  guint8 nul = 0;
+
+  g_return_val_if_fail (message != NULL, NULL);
+
+  props = &message->properties;
+
+  if (!(props->_flags & AMQP_BASIC_CONTENT_ENCODING_FLAG)
+      || props->content_encoding.len == 0
+      || (props->content_encoding.len == strlen ("identity")
+          && g_ascii_strncasecmp (props->content_encoding.bytes, "identity",
+              props->content_encoding.len) == 0)) {
+    return g_strndup (message->body.bytes, message->body.len);
+  }
+
+  if (props->content_encoding.len != strlen (CHAMGE_AMQP_ENCODING_GZIP)
+      || g_ascii_strncasecmp (props->content_encoding.bytes,
+          CHAMGE_AMQP_ENCODING_GZIP, props->content_encoding.len) != 0) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER,
+        "unsupported content encoding %.*s",
+        (gint) props->content_encoding.len,
+        (gchar *) props->content_encoding.bytes);
+    return NULL;
+  }
+
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  decoded = _convert (G_CONVERTER (decompressor), message->body.bytes,
+      message->body.len, error);
+  if (decoded == NULL)
+    return NULL;
+
+  g_byte_array_append (decoded, &nul, 1);
+
+  return (gchar *) g_byte_array_free (decoded, FALSE);
+}
+
+amqp_bytes_t
+chamge_amqp_bytes_from_gbytes (GBytes * bytes)
+{
+  amqp_bytes_t amqp_bytes;
+  gsize size = 0;
+
+  amqp_bytes.bytes = (void *) g_bytes_get_data (bytes, &size);
+  amqp_bytes.len = size;
+
+  return amqp_bytes;
+}
+
+gboolean
+chamge_amqp_publish_oneway (amqp_connection_state_t conn, guint channel,
+    const gchar * exchange, const gchar * routing_key, const gchar * body,
+    ChamgeAmqpHeaders * headers, GError ** error)
+{
+  amqp_basic_properties_t props = { 0 };
+  gint r;
+
+  g_return_val_if_fail (conn != NULL, FALSE);
+  g_return_val_if_fail (routing_key != NULL, FALSE);
+  g_return_val_if_fail (body != NULL, FALSE);
+
+  props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG;
+  props.content_type = amqp_cstring_bytes ("application/json");
+
+  if (headers != NULL)
+    chamge_amqp_headers_apply (headers, &props);
+
+  r = amqp_basic_publish (conn, channel,
+      amqp_cstring_bytes (exchange != NULL ? exchange : ""),
+      amqp_cstring_bytes (routing_key), 0, 0, &props,
+      amqp_cstring_bytes (body));
+  if (r < 0) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "publish failure >> %s",
+        amqp_error_string2 (r));
+    return FALSE;
+  }
+
+  return TRUE;
+}
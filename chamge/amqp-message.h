@@ -0,0 +1,119 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_AMQP_MESSAGE_H__
+#define __CHAMGE_AMQP_MESSAGE_H__
+
+#include <amqp.h>
+#include <glib-object.h>
+#include <chamge/types.h>
+
+G_BEGIN_DECLS
+
+#define CHAMGE_AMQP_ENCODING_GZIP               "gzip"
+
+#define CHAMGE_AMQP_HEADER_ACCEPT_ENCODING      "accept-encoding"
+
+/* routing metadata, so that brokers and peers do not parse a body to route */
+#define CHAMGE_AMQP_HEADER_METHOD               "x-chamge-method"
+#define CHAMGE_AMQP_HEADER_DEVICE_TYPE          "x-chamge-device-type"
+#define CHAMGE_AMQP_HEADER_DEVICE_ID            "x-chamge-device-id"
+#define CHAMGE_AMQP_HEADER_TARGET               "x-chamge-target"
+#define CHAMGE_AMQP_HEADER_STATUS               "x-chamge-status"
+
+#define CHAMGE_AMQP_HEADERS_MAX                 8
+
+/* HTTP-like status codes carried by CHAMGE_AMQP_HEADER_STATUS of a reply */
+typedef enum {
+  CHAMGE_AMQP_STATUS_NONE = 0,
+  CHAMGE_AMQP_STATUS_OK = 200,
+  CHAMGE_AMQP_STATUS_BAD_REQUEST = 400,
+  CHAMGE_AMQP_STATUS_NOT_FOUND = 404,
+  CHAMGE_AMQP_STATUS_TOO_MANY_REQUESTS = 429,
+  CHAMGE_AMQP_STATUS_INTERNAL_ERROR = 500,
+  CHAMGE_AMQP_STATUS_NOT_IMPLEMENTED = 501,
+  CHAMGE_AMQP_STATUS_SERVICE_UNAVAILABLE = 503,
+} ChamgeAmqpStatus;
+
+typedef struct _ChamgeAmqpHeaders ChamgeAmqpHeaders;
+
+/* header entries only borrow key and value strings, so a ChamgeAmqpHeaders
+ * on the stack must outlive the amqp_basic_publish () call it is used for */
+struct _ChamgeAmqpHeaders
+{
+  amqp_table_entry_t entries[CHAMGE_AMQP_HEADERS_MAX];
+  gint n_entries;
+};
+
+void                    chamge_amqp_headers_add_string  (ChamgeAmqpHeaders      *headers,
+                                                         const gchar            *key,
+                                                         const gchar            *value);
+
+void                    chamge_amqp_headers_add_int     (ChamgeAmqpHeaders      *headers,
+                                                         const gchar            *key,
+                                                         gint32                  value);
+
+void                    chamge_amqp_headers_apply       (ChamgeAmqpHeaders      *headers,
+                                                         amqp_basic_properties_t *props);
+
+gboolean                chamge_amqp_headers_get_bytes   (const amqp_basic_properties_t *props,
+                                                         const gchar            *key,
+                                                         amqp_bytes_t           *value);
+
+gboolean                chamge_amqp_headers_get_int     (const amqp_basic_properties_t *props,
+                                                         const gchar            *key,
+                                                         gint                   *value);
+
+gchar *                 chamge_amqp_headers_dup_string  (const amqp_basic_properties_t *props,
+                                                         const gchar            *key);
+
+ChamgeAmqpStatus        chamge_amqp_message_get_status  (const amqp_basic_properties_t *props);
+
+ChamgeAmqpStatus        chamge_amqp_status_from_return  (ChamgeReturn            ret,
+                                                         const GError           *error);
+
+/* FALSE for a status which asks to try again later, so that the reply is not
+ * worth remembering */
+gboolean                chamge_amqp_status_is_final     (ChamgeAmqpStatus        status);
+
+gboolean                chamge_amqp_message_accepts_encoding
+                                                        (const amqp_basic_properties_t *props,
+                                                         const gchar            *encoding);
+
+GBytes *                chamge_amqp_message_encode_body (const gchar            *body,
+                                                         guint                   threshold,
+                                                         gboolean                compress,
+                                                         amqp_basic_properties_t *props);
+
+gchar *                 chamge_amqp_message_decode_body (const amqp_message_t   *message,
+                                                         GError                **error);
+
+amqp_bytes_t            chamge_amqp_bytes_from_gbytes   (GBytes                 *bytes);
+
+/* publishes a JSON message which expects no reply */
+gboolean                chamge_amqp_publish_oneway      (amqp_connection_state_t conn,
+                                                         guint                   channel,
+                                                         const gchar            *exchange,
+                                                         const gchar            *routing_key,
+                                                         const gchar            *body,
+                                                         ChamgeAmqpHeaders      *headers,
+                                                         GError                **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_AMQP_MESSAGE_H__
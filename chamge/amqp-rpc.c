@@ -0,0 +1,500 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "amqp-rpc.h"
+#include "types.h"
+
+#include <amqp_tcp_socket.h>
+#include <string.h>
+
+#define DEFAULT_CONTENT_TYPE "application/json"
+
+#define RPC_TIMEOUT_SECONDS     4
+#define RPC_ATTEMPTS            3
+
+/* how long a wait for a reply goes without checking for a cancellation */
+#define RPC_POLL_USEC           (200 * G_TIME_SPAN_MILLISECOND)
+
+struct _ChamgeAmqpRpc
+{
+  gchar *uri;
+  guint channel;
+
+  /* used by the thread of @pool only */
+  amqp_connection_state_t conn;
+  amqp_bytes_t reply_queue;
+
+  /* cancels the requests in flight and queued once the connection is freed */
+  GCancellable *closing;
+
+  GThreadPool *pool;
+};
+
+typedef struct
+{
+  gchar *exchange;
+  gchar *routing_key;
+  gchar *request;
+
+  /* kept by the retries, so that the peer answers a retry from its cache if
+   * it has handled the request already */
+  gchar *correlation_id;
+
+  /* refers to @strings only */
+  ChamgeAmqpHeaders headers;
+  GPtrArray *strings;
+
+  gboolean replied;
+  ChamgeAmqpStatus status;
+} RpcCall;
+
+static void
+rpc_call_free (RpcCall * call)
+{
+  g_free (call->exchange);
+  g_free (call->routing_key);
+  g_free (call->request);
+  g_free (call->correlation_id);
+  g_ptr_array_unref (call->strings);
+  g_free (call);
+}
+
+static amqp_bytes_t
+_keep_bytes (RpcCall * call, amqp_bytes_t bytes)
+{
+  gchar *str = g_strndup (bytes.bytes, bytes.len);
+
+  g_ptr_array_add (call->strings, str);
+  return amqp_cstring_bytes (str);
+}
+
+static const gchar *
+_amqp_rpc_reply_string (amqp_rpc_reply_t r)
+{
+  switch (r.reply_type) {
+    case AMQP_RESPONSE_NORMAL:
+      return "normal response";
+
+    case AMQP_RESPONSE_NONE:
+      return "missing RPC reply type";
+
+    case AMQP_RESPONSE_LIBRARY_EXCEPTION:
+      return amqp_error_string2 (r.library_error);
+
+    case AMQP_RESPONSE_SERVER_EXCEPTION:
+      return "server exception";
+
+    default:
+      return "unknown reply type";
+  }
+}
+
+static void
+_disconnect (ChamgeAmqpRpc * self)
+{
+  if (self->conn == NULL)
+    return;
+
+  amqp_destroy_connection (self->conn);
+  self->conn = NULL;
+
+  amqp_bytes_free (self->reply_queue);
+  self->reply_queue = amqp_empty_bytes;
+}
+
+/* a reply queue lives as long as the connection, and replies which come too
+ * late for their request are told apart by the correlation id */
+static gboolean
+_connect (ChamgeAmqpRpc * self, GError ** error)
+{
+  struct amqp_connection_info connection_info = { 0 };
+  g_autofree gchar *url = g_strdup (self->uri);
+  amqp_queue_declare_ok_t *declared;
+  amqp_socket_t *amqp_socket;
+  amqp_rpc_reply_t amqp_r;
+
+  if (self->conn != NULL)
+    return TRUE;
+
+  if (amqp_parse_url (url, &connection_info) != AMQP_STATUS_OK) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "url parsing failure");
+    return FALSE;
+  }
+
+  self->conn = amqp_new_connection ();
+  amqp_socket = amqp_tcp_socket_new (self->conn);
+  if (amqp_socket == NULL || amqp_socket_open (amqp_socket,
+          connection_info.host, connection_info.port)) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "socket open failure");
+    goto failed;
+  }
+
+  amqp_r = amqp_login (self->conn, connection_info.vhost, 0, 131072, 0,
+      AMQP_SASL_METHOD_PLAIN, connection_info.user, connection_info.password);
+  if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "login failure >> %s",
+        _amqp_rpc_reply_string (amqp_r));
+    goto failed;
+  }
+
+  if (!amqp_channel_open (self->conn, self->channel)) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "channel open failure >> %s",
+        _amqp_rpc_reply_string (amqp_get_rpc_reply (self->conn)));
+    goto failed;
+  }
+
+  declared = amqp_queue_declare (self->conn, self->channel, amqp_empty_bytes,
+      0, 0, 1, 1, amqp_empty_table);
+  if (declared == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "declare queue failure >> %s",
+        _amqp_rpc_reply_string (amqp_get_rpc_reply (self->conn)));
+    goto failed;
+  }
+  self->reply_queue = amqp_bytes_malloc_dup (declared->queue);
+
+  if (amqp_basic_consume (self->conn, self->channel, self->reply_queue,
+          amqp_empty_bytes, 0, 1, 1, amqp_empty_table) == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "basic consume failure >> %s",
+        _amqp_rpc_reply_string (amqp_get_rpc_reply (self->conn)));
+    goto failed;
+  }
+
+  g_debug ("rpc connection to %s:%d/%s, replies to %.*s",
+      connection_info.host, connection_info.port, connection_info.vhost,
+      (gint) self->reply_queue.len, (gchar *) self->reply_queue.bytes);
+
+  return TRUE;
+
+failed:
+  _disconnect (self);
+  return FALSE;
+}
+
+static gboolean
+_is_reply_to (const amqp_envelope_t * envelope, const gchar * correlation_id)
+{
+  const amqp_basic_properties_t *props = &envelope->message.properties;
+
+  return (props->_flags & AMQP_BASIC_CORRELATION_ID_FLAG)
+      && props->correlation_id.len == strlen (correlation_id)
+      && memcmp (props->correlation_id.bytes, correlation_id,
+      props->correlation_id.len) == 0;
+}
+
+static gboolean
+_is_cancelled (ChamgeAmqpRpc * self, GCancellable * cancellable,
+    GError ** error)
+{
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return TRUE;
+
+  if (g_cancellable_is_cancelled (self->closing)) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+        "the connection is closed");
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gchar *
+_request (ChamgeAmqpRpc * self, RpcCall * call, GCancellable * cancellable,
+    GError ** error)
+{
+  amqp_basic_properties_t amqp_props = { 0 };
+  ChamgeAmqpHeaders amqp_headers = call->headers;
+  gchar *response = NULL;
+  gint64 deadline;
+  gint r;
+
+  if (!_connect (self, error))
+    return NULL;
+
+  /* the request would be lost without the queue */
+  if (amqp_queue_declare (self->conn, self->channel,
+          amqp_cstring_bytes (call->routing_key), 1, 0, 0, 1,
+          amqp_empty_table) == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
+        "passive queue declare failure >> %s",
+        _amqp_rpc_reply_string (amqp_get_rpc_reply (self->conn)));
+    goto failed;
+  }
+
+  amqp_props._flags =
+      AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG |
+      AMQP_BASIC_REPLY_TO_FLAG | AMQP_BASIC_CORRELATION_ID_FLAG;
+  amqp_props.content_type = amqp_cstring_bytes (DEFAULT_CONTENT_TYPE);
+  amqp_props.delivery_mode = 2; /* persistent delivery mode */
+  amqp_props.reply_to = self->reply_queue;
+
+  amqp_props.correlation_id = amqp_cstring_bytes (call->correlation_id);
+
+  /* let the peer compress a large reply */
+  chamge_amqp_headers_add_string (&amqp_headers,
+      CHAMGE_AMQP_HEADER_ACCEPT_ENCODING, CHAMGE_AMQP_ENCODING_GZIP);
+  chamge_amqp_headers_apply (&amqp_headers, &amqp_props);
+
+  r = amqp_basic_publish (self->conn, self->channel,
+      amqp_cstring_bytes (call->exchange != NULL ? call->exchange : ""),
+      amqp_cstring_bytes (call->routing_key), 0, 0, &amqp_props,
+      amqp_cstring_bytes (call->request));
+  if (r < 0) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "publish failure >> %s",
+        amqp_error_string2 (r));
+    goto failed;
+  }
+
+  g_debug ("published to queue[%s], exchange[%s], request[%s]",
+      call->routing_key, call->exchange, call->request);
+
+  deadline = g_get_monotonic_time () + RPC_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+
+  while (response == NULL) {
+    amqp_rpc_reply_t amqp_r;
+    amqp_envelope_t envelope;
+    struct timeval timeout = { 0, };
+    gint64 remaining = deadline - g_get_monotonic_time ();
+
+    if (_is_cancelled (self, cancellable, error))
+      return NULL;
+
+    if (remaining <= 0) {
+      g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg timeout");
+      return NULL;
+    }
+
+    remaining = MIN (remaining, RPC_POLL_USEC);
+    timeout.tv_sec = remaining / G_USEC_PER_SEC;
+    timeout.tv_usec = remaining % G_USEC_PER_SEC;
+
+    amqp_maybe_release_buffers (self->conn);
+    amqp_r = amqp_consume_message (self->conn, &envelope, &timeout, 0);
+
+    if (amqp_r.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
+        && amqp_r.library_error == AMQP_STATUS_TIMEOUT)
+      continue;
+
+    if (amqp_r.reply_type != AMQP_RESPONSE_NORMAL) {
+      g_set_error (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "consume msg failure >> %s",
+          _amqp_rpc_reply_string (amqp_r));
+      goto failed;
+    }
+
+    /* only replies come to the queue, so that nothing else is lost here; a
+     * late reply to an earlier attempt answers this one as well */
+    if (!_is_reply_to (&envelope, call->correlation_id)) {
+      g_debug ("discard >> a reply to an earlier request");
+      amqp_destroy_envelope (&envelope);
+      continue;
+    }
+
+    call->replied = TRUE;
+    response = chamge_amqp_message_decode_body (&envelope.message, error);
+    call->status = chamge_amqp_message_get_status (&envelope.message.properties);
+    amqp_destroy_envelope (&envelope);
+
+    if (response == NULL)
+      return NULL;
+  }
+
+  return response;
+
+failed:
+  /* a closed channel is opened again with the next request */
+  _disconnect (self);
+  return NULL;
+}
+
+static void
+_rpc_thread_func (gpointer data, gpointer user_data)
+{
+  ChamgeAmqpRpc *self = user_data;
+  GTask *task = data;
+  RpcCall *call = g_task_get_task_data (task);
+  GError *error = NULL;
+  gchar *response = NULL;
+  guint attempt;
+
+  /* a request which is lost on the way or whose reply is, is sent again with
+   * the same correlation id */
+  for (attempt = 0; attempt < RPC_ATTEMPTS && response == NULL
+      && !call->replied; attempt++) {
+    if (attempt > 0) {
+      g_debug ("retrying >> %s", error->message);
+      g_clear_error (&error);
+    }
+
+    if (_is_cancelled (self, g_task_get_cancellable (task), &error))
+      break;
+
+    response = _request (self, call, g_task_get_cancellable (task), &error);
+    if (response == NULL && error == NULL)
+      break;
+  }
+
+  if (response == NULL) {
+    if (error == NULL)
+      g_set_error_literal (&error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "no reply is received");
+    g_task_return_error (task, error);
+  } else {
+    g_task_return_pointer (task, response, g_free);
+  }
+
+  g_object_unref (task);
+}
+
+ChamgeAmqpRpc *
+chamge_amqp_rpc_new (const gchar * uri, guint channel)
+{
+  ChamgeAmqpRpc *self;
+
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (channel != 0, NULL);
+
+  self = g_new0 (ChamgeAmqpRpc, 1);
+  self->uri = g_strdup (uri);
+  self->channel = channel;
+  self->closing = g_cancellable_new ();
+
+  /* a single thread keeps the connection to itself and the requests in
+   * order */
+  self->pool = g_thread_pool_new (_rpc_thread_func, self, 1, TRUE, NULL);
+  g_assert_nonnull (self->pool);
+
+  return self;
+}
+
+void
+chamge_amqp_rpc_free (ChamgeAmqpRpc * self)
+{
+  if (self == NULL)
+    return;
+
+  /* the queued requests are answered at once rather than sent, and the one in
+   * flight stops waiting for its reply */
+  g_cancellable_cancel (self->closing);
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+  _disconnect (self);
+
+  g_object_unref (self->closing);
+  g_free (self->uri);
+  g_free (self);
+}
+
+void
+chamge_amqp_rpc_call_async (ChamgeAmqpRpc * self, const gchar * exchange,
+    const gchar * routing_key, const gchar * request,
+    const ChamgeAmqpHeaders * headers, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  GTask *task;
+  RpcCall *call;
+  gint i;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (routing_key != NULL);
+  g_return_if_fail (request != NULL);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chamge_amqp_rpc_call_async);
+
+  call = g_new0 (RpcCall, 1);
+  call->exchange = g_strdup (exchange);
+  call->routing_key = g_strdup (routing_key);
+  call->request = g_strdup (request);
+  call->correlation_id = g_uuid_string_random ();
+  call->strings = g_ptr_array_new_with_free_func (g_free);
+
+  if (headers != NULL) {
+    call->headers = *headers;
+    for (i = 0; i < call->headers.n_entries; i++) {
+      amqp_table_entry_t *entry = &call->headers.entries[i];
+
+      entry->key = _keep_bytes (call, entry->key);
+      if (entry->value.kind == AMQP_FIELD_KIND_UTF8)
+        entry->value.value.bytes = _keep_bytes (call, entry->value.value.bytes);
+    }
+  }
+
+  g_task_set_task_data (task, call, (GDestroyNotify) rpc_call_free);
+
+  /* released by the thread */
+  g_thread_pool_push (self->pool, task, NULL);
+}
+
+gchar *
+chamge_amqp_rpc_call_finish (ChamgeAmqpRpc * self, GAsyncResult * result,
+    ChamgeAmqpStatus * status, GError ** error)
+{
+  RpcCall *call;
+
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+          chamge_amqp_rpc_call_async), NULL);
+
+  call = g_task_get_task_data (G_TASK (result));
+  if (status != NULL)
+    *status = call->status;
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+_call_sync_cb (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  GAsyncResult **out = user_data;
+
+  *out = g_object_ref (result);
+}
+
+gchar *
+chamge_amqp_rpc_call (ChamgeAmqpRpc * self, const gchar * exchange,
+    const gchar * routing_key, const gchar * request,
+    const ChamgeAmqpHeaders * headers, ChamgeAmqpStatus * status,
+    GError ** error)
+{
+  g_autoptr (GMainContext) context = g_main_context_new ();
+  g_autoptr (GAsyncResult) result = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  /* nothing else in the thread is dispatched meanwhile */
+  g_main_context_push_thread_default (context);
+
+  chamge_amqp_rpc_call_async (self, exchange, routing_key, request, headers,
+      NULL, _call_sync_cb, &result);
+  while (result == NULL)
+    g_main_context_iteration (context, TRUE);
+
+  g_main_context_pop_thread_default (context);
+
+  return chamge_amqp_rpc_call_finish (self, result, status, error);
+}
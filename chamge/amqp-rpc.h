@@ -0,0 +1,68 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_AMQP_RPC_H__
+#define __CHAMGE_AMQP_RPC_H__
+
+#include <gio/gio.h>
+#include <chamge/amqp-message.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ChamgeAmqpRpc ChamgeAmqpRpc;
+
+/* a connection of its own to the broker at @uri, logged in on the first
+ * request and used by a thread of its own only, so that a request blocks
+ * neither a main loop nor the consumer of another connection; it may be used
+ * from any thread */
+ChamgeAmqpRpc          *chamge_amqp_rpc_new             (const gchar            *uri,
+                                                         guint                   channel);
+
+/* cancels the requests in flight and queued, and waits for them to stop */
+void                    chamge_amqp_rpc_free            (ChamgeAmqpRpc          *self);
+
+/* sends @request to @routing_key through @exchange with a private reply
+ * queue, and again with the same correlation id if no reply comes in time;
+ * @headers and the strings they refer to are copied */
+void                    chamge_amqp_rpc_call_async      (ChamgeAmqpRpc          *self,
+                                                         const gchar            *exchange,
+                                                         const gchar            *routing_key,
+                                                         const gchar            *request,
+                                                         const ChamgeAmqpHeaders *headers,
+                                                         GCancellable           *cancellable,
+                                                         GAsyncReadyCallback     callback,
+                                                         gpointer                user_data);
+
+/* returns the body of the reply and its status, or NULL if none came */
+gchar                  *chamge_amqp_rpc_call_finish     (ChamgeAmqpRpc          *self,
+                                                         GAsyncResult           *result,
+                                                         ChamgeAmqpStatus       *status,
+                                                         GError                **error);
+
+/* blocks the calling thread only */
+gchar                  *chamge_amqp_rpc_call            (ChamgeAmqpRpc          *self,
+                                                         const gchar            *exchange,
+                                                         const gchar            *routing_key,
+                                                         const gchar            *request,
+                                                         const ChamgeAmqpHeaders *headers,
+                                                         ChamgeAmqpStatus       *status,
+                                                         GError                **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_AMQP_RPC_H__
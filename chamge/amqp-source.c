@@ -101,17 +101,96 @@ chamge_amqp_source_new (amqp_connection_state_t state)
   return source;
 }
 
-guint
-chamge_amqp_add_watch (amqp_connection_state_t state, ChamgeAmqpFunc callback,
-    gpointer data)
+GSource *
+chamge_amqp_add_watch (amqp_connection_state_t state, GMainContext * context,
+    ChamgeAmqpFunc callback, gpointer data)
 {
-  g_autoptr (GSource) source = NULL;
+  GSource *source;
 
-  g_return_val_if_fail (callback != NULL, 0);
+  g_return_val_if_fail (callback != NULL, NULL);
 
   source = chamge_amqp_source_new (state);
 
   g_source_set_callback (source, (GSourceFunc) callback, data, NULL);
+  g_source_attach (source, context);
+
+  return source;
+}
+
+GSource *
+chamge_timeout_add_seconds (GMainContext * context, guint interval,
+    GSourceFunc function, gpointer data)
+{
+  GSource *source = g_timeout_source_new_seconds (interval);
+
+  g_source_set_callback (source, function, data, NULL);
+  g_source_attach (source, context);
+
+  return source;
+}
+
+GSource *
+chamge_idle_add (GMainContext * context, GSourceFunc function, gpointer data)
+{
+  GSource *source = g_idle_source_new ();
+
+  g_source_set_callback (source, function, data, NULL);
+  g_source_attach (source, context);
+
+  return source;
+}
+
+void
+chamge_clear_source (GSource ** source)
+{
+  if (*source == NULL)
+    return;
+
+  g_source_destroy (*source);
+  g_clear_pointer (source, g_source_unref);
+}
+
+typedef struct
+{
+  GSourceFunc function;
+  gpointer data;
+
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+} InvokeSync;
+
+static gboolean
+_invoke_sync_func (gpointer user_data)
+{
+  InvokeSync *invoke = user_data;
+
+  invoke->function (invoke->data);
+
+  g_mutex_lock (&invoke->lock);
+  invoke->done = TRUE;
+  g_cond_signal (&invoke->cond);
+  g_mutex_unlock (&invoke->lock);
+
+  return G_SOURCE_REMOVE;
+}
+
+void
+chamge_main_context_invoke_sync (GMainContext * context, GSourceFunc function,
+    gpointer data)
+{
+  InvokeSync invoke = { function, data };
+
+  g_mutex_init (&invoke.lock);
+  g_cond_init (&invoke.cond);
+
+  g_main_context_invoke (context, _invoke_sync_func, &invoke);
+
+  g_mutex_lock (&invoke.lock);
+  while (!invoke.done)
+    g_cond_wait (&invoke.cond, &invoke.lock);
+  g_mutex_unlock (&invoke.lock);
 
-  return g_source_attach (source, NULL);
+  g_cond_clear (&invoke.cond);
+  g_mutex_clear (&invoke.lock);
 }
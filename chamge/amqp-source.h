@@ -29,10 +29,31 @@ typedef gboolean        (*ChamgeAmqpFunc)               (amqp_connection_state_t
                                                          amqp_envelope_t       *envelope,
                                                          gpointer               user_data);
 
-guint                   chamge_amqp_add_watch           (amqp_connection_state_t state,
+/* the sources below are attached to @context, or to the global default
+ * context if it is %NULL, and returned with a reference */
+GSource                *chamge_amqp_add_watch           (amqp_connection_state_t state,
+                                                         GMainContext          *context,
                                                          ChamgeAmqpFunc         callback,
                                                          gpointer               data);
 
+GSource                *chamge_timeout_add_seconds      (GMainContext          *context,
+                                                         guint                  interval,
+                                                         GSourceFunc            function,
+                                                         gpointer               data);
+
+GSource                *chamge_idle_add                 (GMainContext          *context,
+                                                         GSourceFunc            function,
+                                                         gpointer               data);
+
+/* destroys and releases *@source, if any, from any thread */
+void                    chamge_clear_source             (GSource              **source);
+
+/* calls @function in @context and waits for it to return; a caller running
+ * @context calls it right away */
+void                    chamge_main_context_invoke_sync (GMainContext          *context,
+                                                         GSourceFunc            function,
+                                                         gpointer               data);
+
 G_END_DECLS
 
 #endif // __CHAMGE_AMQP_SOURCE_H__
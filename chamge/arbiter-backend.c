@@ -22,6 +22,7 @@
 #include "arbiter-backend.h"
 
 #include "arbiter.h"
+#include "command.h"
 #include "enumtypes.h"
 
 #include "mock-arbiter-backend.h"
@@ -184,6 +185,32 @@ chamge_arbiter_backend_dispose (GObject * object)
   G_OBJECT_CLASS (chamge_arbiter_backend_parent_class)->dispose (object);
 }
 
+/* backends without a typed path go through the JSON user command */
+static ChamgeReturn
+chamge_arbiter_backend_send_command_default (ChamgeArbiterBackend * self,
+    const gchar * target, const gchar * method, GVariant * arguments,
+    GVariant ** reply, GError ** error)
+{
+  ChamgeArbiterBackendClass *klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+  g_autofree gchar *cmd = NULL;
+  g_autofree gchar *response = NULL;
+  ChamgeReturn ret;
+
+  if (klass->user_command == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_NOT_SUPPORTED, "commands are not supported");
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  cmd = chamge_command_to_json (target, method, arguments);
+  ret = klass->user_command (self, cmd, &response, error);
+
+  if (reply != NULL && response != NULL)
+    *reply = chamge_command_reply_from_json (response, NULL);
+
+  return ret;
+}
+
 static void
 chamge_arbiter_backend_class_init (ChamgeArbiterBackendClass * klass)
 {
@@ -205,6 +232,8 @@ chamge_arbiter_backend_class_init (ChamgeArbiterBackendClass * klass)
 
   klass->hub_enrolled = chamge_arbiter_backend_hub_enrolled;
   klass->hub_delisted = chamge_arbiter_backend_hub_delisted;
+
+  klass->send_command = chamge_arbiter_backend_send_command_default;
 }
 
 static void
@@ -306,6 +335,30 @@ chamge_arbiter_backend_user_command (ChamgeArbiterBackend * self,
   return klass->user_command (self, cmd, out, error);
 }
 
+ChamgeReturn
+chamge_arbiter_backend_send_command (ChamgeArbiterBackend * self,
+    const gchar * target, const gchar * method, GVariant * arguments,
+    GVariant ** reply, GError ** error)
+{
+  ChamgeArbiterBackendClass *klass;
+  g_return_val_if_fail (CHAMGE_IS_ARBITER_BACKEND (self), CHAMGE_RETURN_FAIL);
+
+  klass = CHAMGE_ARBITER_BACKEND_GET_CLASS (self);
+  g_return_val_if_fail (klass->send_command != NULL, CHAMGE_RETURN_FAIL);
+
+  return klass->send_command (self, target, method, arguments, reply, error);
+}
+
+ChamgeRegistry *
+chamge_arbiter_backend_get_registry (ChamgeArbiterBackend * self)
+{
+  ChamgeArbiterBackendPrivate *priv =
+      chamge_arbiter_backend_get_instance_private (self);
+
+  g_return_val_if_fail (CHAMGE_IS_ARBITER_BACKEND (self), NULL);
+
+  return chamge_arbiter_get_registry (priv->arbiter);
+}
 
 void
 chamge_arbiter_backend_approve (ChamgeArbiterBackend * self,
@@ -47,6 +47,12 @@ struct _ChamgeArbiterBackendClass
                                                  const gchar           *cmd,
                                                  gchar                **out,
                                                  GError               **error);
+  ChamgeReturn  (* send_command)                (ChamgeArbiterBackend  *self,
+                                                 const gchar           *target,
+                                                 const gchar           *method,
+                                                 GVariant              *arguments,
+                                                 GVariant             **reply,
+                                                 GError               **error);
 
   void          (* approve)                     (ChamgeArbiterBackend  *self,
                                                  const gchar           *edge_id);
@@ -84,6 +90,17 @@ ChamgeReturn    chamge_arbiter_backend_user_command
                                                  gchar                **out,
                                                  GError               **error);
 
+ChamgeReturn    chamge_arbiter_backend_send_command
+                                                (ChamgeArbiterBackend  *self,
+                                                 const gchar           *target,
+                                                 const gchar           *method,
+                                                 GVariant              *arguments,
+                                                 GVariant             **reply,
+                                                 GError               **error);
+
+ChamgeRegistry *chamge_arbiter_backend_get_registry
+                                                (ChamgeArbiterBackend  *self);
+
 void    chamge_arbiter_backend_approve          (ChamgeArbiterBackend  *self,
                                                  const gchar           *edge_id);
 
@@ -22,11 +22,13 @@
 #include "arbiter.h"
 #include "enumtypes.h"
 #include "arbiter-backend.h"
+#include "registry.h"
 
 typedef struct
 {
   ChamgeBackend backend;
   ChamgeArbiterBackend *arbiter_backend;
+  ChamgeRegistry *registry;
 } ChamgeArbiterPrivate;
 
 typedef enum
@@ -95,6 +97,7 @@ chamge_arbiter_edge_enrolled_cb (const gchar * uid, ChamgeArbiterBackend * self)
 {
   ChamgeArbiter *arbiter = NULL;
 
+  /* the backend keeps the registry up to date */
   g_object_get (self, "arbiter", &arbiter, NULL);
   g_assert (arbiter != NULL);
 
@@ -135,6 +138,14 @@ chamge_arbiter_hub_delisted_cb (const gchar * uid, ChamgeArbiterBackend * self)
 }
 
 
+static void
+chamge_arbiter_device_expired_cb (ChamgeRegistry * registry,
+    const gchar * uid, ChamgeDeviceType type, ChamgeArbiter * self)
+{
+  g_signal_emit (self, signals[type == CHAMGE_DEVICE_TYPE_EDGE ?
+          SIG_EDGE_DELISTED : SIG_HUB_DELISTED], 0, uid);
+}
+
 static ChamgeReturn
 chamge_arbiter_enroll (ChamgeNode * node)
 {
@@ -210,6 +221,7 @@ chamge_arbiter_dispose (GObject * object)
   ChamgeArbiterPrivate *priv = chamge_arbiter_get_instance_private (self);
 
   g_clear_object (&priv->arbiter_backend);
+  g_clear_object (&priv->registry);
   G_OBJECT_CLASS (chamge_arbiter_parent_class)->dispose (object);
 }
 
@@ -261,6 +273,13 @@ chamge_arbiter_class_init (ChamgeArbiterClass * klass)
 static void
 chamge_arbiter_init (ChamgeArbiter * self)
 {
+  ChamgeArbiterPrivate *priv = chamge_arbiter_get_instance_private (self);
+
+  priv->registry = chamge_registry_new ();
+
+  /* an expired device is as good as delisted */
+  g_signal_connect (priv->registry, "device-expired",
+      G_CALLBACK (chamge_arbiter_device_expired_cb), self);
 }
 
 ChamgeArbiter *
@@ -276,3 +295,218 @@ chamge_arbiter_new_full (const gchar * uid, ChamgeBackend backend)
   return g_object_new (CHAMGE_TYPE_ARBITER, "uid", uid, "backend", backend,
       NULL);
 }
+
+ChamgeRegistry *
+chamge_arbiter_get_registry (ChamgeArbiter * self)
+{
+  ChamgeArbiterPrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_ARBITER (self), NULL);
+
+  priv = chamge_arbiter_get_instance_private (self);
+
+  return priv->registry;
+}
+
+ChamgeReturn
+chamge_arbiter_send_command (ChamgeArbiter * self, const gchar * target,
+    const gchar * method, GVariant * arguments, GVariant ** reply,
+    GError ** error)
+{
+  ChamgeArbiterPrivate *priv;
+  g_autoptr (GVariant) args = NULL;
+  ChamgeNodeState state;
+
+  g_return_val_if_fail (CHAMGE_IS_ARBITER (self), CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (target != NULL, CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (method != NULL, CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (arguments == NULL
+      || g_variant_is_of_type (arguments, G_VARIANT_TYPE_VARDICT),
+      CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (reply == NULL || *reply == NULL, CHAMGE_RETURN_FAIL);
+
+  priv = chamge_arbiter_get_instance_private (self);
+
+  if (arguments != NULL)
+    args = g_variant_ref_sink (arguments);
+
+  g_object_get (self, "state", &state, NULL);
+  g_return_val_if_fail (state == CHAMGE_NODE_STATE_ACTIVATED,
+      CHAMGE_RETURN_FAIL);
+
+  return chamge_arbiter_backend_send_command (priv->arbiter_backend, target,
+      method, args, reply, error);
+}
+
+/* a command waiting for its reply in a thread of its own, since the backends
+ * block until the peer answers */
+typedef struct
+{
+  ChamgeArbiterBackend *backend;
+
+  gchar *cmd;
+  gchar *target;
+  gchar *method;
+  GVariant *arguments;
+
+  ChamgeReturn ret;
+  gchar *out;
+  GVariant *reply;
+  GError *error;
+} CommandCall;
+
+static void
+_command_call_free (gpointer user_data)
+{
+  CommandCall *call = user_data;
+
+  g_clear_object (&call->backend);
+  g_free (call->cmd);
+  g_free (call->target);
+  g_free (call->method);
+  g_clear_pointer (&call->arguments, g_variant_unref);
+  g_free (call->out);
+  g_clear_pointer (&call->reply, g_variant_unref);
+  g_clear_error (&call->error);
+  g_free (call);
+}
+
+static void
+_command_call_thread (GTask * task, gpointer source_object,
+    gpointer task_data, GCancellable * cancellable)
+{
+  CommandCall *call = task_data;
+
+  if (call->cmd != NULL)
+    call->ret = chamge_arbiter_backend_user_command (call->backend, call->cmd,
+        &call->out, &call->error);
+  else
+    call->ret = chamge_arbiter_backend_send_command (call->backend,
+        call->target, call->method, call->arguments, &call->reply,
+        &call->error);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+_command_call_run (ChamgeArbiter * self, CommandCall * call,
+    gpointer source_tag, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  ChamgeArbiterPrivate *priv = chamge_arbiter_get_instance_private (self);
+  g_autoptr (GTask) task = NULL;
+  ChamgeNodeState state;
+
+  g_object_get (self, "state", &state, NULL);
+  if (state != CHAMGE_NODE_STATE_ACTIVATED) {
+    _command_call_free (call);
+    g_task_report_new_error (self, callback, user_data, source_tag,
+        CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_INACCESSIBLE,
+        "arbiter is not activated");
+    return;
+  }
+
+  call->backend = g_object_ref (priv->arbiter_backend);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, source_tag);
+  g_task_set_task_data (task, call, _command_call_free);
+
+  /* the reply of a cancelled command is dropped once it comes */
+  g_task_set_return_on_cancel (task, TRUE);
+  g_task_run_in_thread (task, _command_call_thread);
+}
+
+static CommandCall *
+_command_call_finish (ChamgeArbiter * self, GAsyncResult * result,
+    GError ** error)
+{
+  CommandCall *call;
+
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    return NULL;
+
+  call = g_task_get_task_data (G_TASK (result));
+  if (call->error != NULL)
+    g_propagate_error (error, g_steal_pointer (&call->error));
+
+  return call;
+}
+
+void
+chamge_arbiter_user_command_async (ChamgeArbiter * self, const gchar * cmd,
+    GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  CommandCall *call;
+
+  g_return_if_fail (CHAMGE_IS_ARBITER (self));
+  g_return_if_fail (cmd != NULL);
+
+  call = g_new0 (CommandCall, 1);
+  call->cmd = g_strdup (cmd);
+
+  _command_call_run (self, call, chamge_arbiter_user_command_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_arbiter_user_command_finish (ChamgeArbiter * self,
+    GAsyncResult * result, gchar ** out, GError ** error)
+{
+  CommandCall *call;
+
+  g_return_val_if_fail (g_task_is_valid (result, self), CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (out == NULL || *out == NULL, CHAMGE_RETURN_FAIL);
+
+  call = _command_call_finish (self, result, error);
+  if (call == NULL)
+    return CHAMGE_RETURN_FAIL;
+
+  if (out != NULL)
+    *out = g_steal_pointer (&call->out);
+
+  return call->ret;
+}
+
+void
+chamge_arbiter_send_command_async (ChamgeArbiter * self, const gchar * target,
+    const gchar * method, GVariant * arguments, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  CommandCall *call;
+
+  g_return_if_fail (CHAMGE_IS_ARBITER (self));
+  g_return_if_fail (target != NULL);
+  g_return_if_fail (method != NULL);
+  g_return_if_fail (arguments == NULL
+      || g_variant_is_of_type (arguments, G_VARIANT_TYPE_VARDICT));
+
+  call = g_new0 (CommandCall, 1);
+  call->target = g_strdup (target);
+  call->method = g_strdup (method);
+  if (arguments != NULL)
+    call->arguments = g_variant_ref_sink (arguments);
+
+  _command_call_run (self, call, chamge_arbiter_send_command_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_arbiter_send_command_finish (ChamgeArbiter * self,
+    GAsyncResult * result, GVariant ** reply, GError ** error)
+{
+  CommandCall *call;
+
+  g_return_val_if_fail (g_task_is_valid (result, self), CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (reply == NULL || *reply == NULL, CHAMGE_RETURN_FAIL);
+
+  call = _command_call_finish (self, result, error);
+  if (call == NULL)
+    return CHAMGE_RETURN_FAIL;
+
+  if (reply != NULL)
+    *reply = g_steal_pointer (&call->reply);
+
+  return call->ret;
+}
@@ -24,7 +24,9 @@
 #error "Only <chamge/chamge.h> can be included directly."
 #endif
 
+#include <gio/gio.h>
 #include <chamge/node.h>
+#include <chamge/registry.h>
 
 /**
  * SECTION: arbiter
@@ -83,6 +85,118 @@ CHAMGE_API_EXPORT
 ChamgeArbiter*  chamge_arbiter_new_full                 (const gchar   *uid,
                                                          ChamgeBackend  bakend);
 
+/**
+ * chamge_arbiter_get_registry:
+ * @self: a #ChamgeArbiter object
+ *
+ * Gets the registry of the edges and the hubs enrolled to @self. The arbiter
+ * keeps it up to date before emitting its enrolled and delisted signals.
+ *
+ * Returns: (transfer none): a #ChamgeRegistry object
+ */
+CHAMGE_API_EXPORT
+ChamgeRegistry *chamge_arbiter_get_registry             (ChamgeArbiter *self);
+
+/**
+ * chamge_arbiter_send_command:
+ * @self: a #ChamgeArbiter object
+ * @target: the id of the edge or the hub to send the command to
+ * @method: the method of the command
+ * @arguments: (nullable): a #GVariant of type a{sv} with the arguments of the
+ *   command, consumed if floating
+ * @reply: (out) (optional) (transfer full): the reply as a #GVariant of type
+ *   a{sv}
+ * @error: a #GError
+ *
+ * Sends a command like chamge_node_user_command(), but routes it by @target
+ * and @method without building and parsing a JSON command.
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn    chamge_arbiter_send_command             (ChamgeArbiter *self,
+                                                         const gchar   *target,
+                                                         const gchar   *method,
+                                                         GVariant      *arguments,
+                                                         GVariant     **reply,
+                                                         GError       **error);
+
+/**
+ * chamge_arbiter_user_command_async:
+ * @self: a #ChamgeArbiter object
+ * @cmd: user command to send
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the reply is received
+ * @user_data: the data to pass to @callback
+ *
+ * Sends a command like chamge_node_user_command(), without blocking the
+ * thread-default main context while waiting for the reply. Many commands can
+ * be in flight at once. @callback is called in the thread-default main
+ * context of the caller.
+ */
+CHAMGE_API_EXPORT
+void            chamge_arbiter_user_command_async       (ChamgeArbiter *self,
+                                                         const gchar   *cmd,
+                                                         GCancellable  *cancellable,
+                                                         GAsyncReadyCallback
+                                                                        callback,
+                                                         gpointer       user_data);
+
+/**
+ * chamge_arbiter_user_command_finish:
+ * @self: a #ChamgeArbiter object
+ * @result: the #GAsyncResult passed to the callback
+ * @out: (out) (optional) (transfer full): the response to the command, which
+ *   may be set even on failure
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn    chamge_arbiter_user_command_finish      (ChamgeArbiter *self,
+                                                         GAsyncResult  *result,
+                                                         gchar        **out,
+                                                         GError       **error);
+
+/**
+ * chamge_arbiter_send_command_async:
+ * @self: a #ChamgeArbiter object
+ * @target: the id of the edge or the hub to send the command to
+ * @method: the method of the command
+ * @arguments: (nullable): a #GVariant of type a{sv} with the arguments of the
+ *   command, consumed if floating
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the reply is received
+ * @user_data: the data to pass to @callback
+ *
+ * The asynchronous version of chamge_arbiter_send_command().
+ */
+CHAMGE_API_EXPORT
+void            chamge_arbiter_send_command_async       (ChamgeArbiter *self,
+                                                         const gchar   *target,
+                                                         const gchar   *method,
+                                                         GVariant      *arguments,
+                                                         GCancellable  *cancellable,
+                                                         GAsyncReadyCallback
+                                                                        callback,
+                                                         gpointer       user_data);
+
+/**
+ * chamge_arbiter_send_command_finish:
+ * @self: a #ChamgeArbiter object
+ * @result: the #GAsyncResult passed to the callback
+ * @reply: (out) (optional) (transfer full): the reply as a #GVariant of type
+ *   a{sv}
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn    chamge_arbiter_send_command_finish      (ChamgeArbiter *self,
+                                                         GAsyncResult  *result,
+                                                         GVariant     **reply,
+                                                         GError       **error);
+
 G_END_DECLS
 
 #endif //__CHAMGE_ARBITER_H__
@@ -0,0 +1,162 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "batch.h"
+#include "types.h"
+
+static gchar *
+_to_json (JsonObject * object)
+{
+  g_autoptr (JsonGenerator) generator = json_generator_new ();
+  g_autoptr (JsonNode) root = json_node_new (JSON_NODE_OBJECT);
+
+  json_node_take_object (root, object);
+  json_generator_set_root (generator, root);
+
+  return json_generator_to_data (generator, NULL);
+}
+
+gchar *
+chamge_batch_request_to_json (const gchar * method, const gchar * device_type,
+    const gchar * const *ids)
+{
+  JsonObject *object;
+  JsonArray *array;
+  guint i;
+
+  g_return_val_if_fail (method != NULL, NULL);
+  g_return_val_if_fail (device_type != NULL, NULL);
+  g_return_val_if_fail (ids != NULL, NULL);
+
+  array = json_array_new ();
+  for (i = 0; ids[i] != NULL; i++)
+    json_array_add_string_element (array, ids[i]);
+
+  object = json_object_new ();
+  json_object_set_string_member (object, "method", method);
+  json_object_set_string_member (object, "deviceType", device_type);
+  json_object_set_array_member (object, "ids", array);
+
+  return _to_json (object);
+}
+
+GPtrArray *
+chamge_batch_request_get_ids (JsonObject * object, GError ** error)
+{
+  g_autoptr (GPtrArray) ids = NULL;
+  JsonNode *node;
+  JsonArray *array;
+  guint i, len;
+
+  g_return_val_if_fail (object != NULL, NULL);
+
+  node = json_object_get_member (object, "ids");
+  if (node == NULL)
+    return NULL;
+
+  if (!JSON_NODE_HOLDS_ARRAY (node)) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "ids must be an array");
+    return NULL;
+  }
+
+  array = json_node_get_array (node);
+  len = json_array_get_length (array);
+  ids = g_ptr_array_sized_new (len);
+
+  for (i = 0; i < len; i++) {
+    JsonNode *element = json_array_get_element (array, i);
+
+    if (!JSON_NODE_HOLDS_VALUE (element)
+        || json_node_get_value_type (element) != G_TYPE_STRING) {
+      g_set_error (error, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "ids[%u] must be a string",
+          i);
+      return NULL;
+    }
+
+    g_ptr_array_add (ids, (gpointer) json_node_get_string (element));
+  }
+
+  return g_steal_pointer (&ids);
+}
+
+gchar *
+chamge_batch_reply_to_json (GPtrArray * ids, GPtrArray * results)
+{
+  JsonObject *object;
+  JsonObject *members;
+  guint i;
+
+  g_return_val_if_fail (ids != NULL, NULL);
+  g_return_val_if_fail (results != NULL && results->len == ids->len, NULL);
+
+  members = json_object_new ();
+  for (i = 0; i < ids->len; i++)
+    json_object_set_string_member (members, g_ptr_array_index (ids, i),
+        g_ptr_array_index (results, i));
+
+  object = json_object_new ();
+  json_object_set_string_member (object, "result", "done");
+  json_object_set_object_member (object, "results", members);
+
+  return _to_json (object);
+}
+
+GVariant *
+chamge_batch_reply_parse (const gchar * reply, GError ** error)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  GVariantBuilder builder;
+  g_autoptr (GList) members = NULL;
+  JsonObject *results;
+  JsonNode *root;
+  JsonNode *node;
+  GList *l;
+
+  g_return_val_if_fail (reply != NULL, NULL);
+
+  if (!json_parser_load_from_data (parser, reply, -1, error))
+    return NULL;
+
+  root = json_parser_get_root (parser);
+  if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root)
+      || (node = json_object_get_member (json_node_get_object (root),
+              "results")) == NULL || !JSON_NODE_HOLDS_OBJECT (node)) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "results is missing");
+    return NULL;
+  }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+
+  results = json_node_get_object (node);
+  members = json_object_get_members (results);
+
+  for (l = members; l != NULL; l = l->next) {
+    node = json_object_get_member (results, l->data);
+    if (JSON_NODE_HOLDS_VALUE (node)
+        && json_node_get_value_type (node) == G_TYPE_STRING)
+      g_variant_builder_add (&builder, "{ss}", l->data,
+          json_node_get_string (node));
+  }
+
+  return g_variant_builder_end (&builder);
+}
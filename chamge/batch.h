@@ -0,0 +1,48 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_BATCH_H__
+#define __CHAMGE_BATCH_H__
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* a batch request is a DeviceRequest without a device id, the "ids" member
+ * listing the devices instead */
+gchar                  *chamge_batch_request_to_json    (const gchar            *method,
+                                                         const gchar            *device_type,
+                                                         const gchar * const    *ids);
+
+/* returns the ids, borrowed from @object, or NULL without setting @error if
+ * @object is not a batch request */
+GPtrArray              *chamge_batch_request_get_ids    (JsonObject             *object,
+                                                         GError                **error);
+
+/* the reply carries the result of every device in its "results" object */
+gchar                  *chamge_batch_reply_to_json      (GPtrArray              *ids,
+                                                         GPtrArray              *results);
+
+/* returns a new a{ss} mapping the ids to their results */
+GVariant               *chamge_batch_reply_parse        (const gchar            *reply,
+                                                         GError                **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_BATCH_H__
@@ -27,6 +27,7 @@
 #include <chamge/node.h>
 #include <chamge/edge.h>
 #include <chamge/hub.h>
+#include <chamge/registry.h>
 #include <chamge/arbiter.h>
 
 #undef __CHAMGE_INSIDE__
@@ -0,0 +1,180 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "command-batch.h"
+#include "messages-generated.h"
+
+typedef struct
+{
+  ChamgeCommandBatchFuncs funcs;
+  gpointer user_data;
+
+  gchar **commands;
+  guint n_commands;
+  guint max_in_flight;
+  guint next;
+  guint in_flight;
+  guint done;
+  gboolean dispatching;
+
+  ChamgeReturn *rets;
+  gchar **responses;
+} Batch;
+
+typedef struct
+{
+  GTask *task;
+  guint index;
+} BatchItem;
+
+static void _dispatch (GTask * task);
+
+static void
+_batch_free (gpointer data)
+{
+  Batch *batch = data;
+
+  g_strfreev (batch->commands);
+  g_free (batch->rets);
+  g_strfreev (batch->responses);
+  g_free (batch);
+}
+
+static void
+_complete (GTask * task)
+{
+  Batch *batch = g_task_get_task_data (task);
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(is)"));
+  for (i = 0; i < batch->n_commands; i++)
+    g_variant_builder_add (&builder, "(is)", batch->rets[i],
+        batch->responses[i]);
+
+  g_task_return_pointer (task,
+      g_variant_ref_sink (g_variant_builder_end (&builder)),
+      (GDestroyNotify) g_variant_unref);
+}
+
+static void
+_item_done (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  BatchItem *item = user_data;
+  g_autoptr (GTask) task = item->task;
+  Batch *batch = g_task_get_task_data (task);
+  g_autofree gchar *response = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeReturn ret;
+
+  ret = batch->funcs.finish (source, result, &response, &error);
+  if (response == NULL) {
+    ChamgeMsgResult reply = { ret == CHAMGE_RETURN_OK ? "ok" :
+          error ? error->message : "nok"
+    };
+
+    response = chamge_msg_result_to_json (&reply);
+  }
+
+  batch->rets[item->index] = ret;
+  batch->responses[item->index] = g_steal_pointer (&response);
+  batch->in_flight--;
+  batch->done++;
+
+  g_free (item);
+
+  /* a command answered before send() returned is left to the loop which
+   * sent it, so that the batch completes once */
+  if (!batch->dispatching)
+    _dispatch (task);
+}
+
+static void
+_dispatch (GTask * task)
+{
+  Batch *batch = g_task_get_task_data (task);
+
+  batch->dispatching = TRUE;
+  while (batch->next < batch->n_commands
+      && batch->in_flight < batch->max_in_flight) {
+    guint i = batch->next++;
+    BatchItem *item;
+
+    /* rejected before it is sent, so that it takes no slot */
+    batch->responses[i] = batch->funcs.check (batch->commands[i],
+        batch->user_data);
+    if (batch->responses[i] != NULL) {
+      batch->rets[i] = CHAMGE_RETURN_FAIL;
+      batch->done++;
+      continue;
+    }
+
+    item = g_new0 (BatchItem, 1);
+    item->task = g_object_ref (task);
+    item->index = i;
+
+    batch->in_flight++;
+    batch->funcs.send (batch->commands[i], _item_done, item,
+        batch->user_data);
+  }
+  batch->dispatching = FALSE;
+
+  if (batch->done == batch->n_commands)
+    _complete (task);
+}
+
+void
+chamge_command_batch_run_async (const gchar * const *commands,
+    guint max_in_flight, const ChamgeCommandBatchFuncs * funcs,
+    gpointer user_data, GAsyncReadyCallback callback, gpointer callback_data)
+{
+  g_autoptr (GTask) task = NULL;
+  Batch *batch;
+
+  g_return_if_fail (commands != NULL);
+  g_return_if_fail (funcs != NULL);
+  g_return_if_fail (funcs->check != NULL && funcs->send != NULL
+      && funcs->finish != NULL);
+
+  batch = g_new0 (Batch, 1);
+  batch->funcs = *funcs;
+  batch->user_data = user_data;
+  batch->commands = g_strdupv ((gchar **) commands);
+  batch->n_commands = g_strv_length (batch->commands);
+  batch->max_in_flight = MAX (max_in_flight, 1);
+  batch->rets = g_new0 (ChamgeReturn, batch->n_commands);
+  batch->responses = g_new0 (gchar *, batch->n_commands + 1);
+
+  task = g_task_new (NULL, NULL, callback, callback_data);
+  g_task_set_source_tag (task, chamge_command_batch_run_async);
+  g_task_set_task_data (task, batch, _batch_free);
+
+  _dispatch (task);
+}
+
+GVariant *
+chamge_command_batch_run_finish (GAsyncResult * result, GError ** error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+          chamge_command_batch_run_async), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
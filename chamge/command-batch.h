@@ -0,0 +1,69 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_COMMAND_BATCH_H__
+#define __CHAMGE_COMMAND_BATCH_H__
+
+#include <gio/gio.h>
+#include <chamge/types.h>
+
+G_BEGIN_DECLS
+
+/* returns the response to @command if it is not to be sent, or NULL */
+typedef gchar        *(*ChamgeCommandBatchCheckFunc)   (const gchar            *command,
+                                                         gpointer                user_data);
+
+/* sends @command, and calls @callback with @callback_data once it is
+ * answered */
+typedef void          (*ChamgeCommandBatchSendFunc)    (const gchar            *command,
+                                                         GAsyncReadyCallback     callback,
+                                                         gpointer                callback_data,
+                                                         gpointer                user_data);
+
+/* the response may be set even on failure */
+typedef ChamgeReturn  (*ChamgeCommandBatchFinishFunc)  (GObject                *source,
+                                                         GAsyncResult           *result,
+                                                         gchar                 **response,
+                                                         GError                **error);
+
+typedef struct
+{
+  ChamgeCommandBatchCheckFunc check;
+  ChamgeCommandBatchSendFunc send;
+  ChamgeCommandBatchFinishFunc finish;
+} ChamgeCommandBatchFuncs;
+
+/* sends @commands through @funcs with at most @max_in_flight of them in
+ * flight at once, @funcs.send may answer before it returns; a command which
+ * gets no response is answered with a result, naming the error on failure */
+void                    chamge_command_batch_run_async  (const gchar * const    *commands,
+                                                         guint                   max_in_flight,
+                                                         const ChamgeCommandBatchFuncs
+                                                                                *funcs,
+                                                         gpointer                user_data,
+                                                         GAsyncReadyCallback     callback,
+                                                         gpointer                callback_data);
+
+/* returns an a(is) of the return and the response of each command, in the
+ * order of the commands */
+GVariant               *chamge_command_batch_run_finish (GAsyncResult           *result,
+                                                         GError                **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_COMMAND_BATCH_H__
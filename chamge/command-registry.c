@@ -0,0 +1,190 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "command-registry.h"
+
+typedef struct
+{
+  gint ref_count;
+
+  ChamgeCommandHandler handler;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* 0 means no limit */
+  guint max_concurrency;
+  gint in_flight;
+} CommandEntry;
+
+struct _ChamgeCommandRegistry
+{
+  GMutex lock;
+  GHashTable *entries;
+};
+
+static CommandEntry *
+command_entry_ref (CommandEntry * entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+  return entry;
+}
+
+static void
+command_entry_unref (CommandEntry * entry)
+{
+  if (!g_atomic_int_dec_and_test (&entry->ref_count))
+    return;
+
+  if (entry->notify != NULL)
+    entry->notify (entry->user_data);
+
+  g_free (entry);
+}
+
+/* reserves a slot for a new command, or returns FALSE if @entry is busy */
+static gboolean
+command_entry_acquire (CommandEntry * entry)
+{
+  gint in_flight;
+
+  if (entry->max_concurrency == 0) {
+    g_atomic_int_inc (&entry->in_flight);
+    return TRUE;
+  }
+
+  do {
+    in_flight = g_atomic_int_get (&entry->in_flight);
+    if (in_flight >= (gint) entry->max_concurrency)
+      return FALSE;
+  } while (!g_atomic_int_compare_and_exchange (&entry->in_flight, in_flight,
+          in_flight + 1));
+
+  return TRUE;
+}
+
+ChamgeCommandRegistry *
+chamge_command_registry_new (void)
+{
+  ChamgeCommandRegistry *self = g_new0 (ChamgeCommandRegistry, 1);
+
+  g_mutex_init (&self->lock);
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) command_entry_unref);
+
+  return self;
+}
+
+void
+chamge_command_registry_free (ChamgeCommandRegistry * self)
+{
+  if (self == NULL)
+    return;
+
+  g_hash_table_unref (self->entries);
+  g_mutex_clear (&self->lock);
+
+  g_free (self);
+}
+
+gboolean
+chamge_command_registry_add (ChamgeCommandRegistry * self,
+    const gchar * method, guint max_concurrency, ChamgeCommandHandler handler,
+    gpointer user_data, GDestroyNotify notify)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  CommandEntry *entry;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+  g_return_val_if_fail (handler != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  if (g_hash_table_contains (self->entries, method)) {
+    g_debug ("a handler for %s is already added", method);
+    return FALSE;
+  }
+
+  entry = g_new0 (CommandEntry, 1);
+  entry->ref_count = 1;
+  entry->handler = handler;
+  entry->user_data = user_data;
+  entry->notify = notify;
+  entry->max_concurrency = max_concurrency;
+
+  g_hash_table_insert (self->entries, g_strdup (method), entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_command_registry_remove (ChamgeCommandRegistry * self,
+    const gchar * method)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  /* commands in flight keep their own reference to the entry */
+  return g_hash_table_remove (self->entries, method);
+}
+
+gboolean
+chamge_command_registry_dispatch (ChamgeCommandRegistry * self,
+    ChamgeNode * node, const gchar * method, const gchar * cmd,
+    gchar ** response, GError ** error, ChamgeReturn * ret)
+{
+  CommandEntry *entry = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (ret != NULL, FALSE);
+
+  if (method == NULL)
+    return FALSE;
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->entries, method);
+  if (entry != NULL)
+    command_entry_ref (entry);
+  g_mutex_unlock (&self->lock);
+
+  if (entry == NULL)
+    return FALSE;
+
+  if (!command_entry_acquire (entry)) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_BUSY,
+        "too many %s commands in flight (max: %u)", method,
+        entry->max_concurrency);
+    *ret = CHAMGE_RETURN_FAIL;
+    goto out;
+  }
+
+  *ret = entry->handler (node, cmd, response, error, entry->user_data);
+
+  g_atomic_int_add (&entry->in_flight, -1);
+
+out:
+  command_entry_unref (entry);
+
+  return TRUE;
+}
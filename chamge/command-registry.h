@@ -0,0 +1,55 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_COMMAND_REGISTRY_H__
+#define __CHAMGE_COMMAND_REGISTRY_H__
+
+#include <chamge/node.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ChamgeCommandRegistry ChamgeCommandRegistry;
+
+ChamgeCommandRegistry  *chamge_command_registry_new     (void);
+
+void                    chamge_command_registry_free    (ChamgeCommandRegistry  *self);
+
+gboolean                chamge_command_registry_add     (ChamgeCommandRegistry  *self,
+                                                         const gchar            *method,
+                                                         guint                   max_concurrency,
+                                                         ChamgeCommandHandler    handler,
+                                                         gpointer                user_data,
+                                                         GDestroyNotify          notify);
+
+gboolean                chamge_command_registry_remove  (ChamgeCommandRegistry  *self,
+                                                         const gchar            *method);
+
+/* returns FALSE, leaving @ret, @response and @error untouched, if no handler
+ * is registered for @method */
+gboolean                chamge_command_registry_dispatch
+                                                        (ChamgeCommandRegistry  *self,
+                                                         ChamgeNode             *node,
+                                                         const gchar            *method,
+                                                         const gchar            *cmd,
+                                                         gchar                 **response,
+                                                         GError                **error,
+                                                         ChamgeReturn           *ret);
+
+G_END_DECLS
+
+#endif // __CHAMGE_COMMAND_REGISTRY_H__
@@ -0,0 +1,82 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "command.h"
+#include "types.h"
+
+#include <json-glib/json-glib.h>
+
+gchar *
+chamge_command_to_json (const gchar * target, const gchar * method,
+    GVariant * arguments)
+{
+  g_autoptr (JsonGenerator) generator = json_generator_new ();
+  g_autoptr (JsonNode) root = NULL;
+  JsonObject *object;
+
+  g_return_val_if_fail (target != NULL, NULL);
+  g_return_val_if_fail (method != NULL, NULL);
+
+  if (arguments != NULL) {
+    g_return_val_if_fail (g_variant_is_of_type (arguments,
+            G_VARIANT_TYPE_VARDICT), NULL);
+    root = json_gvariant_serialize (arguments);
+  } else {
+    root = json_node_new (JSON_NODE_OBJECT);
+    json_node_take_object (root, json_object_new ());
+  }
+
+  object = json_node_get_object (root);
+  json_object_set_string_member (object, "to", target);
+  json_object_set_string_member (object, "method", method);
+
+  json_generator_set_root (generator, root);
+
+  return json_generator_to_data (generator, NULL);
+}
+
+GVariant *
+chamge_command_reply_from_json (const gchar * response, GError ** error)
+{
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  GVariantBuilder builder;
+  JsonNode *root;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  if (response == NULL)
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  if (json_parser_load_from_data (parser, response, -1, NULL)
+      && (root = json_parser_get_root (parser)) != NULL
+      && JSON_NODE_HOLDS_OBJECT (root)) {
+    GVariant *reply = json_gvariant_deserialize (root, "a{sv}", error);
+
+    g_variant_builder_clear (&builder);
+    return reply != NULL ? g_variant_ref_sink (reply) : NULL;
+  }
+
+  g_variant_builder_add (&builder, "{sv}", "response",
+      g_variant_new_string (response));
+
+  /* not floating, so that the caller keeps its reference when the reply is
+   * packed into another variant, e.g. a D-Bus return value */
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
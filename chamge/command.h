@@ -0,0 +1,39 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_COMMAND_H__
+#define __CHAMGE_COMMAND_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* typed commands still travel as JSON objects, "to" and "method" being
+ * members next to the arguments */
+gchar                  *chamge_command_to_json          (const gchar            *target,
+                                                         const gchar            *method,
+                                                         GVariant               *arguments);
+
+/* returns a new a{sv}, not floating and owned by the caller; a response
+ * which is not a JSON object is kept as its "response" member */
+GVariant               *chamge_command_reply_from_json  (const gchar            *response,
+                                                         GError                **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_COMMAND_H__
@@ -33,6 +33,7 @@ typedef struct
   ChamgeEdge *edge;
 
   GClosure *user_command;
+  ChamgeEdgeBackendDispatchCommand dispatch_command;
 } ChamgeEdgeBackendPrivate;
 
 typedef enum
@@ -230,6 +231,21 @@ chamge_edge_backend_deactivate (ChamgeEdgeBackend * self)
   return ret;
 }
 
+ChamgeReturn
+chamge_edge_backend_enroll_activate (ChamgeEdgeBackend * self)
+{
+  ChamgeEdgeBackendClass *klass;
+  ChamgeReturn ret = CHAMGE_RETURN_OK;
+  g_return_val_if_fail (CHAMGE_IS_EDGE_BACKEND (self), CHAMGE_RETURN_FAIL);
+
+  klass = CHAMGE_EDGE_BACKEND_GET_CLASS (self);
+  g_return_val_if_fail (klass->enroll_activate != NULL, CHAMGE_RETURN_FAIL);
+
+  ret = klass->enroll_activate (self);
+
+  return ret;
+}
+
 gchar *chamge_edge_backend_request_target_uri
     (ChamgeEdgeBackend * self, GError ** error)
 {
@@ -245,6 +261,23 @@ gchar *chamge_edge_backend_request_target_uri
   return g_steal_pointer (&target_uri);
 }
 
+GVariant *
+chamge_edge_backend_request_batch (ChamgeEdgeBackend * self,
+    const gchar * method, const gchar * const *edge_ids, GError ** error)
+{
+  ChamgeEdgeBackendClass *klass;
+  g_return_val_if_fail (CHAMGE_IS_EDGE_BACKEND (self), NULL);
+
+  klass = CHAMGE_EDGE_BACKEND_GET_CLASS (self);
+  if (klass->request_batch == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_NOT_SUPPORTED, "batch requests are not supported");
+    return NULL;
+  }
+
+  return klass->request_batch (self, method, edge_ids, error);
+}
+
 void
 chamge_edge_backend_set_user_command_handler (ChamgeEdgeBackend * self,
     ChamgeEdgeBackendUserCommand user_command)
@@ -264,3 +297,36 @@ chamge_edge_backend_set_user_command_handler (ChamgeEdgeBackend * self,
     g_closure_set_marshal (priv->user_command, g_cclosure_marshal_generic);
   }
 }
+
+void
+chamge_edge_backend_set_command_dispatcher (ChamgeEdgeBackend * self,
+    ChamgeEdgeBackendDispatchCommand dispatch)
+{
+  ChamgeEdgeBackendPrivate *priv =
+      chamge_edge_backend_get_instance_private (self);
+
+  g_return_if_fail (CHAMGE_IS_EDGE_BACKEND (self));
+
+  priv->dispatch_command = dispatch;
+}
+
+ChamgeReturn
+chamge_edge_backend_dispatch_command (ChamgeEdgeBackend * self,
+    const gchar * method, const gchar * cmd, gchar ** response,
+    GError ** error)
+{
+  ChamgeEdgeBackendPrivate *priv =
+      chamge_edge_backend_get_instance_private (self);
+  ChamgeEdgeBackendClass *klass;
+
+  g_return_val_if_fail (CHAMGE_IS_EDGE_BACKEND (self), CHAMGE_RETURN_FAIL);
+
+  /* a direct call, neither GValue boxing nor a property lookup on the way */
+  if (priv->dispatch_command != NULL)
+    return priv->dispatch_command (priv->edge, method, cmd, response, error);
+
+  klass = CHAMGE_EDGE_BACKEND_GET_CLASS (self);
+  g_return_val_if_fail (klass->user_command != NULL, CHAMGE_RETURN_FAIL);
+
+  return klass->user_command (self, cmd, response, error);
+}
@@ -43,9 +43,16 @@ struct _ChamgeEdgeBackendClass
   ChamgeReturn  (* activate)                    (ChamgeEdgeBackend     *self);
   ChamgeReturn  (* deactivate)                  (ChamgeEdgeBackend     *self);
 
+  ChamgeReturn  (* enroll_activate)             (ChamgeEdgeBackend     *self);
+
   gchar*        (* request_target_uri)          (ChamgeEdgeBackend     *self,
                                                  GError               **error);
 
+  GVariant*     (* request_batch)               (ChamgeEdgeBackend     *self,
+                                                 const gchar           *method,
+                                                 const gchar * const   *edge_ids,
+                                                 GError               **error);
+
   ChamgeReturn  (* user_command)               (ChamgeEdgeBackend     *self,
                                                  const gchar           *cmd,
                                                  gchar                **response,
@@ -56,6 +63,13 @@ typedef ChamgeReturn (*ChamgeEdgeBackendUserCommand)    (const gchar          *c
                                                          GError              **error,
                                                          ChamgeEdgeBackend     *edge_backend);
 
+typedef ChamgeReturn (*ChamgeEdgeBackendDispatchCommand)
+                                                        (ChamgeEdge            *edge,
+                                                         const gchar           *method,
+                                                         const gchar           *cmd,
+                                                         gchar               **response,
+                                                         GError              **error);
+
 ChamgeEdgeBackend      *chamge_edge_backend_new         (ChamgeEdge            *edge);
 
 ChamgeReturn            chamge_edge_backend_enroll      (ChamgeEdgeBackend     *self);
@@ -66,14 +80,34 @@ ChamgeReturn            chamge_edge_backend_activate    (ChamgeEdgeBackend     *
 
 ChamgeReturn            chamge_edge_backend_deactivate  (ChamgeEdgeBackend     *self);
 
+ChamgeReturn            chamge_edge_backend_enroll_activate
+                                                        (ChamgeEdgeBackend     *self);
+
 gchar                  *chamge_edge_backend_request_target_uri
                                                         (ChamgeEdgeBackend     *self,
                                                          GError               **error);
 
+GVariant               *chamge_edge_backend_request_batch
+                                                        (ChamgeEdgeBackend     *self,
+                                                         const gchar           *method,
+                                                         const gchar * const   *edge_ids,
+                                                         GError               **error);
+
 void  chamge_edge_backend_set_user_command_handler      (ChamgeEdgeBackend     *self,
                                                          ChamgeEdgeBackendUserCommand
                                                                                 user_command);
 
+void  chamge_edge_backend_set_command_dispatcher        (ChamgeEdgeBackend     *self,
+                                                         ChamgeEdgeBackendDispatchCommand
+                                                                                dispatch);
+
+ChamgeReturn            chamge_edge_backend_dispatch_command
+                                                        (ChamgeEdgeBackend     *self,
+                                                         const gchar           *method,
+                                                         const gchar           *cmd,
+                                                         gchar               **response,
+                                                         GError              **error);
+
 G_END_DECLS
 
 #endif // __CHAMGE_EDGE_BACKEND_H__
@@ -22,6 +22,7 @@
 #include "edge.h"
 #include "enumtypes.h"
 #include "edge-backend.h"
+#include "command-registry.h"
 
 typedef struct
 {
@@ -29,6 +30,8 @@ typedef struct
 
   ChamgeEdgeBackend *edge_backend;
 
+  ChamgeCommandRegistry *commands;
+
   gint n_stream;
 } ChamgeEdgePrivate;
 
@@ -84,6 +87,32 @@ chamge_edge_user_command_cb (const gchar * cmd, gchar ** response,
   return ret;
 }
 
+static ChamgeReturn
+chamge_edge_dispatch_command_cb (ChamgeEdge * self, const gchar * method,
+    const gchar * cmd, gchar ** response, GError ** error)
+{
+  ChamgeEdgePrivate *priv = chamge_edge_get_instance_private (self);
+  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+
+  if (chamge_command_registry_dispatch (priv->commands, CHAMGE_NODE (self),
+          method, cmd, response, error, &ret))
+    return ret;
+
+  /* unknown methods do not wake up an application which only added handlers */
+  if (CHAMGE_EDGE_GET_CLASS (self)->user_command != NULL
+      || g_signal_has_handler_pending (self, signals[SIG_USER_COMMAND], 0,
+          FALSE)) {
+    g_signal_emit (self, signals[SIG_USER_COMMAND], 0, cmd, response, error,
+        &ret);
+    return ret;
+  }
+
+  g_set_error (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_NOT_SUPPORTED,
+      "method(%s) is not supported", method ? method : "(null)");
+
+  return CHAMGE_RETURN_FAIL;
+}
+
 static ChamgeReturn
 chamge_edge_enroll (ChamgeNode * node)
 {
@@ -96,6 +125,8 @@ chamge_edge_enroll (ChamgeNode * node)
 
   chamge_edge_backend_set_user_command_handler (priv->edge_backend,
       chamge_edge_user_command_cb);
+  chamge_edge_backend_set_command_dispatcher (priv->edge_backend,
+      chamge_edge_dispatch_command_cb);
   ret = chamge_edge_backend_enroll (priv->edge_backend);
 
   return ret;
@@ -127,6 +158,18 @@ chamge_edge_activate (ChamgeNode * node)
   return ret;
 }
 
+static ChamgeReturn
+chamge_edge_enroll_activate (ChamgeNode * node)
+{
+  ChamgeEdge *self = CHAMGE_EDGE (node);
+  ChamgeEdgePrivate *priv = chamge_edge_get_instance_private (self);
+  ChamgeReturn ret;
+
+  ret = chamge_edge_backend_enroll_activate (priv->edge_backend);
+
+  return ret;
+}
+
 static ChamgeReturn
 chamge_edge_deactivate (ChamgeNode * node)
 {
@@ -149,6 +192,17 @@ chamge_edge_dispose (GObject * object)
   G_OBJECT_CLASS (chamge_edge_parent_class)->dispose (object);
 }
 
+static void
+chamge_edge_finalize (GObject * object)
+{
+  ChamgeEdge *self = CHAMGE_EDGE (object);
+  ChamgeEdgePrivate *priv = chamge_edge_get_instance_private (self);
+
+  chamge_command_registry_free (priv->commands);
+
+  G_OBJECT_CLASS (chamge_edge_parent_class)->finalize (object);
+}
+
 static void
 chamge_edge_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -193,6 +247,7 @@ chamge_edge_class_init (ChamgeEdgeClass * klass)
   object_class->get_property = chamge_edge_get_property;
   object_class->set_property = chamge_edge_set_property;
   object_class->dispose = chamge_edge_dispose;
+  object_class->finalize = chamge_edge_finalize;
 
   properties[PROP_BACKEND] = g_param_spec_enum ("backend", "backend", "backend",
       CHAMGE_TYPE_BACKEND, CHAMGE_BACKEND_UNKNOWN,
@@ -211,6 +266,7 @@ chamge_edge_class_init (ChamgeEdgeClass * klass)
   node_class->delist = chamge_edge_delist;
   node_class->activate = chamge_edge_activate;
   node_class->deactivate = chamge_edge_deactivate;
+  node_class->enroll_activate = chamge_edge_enroll_activate;
 
   klass->request_target_uri = chamge_edge_request_target_uri_default;
 }
@@ -218,6 +274,9 @@ chamge_edge_class_init (ChamgeEdgeClass * klass)
 static void
 chamge_edge_init (ChamgeEdge * self)
 {
+  ChamgeEdgePrivate *priv = chamge_edge_get_instance_private (self);
+
+  priv->commands = chamge_command_registry_new ();
 }
 
 ChamgeEdge *
@@ -254,3 +313,64 @@ chamge_edge_request_target_uri (ChamgeEdge * self, GError ** error)
 
   return g_steal_pointer (&target_uri);
 }
+
+GVariant *
+chamge_edge_request_batch (ChamgeEdge * self, const gchar * method,
+    const gchar * const *edge_ids, GError ** error)
+{
+  ChamgeEdgePrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_EDGE (self), NULL);
+  g_return_val_if_fail (method != NULL, NULL);
+  g_return_val_if_fail (edge_ids != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  priv = chamge_edge_get_instance_private (self);
+
+  if (priv->edge_backend == NULL) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INACCESSIBLE, "edge is not enrolled");
+    return NULL;
+  }
+
+  return chamge_edge_backend_request_batch (priv->edge_backend, method,
+      edge_ids, error);
+}
+
+gboolean
+chamge_edge_add_command_handler (ChamgeEdge * self, const gchar * method,
+    ChamgeCommandHandler handler, gpointer user_data)
+{
+  return chamge_edge_add_command_handler_full (self, method, 0, handler,
+      user_data, NULL);
+}
+
+gboolean
+chamge_edge_add_command_handler_full (ChamgeEdge * self, const gchar * method,
+    guint max_concurrency, ChamgeCommandHandler handler, gpointer user_data,
+    GDestroyNotify notify)
+{
+  ChamgeEdgePrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_EDGE (self), FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+  g_return_val_if_fail (handler != NULL, FALSE);
+
+  priv = chamge_edge_get_instance_private (self);
+
+  return chamge_command_registry_add (priv->commands, method, max_concurrency,
+      handler, user_data, notify);
+}
+
+gboolean
+chamge_edge_remove_command_handler (ChamgeEdge * self, const gchar * method)
+{
+  ChamgeEdgePrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_EDGE (self), FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+
+  priv = chamge_edge_get_instance_private (self);
+
+  return chamge_command_registry_remove (priv->commands, method);
+}
@@ -101,6 +101,86 @@ CHAMGE_API_EXPORT
 gchar*          chamge_edge_request_target_uri          (ChamgeEdge    *self,
                                                          GError       **error);  
 
+/**
+ * chamge_edge_request_batch:
+ * @self: a #ChamgeEdge object
+ * @method: "enroll", "activate", "enrollActivate", "deactivate" or "delist"
+ * @edge_ids: a %NULL-terminated array of the ids of the edges
+ * @error: a #GError object
+ *
+ * Applies @method to many edges with a single request, so that a gateway can
+ * onboard the devices behind it without a round trip per device. @self must
+ * be enrolled.
+ *
+ * Returns: (transfer full): a new a{ss} #GVariant mapping each id of
+ *   @edge_ids to its result, e.g. "enrolled", or %NULL on error
+ */
+CHAMGE_API_EXPORT
+GVariant*       chamge_edge_request_batch               (ChamgeEdge    *self,
+                                                         const gchar   *method,
+                                                         const gchar * const
+                                                                       *edge_ids,
+                                                         GError       **error);
+
+/**
+ * chamge_edge_add_command_handler:
+ * @self: a #ChamgeEdge object
+ * @method: the method to handle, e.g. "streamingStart"
+ * @handler: the #ChamgeCommandHandler to call
+ * @user_data: user data passed to @handler
+ *
+ * Adds a handler for the commands of @method. Such commands are dispatched
+ * to @handler directly instead of being emitted through the "user-command"
+ * signal, and commands of a method without any handler are rejected unless
+ * the signal is connected.
+ *
+ * Returns: %TRUE on success, %FALSE if @method already has a handler
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_edge_add_command_handler         (ChamgeEdge    *self,
+                                                         const gchar   *method,
+                                                         ChamgeCommandHandler
+                                                                        handler,
+                                                         gpointer       user_data);
+
+/**
+ * chamge_edge_add_command_handler_full:
+ * @self: a #ChamgeEdge object
+ * @method: the method to handle
+ * @max_concurrency: the number of @method commands handled at once, 0 for
+ *   no limit
+ * @handler: the #ChamgeCommandHandler to call
+ * @user_data: user data passed to @handler
+ * @notify: function to free @user_data when the handler is removed
+ *
+ * Adds a handler for the commands of @method like
+ * chamge_edge_add_command_handler(), but rejects a command while
+ * @max_concurrency commands of @method are in flight.
+ *
+ * Returns: %TRUE on success, %FALSE if @method already has a handler
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_edge_add_command_handler_full    (ChamgeEdge    *self,
+                                                         const gchar   *method,
+                                                         guint          max_concurrency,
+                                                         ChamgeCommandHandler
+                                                                        handler,
+                                                         gpointer       user_data,
+                                                         GDestroyNotify notify);
+
+/**
+ * chamge_edge_remove_command_handler:
+ * @self: a #ChamgeEdge object
+ * @method: the method whose handler is removed
+ *
+ * Removes the handler added for @method.
+ *
+ * Returns: %TRUE if a handler was removed
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_edge_remove_command_handler      (ChamgeEdge    *self,
+                                                         const gchar   *method);
+
 G_END_DECLS
 
 #endif // __CHAMGE_EDGE_H__
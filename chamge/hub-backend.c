@@ -33,6 +33,7 @@ typedef struct
   ChamgeHub *hub;
 
   GClosure *user_command;
+  ChamgeHubBackendDispatchCommand dispatch_command;
 } ChamgeHubBackendPrivate;
 
 typedef enum
@@ -263,3 +264,36 @@ chamge_hub_backend_set_user_command_handler (ChamgeHubBackend * self,
     g_closure_set_marshal (priv->user_command, g_cclosure_marshal_generic);
   }
 }
+
+void
+chamge_hub_backend_set_command_dispatcher (ChamgeHubBackend * self,
+    ChamgeHubBackendDispatchCommand dispatch)
+{
+  ChamgeHubBackendPrivate *priv =
+      chamge_hub_backend_get_instance_private (self);
+
+  g_return_if_fail (CHAMGE_IS_HUB_BACKEND (self));
+
+  priv->dispatch_command = dispatch;
+}
+
+ChamgeReturn
+chamge_hub_backend_dispatch_command (ChamgeHubBackend * self,
+    const gchar * method, const gchar * cmd, gchar ** response,
+    GError ** error)
+{
+  ChamgeHubBackendPrivate *priv =
+      chamge_hub_backend_get_instance_private (self);
+  ChamgeHubBackendClass *klass;
+
+  g_return_val_if_fail (CHAMGE_IS_HUB_BACKEND (self), CHAMGE_RETURN_FAIL);
+
+  /* a direct call, neither GValue boxing nor a property lookup on the way */
+  if (priv->dispatch_command != NULL)
+    return priv->dispatch_command (priv->hub, method, cmd, response, error);
+
+  klass = CHAMGE_HUB_BACKEND_GET_CLASS (self);
+  g_return_val_if_fail (klass->user_command != NULL, CHAMGE_RETURN_FAIL);
+
+  return klass->user_command (self, cmd, response, error);
+}
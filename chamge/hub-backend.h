@@ -58,6 +58,13 @@ typedef ChamgeReturn (*ChamgeHubBackendUserCommand)    (const gchar          *cm
                                                         GError              **error,
                                                         ChamgeHubBackend     *hub_backend);
 
+typedef ChamgeReturn (*ChamgeHubBackendDispatchCommand)
+                                                       (ChamgeHub            *hub,
+                                                        const gchar          *method,
+                                                        const gchar          *cmd,
+                                                        gchar               **response,
+                                                        GError              **error);
+
 ChamgeHubBackend      *chamge_hub_backend_new          (ChamgeHub            *hub);
 
 ChamgeReturn            chamge_hub_backend_enroll      (ChamgeHubBackend     *self);
@@ -77,6 +84,17 @@ void  chamge_hub_backend_set_user_command_handler      (ChamgeHubBackend     *se
                                                         ChamgeHubBackendUserCommand
                                                                               user_command);
 
+void  chamge_hub_backend_set_command_dispatcher        (ChamgeHubBackend     *self,
+                                                        ChamgeHubBackendDispatchCommand
+                                                                              dispatch);
+
+ChamgeReturn            chamge_hub_backend_dispatch_command
+                                                       (ChamgeHubBackend     *self,
+                                                        const gchar          *method,
+                                                        const gchar          *cmd,
+                                                        gchar               **response,
+                                                        GError              **error);
+
 G_END_DECLS
 
 #endif // __CHAMGE_HUB_BACKEND_H__
@@ -22,6 +22,7 @@
 #include "hub.h"
 #include "enumtypes.h"
 #include "hub-backend.h"
+#include "command-registry.h"
 
 typedef struct
 {
@@ -29,7 +30,13 @@ typedef struct
 
   ChamgeHubBackend *hub_backend;
 
+  ChamgeCommandRegistry *commands;
+
   gint n_stream;
+
+  /* read by the backend from its own sources */
+  guint capacity;
+  guint load;
 } ChamgeHubPrivate;
 
 typedef enum
@@ -81,6 +88,32 @@ chamge_hub_user_command_cb (const gchar * cmd, gchar ** response,
   return ret;
 }
 
+static ChamgeReturn
+chamge_hub_dispatch_command_cb (ChamgeHub * self, const gchar * method,
+    const gchar * cmd, gchar ** response, GError ** error)
+{
+  ChamgeHubPrivate *priv = chamge_hub_get_instance_private (self);
+  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+
+  if (chamge_command_registry_dispatch (priv->commands, CHAMGE_NODE (self),
+          method, cmd, response, error, &ret))
+    return ret;
+
+  /* unknown methods do not wake up an application which only added handlers */
+  if (CHAMGE_HUB_GET_CLASS (self)->user_command != NULL
+      || g_signal_has_handler_pending (self, signals[SIG_USER_COMMAND], 0,
+          FALSE)) {
+    g_signal_emit (self, signals[SIG_USER_COMMAND], 0, cmd, response, error,
+        &ret);
+    return ret;
+  }
+
+  g_set_error (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_NOT_SUPPORTED,
+      "method(%s) is not supported", method ? method : "(null)");
+
+  return CHAMGE_RETURN_FAIL;
+}
+
 static ChamgeReturn
 chamge_hub_enroll (ChamgeNode * node)
 {
@@ -93,6 +126,8 @@ chamge_hub_enroll (ChamgeNode * node)
 
   chamge_hub_backend_set_user_command_handler (priv->hub_backend,
       chamge_hub_user_command_cb);
+  chamge_hub_backend_set_command_dispatcher (priv->hub_backend,
+      chamge_hub_dispatch_command_cb);
   ret = chamge_hub_backend_enroll (priv->hub_backend);
 
   return ret;
@@ -158,6 +193,17 @@ chamge_hub_dispose (GObject * object)
   G_OBJECT_CLASS (chamge_hub_parent_class)->dispose (object);
 }
 
+static void
+chamge_hub_finalize (GObject * object)
+{
+  ChamgeHub *self = CHAMGE_HUB (object);
+  ChamgeHubPrivate *priv = chamge_hub_get_instance_private (self);
+
+  chamge_command_registry_free (priv->commands);
+
+  G_OBJECT_CLASS (chamge_hub_parent_class)->finalize (object);
+}
+
 static void
 chamge_hub_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -202,6 +248,7 @@ chamge_hub_class_init (ChamgeHubClass * klass)
   object_class->get_property = chamge_hub_get_property;
   object_class->set_property = chamge_hub_set_property;
   object_class->dispose = chamge_hub_dispose;
+  object_class->finalize = chamge_hub_finalize;
 
   properties[PROP_BACKEND] = g_param_spec_enum ("backend", "backend", "backend",
       CHAMGE_TYPE_BACKEND, CHAMGE_BACKEND_UNKNOWN,
@@ -228,6 +275,9 @@ chamge_hub_class_init (ChamgeHubClass * klass)
 static void
 chamge_hub_init (ChamgeHub * self)
 {
+  ChamgeHubPrivate *priv = chamge_hub_get_instance_private (self);
+
+  priv->commands = chamge_command_registry_new ();
 }
 
 ChamgeHub *
@@ -260,3 +310,70 @@ chamge_hub_get_uid (ChamgeHub * self, gchar ** uid)
 
   return ret;
 }
+
+gboolean
+chamge_hub_add_command_handler (ChamgeHub * self, const gchar * method,
+    ChamgeCommandHandler handler, gpointer user_data)
+{
+  return chamge_hub_add_command_handler_full (self, method, 0, handler,
+      user_data, NULL);
+}
+
+gboolean
+chamge_hub_add_command_handler_full (ChamgeHub * self, const gchar * method,
+    guint max_concurrency, ChamgeCommandHandler handler, gpointer user_data,
+    GDestroyNotify notify)
+{
+  ChamgeHubPrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_HUB (self), FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+  g_return_val_if_fail (handler != NULL, FALSE);
+
+  priv = chamge_hub_get_instance_private (self);
+
+  return chamge_command_registry_add (priv->commands, method, max_concurrency,
+      handler, user_data, notify);
+}
+
+gboolean
+chamge_hub_remove_command_handler (ChamgeHub * self, const gchar * method)
+{
+  ChamgeHubPrivate *priv;
+
+  g_return_val_if_fail (CHAMGE_IS_HUB (self), FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+
+  priv = chamge_hub_get_instance_private (self);
+
+  return chamge_command_registry_remove (priv->commands, method);
+}
+
+void
+chamge_hub_set_load (ChamgeHub * self, guint capacity, guint load)
+{
+  ChamgeHubPrivate *priv;
+
+  g_return_if_fail (CHAMGE_IS_HUB (self));
+
+  priv = chamge_hub_get_instance_private (self);
+
+  g_atomic_int_set (&priv->capacity, capacity);
+  g_atomic_int_set (&priv->load, load);
+}
+
+void
+chamge_hub_get_load (ChamgeHub * self, guint * capacity, guint * load)
+{
+  ChamgeHubPrivate *priv;
+
+  g_return_if_fail (CHAMGE_IS_HUB (self));
+
+  priv = chamge_hub_get_instance_private (self);
+
+  if (capacity != NULL)
+    *capacity = g_atomic_int_get (&priv->capacity);
+
+  if (load != NULL)
+    *load = g_atomic_int_get (&priv->load);
+}
@@ -90,6 +90,92 @@ ChamgeHub*    chamge_hub_new_full                     (const gchar   *uid,
 CHAMGE_API_EXPORT
 ChamgeReturn  chamge_hub_get_uid                     (ChamgeHub *self, gchar ** uid);
 
+/**
+ * chamge_hub_add_command_handler:
+ * @self: a #ChamgeHub object
+ * @method: the method to handle, e.g. "streamingStart"
+ * @handler: the #ChamgeCommandHandler to call
+ * @user_data: user data passed to @handler
+ *
+ * Adds a handler for the commands of @method. Such commands are dispatched
+ * to @handler directly instead of being emitted through the "user-command"
+ * signal, and commands of a method without any handler are rejected unless
+ * the signal is connected.
+ *
+ * Returns: %TRUE on success, %FALSE if @method already has a handler
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_hub_add_command_handler          (ChamgeHub     *self,
+                                                         const gchar   *method,
+                                                         ChamgeCommandHandler
+                                                                        handler,
+                                                         gpointer       user_data);
+
+/**
+ * chamge_hub_add_command_handler_full:
+ * @self: a #ChamgeHub object
+ * @method: the method to handle
+ * @max_concurrency: the number of @method commands handled at once, 0 for
+ *   no limit
+ * @handler: the #ChamgeCommandHandler to call
+ * @user_data: user data passed to @handler
+ * @notify: function to free @user_data when the handler is removed
+ *
+ * Adds a handler for the commands of @method like
+ * chamge_hub_add_command_handler(), but rejects a command while
+ * @max_concurrency commands of @method are in flight.
+ *
+ * Returns: %TRUE on success, %FALSE if @method already has a handler
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_hub_add_command_handler_full     (ChamgeHub     *self,
+                                                         const gchar   *method,
+                                                         guint          max_concurrency,
+                                                         ChamgeCommandHandler
+                                                                        handler,
+                                                         gpointer       user_data,
+                                                         GDestroyNotify notify);
+
+/**
+ * chamge_hub_remove_command_handler:
+ * @self: a #ChamgeHub object
+ * @method: the method whose handler is removed
+ *
+ * Removes the handler added for @method.
+ *
+ * Returns: %TRUE if a handler was removed
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_hub_remove_command_handler       (ChamgeHub     *self,
+                                                         const gchar   *method);
+
+/**
+ * chamge_hub_set_load:
+ * @self: a #ChamgeHub object
+ * @capacity: the number of streams the relay can take, or 0 if unknown
+ * @load: the number of streams the relay takes now
+ *
+ * Sets the load reported to the arbiter, which assigns edges to the hubs
+ * with room left. The load is sent along with the next heartbeat.
+ */
+CHAMGE_API_EXPORT
+void            chamge_hub_set_load                     (ChamgeHub     *self,
+                                                         guint          capacity,
+                                                         guint          load);
+
+/**
+ * chamge_hub_get_load:
+ * @self: a #ChamgeHub object
+ * @capacity: (out) (optional): the capacity set by chamge_hub_set_load()
+ * @load: (out) (optional): the load set by chamge_hub_set_load()
+ *
+ * Gets the load reported to the arbiter.
+ */
+CHAMGE_API_EXPORT
+void            chamge_hub_get_load                     (ChamgeHub     *self,
+                                                         guint         *capacity,
+                                                         guint         *load);
+
 G_END_DECLS
 
 #endif // __CHAMGE_HUB_H__
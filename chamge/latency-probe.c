@@ -0,0 +1,227 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "latency-probe.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/* a probe is a TCP handshake with the relay, so no SRT session is set up;
+ * a relay listening on UDP only answers with a reset, which takes the same
+ * round trip */
+#define PROBE_TIMEOUT_SECONDS   2
+
+struct _ChamgeLatencyProbe
+{
+  GSocketClient *client;
+  GCancellable *cancellable;
+
+  /* hub id -> uri */
+  GHashTable *targets;
+
+  /* hub id -> smoothed round-trip time in microseconds */
+  GHashTable *rtts;
+};
+
+typedef struct
+{
+  ChamgeLatencyProbe *probe;
+  gchar *hub_id;
+  gint64 started;
+} ProbeRequest;
+
+static void
+probe_request_free (ProbeRequest * request)
+{
+  g_free (request->hub_id);
+  g_free (request);
+}
+
+static void
+_update_rtt (ChamgeLatencyProbe * self, const gchar * hub_id, gint64 rtt)
+{
+  gpointer value;
+
+  /* only hubs still offered are kept */
+  if (!g_hash_table_contains (self->targets, hub_id))
+    return;
+
+  /* smoothed like the TCP srtt, so that a single slow probe does not move
+   * the edge */
+  if (g_hash_table_lookup_extended (self->rtts, hub_id, NULL, &value))
+    rtt = (7 * GPOINTER_TO_SIZE (value) + rtt) / 8;
+
+  g_hash_table_insert (self->rtts, g_strdup (hub_id),
+      GSIZE_TO_POINTER (MAX (rtt, 1)));
+}
+
+static void
+_connect_cb (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  ProbeRequest *request = user_data;
+  g_autoptr (GSocketConnection) connection = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 rtt;
+
+  connection = g_socket_client_connect_finish (G_SOCKET_CLIENT (source),
+      result, &error);
+
+  /* the probe may be gone already */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    goto out;
+
+  rtt = g_get_monotonic_time () - request->started;
+
+  if (connection != NULL
+      || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED)) {
+    _update_rtt (request->probe, request->hub_id, rtt);
+  } else {
+    g_debug ("%s is unreachable: %s", request->hub_id, error->message);
+    g_hash_table_remove (request->probe->rtts, request->hub_id);
+  }
+
+  if (connection != NULL)
+    g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+
+out:
+  probe_request_free (request);
+}
+
+ChamgeLatencyProbe *
+chamge_latency_probe_new (void)
+{
+  ChamgeLatencyProbe *self = g_new0 (ChamgeLatencyProbe, 1);
+
+  self->client = g_socket_client_new ();
+  g_socket_client_set_timeout (self->client, PROBE_TIMEOUT_SECONDS);
+  self->cancellable = g_cancellable_new ();
+
+  self->targets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  self->rtts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  return self;
+}
+
+void
+chamge_latency_probe_free (ChamgeLatencyProbe * self)
+{
+  if (self == NULL)
+    return;
+
+  /* probes in flight see the cancellation and leave @self alone */
+  g_cancellable_cancel (self->cancellable);
+  g_object_unref (self->cancellable);
+  g_object_unref (self->client);
+
+  g_hash_table_unref (self->targets);
+  g_hash_table_unref (self->rtts);
+
+  g_free (self);
+}
+
+void
+chamge_latency_probe_set_targets (ChamgeLatencyProbe * self,
+    const gchar * candidates)
+{
+  g_auto (GStrv) items = NULL;
+  GHashTableIter iter;
+  gpointer hub_id;
+  guint i;
+
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_remove_all (self->targets);
+
+  if (candidates != NULL) {
+    items = g_strsplit (candidates, ",", -1);
+    for (i = 0; items[i] != NULL; i++) {
+      gchar *uri = strchr (items[i], '=');
+
+      if (uri == NULL || uri == items[i] || uri[1] == '\0')
+        continue;
+
+      g_hash_table_insert (self->targets, g_strndup (items[i], uri - items[i]),
+          g_strdup (uri + 1));
+    }
+  }
+
+  g_hash_table_iter_init (&iter, self->rtts);
+  while (g_hash_table_iter_next (&iter, &hub_id, NULL)) {
+    if (!g_hash_table_contains (self->targets, hub_id))
+      g_hash_table_iter_remove (&iter);
+  }
+}
+
+void
+chamge_latency_probe_run (ChamgeLatencyProbe * self)
+{
+  GHashTableIter iter;
+  gpointer hub_id, uri;
+
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_iter_init (&iter, self->targets);
+  while (g_hash_table_iter_next (&iter, &hub_id, &uri)) {
+    g_autoptr (GSocketConnectable) connectable = NULL;
+    g_autoptr (GError) error = NULL;
+    ProbeRequest *request;
+
+    connectable = g_network_address_parse_uri (uri, 0, &error);
+    if (connectable == NULL) {
+      g_debug ("failed to parse %s: %s", (gchar *) uri, error->message);
+      continue;
+    }
+
+    request = g_new0 (ProbeRequest, 1);
+    request->probe = self;
+    request->hub_id = g_strdup (hub_id);
+    request->started = g_get_monotonic_time ();
+
+    g_socket_client_connect_async (self->client, connectable,
+        self->cancellable, _connect_cb, request);
+  }
+}
+
+gchar *
+chamge_latency_probe_to_string (ChamgeLatencyProbe * self)
+{
+  GString *str;
+  GHashTableIter iter;
+  gpointer hub_id, rtt;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (g_hash_table_size (self->rtts) == 0)
+    return NULL;
+
+  str = g_string_new (NULL);
+
+  g_hash_table_iter_init (&iter, self->rtts);
+  while (g_hash_table_iter_next (&iter, &hub_id, &rtt)) {
+    if (str->len > 0)
+      g_string_append_c (str, ',');
+
+    g_string_append_printf (str, "%s=%" G_GSIZE_FORMAT, (gchar *) hub_id,
+        (GPOINTER_TO_SIZE (rtt) + 500) / 1000);
+  }
+
+  return g_string_free (str, FALSE);
+}
@@ -0,0 +1,47 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_LATENCY_PROBE_H__
+#define __CHAMGE_LATENCY_PROBE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ChamgeLatencyProbe ChamgeLatencyProbe;
+
+ChamgeLatencyProbe     *chamge_latency_probe_new        (void);
+
+void                    chamge_latency_probe_free       (ChamgeLatencyProbe     *self);
+
+/* @candidates lists the hubs to measure as "<hub id>=<uri>" items joined by
+ * commas; the times of the hubs no longer listed are dropped */
+void                    chamge_latency_probe_set_targets
+                                                        (ChamgeLatencyProbe     *self,
+                                                         const gchar            *candidates);
+
+/* starts measuring every target in the thread-default main context */
+void                    chamge_latency_probe_run        (ChamgeLatencyProbe     *self);
+
+/* returns the measured round-trip times as "<hub id>=<rtt in ms>" items
+ * joined by commas, or NULL if none is known yet */
+gchar                  *chamge_latency_probe_to_string  (ChamgeLatencyProbe     *self);
+
+G_END_DECLS
+
+#endif // __CHAMGE_LATENCY_PROBE_H__
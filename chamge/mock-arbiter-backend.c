@@ -53,6 +53,17 @@ chamge_mock_arbiter_backend_deactivate (ChamgeArbiterBackend * self)
   return CHAMGE_RETURN_OK;
 }
 
+/* echoes a command back, so that callers can check what was sent */
+static ChamgeReturn
+chamge_mock_arbiter_backend_user_command (ChamgeArbiterBackend * self,
+    const gchar * cmd, gchar ** out, GError ** error)
+{
+  if (out != NULL)
+    *out = g_strdup (cmd);
+
+  return CHAMGE_RETURN_OK;
+}
+
 static void
 chamge_mock_arbiter_backend_class_init (ChamgeMockArbiterBackendClass * klass)
 {
@@ -63,6 +74,7 @@ chamge_mock_arbiter_backend_class_init (ChamgeMockArbiterBackendClass * klass)
   backend_class->delist = chamge_mock_arbiter_backend_delist;
   backend_class->activate = chamge_mock_arbiter_backend_activate;
   backend_class->deactivate = chamge_mock_arbiter_backend_deactivate;
+  backend_class->user_command = chamge_mock_arbiter_backend_user_command;
 }
 
 static void
@@ -29,15 +29,28 @@ struct _ChamgeMockEdgeBackend
 G_DEFINE_TYPE (ChamgeMockEdgeBackend, chamge_mock_edge_backend, CHAMGE_TYPE_EDGE_BACKEND)
 /* *INDENT-ON* */
 
+#define MOCK_BACKEND_KEY        "chamge-mock-edge-backend"
+
 static ChamgeReturn
 chamge_mock_edge_backend_enroll (ChamgeEdgeBackend * self)
 {
+  g_autoptr (ChamgeEdge) edge = NULL;
+
+  /* where receive_command() finds the backend of the edge */
+  g_object_get (self, "edge", &edge, NULL);
+  g_object_set_data (G_OBJECT (edge), MOCK_BACKEND_KEY, self);
+
   return CHAMGE_RETURN_OK;
 }
 
 static ChamgeReturn
 chamge_mock_edge_backend_delist (ChamgeEdgeBackend * self)
 {
+  g_autoptr (ChamgeEdge) edge = NULL;
+
+  g_object_get (self, "edge", &edge, NULL);
+  g_object_set_data (G_OBJECT (edge), MOCK_BACKEND_KEY, NULL);
+
   return CHAMGE_RETURN_OK;
 }
 
@@ -53,6 +66,12 @@ chamge_mock_edge_backend_deactivate (ChamgeEdgeBackend * self)
   return CHAMGE_RETURN_OK;
 }
 
+static ChamgeReturn
+chamge_mock_edge_backend_enroll_activate (ChamgeEdgeBackend * self)
+{
+  return CHAMGE_RETURN_OK;
+}
+
 static gchar *
 chamge_mock_edge_backend_request_target_uri (ChamgeEdgeBackend * self,
     GError ** error)
@@ -61,6 +80,38 @@ chamge_mock_edge_backend_request_target_uri (ChamgeEdgeBackend * self,
   return g_steal_pointer (&target_uri);
 }
 
+static GVariant *
+chamge_mock_edge_backend_request_batch (ChamgeEdgeBackend * self,
+    const gchar * method, const gchar * const *edge_ids, GError ** error)
+{
+  GVariantBuilder builder;
+  const gchar *result = NULL;
+  guint i;
+
+  if (!g_strcmp0 (method, "enroll"))
+    result = "enrolled";
+  else if (!g_strcmp0 (method, "activate")
+      || !g_strcmp0 (method, "enrollActivate"))
+    result = "activated";
+  else if (!g_strcmp0 (method, "deactivate"))
+    result = "deactivated";
+  else if (!g_strcmp0 (method, "delist"))
+    result = "delisted";
+
+  if (result == NULL) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_NOT_SUPPORTED,
+        "method(%s) is not supported in a batch", method);
+    return NULL;
+  }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  for (i = 0; edge_ids[i] != NULL; i++)
+    g_variant_builder_add (&builder, "{ss}", edge_ids[i], result);
+
+  return g_variant_builder_end (&builder);
+}
+
 
 static void
 chamge_mock_edge_backend_class_init (ChamgeMockEdgeBackendClass * klass)
@@ -71,8 +122,10 @@ chamge_mock_edge_backend_class_init (ChamgeMockEdgeBackendClass * klass)
   backend_class->delist = chamge_mock_edge_backend_delist;
   backend_class->activate = chamge_mock_edge_backend_activate;
   backend_class->deactivate = chamge_mock_edge_backend_deactivate;
+  backend_class->enroll_activate = chamge_mock_edge_backend_enroll_activate;
   backend_class->request_target_uri =
       chamge_mock_edge_backend_request_target_uri;
+  backend_class->request_batch = chamge_mock_edge_backend_request_batch;
 
 }
 
@@ -80,3 +133,19 @@ static void
 chamge_mock_edge_backend_init (ChamgeMockEdgeBackend * self)
 {
 }
+
+ChamgeReturn
+chamge_mock_edge_backend_receive_command (ChamgeEdge * edge,
+    const gchar * method, const gchar * cmd, gchar ** response,
+    GError ** error)
+{
+  ChamgeEdgeBackend *backend = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_EDGE (edge), CHAMGE_RETURN_FAIL);
+
+  backend = g_object_get_data (G_OBJECT (edge), MOCK_BACKEND_KEY);
+  g_return_val_if_fail (backend != NULL, CHAMGE_RETURN_FAIL);
+
+  return chamge_edge_backend_dispatch_command (backend, method, cmd, response,
+      error);
+}
@@ -26,6 +26,15 @@ G_BEGIN_DECLS
 #define CHAMGE_TYPE_MOCK_EDGE_BACKEND       (chamge_mock_edge_backend_get_type ())
 G_DECLARE_FINAL_TYPE (ChamgeMockEdgeBackend, chamge_mock_edge_backend, CHAMGE, MOCK_EDGE_BACKEND, ChamgeEdgeBackend)
 
+/* hands @cmd of @method to @edge as if it came from the broker; @edge must
+ * be enrolled with the mock backend */
+ChamgeReturn    chamge_mock_edge_backend_receive_command
+                                                (ChamgeEdge            *edge,
+                                                 const gchar           *method,
+                                                 const gchar           *cmd,
+                                                 gchar                **response,
+                                                 GError               **error);
+
 G_END_DECLS
 
 #endif // __CHAMGE_MOCK_EDGE_BACKEND_H__
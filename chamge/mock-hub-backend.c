@@ -29,15 +29,28 @@ struct _ChamgeMockHubBackend
 G_DEFINE_TYPE (ChamgeMockHubBackend, chamge_mock_hub_backend, CHAMGE_TYPE_HUB_BACKEND)
 /* *INDENT-ON* */
 
+#define MOCK_BACKEND_KEY        "chamge-mock-hub-backend"
+
 static ChamgeReturn
 chamge_mock_hub_backend_enroll (ChamgeHubBackend * self)
 {
+  g_autoptr (ChamgeHub) hub = NULL;
+
+  /* where receive_command() finds the backend of the hub */
+  g_object_get (self, "hub", &hub, NULL);
+  g_object_set_data (G_OBJECT (hub), MOCK_BACKEND_KEY, self);
+
   return CHAMGE_RETURN_OK;
 }
 
 static ChamgeReturn
 chamge_mock_hub_backend_delist (ChamgeHubBackend * self)
 {
+  g_autoptr (ChamgeHub) hub = NULL;
+
+  g_object_get (self, "hub", &hub, NULL);
+  g_object_set_data (G_OBJECT (hub), MOCK_BACKEND_KEY, NULL);
+
   return CHAMGE_RETURN_OK;
 }
 
@@ -69,3 +82,19 @@ static void
 chamge_mock_hub_backend_init (ChamgeMockHubBackend * self)
 {
 }
+
+ChamgeReturn
+chamge_mock_hub_backend_receive_command (ChamgeHub * hub,
+    const gchar * method, const gchar * cmd, gchar ** response,
+    GError ** error)
+{
+  ChamgeHubBackend *backend = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_HUB (hub), CHAMGE_RETURN_FAIL);
+
+  backend = g_object_get_data (G_OBJECT (hub), MOCK_BACKEND_KEY);
+  g_return_val_if_fail (backend != NULL, CHAMGE_RETURN_FAIL);
+
+  return chamge_hub_backend_dispatch_command (backend, method, cmd, response,
+      error);
+}
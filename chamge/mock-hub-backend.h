@@ -26,6 +26,15 @@ G_BEGIN_DECLS
 #define CHAMGE_TYPE_MOCK_HUB_BACKEND       (chamge_mock_hub_backend_get_type ())
 G_DECLARE_FINAL_TYPE (ChamgeMockHubBackend, chamge_mock_hub_backend, CHAMGE, MOCK_HUB_BACKEND, ChamgeHubBackend)
 
+/* hands @cmd of @method to @hub as if it came from the broker; @hub must
+ * be enrolled with the mock backend */
+ChamgeReturn    chamge_mock_hub_backend_receive_command
+                                                (ChamgeHub             *hub,
+                                                 const gchar           *method,
+                                                 const gchar           *cmd,
+                                                 gchar                **response,
+                                                 GError               **error);
+
 G_END_DECLS
 
 #endif // __CHAMGE_MOCK_HUB_BACKEND_H__
@@ -0,0 +1,510 @@
+#!/usr/bin/env python3
+#
+# Generates C structs and codecs for the chamge messages of messages.idl.
+#
+# usage: msgcodegen.py <messages.idl> <output.h> <output.c>
+
+import os
+import re
+import sys
+
+TYPES = {
+  'string': 'const gchar *',
+  'int': 'gint64 ',
+  'bool': 'gboolean ',
+}
+
+message_re = re.compile(r'^message\s+([A-Z][A-Za-z0-9]*)\s*\{$')
+field_re = re.compile(
+  r'^(string|int|bool)\s+([a-z][a-z0-9_]*)\s+"([^"\\]+)"'
+  r'((?:\s+optional|\s+header\s+[A-Z][A-Z0-9_]*)*)\s*;$')
+
+
+class Field:
+  def __init__(self, type, name, member, optional, header):
+    self.type = type
+    self.name = name
+    self.member = member
+    self.optional = optional
+    self.header = header
+
+
+class Message:
+  def __init__(self, name):
+    self.name = name
+    self.fields = []
+    self.cname = 'ChamgeMsg' + name
+    self.prefix = 'chamge_msg_' + re.sub(r'(?<!^)([A-Z])', r'_\1', name).lower()
+
+
+def fail(path, lineno, msg):
+  sys.stderr.write('%s:%d: %s\n' % (path, lineno, msg))
+  sys.exit(1)
+
+
+def parse(path):
+  messages = []
+  current = None
+
+  with open(path) as f:
+    for lineno, line in enumerate(f, 1):
+      line = line.split('#', 1)[0].strip()
+      if not line:
+        continue
+
+      if current is None:
+        m = message_re.match(line)
+        if m is None:
+          fail(path, lineno, 'expected a message declaration')
+        current = Message(m.group(1))
+        continue
+
+      if line == '}':
+        if not current.fields:
+          fail(path, lineno, 'message %s has no field' % current.name)
+        messages.append(current)
+        current = None
+        continue
+
+      m = field_re.match(line)
+      if m is None:
+        fail(path, lineno, 'malformed field')
+
+      attrs = m.group(4).split()
+      header = None
+      if 'header' in attrs:
+        header = attrs[attrs.index('header') + 1]
+      if any(f.name == m.group(2) for f in current.fields):
+        fail(path, lineno, 'duplicated field %s' % m.group(2))
+
+      current.fields.append(Field(m.group(1), m.group(2), m.group(3),
+                                  'optional' in attrs, header))
+
+  if current is not None:
+    fail(path, lineno, 'message %s is not closed' % current.name)
+
+  return messages
+
+
+def c_string(s):
+  return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def func(ret, name, args):
+  # GStreamer style: return type on its own line, continuation indent 4
+  out = ret + '\n' + name + ' ('
+  line = out.split('\n')[-1]
+  for i, arg in enumerate(args):
+    sep = ', ' if i < len(args) - 1 else ')'
+    if len(line) + len(arg) + len(sep) > 80:
+      out = out.rstrip() + '\n    '
+      line = '    '
+    out += arg + sep
+    line += arg + sep
+  return out
+
+
+HEADER_PROLOGUE = '''/* Generated by msgcodegen.py from %(idl)s, do not edit. */
+
+#ifndef __CHAMGE_MESSAGES_GENERATED_H__
+#define __CHAMGE_MESSAGES_GENERATED_H__
+
+#include "amqp-message.h"
+
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* Strings of a decoded message are borrowed from the JsonObject (or the
+ * JsonParser) they were decoded from, and strings of a message to encode are
+ * borrowed from the caller.
+ *
+ * _encode_json () never allocates; like snprintf () it writes at most @size
+ * bytes including the terminating nul and returns the length the whole
+ * encoding needs, so a return value >= @size means @buf was too short. */
+'''
+
+HEADER_EPILOGUE = '''G_END_DECLS
+
+#endif // __CHAMGE_MESSAGES_GENERATED_H__
+'''
+
+SOURCE_PROLOGUE = '''/* Generated by msgcodegen.py from %(idl)s, do not edit. */
+
+#include "config.h"
+
+#include "%(header)s"
+#include "types.h"
+
+#include <string.h>
+
+/* messages encoding into fewer bytes do not hit the heap but for the result */
+#define JSON_STACK_SIZE         256
+
+typedef struct
+{
+  gchar *buf;
+  gsize size;
+  gsize len;
+} JsonWriter;
+
+static void
+_put (JsonWriter * w, const gchar * data, gsize len)
+{
+  if (w->len < w->size)
+    memcpy (w->buf + w->len, data, MIN (len, w->size - w->len));
+  w->len += len;
+}
+
+static void
+_put_string (JsonWriter * w, const gchar * value)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  const gchar *run = value;
+  const gchar *p;
+
+  _put (w, "\\"", 1);
+
+  for (p = value; *p != '\\0'; p++) {
+    guchar c = (guchar) * p;
+    gchar escaped[6] = { '\\\\', 'u', '0', '0', 0, 0 };
+
+    if (c != '"' && c != '\\\\' && c >= 0x20)
+      continue;
+
+    _put (w, run, p - run);
+    run = p + 1;
+
+    if (c == '"' || c == '\\\\') {
+      escaped[1] = c;
+      _put (w, escaped, 2);
+    } else {
+      escaped[4] = hex[c >> 4];
+      escaped[5] = hex[c & 0xf];
+      _put (w, escaped, 6);
+    }
+  }
+
+  _put (w, run, p - run);
+  _put (w, "\\"", 1);
+}
+
+static void
+_put_int (JsonWriter * w, gint64 value)
+{
+  gchar digits[24];
+  gchar *p = digits + sizeof (digits);
+  guint64 v = value < 0 ? -(guint64) value : (guint64) value;
+
+  do {
+    *--p = '0' + v %% 10;
+    v /= 10;
+  } while (v != 0);
+
+  if (value < 0)
+    *--p = '-';
+
+  _put (w, p, digits + sizeof (digits) - p);
+}
+
+static void
+_put_member (JsonWriter * w, gboolean * first, const gchar * member, gsize len)
+{
+  if (!*first)
+    _put (w, ",", 1);
+  *first = FALSE;
+
+  _put (w, member, len);
+}
+
+static gsize
+_finish (JsonWriter * w)
+{
+  if (w->size > 0)
+    w->buf[MIN (w->len, w->size - 1)] = '\\0';
+
+  return w->len;
+}
+
+/* leaves @node NULL for an absent optional member */
+static gboolean
+_get_member (JsonObject * object, const gchar * member, gboolean optional,
+    GType type, JsonNode ** node, GError ** error)
+{
+  *node = json_object_get_member (object, member);
+
+  if (*node == NULL || JSON_NODE_HOLDS_NULL (*node)) {
+    *node = NULL;
+    if (optional)
+      return TRUE;
+
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_MISSING_PARAMETER, "%%s is missing", member);
+    return FALSE;
+  }
+
+  if (!JSON_NODE_HOLDS_VALUE (*node)
+      || json_node_get_value_type (*node) != type) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "%%s must be a %%s", member,
+        type == G_TYPE_STRING ? "string" :
+        type == G_TYPE_BOOLEAN ? "boolean" : "number");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static JsonObject *
+_load_object (JsonParser * parser, const gchar * data, gssize len,
+    GError ** error)
+{
+  JsonNode *root;
+
+  if (!json_parser_load_from_data (parser, data, len, error))
+    return NULL;
+
+  root = json_parser_get_root (parser);
+  if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root)) {
+    g_set_error_literal (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "message is not a json object");
+    return NULL;
+  }
+
+  return json_node_get_object (root);
+}
+'''
+
+GTYPES = {
+  'string': 'G_TYPE_STRING',
+  'int': 'G_TYPE_INT64',
+  'bool': 'G_TYPE_BOOLEAN',
+}
+
+GETTERS = {
+  'string': 'json_node_get_string',
+  'int': 'json_node_get_int',
+  'bool': 'json_node_get_boolean',
+}
+
+
+def has_headers(msg):
+  return any(f.header is not None for f in msg.fields)
+
+
+def prototypes(msg):
+  protos = [
+    ('gsize', msg.prefix + '_encode_json',
+     ['const %s * msg' % msg.cname, 'gchar * buf', 'gsize size']),
+    ('gchar *', msg.prefix + '_to_json', ['const %s * msg' % msg.cname]),
+    ('gboolean', msg.prefix + '_decode_json',
+     ['%s * msg' % msg.cname, 'JsonObject * object', 'GError ** error']),
+    ('gboolean', msg.prefix + '_parse_json',
+     ['%s * msg' % msg.cname, 'JsonParser * parser', 'const gchar * data',
+      'gssize len', 'GError ** error']),
+  ]
+  if has_headers(msg):
+    protos.append(('void', msg.prefix + '_encode_headers',
+                   ['const %s * msg' % msg.cname,
+                    'ChamgeAmqpHeaders * headers']))
+  return protos
+
+
+def gen_header(messages, idl):
+  out = [HEADER_PROLOGUE % {'idl': idl}]
+
+  for msg in messages:
+    out.append('typedef struct\n{')
+    for f in msg.fields:
+      out.append('  %s%s;' % (TYPES[f.type], f.name))
+    out.append('} %s;\n' % msg.cname)
+
+    for ret, name, args in prototypes(msg):
+      out.append(func(ret, name, args) + ';\n')
+
+  out.append(HEADER_EPILOGUE)
+  return '\n'.join(out)
+
+
+def gen_encode_json(msg):
+  ret, name, args = prototypes(msg)[0]
+  body = [
+    func(ret, name, args),
+    '{',
+    '  JsonWriter w = { buf, size, 0 };',
+    '  gboolean first = TRUE;',
+    '',
+    '  g_return_val_if_fail (msg != NULL, 0);',
+    '  g_return_val_if_fail (buf != NULL || size == 0, 0);',
+    '',
+    '  _put (&w, "{", 1);',
+  ]
+
+  for f in msg.fields:
+    member = c_string('"%s":' % f.member)
+    length = len(f.member) + 3
+    put = '_put_member (&w, &first, %s, %d);' % (member, length)
+    if f.type == 'string':
+      body += [
+        '  if (msg->%s != NULL) {' % f.name,
+        '    ' + put,
+        '    _put_string (&w, msg->%s);' % f.name,
+        '  }',
+      ]
+    elif f.type == 'int':
+      body += [
+        '  ' + put,
+        '  _put_int (&w, msg->%s);' % f.name,
+      ]
+    else:
+      body += [
+        '  ' + put,
+        '  if (msg->%s)' % f.name,
+        '    _put (&w, "true", 4);',
+        '  else',
+        '    _put (&w, "false", 5);',
+      ]
+
+  body += [
+    '  _put (&w, "}", 1);',
+    '',
+    '  return _finish (&w);',
+    '}',
+  ]
+  return '\n'.join(body)
+
+
+def gen_to_json(msg):
+  ret, name, args = prototypes(msg)[1]
+  encode = msg.prefix + '_encode_json'
+  return '\n'.join([
+    func(ret, name, args),
+    '{',
+    '  gchar buf[JSON_STACK_SIZE];',
+    '  gchar *json;',
+    '  gsize len;',
+    '',
+    '  len = %s (msg, buf, sizeof (buf));' % encode,
+    '  if (len < sizeof (buf))',
+    '    return g_strndup (buf, len);',
+    '',
+    '  json = g_malloc (len + 1);',
+    '  %s (msg, json, len + 1);' % encode,
+    '',
+    '  return json;',
+    '}',
+  ])
+
+
+def gen_decode_json(msg):
+  ret, name, args = prototypes(msg)[2]
+  body = [
+    func(ret, name, args),
+    '{',
+    '  JsonNode *node;',
+    '',
+    '  g_return_val_if_fail (msg != NULL, FALSE);',
+    '  g_return_val_if_fail (object != NULL, FALSE);',
+    '',
+    '  memset (msg, 0, sizeof (*msg));',
+  ]
+
+  for f in msg.fields:
+    call = '  if (!_get_member (object, %s, %s, %s, &node, error))' % (
+      c_string(f.member), 'TRUE' if f.optional else 'FALSE', GTYPES[f.type])
+    if len(call) > 80:
+      call = call.replace(', &node, error))', ',\n          &node, error))')
+    body += ['', call, '    return FALSE;']
+    if f.optional:
+      body += [
+        '  if (node != NULL)',
+        '    msg->%s = %s (node);' % (f.name, GETTERS[f.type]),
+      ]
+    else:
+      body.append('  msg->%s = %s (node);' % (f.name, GETTERS[f.type]))
+
+  body += ['', '  return TRUE;', '}']
+  return '\n'.join(body)
+
+
+def gen_parse_json(msg):
+  ret, name, args = prototypes(msg)[3]
+  return '\n'.join([
+    func(ret, name, args),
+    '{',
+    '  JsonObject *object;',
+    '',
+    '  g_return_val_if_fail (msg != NULL, FALSE);',
+    '  g_return_val_if_fail (JSON_IS_PARSER (parser), FALSE);',
+    '  g_return_val_if_fail (data != NULL, FALSE);',
+    '',
+    '  object = _load_object (parser, data, len, error);',
+    '  if (object == NULL)',
+    '    return FALSE;',
+    '',
+    '  return %s_decode_json (msg, object, error);' % msg.prefix,
+    '}',
+  ])
+
+
+def gen_encode_headers(msg):
+  ret, name, args = prototypes(msg)[4]
+  body = [
+    func(ret, name, args),
+    '{',
+    '  g_return_if_fail (msg != NULL);',
+    '  g_return_if_fail (headers != NULL);',
+  ]
+
+  for f in msg.fields:
+    if f.header is None:
+      continue
+    key = 'CHAMGE_AMQP_HEADER_' + f.header
+    body.append('')
+    if f.type == 'string':
+      body += [
+        '  if (msg->%s != NULL)' % f.name,
+        '    chamge_amqp_headers_add_string (headers, %s,' % key,
+        '        msg->%s);' % f.name,
+      ]
+    else:
+      value = 'msg->%s' % f.name
+      value = '(gint32) ' + value if f.type == 'int' else value + ' ? 1 : 0'
+      body += [
+        '  chamge_amqp_headers_add_int (headers, %s,' % key,
+        '      %s);' % value,
+      ]
+
+  body.append('}')
+  return '\n'.join(body)
+
+
+def gen_source(messages, idl, header):
+  out = [SOURCE_PROLOGUE % {'idl': idl, 'header': header}]
+
+  for msg in messages:
+    out += [gen_encode_json(msg), gen_to_json(msg), gen_decode_json(msg),
+            gen_parse_json(msg)]
+    if has_headers(msg):
+      out.append(gen_encode_headers(msg))
+
+  return '\n\n'.join(out) + '\n'
+
+
+def main():
+  if len(sys.argv) != 4:
+    sys.stderr.write('usage: %s <idl> <output.h> <output.c>\n' % sys.argv[0])
+    sys.exit(2)
+
+  idl, out_h, out_c = sys.argv[1:]
+  messages = parse(idl)
+
+  with open(out_h, 'w') as f:
+    f.write(gen_header(messages, os.path.basename(idl)))
+
+  with open(out_c, 'w') as f:
+    f.write(gen_source(messages, os.path.basename(idl), os.path.basename(out_h)))
+
+
+if __name__ == '__main__':
+  main()
@@ -26,6 +26,15 @@
 #include <glib.h>
 #include <string.h>
 
+typedef enum
+{
+  NODE_OPERATION_ENROLL,
+  NODE_OPERATION_DELIST,
+  NODE_OPERATION_ACTIVATE,
+  NODE_OPERATION_DEACTIVATE,
+  NODE_OPERATION_ENROLL_ACTIVATE,
+} _ChamgeNodeOperation;
+
 typedef struct
 {
   GMutex mutex;
@@ -33,17 +42,66 @@ typedef struct
   gchar *uid;
   ChamgeNodeState state;
 
+  /* an asynchronous transition is in progress */
+  gboolean busy;
+
+  /* lazy enroll schedule, see _get_enroll_schedule () */
+  guint enroll_window;
+  guint enroll_slots;
+  guint enroll_rate;
+  guint fleet_size;
+
+  /* failed lazy enrolls since the last one which succeeded */
+  guint enroll_attempts;
+
+  /* the pending lazy enroll, see _schedule_enroll (), in the context the
+   * node was made in, and the operation it retries */
+  GSource *enroll_source;
+  GMainContext *context;
+  _ChamgeNodeOperation enroll_operation;
+
+  /* the operation the backend is called for, -1 for none */
+  gint calling;
+
+  /* an asynchronous transition going on with the pending enroll */
+  GTask *pending;
+
 } ChamgeNodePrivate;
 
 typedef enum
 {
   PROP_UID = 1,
   PROP_STATE,
+  PROP_ENROLL_WINDOW,
+  PROP_ENROLL_SLOTS,
+  PROP_ENROLL_RATE,
+  PROP_FLEET_SIZE,
 
   /*< private > */
-  PROP_LAST = PROP_STATE
+  PROP_LAST = PROP_FLEET_SIZE
 } _ChamgeNodeProperty;
 
+#define DEFAULT_ENROLL_WINDOW   100000
+#define DEFAULT_ENROLL_SLOTS    16
+#define DEFAULT_ENROLL_RATE     100
+
+/* the first retry of a failed lazy enroll, doubled on each failure */
+#define ENROLL_BACKOFF_MS       1000
+
+/* the state a transition starts from, -1 for any, and the one it leads to */
+static const struct
+{
+  const gchar *name;
+  gint from;
+  ChamgeNodeState to;
+} node_operations[] = {
+  {"enroll", CHAMGE_NODE_STATE_NULL, CHAMGE_NODE_STATE_ENROLLED},
+  {"delist", -1, CHAMGE_NODE_STATE_NULL},
+  {"activate", CHAMGE_NODE_STATE_ENROLLED, CHAMGE_NODE_STATE_ACTIVATED},
+  {"deactivate", CHAMGE_NODE_STATE_ACTIVATED, CHAMGE_NODE_STATE_ENROLLED},
+  {"enroll and activate", CHAMGE_NODE_STATE_NULL, CHAMGE_NODE_STATE_ACTIVATED},
+};
+
 static GParamSpec *properties[PROP_LAST + 1];
 
 enum
@@ -83,6 +141,24 @@ chamge_node_deactivate_default (ChamgeNode * self)
   return CHAMGE_RETURN_OK;
 }
 
+/* two round trips, undone if the second one fails */
+static ChamgeReturn
+chamge_node_enroll_activate_default (ChamgeNode * self)
+{
+  ChamgeNodeClass *klass = CHAMGE_NODE_GET_CLASS (self);
+  ChamgeReturn ret;
+
+  ret = klass->enroll (self);
+  if (ret != CHAMGE_RETURN_OK)
+    return ret;
+
+  ret = klass->activate (self);
+  if (ret != CHAMGE_RETURN_OK)
+    klass->delist (self);
+
+  return ret;
+}
+
 static gchar *
 chamge_node_get_uid_default (ChamgeNode * self)
 {
@@ -97,12 +173,16 @@ chamge_node_user_command_default (ChamgeNode * self, const gchar * user_data,
   return CHAMGE_RETURN_OK;
 }
 
+static void _cancel_enroll (ChamgeNode * self);
+
 static void
 chamge_node_dispose (GObject * object)
 {
   ChamgeNode *self = CHAMGE_NODE (object);
   ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
 
+  _cancel_enroll (self);
+
   g_clear_pointer (&priv->uid, g_free);
 
   G_OBJECT_CLASS (chamge_node_parent_class)->dispose (object);
@@ -114,6 +194,7 @@ chamge_node_finalize (GObject * object)
   ChamgeNode *self = CHAMGE_NODE (object);
   ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
 
+  g_main_context_unref (priv->context);
   g_mutex_clear (&priv->mutex);
 
   G_OBJECT_CLASS (chamge_node_parent_class)->finalize (object);
@@ -135,6 +216,18 @@ chamge_node_get_property (GObject * object,
       locker = g_mutex_locker_new (&priv->mutex);
       g_value_set_enum (value, priv->state);
       break;
+    case PROP_ENROLL_WINDOW:
+      g_value_set_uint (value, priv->enroll_window);
+      break;
+    case PROP_ENROLL_SLOTS:
+      g_value_set_uint (value, priv->enroll_slots);
+      break;
+    case PROP_ENROLL_RATE:
+      g_value_set_uint (value, priv->enroll_rate);
+      break;
+    case PROP_FLEET_SIZE:
+      g_value_set_uint (value, priv->fleet_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -153,6 +246,18 @@ chamge_node_set_property (GObject * object,
       g_assert (priv->uid == NULL);     /* construct only */
       priv->uid = g_value_dup_string (value);
       break;
+    case PROP_ENROLL_WINDOW:
+      priv->enroll_window = g_value_get_uint (value);
+      break;
+    case PROP_ENROLL_SLOTS:
+      priv->enroll_slots = g_value_get_uint (value);
+      break;
+    case PROP_ENROLL_RATE:
+      priv->enroll_rate = g_value_get_uint (value);
+      break;
+    case PROP_FLEET_SIZE:
+      priv->fleet_size = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -176,6 +281,29 @@ chamge_node_class_init (ChamgeNodeClass * klass)
       CHAMGE_TYPE_NODE_STATE, CHAMGE_NODE_STATE_NULL,
       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_ENROLL_WINDOW] =
+      g_param_spec_uint ("enroll-window", "enroll-window",
+      "The window in milliseconds over which lazy enrolls are spread",
+      1, G_MAXUINT, DEFAULT_ENROLL_WINDOW,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ENROLL_SLOTS] =
+      g_param_spec_uint ("enroll-slots", "enroll-slots",
+      "The number of slots the enroll window is divided into",
+      1, G_MAXUINT, DEFAULT_ENROLL_SLOTS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ENROLL_RATE] =
+      g_param_spec_uint ("enroll-rate", "enroll-rate",
+      "The enrolls per second the arbiter admits, to size the window by",
+      1, G_MAXUINT, DEFAULT_ENROLL_RATE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FLEET_SIZE] =
+      g_param_spec_uint ("fleet-size", "fleet-size",
+      "The number of devices enrolling with the same arbiter, 0 if unknown",
+      0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, G_N_ELEMENTS (properties),
       properties);
 
@@ -195,6 +323,7 @@ chamge_node_class_init (ChamgeNodeClass * klass)
   klass->delist = chamge_node_delist_default;
   klass->activate = chamge_node_activate_default;
   klass->deactivate = chamge_node_deactivate_default;
+  klass->enroll_activate = chamge_node_enroll_activate_default;
   klass->get_uid = chamge_node_get_uid_default;
   klass->user_command = chamge_node_user_command_default;
 }
@@ -206,34 +335,249 @@ chamge_node_init (ChamgeNode * self)
 
   g_mutex_init (&priv->mutex);
 
+  priv->context = g_main_context_ref_thread_default ();
+  priv->calling = -1;
+
   priv->state = CHAMGE_NODE_STATE_NULL;
+
+  priv->enroll_window = DEFAULT_ENROLL_WINDOW;
+  priv->enroll_slots = DEFAULT_ENROLL_SLOTS;
+  priv->enroll_rate = DEFAULT_ENROLL_RATE;
 }
 
-static gboolean
-enroll_by_uid_group_func (gpointer user_data)
+/* a known fleet widens the window so that it enrolls within "enroll-rate",
+ * and gets a slot per device as long as slots stay a millisecond apart */
+static void
+_get_enroll_schedule (ChamgeNodePrivate * priv, guint * window_ms,
+    guint * slots)
+{
+  *window_ms = priv->enroll_window;
+  *slots = priv->enroll_slots;
+
+  if (priv->fleet_size == 0)
+    return;
+
+  *window_ms = MAX (*window_ms,
+      MIN ((guint64) priv->fleet_size * 1000 / priv->enroll_rate, G_MAXUINT));
+  *slots = MAX (*slots, MIN (priv->fleet_size, *window_ms));
+}
+
+/* equal jitter, half of a ceiling doubled on each failure up to the window
+ * and a random share of the other half, so that a retry never comes right
+ * away */
+static guint
+_get_enroll_backoff (ChamgeNodePrivate * priv)
+{
+  guint window_ms, slots;
+  guint64 ceiling_ms;
+
+  _get_enroll_schedule (priv, &window_ms, &slots);
+
+  ceiling_ms = (guint64) ENROLL_BACKOFF_MS << MIN (priv->enroll_attempts, 31);
+  ceiling_ms = MIN (ceiling_ms, MIN (window_ms, G_MAXINT));
+
+  return ceiling_ms / 2 + g_random_int_range (0, ceiling_ms / 2 + 1);
+}
+
+/* lets chamge_node_enroll_later () retry the operation the backend is called
+ * for */
+static ChamgeReturn
+_node_call (ChamgeNode * self, _ChamgeNodeOperation operation)
 {
-  ChamgeNode *self = CHAMGE_NODE (user_data);
   ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
   ChamgeNodeClass *klass = CHAMGE_NODE_GET_CLASS (self);
+  ChamgeReturn ret = CHAMGE_RETURN_FAIL;
+
+  g_mutex_lock (&priv->mutex);
+  priv->calling = operation;
+  g_mutex_unlock (&priv->mutex);
+
+  switch (operation) {
+    case NODE_OPERATION_ENROLL:
+      ret = klass->enroll (self);
+      break;
+    case NODE_OPERATION_DELIST:
+      ret = klass->delist (self);
+      break;
+    case NODE_OPERATION_ACTIVATE:
+      ret = klass->activate (self);
+      break;
+    case NODE_OPERATION_DEACTIVATE:
+      ret = klass->deactivate (self);
+      break;
+    case NODE_OPERATION_ENROLL_ACTIVATE:
+      ret = klass->enroll_activate (self);
+      break;
+  }
+
+  g_mutex_lock (&priv->mutex);
+  priv->calling = -1;
+  g_mutex_unlock (&priv->mutex);
+
+  return ret;
+}
+
+static void _schedule_enroll (ChamgeNode * self,
+    _ChamgeNodeOperation operation, guint delay_ms);
+static void _node_call_resume (ChamgeNode * self,
+    _ChamgeNodeOperation operation, GTask * task);
+
+static gboolean
+enroll_by_uid_group_func (gpointer user_data)
+{
+  g_autoptr (ChamgeNode) self = g_weak_ref_get (user_data);
+  g_autoptr (GTask) pending = NULL;
+  ChamgeNodePrivate *priv;
+  _ChamgeNodeOperation operation;
   ChamgeReturn ret = CHAMGE_RETURN_OK;
-  g_autoptr (GMutexLocker) locker = NULL;
 
-  g_return_val_if_fail (klass->enroll != NULL, G_SOURCE_REMOVE);
-  g_return_val_if_fail (priv->state == CHAMGE_NODE_STATE_NULL,
-      CHAMGE_RETURN_FAIL);
-  ret = klass->enroll (self);
+  /* the node is gone */
+  if (self == NULL)
+    return G_SOURCE_REMOVE;
+
+  priv = chamge_node_get_instance_private (self);
+
+  g_mutex_lock (&priv->mutex);
+  if (priv->enroll_source == g_main_current_source ())
+    g_clear_pointer (&priv->enroll_source, g_source_unref);
+  operation = priv->enroll_operation;
+  pending = g_steal_pointer (&priv->pending);
+  g_mutex_unlock (&priv->mutex);
+
+  /* the retry resolves an asynchronous transition, off this context too */
+  if (pending != NULL) {
+    _node_call_resume (self, operation, g_steal_pointer (&pending));
+    return G_SOURCE_REMOVE;
+  }
+
+  g_return_val_if_fail (priv->state ==
+      (ChamgeNodeState) node_operations[operation].from, G_SOURCE_REMOVE);
+  ret = _node_call (self, operation);
 
   if (ret == CHAMGE_RETURN_OK) {
-    locker = g_mutex_locker_new (&priv->mutex);
-    priv->state = CHAMGE_NODE_STATE_ENROLLED;
-    g_clear_pointer (&locker, g_mutex_locker_free);
+    priv->enroll_attempts = 0;
+
+    g_mutex_lock (&priv->mutex);
+    priv->state = node_operations[operation].to;
+    pending = g_steal_pointer (&priv->pending);
+    if (pending != NULL)
+      priv->busy = FALSE;
+    g_mutex_unlock (&priv->mutex);
 
     g_signal_emit (self, signals[SIG_STATE_CHANGED], 0, priv->state);
+
+    if (pending != NULL)
+      g_task_return_int (pending, ret);
+  } else if (ret == CHAMGE_RETURN_FAIL) {
+    guint delay_ms = _get_enroll_backoff (priv);
+
+    /* an asynchronous transition reports the failure rather than waiting */
+    g_mutex_lock (&priv->mutex);
+    pending = g_steal_pointer (&priv->pending);
+    if (pending != NULL)
+      priv->busy = FALSE;
+    g_mutex_unlock (&priv->mutex);
+
+    if (pending != NULL) {
+      priv->enroll_attempts = 0;
+      g_task_return_new_error (pending, CHAMGE_BACKEND_ERROR,
+          CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "failed to %s",
+          node_operations[operation].name);
+      return G_SOURCE_REMOVE;
+    }
+
+    priv->enroll_attempts++;
+    g_debug ("%s failed %u times, retrying in %u ms",
+        node_operations[operation].name, priv->enroll_attempts, delay_ms);
+    _schedule_enroll (self, operation, delay_ms);
   }
 
   return G_SOURCE_REMOVE;
 }
 
+static void
+_weak_ref_free (GWeakRef * ref)
+{
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+static void
+_clear_enroll_source (ChamgeNodePrivate * priv)
+{
+  if (priv->enroll_source == NULL)
+    return;
+
+  g_source_destroy (priv->enroll_source);
+  g_clear_pointer (&priv->enroll_source, g_source_unref);
+}
+
+/* a node has a single lazy enroll pending, which does not keep it alive and
+ * is cancelled by a delist; it runs in the context of the node even if it is
+ * scheduled by a backend on a worker thread */
+static void
+_schedule_enroll (ChamgeNode * self, _ChamgeNodeOperation operation,
+    guint delay_ms)
+{
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  GWeakRef *ref = g_new0 (GWeakRef, 1);
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_weak_ref_init (ref, self);
+
+  locker = g_mutex_locker_new (&priv->mutex);
+
+  _clear_enroll_source (priv);
+
+  priv->enroll_operation = operation;
+  priv->enroll_source = g_timeout_source_new (delay_ms);
+  g_source_set_callback (priv->enroll_source, enroll_by_uid_group_func, ref,
+      (GDestroyNotify) _weak_ref_free);
+  g_source_attach (priv->enroll_source, priv->context);
+}
+
+static void
+_cancel_enroll (ChamgeNode * self)
+{
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  g_autoptr (GTask) pending = NULL;
+
+  g_mutex_lock (&priv->mutex);
+
+  _clear_enroll_source (priv);
+
+  priv->enroll_attempts = 0;
+
+  pending = g_steal_pointer (&priv->pending);
+  if (pending != NULL)
+    priv->busy = FALSE;
+
+  g_mutex_unlock (&priv->mutex);
+
+  if (pending != NULL)
+    g_task_return_new_error (pending, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+        "the pending enroll is cancelled");
+}
+
+void
+chamge_node_enroll_later (ChamgeNode * self, guint delay_ms)
+{
+  ChamgeNodePrivate *priv;
+  _ChamgeNodeOperation operation = NODE_OPERATION_ENROLL;
+
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+
+  priv = chamge_node_get_instance_private (self);
+
+  /* an enroll and activate which is throttled is retried as such */
+  g_mutex_lock (&priv->mutex);
+  if (priv->calling == NODE_OPERATION_ENROLL_ACTIVATE)
+    operation = NODE_OPERATION_ENROLL_ACTIVATE;
+  g_mutex_unlock (&priv->mutex);
+
+  _schedule_enroll (self, operation, delay_ms);
+}
+
 ChamgeReturn
 chamge_node_enroll (ChamgeNode * self, gboolean lazy)
 {
@@ -252,7 +596,8 @@ chamge_node_enroll (ChamgeNode * self, gboolean lazy)
 
   if (lazy) {
     const gchar *md5_digest;
-    guint group_time_ms, trigger_ms;
+    guint window_ms, slots, group_time_ms, trigger_ms;
+    guint64 slot;
     gint64 rtime_ms;
     g_autoptr (GChecksum) md5 = NULL;
 
@@ -260,18 +605,19 @@ chamge_node_enroll (ChamgeNode * self, gboolean lazy)
     g_checksum_update (md5, (const guchar *) priv->uid, strlen (priv->uid));
     md5_digest = g_checksum_get_string (md5);
 
-    /* 16 groups in 100 seconds */
-    group_time_ms =
-        g_ascii_strtoull (md5_digest + strlen (md5_digest) - 1, NULL,
-        16) * 6250;
+    /* the slot of the uid in the window; 16 slots take the last hex digit */
+    _get_enroll_schedule (priv, &window_ms, &slots);
+    slot = g_ascii_strtoull (md5_digest + strlen (md5_digest) - 8, NULL,
+        16) % slots;
+    group_time_ms = slot * window_ms / slots;
 
     rtime_ms = g_get_real_time () / 1000;
     trigger_ms =
-        rtime_ms % 100000 >
-        group_time_ms ? 100000 + group_time_ms -
-        rtime_ms % 100000 : group_time_ms - rtime_ms % 100000;
+        rtime_ms % window_ms >
+        group_time_ms ? window_ms + group_time_ms -
+        rtime_ms % window_ms : group_time_ms - rtime_ms % window_ms;
 
-    g_timeout_add (trigger_ms, enroll_by_uid_group_func, self);
+    _schedule_enroll (self, NODE_OPERATION_ENROLL, trigger_ms);
 
     ret = CHAMGE_RETURN_ASYNC;
 
@@ -303,6 +649,9 @@ chamge_node_delist (ChamgeNode * self)
   klass = CHAMGE_NODE_GET_CLASS (self);
   g_return_val_if_fail (klass->delist != NULL, CHAMGE_RETURN_FAIL);
 
+  /* an enroll still to come would undo the delist */
+  _cancel_enroll (self);
+
   /* Check return value by local variable to make debugger trace stack easy */
   ret = klass->delist (self);
 
@@ -369,6 +718,33 @@ chamge_node_deactivate (ChamgeNode * self)
   return ret;
 }
 
+ChamgeReturn
+chamge_node_enroll_activate (ChamgeNode * self)
+{
+  ChamgeNodeClass *klass;
+  ChamgeReturn ret = CHAMGE_RETURN_OK;
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_NODE (self), CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (priv->state == CHAMGE_NODE_STATE_NULL,
+      CHAMGE_RETURN_FAIL);
+
+  klass = CHAMGE_NODE_GET_CLASS (self);
+  g_return_val_if_fail (klass->enroll_activate != NULL, CHAMGE_RETURN_FAIL);
+
+  /* Check return value by local variable to make debugger trace stack easy */
+  ret = _node_call (self, NODE_OPERATION_ENROLL_ACTIVATE);
+
+  if (ret == CHAMGE_RETURN_OK) {
+    locker = g_mutex_locker_new (&priv->mutex);
+    priv->state = CHAMGE_NODE_STATE_ACTIVATED;
+    g_signal_emit (self, signals[SIG_STATE_CHANGED], 0, priv->state);
+  }
+
+  return ret;
+}
+
 ChamgeReturn
 chamge_node_get_uid (ChamgeNode * self, gchar ** uid)
 {
@@ -408,3 +784,253 @@ chamge_node_user_command (ChamgeNode * self, const gchar * cmd, gchar ** out,
 
   return ret;
 }
+
+static void
+_node_call_thread (GTask * task, gpointer source_object, gpointer task_data,
+    GCancellable * cancellable)
+{
+  ChamgeNode *self = CHAMGE_NODE (source_object);
+  ChamgeReturn ret;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  ret = _node_call (self, GPOINTER_TO_INT (task_data));
+
+  g_task_return_int (task, ret);
+}
+
+static void
+_node_call_done (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  ChamgeNode *self = CHAMGE_NODE (source);
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  g_autoptr (GTask) task = user_data;
+  _ChamgeNodeOperation operation =
+      GPOINTER_TO_INT (g_task_get_task_data (G_TASK (result)));
+  GError *error = NULL;
+  ChamgeReturn ret;
+
+  ret = g_task_propagate_int (G_TASK (result), &error);
+
+  g_mutex_lock (&priv->mutex);
+
+  /* a throttled transition stays in progress until the retry the backend has
+   * scheduled resolves it, or a delist cancels it */
+  if (ret == CHAMGE_RETURN_ASYNC && priv->enroll_source != NULL
+      && priv->pending == NULL) {
+    priv->pending = g_steal_pointer (&task);
+    g_mutex_unlock (&priv->mutex);
+    return;
+  }
+
+  priv->busy = FALSE;
+  if (ret == CHAMGE_RETURN_OK)
+    priv->state = node_operations[operation].to;
+  g_mutex_unlock (&priv->mutex);
+
+  if (error != NULL) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  if (ret == CHAMGE_RETURN_FAIL) {
+    g_task_return_new_error (task, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "failed to %s",
+        node_operations[operation].name);
+    return;
+  }
+
+  /* in the context of the caller, before its callback */
+  if (ret == CHAMGE_RETURN_OK)
+    g_signal_emit (self, signals[SIG_STATE_CHANGED], 0,
+        node_operations[operation].to);
+
+  g_task_return_int (task, ret);
+}
+
+/* runs the retry of @operation which resolves the transition of @task, once
+ * it has been throttled */
+static void
+_node_call_resume (ChamgeNode * self, _ChamgeNodeOperation operation,
+    GTask * task)
+{
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  g_autoptr (GTask) call = NULL;
+  gint from = node_operations[operation].from;
+
+  if (from >= 0 && priv->state != (ChamgeNodeState) from) {
+    g_mutex_lock (&priv->mutex);
+    priv->busy = FALSE;
+    g_mutex_unlock (&priv->mutex);
+
+    g_task_return_new_error (task, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INACCESSIBLE, "cannot %s in state %d",
+        node_operations[operation].name, priv->state);
+    g_object_unref (task);
+    return;
+  }
+
+  priv->enroll_attempts = 0;
+
+  /* done in the context of the node, like the retry itself */
+  g_main_context_push_thread_default (priv->context);
+  call = g_task_new (self, g_task_get_cancellable (task), _node_call_done,
+      task);
+  g_main_context_pop_thread_default (priv->context);
+
+  g_task_set_task_data (call, GINT_TO_POINTER (operation), NULL);
+  g_task_set_check_cancellable (call, FALSE);
+  g_task_run_in_thread (call, _node_call_thread);
+}
+
+static void
+_node_call_run (ChamgeNode * self, _ChamgeNodeOperation operation,
+    gpointer source_tag, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  ChamgeNodePrivate *priv = chamge_node_get_instance_private (self);
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autoptr (GTask) task = NULL;
+  g_autoptr (GTask) call = NULL;
+  gint from = node_operations[operation].from;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, source_tag);
+
+  /* a transition which has taken place is reported even if cancelled */
+  g_task_set_check_cancellable (task, FALSE);
+
+  locker = g_mutex_locker_new (&priv->mutex);
+
+  if (priv->busy) {
+    g_task_return_new_error (task, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_BUSY, "another transition is in progress");
+    return;
+  }
+
+  if (from >= 0 && priv->state != (ChamgeNodeState) from) {
+    g_task_return_new_error (task, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INACCESSIBLE, "cannot %s in state %d",
+        node_operations[operation].name, priv->state);
+    return;
+  }
+
+  priv->busy = TRUE;
+
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  /* the backend blocks on the broker, while the state is changed in the
+   * context of the caller once it is done */
+  call = g_task_new (self, cancellable, _node_call_done,
+      g_steal_pointer (&task));
+  g_task_set_task_data (call, GINT_TO_POINTER (operation), NULL);
+  g_task_set_check_cancellable (call, FALSE);
+  g_task_run_in_thread (call, _node_call_thread);
+}
+
+static ChamgeReturn
+_node_call_finish (ChamgeNode * self, GAsyncResult * result,
+    gpointer source_tag, GError ** error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), CHAMGE_RETURN_FAIL);
+  g_return_val_if_fail (g_async_result_is_tagged (result, source_tag),
+      CHAMGE_RETURN_FAIL);
+
+  /* -1 on error, which is CHAMGE_RETURN_FAIL */
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+void
+chamge_node_enroll_async (ChamgeNode * self, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+  g_return_if_fail (CHAMGE_NODE_GET_CLASS (self)->enroll != NULL);
+
+  _node_call_run (self, NODE_OPERATION_ENROLL, chamge_node_enroll_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_node_enroll_finish (ChamgeNode * self, GAsyncResult * result,
+    GError ** error)
+{
+  return _node_call_finish (self, result, chamge_node_enroll_async, error);
+}
+
+void
+chamge_node_delist_async (ChamgeNode * self, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+  g_return_if_fail (CHAMGE_NODE_GET_CLASS (self)->delist != NULL);
+
+  _cancel_enroll (self);
+
+  _node_call_run (self, NODE_OPERATION_DELIST, chamge_node_delist_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_node_delist_finish (ChamgeNode * self, GAsyncResult * result,
+    GError ** error)
+{
+  return _node_call_finish (self, result, chamge_node_delist_async, error);
+}
+
+void
+chamge_node_activate_async (ChamgeNode * self, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+  g_return_if_fail (CHAMGE_NODE_GET_CLASS (self)->activate != NULL);
+
+  _node_call_run (self, NODE_OPERATION_ACTIVATE, chamge_node_activate_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_node_activate_finish (ChamgeNode * self, GAsyncResult * result,
+    GError ** error)
+{
+  return _node_call_finish (self, result, chamge_node_activate_async, error);
+}
+
+void
+chamge_node_deactivate_async (ChamgeNode * self, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+  g_return_if_fail (CHAMGE_NODE_GET_CLASS (self)->deactivate != NULL);
+
+  _node_call_run (self, NODE_OPERATION_DEACTIVATE, chamge_node_deactivate_async,
+      cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_node_deactivate_finish (ChamgeNode * self, GAsyncResult * result,
+    GError ** error)
+{
+  return _node_call_finish (self, result, chamge_node_deactivate_async, error);
+}
+
+void
+chamge_node_enroll_activate_async (ChamgeNode * self,
+    GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (CHAMGE_IS_NODE (self));
+  g_return_if_fail (CHAMGE_NODE_GET_CLASS (self)->enroll_activate != NULL);
+
+  _node_call_run (self, NODE_OPERATION_ENROLL_ACTIVATE,
+      chamge_node_enroll_activate_async, cancellable, callback, user_data);
+}
+
+ChamgeReturn
+chamge_node_enroll_activate_finish (ChamgeNode * self, GAsyncResult * result,
+    GError ** error)
+{
+  return _node_call_finish (self, result, chamge_node_enroll_activate_async,
+      error);
+}
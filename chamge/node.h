@@ -25,6 +25,7 @@
 #endif
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <chamge/types.h>
 
 /**
@@ -58,6 +59,8 @@ struct _ChamgeNodeClass
   ChamgeReturn (* activate)             (ChamgeNode *self);
   ChamgeReturn (* deactivate)           (ChamgeNode *self);
 
+  ChamgeReturn (* enroll_activate)      (ChamgeNode *self);
+
   gchar *      (* get_uid)              (ChamgeNode *self);
   ChamgeReturn (* user_command)         (ChamgeNode *self, const gchar* cmd, gchar **out, GError ** error);
 
@@ -72,18 +75,56 @@ struct _ChamgeNodeClass
 
 };
 
+/**
+ * ChamgeCommandHandler:
+ * @node: the #ChamgeNode which received the command
+ * @cmd: the received command
+ * @response: response to the command
+ * @error: a #GError object
+ * @user_data: user data given when the handler was added
+ *
+ * Handles the commands of a single method.
+ *
+ * Returns: a #ChamgeReturn object
+ */
+typedef ChamgeReturn (*ChamgeCommandHandler) (ChamgeNode    *node,
+                                              const gchar   *cmd,
+                                              gchar        **response,
+                                              GError       **error,
+                                              gpointer       user_data);
+
 /**
  * chamge_node_enroll:
  * @self: a #ChamgeNode object
- * @lazy:
+ * @lazy: whether to wait for the slot of the node in the enroll window
  *
- * Enrolls the node in the message broker
+ * Enrolls the node in the message broker. A lazy enroll is deferred to the
+ * slot the uid of the node hashes to in #ChamgeNode:enroll-window, which is
+ * widened to fit #ChamgeNode:fleet-size at #ChamgeNode:enroll-rate, and is
+ * retried with a jittered exponential backoff when it fails.
  *
  * Returns: a #ChamgeReturn object
  */
 CHAMGE_API_EXPORT
 ChamgeReturn chamge_node_enroll         (ChamgeNode *self, gboolean lazy);
 
+/**
+ * chamge_node_enroll_later:
+ * @self: a #ChamgeNode object
+ * @delay_ms: how long to wait, in milliseconds
+ *
+ * Enrolls the node again after @delay_ms, as a lazy chamge_node_enroll()
+ * does. A backend calls it when the arbiter asks the node to come back later,
+ * and then fails the enroll in progress with %CHAMGE_RETURN_ASYNC. Called
+ * from chamge_node_enroll_activate(), it enrolls and activates the node
+ * again instead.
+ *
+ * It replaces the enroll pending for the node, if any. The pending enroll
+ * does not keep the node alive, and chamge_node_delist() cancels it.
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_enroll_later   (ChamgeNode *self, guint delay_ms);
+
 /**
  * chamge_node_delist:
  * @self: a #ChamgeNode object
@@ -117,6 +158,183 @@ ChamgeReturn chamge_node_activate       (ChamgeNode *self);
 CHAMGE_API_EXPORT
 ChamgeReturn chamge_node_deactivate     (ChamgeNode *self);
 
+/**
+ * chamge_node_enroll_activate:
+ * @self: a #ChamgeNode object
+ *
+ * Enrolls and activates the node at once. A backend which supports it does
+ * so in a single request to the arbiter; otherwise the node is enrolled and
+ * activated in turn, and delisted again if the activation fails. A backend
+ * may instead resume the session the arbiter has issued to an earlier
+ * activation, as long as the arbiter has kept the node registered since;
+ * a delist ends the session.
+ *
+ * If the arbiter throttles the enroll, %CHAMGE_RETURN_ASYNC is returned and
+ * the node is only enrolled and activated later, as by
+ * chamge_node_enroll_later().
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_enroll_activate (ChamgeNode *self);
+
+/**
+ * chamge_node_enroll_async:
+ * @self: a #ChamgeNode object
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the node is enrolled
+ * @user_data: the data to pass to @callback
+ *
+ * Enrolls the node like chamge_node_enroll() without @lazy. The backend is
+ * called on a worker thread, so that the thread-default main context of the
+ * caller is not blocked while it waits for the broker. The state is changed
+ * and #ChamgeNode::state-changed is emitted in that context, right before
+ * @callback is called.
+ *
+ * Only one transition runs at a time. Cancelling @cancellable stops a
+ * transition which has not started yet; one under way is carried out.
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_enroll_async     (ChamgeNode          *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+
+/**
+ * chamge_node_enroll_finish:
+ * @self: a #ChamgeNode object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_enroll_finish    (ChamgeNode          *self,
+                                           GAsyncResult        *result,
+                                           GError             **error);
+
+/**
+ * chamge_node_delist_async:
+ * @self: a #ChamgeNode object
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the node is delisted
+ * @user_data: the data to pass to @callback
+ *
+ * Delists the node like chamge_node_delist(), without blocking the caller.
+ * See chamge_node_enroll_async().
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_delist_async     (ChamgeNode          *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+
+/**
+ * chamge_node_delist_finish:
+ * @self: a #ChamgeNode object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_delist_finish    (ChamgeNode          *self,
+                                           GAsyncResult        *result,
+                                           GError             **error);
+
+/**
+ * chamge_node_activate_async:
+ * @self: a #ChamgeNode object
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the node is activated
+ * @user_data: the data to pass to @callback
+ *
+ * Activates the node like chamge_node_activate(), without blocking the caller.
+ * See chamge_node_enroll_async().
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_activate_async   (ChamgeNode          *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+
+/**
+ * chamge_node_activate_finish:
+ * @self: a #ChamgeNode object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_activate_finish  (ChamgeNode          *self,
+                                           GAsyncResult        *result,
+                                           GError             **error);
+
+/**
+ * chamge_node_deactivate_async:
+ * @self: a #ChamgeNode object
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the node is deactivated
+ * @user_data: the data to pass to @callback
+ *
+ * Deactivates the node like chamge_node_deactivate(), without blocking the
+ * caller. See chamge_node_enroll_async().
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_deactivate_async (ChamgeNode          *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+
+/**
+ * chamge_node_deactivate_finish:
+ * @self: a #ChamgeNode object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_deactivate_finish(ChamgeNode          *self,
+                                           GAsyncResult        *result,
+                                           GError             **error);
+
+/**
+ * chamge_node_enroll_activate_async:
+ * @self: a #ChamgeNode object
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the node is activated
+ * @user_data: the data to pass to @callback
+ *
+ * Enrolls and activates the node like chamge_node_enroll_activate(), without
+ * blocking the caller. See chamge_node_enroll_async().
+ *
+ * A throttled transition stays in progress, and @callback is only called once
+ * the retry has activated the node or failed. chamge_node_delist() cancels it
+ * with %G_IO_ERROR_CANCELLED.
+ */
+CHAMGE_API_EXPORT
+void         chamge_node_enroll_activate_async
+                                          (ChamgeNode          *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+
+/**
+ * chamge_node_enroll_activate_finish:
+ * @self: a #ChamgeNode object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: a #GError
+ *
+ * Returns: a #ChamgeReturn object
+ */
+CHAMGE_API_EXPORT
+ChamgeReturn chamge_node_enroll_activate_finish
+                                          (ChamgeNode          *self,
+                                           GAsyncResult        *result,
+                                           GError             **error);
+
 /**
  * chamge_node_get_uid:
  * @self: a #ChamgeNode object
@@ -0,0 +1,469 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "registry-journal.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Both files start with a header made of a magic, a format version and a
+ * generation, followed by records. A record is the length and the FNV-1a
+ * checksum of its payload, then the payload itself: op, type, state, one
+ * reserved byte, the lengths of the id and of the hub id, a timestamp, the
+ * generation of the device, and finally the two ids without terminators.
+ * Integers are in host byte order.
+ *
+ * Compaction writes a snapshot of the next generation and then empties the
+ * journal, so a journal whose generation is not the one of the snapshot is
+ * already included in the snapshot.
+ */
+
+#define JOURNAL_MAGIC           "CHGJ"
+#define SNAPSHOT_MAGIC          "CHGS"
+#define FORMAT_VERSION          2
+
+#define FILE_HEADER_SIZE        16
+#define RECORD_HEADER_SIZE      8
+#define PAYLOAD_HEADER_SIZE     20
+
+struct _ChamgeJournal
+{
+  gchar *path;
+  gchar *snapshot_path;
+
+  gint fd;
+  goffset length;
+  guint64 generation;
+  guint n_records;
+};
+
+static guint32
+_fnv1a (const guint8 * data, gsize len)
+{
+  guint32 hash = 2166136261u;
+  gsize i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static void
+_encode_header (GByteArray * buf, const gchar * magic, guint64 generation)
+{
+  guint8 header[FILE_HEADER_SIZE];
+  guint32 version = FORMAT_VERSION;
+
+  memcpy (header, magic, 4);
+  memcpy (header + 4, &version, 4);
+  memcpy (header + 8, &generation, 8);
+
+  g_byte_array_append (buf, header, sizeof (header));
+}
+
+static gboolean
+_decode_header (const gchar * data, gsize len, const gchar * magic,
+    guint64 * generation)
+{
+  guint32 version;
+
+  if (len < FILE_HEADER_SIZE || memcmp (data, magic, 4) != 0)
+    return FALSE;
+
+  memcpy (&version, data + 4, 4);
+  if (version != FORMAT_VERSION)
+    return FALSE;
+
+  memcpy (generation, data + 8, 8);
+
+  return TRUE;
+}
+
+static gboolean
+_encode_record (GByteArray * buf, const ChamgeJournalRecord * record,
+    GError ** error)
+{
+  guint8 header[RECORD_HEADER_SIZE + PAYLOAD_HEADER_SIZE] = { 0 };
+  gsize id_len = strlen (record->id);
+  gsize hub_len = record->hub_id != NULL ? strlen (record->hub_id) : 0;
+  guint16 len16;
+  guint32 payload_len, checksum;
+  guint offset = buf->len;
+
+  if (id_len > G_MAXUINT16 || hub_len > G_MAXUINT16) {
+    g_set_error (error, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_INVALID_PARAMETER, "too long id (%s)",
+        record->id);
+    return FALSE;
+  }
+
+  payload_len = PAYLOAD_HEADER_SIZE + id_len + hub_len;
+
+  memcpy (header, &payload_len, 4);
+  header[8] = record->op;
+  header[9] = record->type;
+  header[10] = record->state;
+  len16 = id_len;
+  memcpy (header + 12, &len16, 2);
+  len16 = hub_len;
+  memcpy (header + 14, &len16, 2);
+  memcpy (header + 16, &record->timestamp, 8);
+  memcpy (header + 24, &record->generation, 4);
+
+  g_byte_array_append (buf, header, sizeof (header));
+  g_byte_array_append (buf, (const guint8 *) record->id, id_len);
+  if (hub_len > 0)
+    g_byte_array_append (buf, (const guint8 *) record->hub_id, hub_len);
+
+  checksum = _fnv1a (buf->data + offset + RECORD_HEADER_SIZE, payload_len);
+  memcpy (buf->data + offset + 4, &checksum, 4);
+
+  return TRUE;
+}
+
+/* returns the length of the valid records at the start of @data */
+static gsize
+_replay_records (const gchar * data, gsize len, ChamgeJournalReplayFunc func,
+    gpointer user_data, guint * n_records)
+{
+  gsize offset = 0;
+
+  while (len - offset >= RECORD_HEADER_SIZE) {
+    const guint8 *payload = (const guint8 *) data + offset + RECORD_HEADER_SIZE;
+    ChamgeJournalRecord record = { 0 };
+    g_autofree gchar *id = NULL;
+    g_autofree gchar *hub_id = NULL;
+    guint32 payload_len, checksum;
+    guint16 id_len, hub_len;
+
+    memcpy (&payload_len, data + offset, 4);
+    memcpy (&checksum, data + offset + 4, 4);
+
+    if (payload_len < PAYLOAD_HEADER_SIZE
+        || payload_len > len - offset - RECORD_HEADER_SIZE
+        || _fnv1a (payload, payload_len) != checksum)
+      break;
+
+    memcpy (&id_len, payload + 4, 2);
+    memcpy (&hub_len, payload + 6, 2);
+    if (PAYLOAD_HEADER_SIZE + id_len + hub_len != payload_len || id_len == 0)
+      break;
+
+    id = g_strndup ((const gchar *) payload + PAYLOAD_HEADER_SIZE, id_len);
+    if (hub_len > 0)
+      hub_id = g_strndup ((const gchar *) payload + PAYLOAD_HEADER_SIZE
+          + id_len, hub_len);
+
+    record.op = payload[0];
+    record.type = payload[1];
+    record.state = payload[2];
+    memcpy (&record.timestamp, payload + 8, 8);
+    memcpy (&record.generation, payload + 16, 4);
+    record.id = id;
+    record.hub_id = hub_id;
+
+    func (&record, user_data);
+
+    offset += RECORD_HEADER_SIZE + payload_len;
+    if (n_records != NULL)
+      (*n_records)++;
+  }
+
+  return offset;
+}
+
+/* returns NULL without setting @error if @path does not exist */
+static GMappedFile *
+_map_file (const gchar * path, GError ** error)
+{
+  g_autoptr (GError) local_error = NULL;
+  GMappedFile *file;
+
+  file = g_mapped_file_new (path, FALSE, &local_error);
+  if (file == NULL && !g_error_matches (local_error, G_FILE_ERROR,
+          G_FILE_ERROR_NOENT))
+    g_propagate_error (error, g_steal_pointer (&local_error));
+
+  return file;
+}
+
+static gboolean
+_write_all (gint fd, const guint8 * data, gsize len, const gchar * path,
+    GError ** error)
+{
+  while (len > 0) {
+    gssize written = write (fd, data, len);
+
+    if (written < 0) {
+      gint errsv = errno;
+
+      if (errsv == EINTR)
+        continue;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+          "failed to write %s: %s", path, g_strerror (errsv));
+      return FALSE;
+    }
+
+    data += written;
+    len -= written;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+_sync_parent (const gchar * path)
+{
+  g_autofree gchar *dirname = g_path_get_dirname (path);
+  gint fd = g_open (dirname, O_RDONLY | O_CLOEXEC, 0);
+  gboolean ret;
+
+  if (fd < 0)
+    return FALSE;
+
+  ret = fsync (fd) == 0;
+  close (fd);
+
+  return ret;
+}
+
+/* truncates the journal down to an empty one of the current generation */
+static gboolean
+_reset_journal (ChamgeJournal * self, GError ** error)
+{
+  g_autoptr (GByteArray) buf = g_byte_array_sized_new (FILE_HEADER_SIZE);
+
+  if (ftruncate (self->fd, 0) < 0) {
+    gint errsv = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "failed to truncate %s: %s", self->path, g_strerror (errsv));
+    return FALSE;
+  }
+
+  _encode_header (buf, JOURNAL_MAGIC, self->generation);
+  if (!_write_all (self->fd, buf->data, buf->len, self->path, error))
+    return FALSE;
+
+  fsync (self->fd);
+
+  self->length = FILE_HEADER_SIZE;
+  self->n_records = 0;
+
+  return TRUE;
+}
+
+ChamgeJournal *
+chamge_journal_open (const gchar * path, ChamgeJournalReplayFunc func,
+    gpointer user_data, GError ** error)
+{
+  ChamgeJournal *self = NULL;
+  g_autoptr (GMappedFile) snapshot = NULL;
+  g_autoptr (GMappedFile) journal = NULL;
+  GError *local_error = NULL;
+  guint64 journal_generation = 0;
+  gboolean replay_journal = FALSE;
+  gsize valid = 0;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  self = g_new0 (ChamgeJournal, 1);
+  self->path = g_strdup (path);
+  self->snapshot_path = g_strconcat (path, ".snapshot", NULL);
+  self->fd = -1;
+
+  snapshot = _map_file (self->snapshot_path, &local_error);
+  if (local_error != NULL)
+    goto error;
+
+  if (snapshot != NULL) {
+    const gchar *data = g_mapped_file_get_contents (snapshot);
+    gsize len = g_mapped_file_get_length (snapshot);
+
+    /* snapshots are renamed into place once complete, so must be intact */
+    if (!_decode_header (data, len, SNAPSHOT_MAGIC, &self->generation)
+        || _replay_records (data + FILE_HEADER_SIZE, len - FILE_HEADER_SIZE,
+            func, user_data, NULL) != len - FILE_HEADER_SIZE) {
+      g_set_error (&local_error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+          "corrupted snapshot %s", self->snapshot_path);
+      goto error;
+    }
+  }
+
+  journal = _map_file (self->path, &local_error);
+  if (local_error != NULL)
+    goto error;
+
+  if (journal != NULL) {
+    const gchar *data = g_mapped_file_get_contents (journal);
+    gsize len = g_mapped_file_get_length (journal);
+
+    replay_journal = _decode_header (data, len, JOURNAL_MAGIC,
+        &journal_generation) && journal_generation == self->generation;
+
+    if (replay_journal)
+      valid = _replay_records (data + FILE_HEADER_SIZE,
+          len - FILE_HEADER_SIZE, func, user_data, &self->n_records);
+
+    /* expected after a crash in the middle of an append */
+    if (replay_journal && valid != len - FILE_HEADER_SIZE)
+      g_debug ("dropping %" G_GSIZE_FORMAT " bytes of a torn record in %s",
+          len - FILE_HEADER_SIZE - valid, self->path);
+  }
+
+  self->fd = g_open (self->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+      0600);
+  if (self->fd < 0) {
+    gint errsv = errno;
+
+    g_set_error (&local_error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "failed to open %s: %s", self->path, g_strerror (errsv));
+    goto error;
+  }
+
+  if (!replay_journal) {
+    if (!_reset_journal (self, &local_error))
+      goto error;
+  } else {
+    self->length = FILE_HEADER_SIZE + valid;
+    if (ftruncate (self->fd, self->length) < 0)
+      g_warning ("failed to truncate %s", self->path);
+  }
+
+  return self;
+
+error:
+  g_propagate_error (error, local_error);
+  chamge_journal_free (self);
+
+  return NULL;
+}
+
+void
+chamge_journal_free (ChamgeJournal * self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->fd >= 0)
+    close (self->fd);
+
+  g_free (self->path);
+  g_free (self->snapshot_path);
+
+  g_free (self);
+}
+
+gboolean
+chamge_journal_append (ChamgeJournal * self,
+    const ChamgeJournalRecord * record, GError ** error)
+{
+  g_autoptr (GByteArray) buf = g_byte_array_new ();
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (record != NULL && record->id != NULL, FALSE);
+
+  if (!_encode_record (buf, record, error))
+    return FALSE;
+
+  if (!_write_all (self->fd, buf->data, buf->len, self->path, error)) {
+    /* do not leave a torn record in front of the next ones */
+    if (ftruncate (self->fd, self->length) < 0)
+      g_warning ("failed to truncate %s", self->path);
+    return FALSE;
+  }
+
+  self->length += buf->len;
+  self->n_records++;
+
+  return TRUE;
+}
+
+guint
+chamge_journal_get_n_records (ChamgeJournal * self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_records;
+}
+
+gboolean
+chamge_journal_compact (ChamgeJournal * self,
+    const ChamgeJournalRecord * records, guint n_records, GError ** error)
+{
+  g_autoptr (GByteArray) buf = g_byte_array_new ();
+  g_autofree gchar *tmp_path = NULL;
+  gboolean ret = FALSE;
+  gint fd;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (records != NULL || n_records == 0, FALSE);
+
+  _encode_header (buf, SNAPSHOT_MAGIC, self->generation + 1);
+  for (i = 0; i < n_records; i++) {
+    if (!_encode_record (buf, &records[i], error))
+      return FALSE;
+  }
+
+  tmp_path = g_strconcat (self->snapshot_path, ".tmp", NULL);
+  fd = g_open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    gint errsv = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "failed to open %s: %s", tmp_path, g_strerror (errsv));
+    return FALSE;
+  }
+
+  if (!_write_all (fd, buf->data, buf->len, tmp_path, error))
+    goto out;
+
+  if (fsync (fd) < 0 || g_rename (tmp_path, self->snapshot_path) < 0) {
+    gint errsv = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "failed to replace %s: %s", self->snapshot_path, g_strerror (errsv));
+    goto out;
+  }
+
+  _sync_parent (self->snapshot_path);
+
+  /* from here on, the journal of the previous generation is ignored */
+  self->generation++;
+  ret = _reset_journal (self, error);
+
+out:
+  close (fd);
+  if (!ret)
+    g_unlink (tmp_path);
+
+  return ret;
+}
@@ -0,0 +1,77 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_REGISTRY_JOURNAL_H__
+#define __CHAMGE_REGISTRY_JOURNAL_H__
+
+#include <glib.h>
+#include <chamge/types.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  CHAMGE_JOURNAL_OP_ADD = 1,
+  CHAMGE_JOURNAL_OP_REMOVE,
+  CHAMGE_JOURNAL_OP_SET_STATE,
+  CHAMGE_JOURNAL_OP_SET_HUB,
+
+  /* a whole entry, as written in snapshots */
+  CHAMGE_JOURNAL_OP_PUT,
+} ChamgeJournalOp;
+
+typedef struct
+{
+  ChamgeJournalOp op;
+  ChamgeDeviceType type;
+  ChamgeDeviceState state;
+  gint64 timestamp;
+  guint32 generation;
+  const gchar *id;
+  const gchar *hub_id;
+} ChamgeJournalRecord;
+
+typedef void (*ChamgeJournalReplayFunc)         (const ChamgeJournalRecord  *record,
+                                                 gpointer                    user_data);
+
+typedef struct _ChamgeJournal ChamgeJournal;
+
+/* replays the snapshot and then the journal found at @path, and keeps the
+ * journal open for appending; a torn record at the end of the journal is
+ * dropped */
+ChamgeJournal  *chamge_journal_open             (const gchar                *path,
+                                                 ChamgeJournalReplayFunc     func,
+                                                 gpointer                    user_data,
+                                                 GError                    **error);
+
+void            chamge_journal_free             (ChamgeJournal              *self);
+
+gboolean        chamge_journal_append           (ChamgeJournal              *self,
+                                                 const ChamgeJournalRecord  *record,
+                                                 GError                    **error);
+
+guint           chamge_journal_get_n_records    (ChamgeJournal              *self);
+
+/* replaces the snapshot with @records and empties the journal */
+gboolean        chamge_journal_compact          (ChamgeJournal              *self,
+                                                 const ChamgeJournalRecord  *records,
+                                                 guint                       n_records,
+                                                 GError                    **error);
+
+G_END_DECLS
+
+#endif // __CHAMGE_REGISTRY_JOURNAL_H__
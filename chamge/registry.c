@@ -0,0 +1,1397 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "registry.h"
+#include "registry-journal.h"
+#include "timing-wheel.h"
+#include "enumtypes.h"
+#include "glib-compat.h"
+
+#include <string.h>
+
+#define N_DEVICE_TYPES  (CHAMGE_DEVICE_TYPE_HUB + 1)
+#define N_DEVICE_STATES (CHAMGE_DEVICE_STATE_ACTIVATED + 1)
+
+/* points of a hub on the consistent hash ring */
+#define HUB_RING_REPLICAS       64
+
+/* the journal is compacted once it holds twice as many records as there are
+ * devices, and never below this */
+#define JOURNAL_COMPACT_MIN_RECORDS     4096
+
+typedef struct
+{
+  /* kept first, so that the timer is the entry */
+  ChamgeTimer timer;
+
+  /* the only copy of the id, shared by every index */
+  gchar *id;
+
+  ChamgeDeviceType type;
+  ChamgeDeviceState state;
+  gint64 last_seen;
+  gchar *hub_id;
+
+  /* drawn when the device is added, so that it is told apart from the one
+   * registered with the same id before it was removed */
+  guint32 generation;
+
+  /* as last reported by a hub, never journaled */
+  guint capacity;
+  guint load;
+  gchar *uri;
+
+  /* HubLatency measured by an edge, sorted by rtt */
+  GArray *latencies;
+
+  /* position of the id in ChamgeRegistry::sorted */
+  GSequenceIter *sorted_iter;
+} RegistryEntry;
+
+typedef struct
+{
+  gchar *hub_id;
+  guint rtt;
+} HubLatency;
+
+typedef struct
+{
+  guint32 hash;
+  RegistryEntry *hub;
+} HubRingPoint;
+
+struct _ChamgeRegistry
+{
+  GObject parent;
+
+  GMutex lock;
+
+  /* id -> RegistryEntry */
+  GHashTable *entries;
+
+  /* sets of interned ids, so compared by address */
+  GHashTable *by_type[N_DEVICE_TYPES];
+  GHashTable *by_state[N_DEVICE_STATES];
+
+  /* the ids again, in order, to page through them */
+  GSequence *sorted;
+
+  /* hub id -> number of edges assigned to it, whether the hub is known */
+  GHashTable *assigned;
+
+  /* sorted by hash, rebuilt on demand once hubs come or go */
+  GArray *hub_ring;
+  gboolean hub_ring_dirty;
+
+  ChamgeJournal *journal;
+
+  /* random, and kept next to the journal, so that it changes only when the
+   * devices are lost */
+  gchar *epoch;
+
+  /* bumped by every change but marking a device as seen */
+  guint64 version;
+
+  /* in seconds, 0 when devices never expire */
+  guint expiry;
+  GSource *expiry_source;
+  ChamgeTimingWheel *wheel;
+
+  /* the thread-default context the registry was made in, where devices
+   * expire whichever thread sets the expiry */
+  GMainContext *context;
+};
+
+enum
+{
+  SIG_DEVICE_EXPIRED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (ChamgeRegistry, chamge_registry, G_TYPE_OBJECT)
+/* *INDENT-ON* */
+
+static void
+registry_entry_free (RegistryEntry * entry)
+{
+  g_free (entry->id);
+  g_free (entry->hub_id);
+  g_free (entry->uri);
+  if (entry->latencies != NULL)
+    g_array_unref (entry->latencies);
+  g_free (entry);
+}
+
+static void
+hub_latency_clear (HubLatency * latency)
+{
+  g_free (latency->hub_id);
+}
+
+static guint64
+_now_tick (void)
+{
+  return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+static void
+_refresh_locked (ChamgeRegistry * self, RegistryEntry * entry)
+{
+  if (self->expiry > 0)
+    chamge_timing_wheel_schedule (self->wheel, &entry->timer,
+        _now_tick () + self->expiry);
+}
+
+static void
+_assign_locked (ChamgeRegistry * self, const gchar * hub_id, gint delta)
+{
+  guint n;
+
+  if (hub_id == NULL)
+    return;
+
+  n = GPOINTER_TO_UINT (g_hash_table_lookup (self->assigned, hub_id)) + delta;
+  if (n > 0)
+    g_hash_table_insert (self->assigned, g_strdup (hub_id),
+        GUINT_TO_POINTER (n));
+  else
+    g_hash_table_remove (self->assigned, hub_id);
+}
+
+static gint
+_compare_ids (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  return strcmp (a, b);
+}
+
+static RegistryEntry *
+_insert_locked (ChamgeRegistry * self, const gchar * id, ChamgeDeviceType type,
+    ChamgeDeviceState state, gint64 last_seen, const gchar * hub_id,
+    guint32 generation)
+{
+  RegistryEntry *entry = g_new0 (RegistryEntry, 1);
+
+  entry->id = g_strdup (id);
+  entry->type = type;
+  entry->state = state;
+  entry->last_seen = last_seen;
+  entry->hub_id = g_strdup (hub_id);
+  entry->generation = generation;
+
+  g_hash_table_insert (self->entries, entry->id, entry);
+  g_hash_table_add (self->by_type[entry->type], entry->id);
+  g_hash_table_add (self->by_state[entry->state], entry->id);
+  entry->sorted_iter = g_sequence_insert_sorted (self->sorted, entry->id,
+      _compare_ids, NULL);
+
+  _assign_locked (self, entry->hub_id, 1);
+  if (entry->type == CHAMGE_DEVICE_TYPE_HUB)
+    self->hub_ring_dirty = TRUE;
+
+  _refresh_locked (self, entry);
+  self->version++;
+
+  return entry;
+}
+
+static void
+_remove_locked (ChamgeRegistry * self, RegistryEntry * entry)
+{
+  chamge_timing_wheel_cancel (self->wheel, &entry->timer);
+  g_hash_table_remove (self->by_type[entry->type], entry->id);
+  g_hash_table_remove (self->by_state[entry->state], entry->id);
+  g_sequence_remove (entry->sorted_iter);
+
+  /* edges assigned to a hub which is gone keep it until they are assigned
+   * again, so that they stick to it if it comes back */
+  _assign_locked (self, entry->hub_id, -1);
+  if (entry->type == CHAMGE_DEVICE_TYPE_HUB)
+    self->hub_ring_dirty = TRUE;
+
+  self->version++;
+
+  /* frees the entry, and the id with it */
+  g_hash_table_remove (self->entries, entry->id);
+}
+
+static void
+_set_state_locked (ChamgeRegistry * self, RegistryEntry * entry,
+    ChamgeDeviceState state)
+{
+  if (entry->state == state)
+    return;
+
+  g_hash_table_remove (self->by_state[entry->state], entry->id);
+  entry->state = state;
+  g_hash_table_add (self->by_state[entry->state], entry->id);
+
+  self->version++;
+}
+
+static void
+_set_hub_locked (ChamgeRegistry * self, RegistryEntry * entry,
+    const gchar * hub_id)
+{
+  if (!g_strcmp0 (entry->hub_id, hub_id))
+    return;
+
+  _assign_locked (self, entry->hub_id, -1);
+  _assign_locked (self, hub_id, 1);
+
+  g_free (entry->hub_id);
+  entry->hub_id = g_strdup (hub_id);
+
+  self->version++;
+}
+
+static void
+_replay (const ChamgeJournalRecord * record, gpointer user_data)
+{
+  ChamgeRegistry *self = user_data;
+  RegistryEntry *entry = g_hash_table_lookup (self->entries, record->id);
+
+  if (record->type >= N_DEVICE_TYPES || record->state >= N_DEVICE_STATES) {
+    g_debug ("skipping a record of %s with unknown values", record->id);
+    return;
+  }
+
+  switch (record->op) {
+    case CHAMGE_JOURNAL_OP_PUT:
+      if (entry != NULL)
+        _remove_locked (self, entry);
+      _insert_locked (self, record->id, record->type, record->state,
+          record->timestamp, record->hub_id, record->generation);
+      return;
+    case CHAMGE_JOURNAL_OP_ADD:
+      if (entry == NULL) {
+        _insert_locked (self, record->id, record->type,
+            CHAMGE_DEVICE_STATE_ENROLLED, record->timestamp, NULL,
+            record->generation);
+        return;
+      }
+      break;
+    case CHAMGE_JOURNAL_OP_REMOVE:
+      if (entry != NULL)
+        _remove_locked (self, entry);
+      return;
+    default:
+      break;
+  }
+
+  if (entry == NULL)
+    return;
+
+  entry->last_seen = record->timestamp;
+
+  if (record->op == CHAMGE_JOURNAL_OP_SET_HUB)
+    _set_hub_locked (self, entry, record->hub_id);
+  else if (record->op == CHAMGE_JOURNAL_OP_SET_STATE)
+    _set_state_locked (self, entry, record->state);
+}
+
+static gboolean
+_compact_locked (ChamgeRegistry * self, GError ** error)
+{
+  g_autofree ChamgeJournalRecord *records = NULL;
+  GHashTableIter iter;
+  RegistryEntry *entry;
+  guint n = 0;
+
+  records = g_new0 (ChamgeJournalRecord, g_hash_table_size (self->entries));
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry)) {
+    records[n].op = CHAMGE_JOURNAL_OP_PUT;
+    records[n].type = entry->type;
+    records[n].state = entry->state;
+    records[n].timestamp = entry->last_seen;
+    records[n].generation = entry->generation;
+    records[n].id = entry->id;
+    records[n].hub_id = entry->hub_id;
+    n++;
+  }
+
+  return chamge_journal_compact (self->journal, records, n, error);
+}
+
+static void
+_journal_locked (ChamgeRegistry * self, ChamgeJournalOp op,
+    RegistryEntry * entry)
+{
+  g_autoptr (GError) error = NULL;
+  ChamgeJournalRecord record = { 0 };
+  guint threshold;
+
+  if (self->journal == NULL)
+    return;
+
+  record.op = op;
+  record.type = entry->type;
+  record.state = entry->state;
+  record.timestamp = entry->last_seen;
+  record.generation = entry->generation;
+  record.id = entry->id;
+  record.hub_id = entry->hub_id;
+
+  if (!chamge_journal_append (self->journal, &record, &error)) {
+    g_warning ("failed to journal %s (reason: %s)", entry->id,
+        error->message);
+    return;
+  }
+
+  /* a removed entry is still in the table until the caller drops it, so
+   * leave the compaction to the next change */
+  if (op == CHAMGE_JOURNAL_OP_REMOVE)
+    return;
+
+  threshold = MAX (JOURNAL_COMPACT_MIN_RECORDS,
+      2 * g_hash_table_size (self->entries));
+  if (chamge_journal_get_n_records (self->journal) >= threshold
+      && !_compact_locked (self, &error))
+    g_warning ("failed to compact the registry (reason: %s)", error->message);
+}
+
+typedef struct
+{
+  ChamgeRegistry *self;
+  GPtrArray *ids;
+  GArray *types;
+} ExpiredDevices;
+
+static void
+_expire_entry_locked (ChamgeTimer * timer, gpointer user_data)
+{
+  ExpiredDevices *expired = user_data;
+  RegistryEntry *entry = (RegistryEntry *) timer;
+
+  g_ptr_array_add (expired->ids, g_strdup (entry->id));
+  g_array_append_val (expired->types, entry->type);
+
+  _journal_locked (expired->self, CHAMGE_JOURNAL_OP_REMOVE, entry);
+  _remove_locked (expired->self, entry);
+}
+
+static gboolean
+_expire_devices (gpointer user_data)
+{
+  ChamgeRegistry *self = CHAMGE_REGISTRY (user_data);
+  g_autoptr (GPtrArray) ids = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr (GArray) types = g_array_new (FALSE, FALSE,
+      sizeof (ChamgeDeviceType));
+  ExpiredDevices expired = { self, ids, types };
+  guint i;
+
+  g_mutex_lock (&self->lock);
+  chamge_timing_wheel_advance (self->wheel, _now_tick (),
+      _expire_entry_locked, &expired);
+  g_mutex_unlock (&self->lock);
+
+  for (i = 0; i < ids->len; i++) {
+    g_debug ("%s is expired", (gchar *) g_ptr_array_index (ids, i));
+    g_signal_emit (self, signals[SIG_DEVICE_EXPIRED], 0,
+        g_ptr_array_index (ids, i), g_array_index (types, ChamgeDeviceType,
+            i));
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gchar **
+_list_ids (GHashTable * index)
+{
+  GHashTableIter iter;
+  gpointer id;
+  gchar **ids = g_new (gchar *, g_hash_table_size (index) + 1);
+  guint i = 0;
+
+  g_hash_table_iter_init (&iter, index);
+  while (g_hash_table_iter_next (&iter, &id, NULL))
+    ids[i++] = g_strdup (id);
+  ids[i] = NULL;
+
+  return ids;
+}
+
+static guint32
+_hash (const gchar * data)
+{
+  guint32 hash = 2166136261u;
+
+  for (; *data != '\0'; data++)
+    hash = (hash ^ (guchar) * data) * 16777619u;
+
+  /* FNV-1a alone clusters the ids which only differ at the end */
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+static gint
+_compare_ring_points (gconstpointer a, gconstpointer b)
+{
+  guint32 ha = ((const HubRingPoint *) a)->hash;
+  guint32 hb = ((const HubRingPoint *) b)->hash;
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+static guint
+_assigned_locked (ChamgeRegistry * self, RegistryEntry * hub)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (self->assigned, hub->id));
+}
+
+/* a hub may run behind on its reports, so it is never considered less loaded
+ * than the edges assigned to it */
+static guint
+_hub_load_locked (ChamgeRegistry * self, RegistryEntry * hub)
+{
+  return MAX (hub->load, _assigned_locked (self, hub));
+}
+
+/* @extra is the number of edges which would be added to @hub */
+static gboolean
+_hub_available_locked (ChamgeRegistry * self, RegistryEntry * hub,
+    guint extra)
+{
+  if (hub == NULL || hub->type != CHAMGE_DEVICE_TYPE_HUB
+      || hub->state != CHAMGE_DEVICE_STATE_ACTIVATED)
+    return FALSE;
+
+  return hub->capacity == 0
+      || _hub_load_locked (self, hub) + extra <= hub->capacity;
+}
+
+static RegistryEntry *
+_select_least_loaded_locked (ChamgeRegistry * self)
+{
+  GHashTableIter iter;
+  gpointer id;
+  RegistryEntry *best = NULL;
+  guint64 best_load = 0, best_capacity = 1;
+
+  g_hash_table_iter_init (&iter, self->by_type[CHAMGE_DEVICE_TYPE_HUB]);
+  while (g_hash_table_iter_next (&iter, &id, NULL)) {
+    RegistryEntry *hub = g_hash_table_lookup (self->entries, id);
+    guint64 load, capacity;
+
+    if (!_hub_available_locked (self, hub, 1))
+      continue;
+
+    /* hubs which report no capacity are compared by their load alone */
+    load = _hub_load_locked (self, hub) + 1;
+    capacity = MAX (hub->capacity, 1);
+
+    /* load / capacity < best_load / best_capacity, ties go to the lower id */
+    if (best == NULL || load * best_capacity < best_load * capacity
+        || (load * best_capacity == best_load * capacity
+            && g_strcmp0 (hub->id, best->id) < 0)) {
+      best = hub;
+      best_load = load;
+      best_capacity = capacity;
+    }
+  }
+
+  return best;
+}
+
+static RegistryEntry *
+_select_weighted_locked (ChamgeRegistry * self)
+{
+  g_autoptr (GPtrArray) hubs = g_ptr_array_new ();
+  g_autoptr (GArray) weights = g_array_new (FALSE, FALSE, sizeof (guint64));
+  GHashTableIter iter;
+  gpointer id;
+  guint64 total = 0;
+  gdouble pick;
+  guint i;
+
+  g_hash_table_iter_init (&iter, self->by_type[CHAMGE_DEVICE_TYPE_HUB]);
+  while (g_hash_table_iter_next (&iter, &id, NULL)) {
+    RegistryEntry *hub = g_hash_table_lookup (self->entries, id);
+    guint64 weight;
+
+    if (!_hub_available_locked (self, hub, 1))
+      continue;
+
+    /* the room left on a hub, or an even share if it reports no capacity */
+    weight = hub->capacity > 0 ? hub->capacity - _hub_load_locked (self, hub)
+        : 1;
+
+    g_ptr_array_add (hubs, hub);
+    g_array_append_val (weights, weight);
+    total += weight;
+  }
+
+  if (hubs->len == 0)
+    return NULL;
+
+  pick = g_random_double () * total;
+  for (i = 0; i < hubs->len - 1; i++) {
+    pick -= g_array_index (weights, guint64, i);
+    if (pick < 0)
+      break;
+  }
+
+  return g_ptr_array_index (hubs, i);
+}
+
+static gint
+_compare_latencies (gconstpointer a, gconstpointer b)
+{
+  guint ra = ((const HubLatency *) a)->rtt;
+  guint rb = ((const HubLatency *) b)->rtt;
+
+  return ra < rb ? -1 : ra > rb;
+}
+
+/* the nearest hub which can take @edge, or NULL if it measured none */
+static RegistryEntry *
+_select_lowest_rtt_locked (ChamgeRegistry * self, RegistryEntry * edge)
+{
+  guint i;
+
+  if (edge->latencies == NULL)
+    return NULL;
+
+  for (i = 0; i < edge->latencies->len; i++) {
+    HubLatency *latency = &g_array_index (edge->latencies, HubLatency, i);
+    RegistryEntry *hub = g_hash_table_lookup (self->entries, latency->hub_id);
+
+    if (_hub_available_locked (self, hub,
+            g_strcmp0 (edge->hub_id, latency->hub_id) == 0 ? 0 : 1))
+      return hub;
+  }
+
+  return NULL;
+}
+
+static void
+_build_hub_ring_locked (ChamgeRegistry * self)
+{
+  GHashTableIter iter;
+  gpointer id;
+
+  if (!self->hub_ring_dirty)
+    return;
+
+  g_array_set_size (self->hub_ring, 0);
+
+  /* every hub is on the ring, so that edges do not move when a hub becomes
+   * unavailable for a while */
+  g_hash_table_iter_init (&iter, self->by_type[CHAMGE_DEVICE_TYPE_HUB]);
+  while (g_hash_table_iter_next (&iter, &id, NULL)) {
+    RegistryEntry *hub = g_hash_table_lookup (self->entries, id);
+    guint i;
+
+    for (i = 0; i < HUB_RING_REPLICAS; i++) {
+      g_autofree gchar *point = g_strdup_printf ("%s#%u", hub->id, i);
+      HubRingPoint p = { _hash (point), hub };
+
+      g_array_append_val (self->hub_ring, p);
+    }
+  }
+
+  g_array_sort (self->hub_ring, _compare_ring_points);
+  self->hub_ring_dirty = FALSE;
+}
+
+static RegistryEntry *
+_select_consistent_hash_locked (ChamgeRegistry * self, const gchar * edge_id)
+{
+  guint32 hash = _hash (edge_id);
+  guint lo = 0, hi, i;
+
+  _build_hub_ring_locked (self);
+
+  hi = self->hub_ring->len;
+  if (hi == 0)
+    return NULL;
+
+  /* the first point at or after the hash of the edge */
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+
+    if (g_array_index (self->hub_ring, HubRingPoint, mid).hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* walk clockwise past the hubs which cannot take the edge */
+  for (i = 0; i < self->hub_ring->len; i++) {
+    HubRingPoint *p = &g_array_index (self->hub_ring, HubRingPoint,
+        (lo + i) % self->hub_ring->len);
+
+    if (_hub_available_locked (self, p->hub, 1))
+      return p->hub;
+  }
+
+  return NULL;
+}
+
+static void
+chamge_registry_finalize (GObject * object)
+{
+  ChamgeRegistry *self = CHAMGE_REGISTRY (object);
+  guint i;
+
+  if (self->expiry_source != NULL) {
+    g_source_destroy (self->expiry_source);
+    g_source_unref (self->expiry_source);
+  }
+  g_main_context_unref (self->context);
+
+  g_clear_pointer (&self->journal, chamge_journal_free);
+  g_free (self->epoch);
+
+  for (i = 0; i < N_DEVICE_TYPES; i++)
+    g_hash_table_unref (self->by_type[i]);
+
+  for (i = 0; i < N_DEVICE_STATES; i++)
+    g_hash_table_unref (self->by_state[i]);
+
+  g_sequence_free (self->sorted);
+  g_array_unref (self->hub_ring);
+  g_hash_table_unref (self->assigned);
+  g_hash_table_unref (self->entries);
+  chamge_timing_wheel_free (self->wheel);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (chamge_registry_parent_class)->finalize (object);
+}
+
+static void
+chamge_registry_class_init (ChamgeRegistryClass * klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = chamge_registry_finalize;
+
+  /**
+   * ChamgeRegistry::device-expired:
+   * @self: a #ChamgeRegistry object
+   * @id: the id of the device
+   * @type: the #ChamgeDeviceType of the device
+   *
+   * Emitted, in the thread-default main context @self was made in, after a
+   * device which was not seen for longer than the expiry has been removed.
+   */
+  signals[SIG_DEVICE_EXPIRED] =
+      g_signal_new ("device-expired", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_generic,
+      G_TYPE_NONE, 2, G_TYPE_STRING, CHAMGE_TYPE_DEVICE_TYPE);
+}
+
+static void
+chamge_registry_init (ChamgeRegistry * self)
+{
+  guint i;
+
+  g_mutex_init (&self->lock);
+
+  self->context = g_main_context_ref_thread_default ();
+  self->wheel = chamge_timing_wheel_new (_now_tick ());
+
+  self->epoch = g_strdup_printf ("%08x%08x%08x%08x%08x%08x%08x%08x",
+      g_random_int (), g_random_int (), g_random_int (), g_random_int (),
+      g_random_int (), g_random_int (), g_random_int (), g_random_int ());
+
+  /* entries own their ids, so the table does not free the keys */
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) registry_entry_free);
+
+  for (i = 0; i < N_DEVICE_TYPES; i++)
+    self->by_type[i] = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  for (i = 0; i < N_DEVICE_STATES; i++)
+    self->by_state[i] = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  self->sorted = g_sequence_new (NULL);
+
+  self->assigned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  self->hub_ring = g_array_new (FALSE, FALSE, sizeof (HubRingPoint));
+}
+
+ChamgeRegistry *
+chamge_registry_new (void)
+{
+  return g_object_new (CHAMGE_TYPE_REGISTRY, NULL);
+}
+
+gboolean
+chamge_registry_add (ChamgeRegistry * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+  g_return_val_if_fail (type < N_DEVICE_TYPES, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  if (g_hash_table_contains (self->entries, id))
+    return FALSE;
+
+  entry = _insert_locked (self, id, type, CHAMGE_DEVICE_STATE_ENROLLED,
+      g_get_real_time (), NULL, g_random_int ());
+  _journal_locked (self, CHAMGE_JOURNAL_OP_ADD, entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_put (ChamgeRegistry * self, const gchar * id,
+    ChamgeDeviceType type, ChamgeDeviceState state)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+  g_return_val_if_fail (type < N_DEVICE_TYPES, FALSE);
+  g_return_val_if_fail (state < N_DEVICE_STATES, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL) {
+    entry = _insert_locked (self, id, type, state, g_get_real_time (), NULL,
+        g_random_int ());
+    _journal_locked (self, CHAMGE_JOURNAL_OP_PUT, entry);
+    return TRUE;
+  }
+
+  entry->last_seen = g_get_real_time ();
+  _refresh_locked (self, entry);
+  _set_state_locked (self, entry, state);
+  _journal_locked (self, CHAMGE_JOURNAL_OP_PUT, entry);
+
+  return FALSE;
+}
+
+gboolean
+chamge_registry_remove (ChamgeRegistry * self, const gchar * id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  _journal_locked (self, CHAMGE_JOURNAL_OP_REMOVE, entry);
+  _remove_locked (self, entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_contains (ChamgeRegistry * self, const gchar * id,
+    ChamgeDeviceType type)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+
+  if (id == NULL)
+    return FALSE;
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+
+  return entry != NULL && entry->type == type;
+}
+
+gboolean
+chamge_registry_lookup (ChamgeRegistry * self, const gchar * id,
+    ChamgeDeviceType * type, ChamgeDeviceState * state, gint64 * last_seen,
+    gchar ** hub_id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  if (type != NULL)
+    *type = entry->type;
+
+  if (state != NULL)
+    *state = entry->state;
+
+  if (last_seen != NULL)
+    *last_seen = entry->last_seen;
+
+  if (hub_id != NULL)
+    *hub_id = g_strdup (entry->hub_id);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_get_generation (ChamgeRegistry * self, const gchar * id,
+    guint32 * generation)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+  g_return_val_if_fail (generation != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  *generation = entry->generation;
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_set_generation (ChamgeRegistry * self, const gchar * id,
+    guint32 generation)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  if (entry->generation == generation)
+    return TRUE;
+
+  entry->generation = generation;
+  self->version++;
+
+  /* a put is replayed with the generation it carries */
+  _journal_locked (self, CHAMGE_JOURNAL_OP_PUT, entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_set_state (ChamgeRegistry * self, const gchar * id,
+    ChamgeDeviceState state)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+  g_return_val_if_fail (state < N_DEVICE_STATES, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  entry->last_seen = g_get_real_time ();
+  _refresh_locked (self, entry);
+
+  if (entry->state == state)
+    return TRUE;
+
+  _set_state_locked (self, entry, state);
+  _journal_locked (self, CHAMGE_JOURNAL_OP_SET_STATE, entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_set_hub (ChamgeRegistry * self, const gchar * id,
+    const gchar * hub_id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  if (g_strcmp0 (entry->hub_id, hub_id) == 0)
+    return TRUE;
+
+  _set_hub_locked (self, entry, hub_id);
+  _journal_locked (self, CHAMGE_JOURNAL_OP_SET_HUB, entry);
+
+  return TRUE;
+}
+
+gboolean
+chamge_registry_touch (ChamgeRegistry * self, const gchar * id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, id);
+  if (entry == NULL)
+    return FALSE;
+
+  entry->last_seen = g_get_real_time ();
+  _refresh_locked (self, entry);
+
+  return TRUE;
+}
+
+guint
+chamge_registry_count_by_type (ChamgeRegistry * self, ChamgeDeviceType type)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+  g_return_val_if_fail (type < N_DEVICE_TYPES, 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return g_hash_table_size (self->by_type[type]);
+}
+
+guint
+chamge_registry_count_by_state (ChamgeRegistry * self, ChamgeDeviceState state)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+  g_return_val_if_fail (state < N_DEVICE_STATES, 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return g_hash_table_size (self->by_state[state]);
+}
+
+gchar **
+chamge_registry_list_by_type (ChamgeRegistry * self, ChamgeDeviceType type)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), NULL);
+  g_return_val_if_fail (type < N_DEVICE_TYPES, NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return _list_ids (self->by_type[type]);
+}
+
+gchar **
+chamge_registry_list_by_state (ChamgeRegistry * self, ChamgeDeviceState state)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), NULL);
+  g_return_val_if_fail (state < N_DEVICE_STATES, NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return _list_ids (self->by_state[state]);
+}
+
+/* the epoch of the devices restored from @path, or a new one for them */
+static void
+_load_epoch_locked (ChamgeRegistry * self, const gchar * path)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *epoch_path = g_strconcat (path, ".epoch", NULL);
+  g_autofree gchar *contents = NULL;
+
+  if (g_file_get_contents (epoch_path, &contents, NULL, NULL)
+      && strlen (g_strstrip (contents)) == strlen (self->epoch)) {
+    g_free (self->epoch);
+    self->epoch = g_steal_pointer (&contents);
+    return;
+  }
+
+  /* the epoch signs the sessions of the devices, so it is kept private */
+  if (!g_file_set_contents_full (epoch_path, self->epoch, -1,
+          G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error))
+    g_warning ("failed to keep the epoch of the registry (reason: %s)",
+        error->message);
+}
+
+gboolean
+chamge_registry_open_journal (ChamgeRegistry * self, const gchar * path,
+    GError ** error)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  g_return_val_if_fail (self->journal == NULL, FALSE);
+
+  self->journal = chamge_journal_open (path, _replay, self, error);
+  if (self->journal == NULL)
+    return FALSE;
+
+  _load_epoch_locked (self, path);
+
+  return TRUE;
+}
+
+gchar *
+chamge_registry_dup_epoch (ChamgeRegistry * self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return g_strdup (self->epoch);
+}
+
+gboolean
+chamge_registry_compact (ChamgeRegistry * self, GError ** error)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  if (self->journal == NULL)
+    return TRUE;
+
+  return _compact_locked (self, error);
+}
+
+void
+chamge_registry_set_expiry (ChamgeRegistry * self, guint seconds)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  GHashTableIter iter;
+  RegistryEntry *entry;
+
+  g_return_if_fail (CHAMGE_IS_REGISTRY (self));
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  if (self->expiry == seconds)
+    return;
+
+  self->expiry = seconds;
+
+  /* devices get a full period from now on */
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry)) {
+    if (seconds > 0)
+      _refresh_locked (self, entry);
+    else
+      chamge_timing_wheel_cancel (self->wheel, &entry->timer);
+  }
+
+  if (seconds > 0 && self->expiry_source == NULL) {
+    self->expiry_source = g_timeout_source_new_seconds (1);
+    g_source_set_callback (self->expiry_source, _expire_devices, self, NULL);
+    g_source_attach (self->expiry_source, self->context);
+  } else if (seconds == 0 && self->expiry_source != NULL) {
+    g_source_destroy (self->expiry_source);
+    g_clear_pointer (&self->expiry_source, g_source_unref);
+  }
+}
+
+guint
+chamge_registry_get_expiry (ChamgeRegistry * self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return self->expiry;
+}
+
+static void
+_foreach_locked (ChamgeRegistry * self, const gchar * after,
+    ChamgeRegistryForeachFunc func, gpointer user_data)
+{
+  GSequenceIter *iter;
+
+  /* the first id past @after, found in logarithmic time */
+  if (after != NULL)
+    iter = g_sequence_search (self->sorted, (gpointer) after, _compare_ids,
+        NULL);
+  else
+    iter = g_sequence_get_begin_iter (self->sorted);
+
+  for (; !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
+    RegistryEntry *entry = g_hash_table_lookup (self->entries,
+        g_sequence_get (iter));
+    ChamgeRegistryDevice device;
+
+    if (after != NULL && strcmp (entry->id, after) <= 0)
+      continue;
+
+    device.id = entry->id;
+    device.type = entry->type;
+    device.state = entry->state;
+    device.hub_id = entry->hub_id;
+
+    if (!func (&device, user_data))
+      break;
+  }
+}
+
+void
+chamge_registry_foreach (ChamgeRegistry * self, const gchar * after,
+    ChamgeRegistryForeachFunc func, gpointer user_data)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_if_fail (CHAMGE_IS_REGISTRY (self));
+  g_return_if_fail (func != NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  _foreach_locked (self, after, func, user_data);
+}
+
+guint64
+chamge_registry_get_version (ChamgeRegistry * self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return self->version;
+}
+
+guint64
+chamge_registry_snapshot (ChamgeRegistry * self,
+    ChamgeRegistryForeachFunc func, gpointer user_data)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  _foreach_locked (self, NULL, func, user_data);
+
+  return self->version;
+}
+
+gboolean
+chamge_registry_set_hub_load (ChamgeRegistry * self, const gchar * hub_id,
+    guint capacity, guint load, const gchar * uri)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (hub_id != NULL, FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, hub_id);
+  if (entry == NULL || entry->type != CHAMGE_DEVICE_TYPE_HUB)
+    return FALSE;
+
+  entry->capacity = capacity;
+  entry->load = load;
+
+  if (g_strcmp0 (entry->uri, uri) != 0) {
+    g_free (entry->uri);
+    entry->uri = g_strdup (uri);
+  }
+
+  return TRUE;
+}
+
+guint
+chamge_registry_count_assigned (ChamgeRegistry * self, const gchar * hub_id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), 0);
+  g_return_val_if_fail (hub_id != NULL, 0);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (self->assigned, hub_id));
+}
+
+gchar *
+chamge_registry_assign_hub (ChamgeRegistry * self, const gchar * edge_id,
+    ChamgeHubStrategy strategy, gchar ** uri)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *edge;
+  RegistryEntry *hub = NULL;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), NULL);
+  g_return_val_if_fail (edge_id != NULL, NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  edge = g_hash_table_lookup (self->entries, edge_id);
+  if (edge == NULL || edge->type != CHAMGE_DEVICE_TYPE_EDGE)
+    return NULL;
+
+  /* the latencies are kept sorted as they are reported, so the nearest hub
+   * is one of the first ones */
+  if (strategy == CHAMGE_HUB_STRATEGY_LOWEST_RTT)
+    hub = _select_lowest_rtt_locked (self, edge);
+
+  /* an edge stays where it is as long as its hub can keep it */
+  if (hub == NULL && edge->hub_id != NULL) {
+    hub = g_hash_table_lookup (self->entries, edge->hub_id);
+    if (!_hub_available_locked (self, hub, 0))
+      hub = NULL;
+  }
+
+  if (hub == NULL) {
+    switch (strategy) {
+      case CHAMGE_HUB_STRATEGY_WEIGHTED:
+        hub = _select_weighted_locked (self);
+        break;
+      case CHAMGE_HUB_STRATEGY_CONSISTENT_HASH:
+        hub = _select_consistent_hash_locked (self, edge_id);
+        break;
+      case CHAMGE_HUB_STRATEGY_LOWEST_RTT:
+        /* no measured hub can take the edge */
+      case CHAMGE_HUB_STRATEGY_LEAST_LOADED:
+      default:
+        hub = _select_least_loaded_locked (self);
+        break;
+    }
+
+    if (hub == NULL) {
+      g_debug ("no hub is available for %s", edge_id);
+      return NULL;
+    }
+  }
+
+  if (g_strcmp0 (edge->hub_id, hub->id) != 0) {
+    _set_hub_locked (self, edge, hub->id);
+    _journal_locked (self, CHAMGE_JOURNAL_OP_SET_HUB, edge);
+  }
+
+  if (uri != NULL)
+    *uri = g_strdup (hub->uri);
+
+  return g_strdup (hub->id);
+}
+
+gboolean
+chamge_registry_set_latencies (ChamgeRegistry * self, const gchar * edge_id,
+    const gchar * const *hub_ids, const guint * rtts, guint n_hubs)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+  guint i;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), FALSE);
+  g_return_val_if_fail (edge_id != NULL, FALSE);
+  g_return_val_if_fail (n_hubs == 0 || (hub_ids != NULL && rtts != NULL),
+      FALSE);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, edge_id);
+  if (entry == NULL || entry->type != CHAMGE_DEVICE_TYPE_EDGE)
+    return FALSE;
+
+  if (entry->latencies == NULL) {
+    entry->latencies = g_array_sized_new (FALSE, FALSE, sizeof (HubLatency),
+        n_hubs);
+    g_array_set_clear_func (entry->latencies,
+        (GDestroyNotify) hub_latency_clear);
+  }
+
+  g_array_set_size (entry->latencies, 0);
+  for (i = 0; i < n_hubs; i++) {
+    HubLatency latency = { g_strdup (hub_ids[i]), rtts[i] };
+
+    g_array_append_val (entry->latencies, latency);
+  }
+
+  g_array_sort (entry->latencies, _compare_latencies);
+
+  return TRUE;
+}
+
+gchar *
+chamge_registry_dup_hub_uri (ChamgeRegistry * self, const gchar * hub_id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RegistryEntry *entry;
+
+  g_return_val_if_fail (CHAMGE_IS_REGISTRY (self), NULL);
+  g_return_val_if_fail (hub_id != NULL, NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  entry = g_hash_table_lookup (self->entries, hub_id);
+  if (entry == NULL || entry->type != CHAMGE_DEVICE_TYPE_HUB
+      || entry->state != CHAMGE_DEVICE_STATE_ACTIVATED)
+    return NULL;
+
+  return g_strdup (entry->uri);
+}
@@ -0,0 +1,496 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_REGISTRY_H__
+#define __CHAMGE_REGISTRY_H__
+
+#if !defined(__CHAMGE_INSIDE__) && !defined(CHAMGE_COMPILATION)
+#error "Only <chamge/chamge.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include <chamge/types.h>
+
+/**
+ * SECTION: registry
+ * @Title: ChamgeRegistry
+ * @Short_description: An index of the devices known to an arbiter
+ *
+ * A #ChamgeRegistry keeps the edges and the hubs enrolled to an arbiter,
+ * indexed by id, by #ChamgeDeviceState and by #ChamgeDeviceType. All lookups
+ * take constant time and the registry can be used from any thread.
+ */
+
+G_BEGIN_DECLS
+
+#define CHAMGE_TYPE_REGISTRY    (chamge_registry_get_type ())
+CHAMGE_API_EXPORT
+G_DECLARE_FINAL_TYPE            (ChamgeRegistry, chamge_registry, CHAMGE, REGISTRY, GObject)
+
+/**
+ * ChamgeRegistryDevice:
+ * @id: the id of the device
+ * @type: the type of the device
+ * @state: the state of the device
+ * @hub_id: (nullable): the id of the hub assigned to the device
+ *
+ * A device as seen by chamge_registry_foreach(), valid only during the call.
+ */
+typedef struct
+{
+  const gchar      *id;
+  ChamgeDeviceType  type;
+  ChamgeDeviceState state;
+  const gchar      *hub_id;
+} ChamgeRegistryDevice;
+
+/**
+ * ChamgeRegistryForeachFunc:
+ * @device: a #ChamgeRegistryDevice
+ * @user_data: the data passed to chamge_registry_foreach()
+ *
+ * Returns: %FALSE to stop
+ */
+typedef gboolean (*ChamgeRegistryForeachFunc) (const ChamgeRegistryDevice *device,
+                                               gpointer                    user_data);
+
+/**
+ * chamge_registry_new:
+ *
+ * Creates a new empty #ChamgeRegistry object
+ *
+ * Returns: the newly created object
+ */
+CHAMGE_API_EXPORT
+ChamgeRegistry *chamge_registry_new                     (void);
+
+/**
+ * chamge_registry_add:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @type: the type of the device
+ *
+ * Adds a device in the %CHAMGE_DEVICE_STATE_ENROLLED state.
+ *
+ * Returns: %FALSE if a device with @id is already registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_add                     (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         ChamgeDeviceType   type);
+
+/**
+ * chamge_registry_put:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @type: the type of the device
+ * @state: the state of the device
+ *
+ * Adds a device in @state, or moves a registered one to @state, as a single
+ * change.
+ *
+ * Returns: %TRUE if the device was not registered yet
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_put                     (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         ChamgeDeviceType   type,
+                                                         ChamgeDeviceState  state);
+
+/**
+ * chamge_registry_remove:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_remove                  (ChamgeRegistry    *self,
+                                                         const gchar       *id);
+
+/**
+ * chamge_registry_contains:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @type: the expected type of the device
+ *
+ * Returns: %TRUE if a device of @type is registered with @id
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_contains                (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         ChamgeDeviceType   type);
+
+/**
+ * chamge_registry_lookup:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @type: (out) (optional): the type of the device
+ * @state: (out) (optional): the state of the device
+ * @last_seen: (out) (optional): the wall-clock time, in microseconds, at
+ *   which the device was last heard from
+ * @hub_id: (out) (optional) (transfer full): the id of the hub assigned to
+ *   the device, or %NULL
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_lookup                  (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         ChamgeDeviceType  *type,
+                                                         ChamgeDeviceState *state,
+                                                         gint64            *last_seen,
+                                                         gchar            **hub_id);
+
+/**
+ * chamge_registry_get_generation:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @generation: (out): the generation of the device
+ *
+ * Gets a random number drawn when the device was added, which tells it apart
+ * from a device registered with the same @id before it was removed. It is
+ * kept in the journal, and stays the same as long as the device is
+ * registered.
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_get_generation          (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         guint32           *generation);
+
+/**
+ * chamge_registry_set_generation:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @generation: the generation of the device
+ *
+ * Adopts the generation another arbiter has drawn for the device, so that the
+ * arbiters sharing a registry tell the same registration of it apart.
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_set_generation          (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         guint32            generation);
+
+/**
+ * chamge_registry_set_state:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @state: the new state of the device
+ *
+ * Changes the state of a device and marks it as seen.
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_set_state               (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         ChamgeDeviceState  state);
+
+/**
+ * chamge_registry_set_hub:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ * @hub_id: (nullable): the id of the hub assigned to the device
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_set_hub                 (ChamgeRegistry    *self,
+                                                         const gchar       *id,
+                                                         const gchar       *hub_id);
+
+/**
+ * chamge_registry_touch:
+ * @self: a #ChamgeRegistry object
+ * @id: the id of the device
+ *
+ * Marks a device as seen now.
+ *
+ * Returns: %FALSE if no device with @id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_touch                   (ChamgeRegistry    *self,
+                                                         const gchar       *id);
+
+/**
+ * chamge_registry_count_by_type:
+ * @self: a #ChamgeRegistry object
+ * @type: a #ChamgeDeviceType
+ *
+ * Returns: the number of registered devices of @type
+ */
+CHAMGE_API_EXPORT
+guint           chamge_registry_count_by_type           (ChamgeRegistry    *self,
+                                                         ChamgeDeviceType   type);
+
+/**
+ * chamge_registry_count_by_state:
+ * @self: a #ChamgeRegistry object
+ * @state: a #ChamgeDeviceState
+ *
+ * Returns: the number of registered devices in @state
+ */
+CHAMGE_API_EXPORT
+guint           chamge_registry_count_by_state          (ChamgeRegistry    *self,
+                                                         ChamgeDeviceState  state);
+
+/**
+ * chamge_registry_list_by_type:
+ * @self: a #ChamgeRegistry object
+ * @type: a #ChamgeDeviceType
+ *
+ * Returns: (transfer full): a %NULL-terminated array of the ids of the
+ *   devices of @type
+ */
+CHAMGE_API_EXPORT
+gchar         **chamge_registry_list_by_type            (ChamgeRegistry    *self,
+                                                         ChamgeDeviceType   type);
+
+/**
+ * chamge_registry_list_by_state:
+ * @self: a #ChamgeRegistry object
+ * @state: a #ChamgeDeviceState
+ *
+ * Returns: (transfer full): a %NULL-terminated array of the ids of the
+ *   devices in @state
+ */
+CHAMGE_API_EXPORT
+gchar         **chamge_registry_list_by_state           (ChamgeRegistry    *self,
+                                                         ChamgeDeviceState  state);
+
+/**
+ * chamge_registry_open_journal:
+ * @self: a #ChamgeRegistry object
+ * @path: the path of the journal file
+ * @error: a #GError
+ *
+ * Restores the devices recorded at @path, and from then on records every
+ * change to @self there, so that the registry survives a restart. The
+ * snapshot written by chamge_registry_compact() and the epoch of @self are
+ * kept next to @path. Marking a device as seen is not recorded until the next
+ * compaction.
+ *
+ * Returns: %TRUE if the journal was opened
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_open_journal            (ChamgeRegistry    *self,
+                                                         const gchar       *path,
+                                                         GError           **error);
+
+/**
+ * chamge_registry_dup_epoch:
+ * @self: a #ChamgeRegistry object
+ *
+ * Gets a random secret which identifies the devices known to @self. It stays
+ * the same as long as they are, across restarts when the journal is kept, and
+ * is never the same again once they are lost.
+ *
+ * Returns: (transfer full): the epoch of @self
+ */
+CHAMGE_API_EXPORT
+gchar          *chamge_registry_dup_epoch               (ChamgeRegistry    *self);
+
+/**
+ * chamge_registry_compact:
+ * @self: a #ChamgeRegistry object
+ * @error: a #GError
+ *
+ * Writes a snapshot of @self and empties the journal. The journal is also
+ * compacted automatically when it grows large.
+ *
+ * Returns: %TRUE on success, or if no journal is open
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_compact                 (ChamgeRegistry    *self,
+                                                         GError           **error);
+
+/**
+ * chamge_registry_set_expiry:
+ * @self: a #ChamgeRegistry object
+ * @seconds: how long a device may stay unseen, or 0 to never expire devices
+ *
+ * Makes @self remove the devices which were not seen for @seconds and emit
+ * #ChamgeRegistry::device-expired for them, from the thread-default main
+ * context @self was made in. Adding a device, changing its state and
+ * chamge_registry_touch() all mark it as seen.
+ */
+CHAMGE_API_EXPORT
+void            chamge_registry_set_expiry              (ChamgeRegistry    *self,
+                                                         guint              seconds);
+
+/**
+ * chamge_registry_get_expiry:
+ * @self: a #ChamgeRegistry object
+ *
+ * Returns: the expiry of devices in seconds, or 0 if they never expire
+ */
+CHAMGE_API_EXPORT
+guint           chamge_registry_get_expiry              (ChamgeRegistry    *self);
+
+/**
+ * chamge_registry_foreach:
+ * @self: a #ChamgeRegistry object
+ * @after: (nullable): an id to start after, or %NULL to start from the first
+ * @func: (scope call): the function to call for each device
+ * @user_data: the data to pass to @func
+ *
+ * Calls @func for the devices in the order of their ids, starting past
+ * @after, until @func returns %FALSE. Finding where to start takes
+ * logarithmic time, so that a large registry can be walked a page at a time
+ * by passing the last id seen as @after. @self is locked meanwhile, so
+ * @func must not call back into it.
+ */
+CHAMGE_API_EXPORT
+void            chamge_registry_foreach                 (ChamgeRegistry    *self,
+                                                         const gchar       *after,
+                                                         ChamgeRegistryForeachFunc
+                                                                            func,
+                                                         gpointer           user_data);
+
+/**
+ * chamge_registry_get_version:
+ * @self: a #ChamgeRegistry object
+ *
+ * Gets a counter which grows whenever a device is added or removed, or
+ * changes its state or its hub. Marking a device as seen leaves it as is.
+ * Comparing it with a previous value tells whether anything changed since.
+ *
+ * Returns: the version of @self
+ */
+CHAMGE_API_EXPORT
+guint64         chamge_registry_get_version             (ChamgeRegistry    *self);
+
+/**
+ * chamge_registry_snapshot:
+ * @self: a #ChamgeRegistry object
+ * @func: (scope call): the function to call for each device
+ * @user_data: the data to pass to @func
+ *
+ * Calls @func for all the devices in the order of their ids, as
+ * chamge_registry_foreach() does, under the same lock as the version is
+ * read, so that the devices seen are exactly those of the version returned.
+ * @func must not call back into @self.
+ *
+ * Returns: the version of @self the devices were seen at
+ */
+CHAMGE_API_EXPORT
+guint64         chamge_registry_snapshot                (ChamgeRegistry    *self,
+                                                         ChamgeRegistryForeachFunc
+                                                                            func,
+                                                         gpointer           user_data);
+
+/**
+ * chamge_registry_set_hub_load:
+ * @self: a #ChamgeRegistry object
+ * @hub_id: the id of the hub
+ * @capacity: the number of streams the hub can relay, or 0 if unknown
+ * @load: the number of streams the hub relays
+ * @uri: (nullable): the uri edges should stream to
+ *
+ * Records the load a hub reported. The load is not written to the journal,
+ * hubs are expected to report it again after a restart.
+ *
+ * Returns: %FALSE if no hub with @hub_id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_set_hub_load            (ChamgeRegistry    *self,
+                                                         const gchar       *hub_id,
+                                                         guint              capacity,
+                                                         guint              load,
+                                                         const gchar       *uri);
+
+/**
+ * chamge_registry_assign_hub:
+ * @self: a #ChamgeRegistry object
+ * @edge_id: the id of the edge
+ * @strategy: how to choose a hub for an edge without one
+ * @uri: (out) (optional) (transfer full): the uri reported by the hub, or
+ *   %NULL
+ *
+ * Assigns an activated hub with room left to an edge, as
+ * chamge_registry_set_hub() does. An edge keeps the hub it is assigned to
+ * as long as that hub can keep it, so calling this again is cheap. A hub is
+ * considered at least as loaded as the number of edges assigned to it.
+ *
+ * With %CHAMGE_HUB_STRATEGY_LOWEST_RTT, the edge moves to the nearest hub
+ * with room left according to chamge_registry_set_latencies(), and falls
+ * back to %CHAMGE_HUB_STRATEGY_LEAST_LOADED if it measured none.
+ *
+ * Returns: (transfer full): the id of the assigned hub, or %NULL if no edge
+ *   with @edge_id is registered or no hub is available
+ */
+CHAMGE_API_EXPORT
+gchar          *chamge_registry_assign_hub              (ChamgeRegistry    *self,
+                                                         const gchar       *edge_id,
+                                                         ChamgeHubStrategy  strategy,
+                                                         gchar            **uri);
+
+/**
+ * chamge_registry_count_assigned:
+ * @self: a #ChamgeRegistry object
+ * @hub_id: the id of a hub
+ *
+ * Returns: the number of registered edges assigned to @hub_id
+ */
+CHAMGE_API_EXPORT
+guint           chamge_registry_count_assigned          (ChamgeRegistry    *self,
+                                                         const gchar       *hub_id);
+
+/**
+ * chamge_registry_set_latencies:
+ * @self: a #ChamgeRegistry object
+ * @edge_id: the id of the edge
+ * @hub_ids: (array length=n_hubs): the ids of the hubs the edge measured
+ * @rtts: (array length=n_hubs): the round-trip times to @hub_ids in
+ *   milliseconds
+ * @n_hubs: the number of hubs
+ *
+ * Replaces the round-trip times an edge measured, which
+ * %CHAMGE_HUB_STRATEGY_LOWEST_RTT uses to assign it a hub. They are not
+ * written to the journal.
+ *
+ * Returns: %FALSE if no edge with @edge_id is registered
+ */
+CHAMGE_API_EXPORT
+gboolean        chamge_registry_set_latencies           (ChamgeRegistry    *self,
+                                                         const gchar       *edge_id,
+                                                         const gchar * const
+                                                                           *hub_ids,
+                                                         const guint       *rtts,
+                                                         guint              n_hubs);
+
+/**
+ * chamge_registry_dup_hub_uri:
+ * @self: a #ChamgeRegistry object
+ * @hub_id: the id of the hub
+ *
+ * Returns: (transfer full) (nullable): the uri reported by @hub_id, or %NULL
+ *   if it reported none or is not activated
+ */
+CHAMGE_API_EXPORT
+gchar          *chamge_registry_dup_hub_uri             (ChamgeRegistry    *self,
+                                                         const gchar       *hub_id);
+
+G_END_DECLS
+
+#endif // __CHAMGE_REGISTRY_H__
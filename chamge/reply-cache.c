@@ -0,0 +1,165 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "reply-cache.h"
+
+typedef struct
+{
+  /* the scope and the correlation id */
+  gchar *key;
+  gchar *response;
+  gint status;
+} CachedReply;
+
+struct _ChamgeReplyCache
+{
+  GMutex lock;
+  guint capacity;
+
+  /* key -> link of @recent, most recently used first */
+  GHashTable *replies;
+  GQueue recent;
+};
+
+static void
+_cached_reply_free (gpointer data)
+{
+  CachedReply *reply = data;
+
+  g_free (reply->key);
+  g_free (reply->response);
+  g_free (reply);
+}
+
+static gchar *
+_make_key (const gchar * scope, const gchar * id)
+{
+  /* neither part has a NUL in it, so that the key is not ambiguous */
+  return g_strconcat (scope != NULL ? scope : "", "\n", id, NULL);
+}
+
+ChamgeReplyCache *
+chamge_reply_cache_new (guint capacity)
+{
+  ChamgeReplyCache *self;
+
+  g_return_val_if_fail (capacity > 0, NULL);
+
+  self = g_new0 (ChamgeReplyCache, 1);
+  g_mutex_init (&self->lock);
+  self->capacity = capacity;
+  self->replies = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&self->recent);
+
+  return self;
+}
+
+void
+chamge_reply_cache_free (ChamgeReplyCache * self)
+{
+  if (self == NULL)
+    return;
+
+  g_hash_table_unref (self->replies);
+  g_queue_foreach (&self->recent, (GFunc) _cached_reply_free, NULL);
+  g_queue_clear (&self->recent);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
+
+gboolean
+chamge_reply_cache_lookup (ChamgeReplyCache * self, const gchar * scope,
+    const gchar * id, gchar ** response, gint * status)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autofree gchar *key = NULL;
+  CachedReply *reply;
+  GList *link;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (id == NULL)
+    return FALSE;
+
+  key = _make_key (scope, id);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  link = g_hash_table_lookup (self->replies, key);
+  if (link == NULL)
+    return FALSE;
+
+  g_queue_unlink (&self->recent, link);
+  g_queue_push_head_link (&self->recent, link);
+
+  reply = link->data;
+  if (response != NULL)
+    *response = g_strdup (reply->response);
+  if (status != NULL)
+    *status = reply->status;
+
+  return TRUE;
+}
+
+void
+chamge_reply_cache_insert (ChamgeReplyCache * self, const gchar * scope,
+    const gchar * id, const gchar * response, gint status)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autofree gchar *key = NULL;
+  CachedReply *reply;
+  GList *link;
+
+  g_return_if_fail (self != NULL);
+
+  if (id == NULL)
+    return;
+
+  key = _make_key (scope, id);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  link = g_hash_table_lookup (self->replies, key);
+  if (link != NULL) {
+    reply = link->data;
+    g_free (reply->response);
+    reply->response = g_strdup (response);
+    reply->status = status;
+
+    g_queue_unlink (&self->recent, link);
+    g_queue_push_head_link (&self->recent, link);
+    return;
+  }
+
+  if (self->recent.length >= self->capacity) {
+    CachedReply *oldest = g_queue_pop_tail (&self->recent);
+
+    g_hash_table_remove (self->replies, oldest->key);
+    _cached_reply_free (oldest);
+  }
+
+  reply = g_new0 (CachedReply, 1);
+  reply->key = g_steal_pointer (&key);
+  reply->response = g_strdup (response);
+  reply->status = status;
+
+  g_queue_push_head (&self->recent, reply);
+  g_hash_table_insert (self->replies, reply->key, self->recent.head);
+}
@@ -0,0 +1,54 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_REPLY_CACHE_H__
+#define __CHAMGE_REPLY_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ChamgeReplyCache ChamgeReplyCache;
+
+/* remembers the replies to the last @capacity requests by correlation id, so
+ * that a retried request is answered again without being handled twice; it
+ * may be used from any thread */
+ChamgeReplyCache       *chamge_reply_cache_new          (guint                   capacity);
+
+void                    chamge_reply_cache_free         (ChamgeReplyCache       *self);
+
+/* a correlation id is chosen by the peer, so that a reply is only found in
+ * the @scope it was inserted in, e.g. the device of the request, or NULL for
+ * none; returns TRUE with a copy of the reply and its status if @id is
+ * known */
+gboolean                chamge_reply_cache_lookup       (ChamgeReplyCache       *self,
+                                                         const gchar            *scope,
+                                                         const gchar            *id,
+                                                         gchar                 **response,
+                                                         gint                   *status);
+
+/* the least recently used reply is forgotten when the cache is full */
+void                    chamge_reply_cache_insert       (ChamgeReplyCache       *self,
+                                                         const gchar            *scope,
+                                                         const gchar            *id,
+                                                         const gchar            *response,
+                                                         gint                    status);
+
+G_END_DECLS
+
+#endif // __CHAMGE_REPLY_CACHE_H__
@@ -0,0 +1,174 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "timing-wheel.h"
+
+/*
+ * Each level has 64 slots, a slot of the level N spanning 64^N ticks. Timers
+ * are kept in the lowest level that can hold them, and moved down a level
+ * whenever the lower level wraps around, so that scheduling and cancelling
+ * take constant time and advancing costs one slot per tick. Timers beyond
+ * the last level are parked in its farthest slot and placed again later.
+ */
+
+#define SLOT_BITS       6
+#define N_SLOTS         (1 << SLOT_BITS)
+#define SLOT_MASK       (N_SLOTS - 1)
+#define N_LEVELS        4
+#define MAX_DELTA       ((G_GUINT64_CONSTANT (1) << (SLOT_BITS * N_LEVELS)) - 1)
+
+struct _ChamgeTimingWheel
+{
+  /* the next tick to process */
+  guint64 now;
+
+  /* circular lists, the heads acting as sentinels */
+  ChamgeTimer slots[N_LEVELS][N_SLOTS];
+};
+
+static void
+_unlink (ChamgeTimer * timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = timer->next = NULL;
+}
+
+static void
+_insert (ChamgeTimingWheel * self, ChamgeTimer * timer)
+{
+  guint64 expires = MAX (timer->expires, self->now);
+  guint64 delta = expires - self->now;
+  ChamgeTimer *head;
+  guint level;
+
+  if (delta > MAX_DELTA)
+    expires = self->now + MAX_DELTA;
+
+  for (level = 0; level < N_LEVELS - 1; level++) {
+    if (delta < (G_GUINT64_CONSTANT (1) << (SLOT_BITS * (level + 1))))
+      break;
+  }
+
+  head = &self->slots[level][(expires >> (SLOT_BITS * level)) & SLOT_MASK];
+
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+/* moves the timers of a slot down, and returns the index of the slot */
+static guint
+_cascade (ChamgeTimingWheel * self, guint level)
+{
+  guint index = (self->now >> (SLOT_BITS * level)) & SLOT_MASK;
+  ChamgeTimer *head = &self->slots[level][index];
+
+  while (head->next != head) {
+    ChamgeTimer *timer = head->next;
+
+    _unlink (timer);
+    _insert (self, timer);
+  }
+
+  return index;
+}
+
+ChamgeTimingWheel *
+chamge_timing_wheel_new (guint64 now)
+{
+  ChamgeTimingWheel *self = g_new0 (ChamgeTimingWheel, 1);
+  guint level, index;
+
+  self->now = now;
+
+  for (level = 0; level < N_LEVELS; level++) {
+    for (index = 0; index < N_SLOTS; index++) {
+      ChamgeTimer *head = &self->slots[level][index];
+      head->prev = head->next = head;
+    }
+  }
+
+  return self;
+}
+
+void
+chamge_timing_wheel_free (ChamgeTimingWheel * self)
+{
+  g_free (self);
+}
+
+void
+chamge_timing_wheel_schedule (ChamgeTimingWheel * self, ChamgeTimer * timer,
+    guint64 expires)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (timer != NULL);
+
+  if (timer->next != NULL)
+    _unlink (timer);
+
+  timer->expires = expires;
+  _insert (self, timer);
+}
+
+void
+chamge_timing_wheel_cancel (ChamgeTimingWheel * self, ChamgeTimer * timer)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (timer != NULL);
+
+  if (timer->next != NULL)
+    _unlink (timer);
+}
+
+void
+chamge_timing_wheel_advance (ChamgeTimingWheel * self, guint64 now,
+    ChamgeTimerFunc func, gpointer user_data)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  while (self->now <= now) {
+    guint index = self->now & SLOT_MASK;
+    ChamgeTimer *head = &self->slots[0][index];
+    guint level;
+
+    for (level = 1; index == 0 && level < N_LEVELS; level++)
+      index = _cascade (self, level);
+
+    while (head->next != head) {
+      ChamgeTimer *timer = head->next;
+
+      _unlink (timer);
+
+      /* parked beyond the last level */
+      if (timer->expires > self->now) {
+        _insert (self, timer);
+        continue;
+      }
+
+      func (timer, user_data);
+    }
+
+    self->now++;
+  }
+}
@@ -0,0 +1,61 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_TIMING_WHEEL_H__
+#define __CHAMGE_TIMING_WHEEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* embedded in the objects to expire, so that no allocation is needed */
+typedef struct _ChamgeTimer ChamgeTimer;
+struct _ChamgeTimer
+{
+  ChamgeTimer *prev;
+  ChamgeTimer *next;
+  guint64 expires;
+};
+
+typedef void (*ChamgeTimerFunc)                 (ChamgeTimer            *timer,
+                                                 gpointer                user_data);
+
+typedef struct _ChamgeTimingWheel ChamgeTimingWheel;
+
+ChamgeTimingWheel      *chamge_timing_wheel_new         (guint64                 now);
+
+void                    chamge_timing_wheel_free        (ChamgeTimingWheel      *self);
+
+/* (re)schedules @timer to expire at the tick @expires */
+void                    chamge_timing_wheel_schedule    (ChamgeTimingWheel      *self,
+                                                         ChamgeTimer            *timer,
+                                                         guint64                 expires);
+
+void                    chamge_timing_wheel_cancel      (ChamgeTimingWheel      *self,
+                                                         ChamgeTimer            *timer);
+
+/* calls @func for every timer expiring up to the tick @now; @func is given
+ * timers already unlinked from the wheel */
+void                    chamge_timing_wheel_advance     (ChamgeTimingWheel      *self,
+                                                         guint64                 now,
+                                                         ChamgeTimerFunc         func,
+                                                         gpointer                user_data);
+
+G_END_DECLS
+
+#endif // __CHAMGE_TIMING_WHEEL_H__
@@ -0,0 +1,79 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "token-bucket.h"
+
+struct _ChamgeTokenBucket
+{
+  gdouble rate;
+  gdouble burst;
+  gdouble tokens;
+  gint64 last;
+};
+
+ChamgeTokenBucket *
+chamge_token_bucket_new (guint rate, guint burst, gint64 now)
+{
+  ChamgeTokenBucket *self;
+
+  g_return_val_if_fail (rate > 0, NULL);
+
+  self = g_new0 (ChamgeTokenBucket, 1);
+  self->rate = rate;
+  self->burst = MAX (burst, 1);
+  self->tokens = self->burst;
+  self->last = now;
+
+  return self;
+}
+
+void
+chamge_token_bucket_free (ChamgeTokenBucket * self)
+{
+  g_free (self);
+}
+
+gboolean
+chamge_token_bucket_take (ChamgeTokenBucket * self, guint n, gint64 now,
+    guint * wait_ms)
+{
+  gdouble needed;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (now > self->last) {
+    self->tokens = MIN (self->burst,
+        self->tokens + (now - self->last) * self->rate / G_USEC_PER_SEC);
+    self->last = now;
+  }
+
+  /* more than a burst is admitted once the bucket is full and leaves it in
+   * debt, so that the average rate still holds */
+  needed = MIN (n, self->burst);
+  if (self->tokens >= needed) {
+    self->tokens -= n;
+    return TRUE;
+  }
+
+  if (wait_ms != NULL)
+    *wait_ms = (guint) ((needed - self->tokens) * 1000 / self->rate) + 1;
+
+  return FALSE;
+}
@@ -0,0 +1,45 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __CHAMGE_TOKEN_BUCKET_H__
+#define __CHAMGE_TOKEN_BUCKET_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ChamgeTokenBucket ChamgeTokenBucket;
+
+/* admits @rate requests per second on average and @burst at once; times are
+ * monotonic microseconds */
+ChamgeTokenBucket      *chamge_token_bucket_new         (guint                   rate,
+                                                         guint                   burst,
+                                                         gint64                  now);
+
+void                    chamge_token_bucket_free        (ChamgeTokenBucket      *self);
+
+/* takes @n tokens, or none and returns FALSE with the milliseconds to wait
+ * for them in @wait_ms; more than @burst tokens are taken from a full bucket */
+gboolean                chamge_token_bucket_take        (ChamgeTokenBucket      *self,
+                                                         guint                   n,
+                                                         gint64                  now,
+                                                         guint                  *wait_ms);
+
+G_END_DECLS
+
+#endif // __CHAMGE_TOKEN_BUCKET_H__
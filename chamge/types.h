@@ -51,6 +51,23 @@ typedef enum {
   CHAMGE_BACKEND_AMQP,
 } ChamgeBackend;
 
+typedef enum {
+  CHAMGE_DEVICE_TYPE_EDGE,
+  CHAMGE_DEVICE_TYPE_HUB,
+} ChamgeDeviceType;
+
+typedef enum {
+  CHAMGE_DEVICE_STATE_ENROLLED,
+  CHAMGE_DEVICE_STATE_ACTIVATED,
+} ChamgeDeviceState;
+
+typedef enum {
+  CHAMGE_HUB_STRATEGY_LEAST_LOADED,
+  CHAMGE_HUB_STRATEGY_WEIGHTED,
+  CHAMGE_HUB_STRATEGY_CONSISTENT_HASH,
+  CHAMGE_HUB_STRATEGY_LOWEST_RTT,
+} ChamgeHubStrategy;
+
 #define CHAMGE_BACKEND_ERROR      (chamge_backend_error_quark())
 GQuark chamge_backend_error_quark (void);
 
@@ -59,6 +76,8 @@ typedef enum {
   CHAMGE_BACKEND_ERROR_OPERATION_FAILURE,
   CHAMGE_BACKEND_ERROR_INACCESSIBLE,
   CHAMGE_BACKEND_ERROR_MISSING_PARAMETER,
+  CHAMGE_BACKEND_ERROR_NOT_SUPPORTED,
+  CHAMGE_BACKEND_ERROR_BUSY,
 } ChamgeBackendError;
 
 #endif // __CHAMGE_TYPES_H__
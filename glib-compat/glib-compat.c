@@ -18,6 +18,13 @@
 
 #include "glib-compat.h"
 
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #if ! GLIB_CHECK_VERSION (2, 52, 0)
 
 gchar *
@@ -43,3 +50,78 @@ g_uuid_string_random (void)
 }
 
 #endif
+
+#if ! GLIB_CHECK_VERSION (2, 66, 0)
+
+static gboolean
+_set_error_from_errno (GError ** error, const gchar * action,
+    const gchar * filename, gint errsv)
+{
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+      "failed to %s %s: %s", action, filename, g_strerror (errsv));
+  return FALSE;
+}
+
+/* always written to a temporary file which is renamed over @filename, so
+ * that it is created with @mode and never seen half written */
+gboolean
+g_file_set_contents_full (const gchar * filename, const gchar * contents,
+    gssize length, GFileSetContentsFlags flags, int mode, GError ** error)
+{
+  g_autofree gchar *tmp_path = NULL;
+  gsize written = 0;
+  gint fd;
+
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (contents != NULL || length == 0, FALSE);
+
+  if (length < 0)
+    length = strlen (contents);
+
+  if ((flags & G_FILE_SET_CONTENTS_ONLY_EXISTING)
+      && !g_file_test (filename, G_FILE_TEST_EXISTS))
+    flags &= ~G_FILE_SET_CONTENTS_DURABLE;
+
+  tmp_path = g_strconcat (filename, ".XXXXXX", NULL);
+  fd = g_mkstemp_full (tmp_path, O_RDWR, mode);
+  if (fd < 0)
+    return _set_error_from_errno (error, "create", tmp_path, errno);
+
+  while (written < (gsize) length) {
+    gssize n = write (fd, contents + written, length - written);
+
+    if (n < 0) {
+      gint errsv = errno;
+
+      if (errsv == EINTR)
+        continue;
+
+      close (fd);
+      g_unlink (tmp_path);
+      return _set_error_from_errno (error, "write", tmp_path, errsv);
+    }
+
+    written += n;
+  }
+
+  if ((flags & G_FILE_SET_CONTENTS_DURABLE) && fsync (fd) < 0) {
+    gint errsv = errno;
+
+    close (fd);
+    g_unlink (tmp_path);
+    return _set_error_from_errno (error, "sync", tmp_path, errsv);
+  }
+
+  close (fd);
+
+  if (g_rename (tmp_path, filename) < 0) {
+    gint errsv = errno;
+
+    g_unlink (tmp_path);
+    return _set_error_from_errno (error, "rename", filename, errsv);
+  }
+
+  return TRUE;
+}
+
+#endif
@@ -25,4 +25,18 @@
 gchar * g_uuid_string_random (void);
 #endif
 
+#if ! GLIB_CHECK_VERSION (2, 66, 0)
+typedef enum
+{
+  G_FILE_SET_CONTENTS_NONE = 0,
+  G_FILE_SET_CONTENTS_CONSISTENT = 1 << 0,
+  G_FILE_SET_CONTENTS_DURABLE = 1 << 1,
+  G_FILE_SET_CONTENTS_ONLY_EXISTING = 1 << 2
+} GFileSetContentsFlags;
+
+gboolean g_file_set_contents_full (const gchar * filename,
+    const gchar * contents, gssize length, GFileSetContentsFlags flags,
+    int mode, GError ** error);
+#endif
+
 #endif // __CHAMGE_GLIB_COMPAT_H__
@@ -0,0 +1,186 @@
+/**
+ *  tests/test-amqp-message
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <chamge/chamge.h>
+
+#include <glib.h>
+#include <string.h>
+
+#include "amqp-message.h"
+
+/* the largest body a peer is allowed to inflate to */
+#define MAX_DECODED_BODY_SIZE   (16 * 1024 * 1024)
+
+static gboolean
+_is_gzip (const amqp_basic_properties_t * props)
+{
+  return (props->_flags & AMQP_BASIC_CONTENT_ENCODING_FLAG)
+      && props->content_encoding.len == strlen (CHAMGE_AMQP_ENCODING_GZIP)
+      && !memcmp (props->content_encoding.bytes, CHAMGE_AMQP_ENCODING_GZIP,
+      props->content_encoding.len);
+}
+
+static gchar *
+_decode (amqp_basic_properties_t * props, GBytes * payload, GError ** error)
+{
+  amqp_message_t message = { 0 };
+
+  message.properties = *props;
+  message.body = chamge_amqp_bytes_from_gbytes (payload);
+
+  return chamge_amqp_message_decode_body (&message, error);
+}
+
+static void
+test_amqp_message_gzip_round_trip (void)
+{
+  amqp_basic_properties_t props = { 0 };
+  g_autoptr (GString) body = g_string_new ("{\"devices\":[");
+  g_autoptr (GBytes) payload = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *decoded = NULL;
+  guint i;
+
+  for (i = 0; i < 512; i++)
+    g_string_append_printf (body, "%s{\"edgeId\":\"edge-%u\"}", i ? "," : "",
+        i);
+  g_string_append (body, "]}");
+
+  payload = chamge_amqp_message_encode_body (body->str, 1024, TRUE, &props);
+  g_assert_true (_is_gzip (&props));
+  g_assert_cmpuint (g_bytes_get_size (payload), <, body->len);
+
+  decoded = _decode (&props, payload, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (decoded, ==, body->str);
+}
+
+static void
+test_amqp_message_below_threshold (void)
+{
+  const gchar *body = "{\"result\":\"activated\"}";
+  amqp_basic_properties_t props = { 0 };
+  g_autoptr (GBytes) payload = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *decoded = NULL;
+
+  payload = chamge_amqp_message_encode_body (body, 1024, TRUE, &props);
+  g_assert_false (_is_gzip (&props));
+  g_assert_cmpuint (g_bytes_get_size (payload), ==, strlen (body));
+  g_assert_true (!memcmp (g_bytes_get_data (payload, NULL), body,
+          strlen (body)));
+
+  decoded = _decode (&props, payload, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (decoded, ==, body);
+  g_clear_pointer (&payload, g_bytes_unref);
+
+  /* a peer which did not ask for it, or a threshold of 0, gets it as is */
+  payload = chamge_amqp_message_encode_body (body, 1, FALSE, &props);
+  g_assert_false (_is_gzip (&props));
+  g_clear_pointer (&payload, g_bytes_unref);
+
+  payload = chamge_amqp_message_encode_body (body, 0, TRUE, &props);
+  g_assert_false (_is_gzip (&props));
+}
+
+static void
+test_amqp_message_oversized (void)
+{
+  amqp_basic_properties_t props = { 0 };
+  g_autoptr (GBytes) payload = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *body = NULL;
+  g_autofree gchar *decoded = NULL;
+
+  /* a few kilobytes on the wire which inflate past the limit */
+  body = g_malloc (MAX_DECODED_BODY_SIZE + 2);
+  memset (body, '0', MAX_DECODED_BODY_SIZE + 1);
+  body[MAX_DECODED_BODY_SIZE + 1] = '\0';
+
+  payload = chamge_amqp_message_encode_body (body, 1, TRUE, &props);
+  g_assert_true (_is_gzip (&props));
+  g_assert_cmpuint (g_bytes_get_size (payload), <, 1024 * 1024);
+
+  decoded = _decode (&props, payload, &error);
+  g_assert_null (decoded);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+}
+
+static void
+test_amqp_message_unsupported_encoding (void)
+{
+  amqp_basic_properties_t props = { 0 };
+  g_autoptr (GBytes) payload = g_bytes_new_static ("{}", 2);
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *decoded = NULL;
+
+  props._flags = AMQP_BASIC_CONTENT_ENCODING_FLAG;
+  props.content_encoding = amqp_cstring_bytes ("br");
+
+  decoded = _decode (&props, payload, &error);
+  g_assert_null (decoded);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+  g_clear_error (&error);
+
+  /* identity is no encoding at all */
+  props.content_encoding = amqp_cstring_bytes ("identity");
+  decoded = _decode (&props, payload, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (decoded, ==, "{}");
+}
+
+static void
+test_amqp_message_accept_encoding (void)
+{
+  amqp_basic_properties_t props = { 0 };
+  ChamgeAmqpHeaders headers = { 0 };
+
+  g_assert_false (chamge_amqp_message_accepts_encoding (&props,
+          CHAMGE_AMQP_ENCODING_GZIP));
+
+  chamge_amqp_headers_add_string (&headers,
+      CHAMGE_AMQP_HEADER_ACCEPT_ENCODING, "deflate, GZip");
+  chamge_amqp_headers_apply (&headers, &props);
+
+  g_assert_true (chamge_amqp_message_accepts_encoding (&props,
+          CHAMGE_AMQP_ENCODING_GZIP));
+  g_assert_true (chamge_amqp_message_accepts_encoding (&props, "deflate"));
+  g_assert_false (chamge_amqp_message_accepts_encoding (&props, "br"));
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/amqp-message-gzip-round-trip",
+      test_amqp_message_gzip_round_trip);
+  g_test_add_func ("/chamge/amqp-message-below-threshold",
+      test_amqp_message_below_threshold);
+  g_test_add_func ("/chamge/amqp-message-oversized",
+      test_amqp_message_oversized);
+  g_test_add_func ("/chamge/amqp-message-unsupported-encoding",
+      test_amqp_message_unsupported_encoding);
+  g_test_add_func ("/chamge/amqp-message-accept-encoding",
+      test_amqp_message_accept_encoding);
+  return g_test_run ();
+}
@@ -0,0 +1,270 @@
+/**
+ *  tests/test-arbiter-cluster
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <chamge/chamge.h>
+
+#include <glib.h>
+
+#include "amqp-arbiter-cluster.h"
+
+#define N_PEERS 2
+
+/* a fanout exchange between the peers, which sends a change back to its
+ * origin as well, unless it holds the changes for the test to deliver */
+typedef struct
+{
+  ChamgeRegistry *registries[N_PEERS];
+  ChamgeArbiterCluster *clusters[N_PEERS];
+  const gchar *queues[N_PEERS];
+
+  gboolean hold;
+  GPtrArray *held;
+} Bus;
+
+static void
+_bus_send (const gchar * exchange, const gchar * routing_key,
+    const gchar * body, gpointer user_data)
+{
+  Bus *bus = user_data;
+  guint i;
+
+  if (bus->hold) {
+    g_ptr_array_add (bus->held, g_strdup (body));
+    return;
+  }
+
+  for (i = 0; i < N_PEERS; i++) {
+    if (*exchange != '\0' || !g_strcmp0 (routing_key, bus->queues[i]))
+      chamge_arbiter_cluster_receive (bus->clusters[i], body);
+  }
+}
+
+static void
+_bus_init (Bus * bus)
+{
+  static const gchar *queues[N_PEERS] = { "queue-a", "queue-b" };
+  guint i;
+
+  bus->hold = FALSE;
+  bus->held = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < N_PEERS; i++) {
+    bus->queues[i] = queues[i];
+    bus->registries[i] = chamge_registry_new ();
+    bus->clusters[i] = chamge_arbiter_cluster_new_full (bus->registries[i],
+        "state", queues[i], 0, NULL, _bus_send, bus);
+  }
+}
+
+static void
+_bus_clear (Bus * bus)
+{
+  guint i;
+
+  for (i = 0; i < N_PEERS; i++) {
+    chamge_arbiter_cluster_free (bus->clusters[i]);
+    g_object_unref (bus->registries[i]);
+  }
+
+  g_ptr_array_unref (bus->held);
+}
+
+static void
+_share (Bus * bus, guint peer, const gchar * id)
+{
+  chamge_arbiter_cluster_share_device (bus->clusters[peer], id);
+  chamge_arbiter_cluster_flush (bus->clusters[peer]);
+}
+
+static void
+test_cluster_put_remove (void)
+{
+  g_autofree gchar *hub_id = NULL;
+  ChamgeDeviceState state;
+  guint32 generation, peer_generation;
+  Bus bus;
+
+  _bus_init (&bus);
+
+  chamge_registry_add (bus.registries[0], "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_set_state (bus.registries[0], "edge-1",
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+  chamge_registry_set_hub (bus.registries[0], "edge-1", "hub-1");
+  _share (&bus, 0, "edge-1");
+
+  g_assert_true (chamge_registry_lookup (bus.registries[1], "edge-1", NULL,
+          &state, NULL, &hub_id));
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpstr (hub_id, ==, "hub-1");
+
+  /* so that a session issued by one peer is known to the other */
+  g_assert_true (chamge_registry_get_generation (bus.registries[0], "edge-1",
+          &generation));
+  g_assert_true (chamge_registry_get_generation (bus.registries[1], "edge-1",
+          &peer_generation));
+  g_assert_cmpuint (peer_generation, ==, generation);
+
+  chamge_registry_remove (bus.registries[0], "edge-1");
+  _share (&bus, 0, "edge-1");
+
+  g_assert_false (chamge_registry_contains (bus.registries[1], "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  _bus_clear (&bus);
+}
+
+static void
+test_cluster_echo (void)
+{
+  Bus bus;
+
+  _bus_init (&bus);
+
+  /* our own change comes back after we have moved on */
+  bus.hold = TRUE;
+  chamge_registry_add (bus.registries[0], "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  _share (&bus, 0, "edge-1");
+  chamge_registry_remove (bus.registries[0], "edge-1");
+
+  g_assert_cmpuint (bus.held->len, ==, 1);
+  chamge_arbiter_cluster_receive (bus.clusters[0],
+      g_ptr_array_index (bus.held, 0));
+
+  g_assert_false (chamge_registry_contains (bus.registries[0], "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  _bus_clear (&bus);
+}
+
+static void
+test_cluster_order (void)
+{
+  ChamgeDeviceState state;
+  Bus bus;
+
+  _bus_init (&bus);
+
+  bus.hold = TRUE;
+  chamge_registry_add (bus.registries[0], "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  _share (&bus, 0, "edge-1");
+  chamge_registry_set_state (bus.registries[0], "edge-1",
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+  _share (&bus, 0, "edge-1");
+  g_assert_cmpuint (bus.held->len, ==, 2);
+
+  /* the put of the activation overtakes the one of the enroll */
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      g_ptr_array_index (bus.held, 1));
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      g_ptr_array_index (bus.held, 0));
+
+  g_assert_true (chamge_registry_lookup (bus.registries[1], "edge-1", NULL,
+          &state, NULL, NULL));
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+
+  /* a remove is not undone by an older put */
+  chamge_registry_remove (bus.registries[0], "edge-1");
+  _share (&bus, 0, "edge-1");
+  g_assert_cmpuint (bus.held->len, ==, 3);
+
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      g_ptr_array_index (bus.held, 2));
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      g_ptr_array_index (bus.held, 1));
+
+  g_assert_false (chamge_registry_contains (bus.registries[1], "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  /* a peer which does not order its changes is applied as it comes */
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      "{\"origin\":\"peer\",\"op\":\"put\",\"deviceId\":\"edge-1\","
+      "\"deviceType\":\"edge\",\"state\":\"enrolled\","
+      "\"capacity\":0,\"load\":0}");
+
+  g_assert_true (chamge_registry_contains (bus.registries[1], "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  _bus_clear (&bus);
+}
+
+static void
+test_cluster_touch (void)
+{
+  gint64 before, after;
+  Bus bus;
+
+  _bus_init (&bus);
+
+  chamge_registry_add (bus.registries[1], "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_true (chamge_registry_lookup (bus.registries[1], "edge-1", NULL,
+          NULL, &before, NULL));
+
+  g_usleep (10000);
+  chamge_arbiter_cluster_receive (bus.clusters[1],
+      "{\"origin\":\"peer\",\"op\":\"touch\",\"ids\":\"edge-1,edge-2\","
+      "\"capacity\":0,\"load\":0}");
+
+  g_assert_true (chamge_registry_lookup (bus.registries[1], "edge-1", NULL,
+          NULL, &after, NULL));
+  g_assert_cmpint (after, >, before);
+
+  /* a device unknown here is left to be heard of */
+  g_assert_false (chamge_registry_contains (bus.registries[1], "edge-2",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  _bus_clear (&bus);
+}
+
+static void
+test_cluster_sync (void)
+{
+  ChamgeDeviceState state;
+  Bus bus;
+
+  _bus_init (&bus);
+
+  chamge_registry_add (bus.registries[0], "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (bus.registries[0], "hub-1", CHAMGE_DEVICE_TYPE_HUB);
+  chamge_registry_set_state (bus.registries[0], "hub-1",
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+
+  /* a new peer asks the others for their devices */
+  chamge_arbiter_cluster_sync (bus.clusters[1]);
+
+  g_assert_true (chamge_registry_contains (bus.registries[1], "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_true (chamge_registry_lookup (bus.registries[1], "hub-1", NULL,
+          &state, NULL, NULL));
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+
+  _bus_clear (&bus);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/cluster-put-remove", test_cluster_put_remove);
+  g_test_add_func ("/chamge/cluster-echo", test_cluster_echo);
+  g_test_add_func ("/chamge/cluster-order", test_cluster_order);
+  g_test_add_func ("/chamge/cluster-touch", test_cluster_touch);
+  g_test_add_func ("/chamge/cluster-sync", test_cluster_sync);
+  return g_test_run ();
+}
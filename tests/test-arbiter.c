@@ -54,6 +54,7 @@ test_arbiter_instance (void)
 
   g_object_get (arbiter, "uid", &uid, NULL);
   g_assert_cmpstr (uid, ==, DEFAULT_EDGE_UID);
+  g_assert_nonnull (chamge_arbiter_get_registry (arbiter));
 
   ret = chamge_node_enroll (CHAMGE_NODE (arbiter), FALSE);
   g_assert (ret == CHAMGE_RETURN_OK);
@@ -90,6 +91,105 @@ test_arbiter_activate (TestFixture * fixture, gconstpointer unused)
 
 }
 
+static void
+test_arbiter_send_command (void)
+{
+  ChamgeReturn ret;
+  GVariantDict dict;
+  g_autoptr (ChamgeArbiter) arbiter = NULL;
+  g_autoptr (GVariant) reply = NULL;
+  g_autoptr (GError) error = NULL;
+  const gchar *value = NULL;
+
+  arbiter = chamge_arbiter_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  ret = chamge_node_enroll (CHAMGE_NODE (arbiter), FALSE);
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  ret = chamge_node_activate (CHAMGE_NODE (arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "sessionId", "s", "session-1");
+
+  /* the mock backend echoes the command back */
+  ret = chamge_arbiter_send_command (arbiter, "edge-1", "streamingStart",
+      g_variant_dict_end (&dict), &reply, &error);
+  g_assert (ret == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert_nonnull (reply);
+
+  g_assert_true (g_variant_lookup (reply, "to", "&s", &value));
+  g_assert_cmpstr (value, ==, "edge-1");
+  g_assert_true (g_variant_lookup (reply, "method", "&s", &value));
+  g_assert_cmpstr (value, ==, "streamingStart");
+  g_assert_true (g_variant_lookup (reply, "sessionId", "&s", &value));
+  g_assert_cmpstr (value, ==, "session-1");
+
+  /* the reply is completed as a D-Bus return value, which must not take
+   * over the reference of the caller */
+  g_assert_false (g_variant_is_floating (reply));
+  g_variant_unref (g_variant_new ("(i@a{sv})", ret, reply));
+  g_assert_true (g_variant_lookup (reply, "to", "&s", &value));
+  g_assert_cmpstr (value, ==, "edge-1");
+
+  ret = chamge_node_deactivate (CHAMGE_NODE (arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  ret = chamge_node_delist (CHAMGE_NODE (arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+}
+
+#define TEST_USER_COMMAND "{\"to\":\"edge-1\",\"method\":\"getUrl\"}"
+
+static void
+user_command_done_cb (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  TestFixture *fixture = user_data;
+  ChamgeReturn ret;
+  g_autofree gchar *out = NULL;
+  g_autoptr (GError) error = NULL;
+
+  ret = chamge_arbiter_user_command_finish (CHAMGE_ARBITER (source), result,
+      &out, &error);
+  g_assert (ret == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+
+  /* the mock backend echoes the command back */
+  g_assert_cmpstr (out, ==, TEST_USER_COMMAND);
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+test_arbiter_user_command_async (TestFixture * fixture, gconstpointer unused)
+{
+  ChamgeReturn ret;
+
+  fixture->arbiter = chamge_arbiter_new_full (DEFAULT_EDGE_UID,
+      DEFAULT_BACKEND);
+
+  ret = chamge_node_enroll (CHAMGE_NODE (fixture->arbiter), FALSE);
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  ret = chamge_node_activate (CHAMGE_NODE (fixture->arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  chamge_arbiter_user_command_async (fixture->arbiter, TEST_USER_COMMAND,
+      NULL, user_command_done_cb, fixture);
+
+  g_main_loop_run (fixture->loop);
+
+  ret = chamge_node_deactivate (CHAMGE_NODE (fixture->arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  ret = chamge_node_delist (CHAMGE_NODE (fixture->arbiter));
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  g_clear_object (&fixture->arbiter);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -97,5 +197,8 @@ main (int argc, char *argv[])
   g_test_add_func ("/chamge/arbiter-instance", test_arbiter_instance);
   g_test_add ("/chamge/arbiter-activate", TestFixture, NULL,
       fixture_setup, test_arbiter_activate, fixture_teardown);
+  g_test_add_func ("/chamge/arbiter-send-command", test_arbiter_send_command);
+  g_test_add ("/chamge/arbiter-user-command-async", TestFixture, NULL,
+      fixture_setup, test_arbiter_user_command_async, fixture_teardown);
   return g_test_run ();
 }
@@ -0,0 +1,284 @@
+/**
+ *  tests/test-command-batch
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <chamge/chamge.h>
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "command-batch.h"
+
+/* a peer answering each command after a while, in any order */
+typedef struct
+{
+  gboolean synchronous;
+  guint in_flight;
+  guint max_in_flight;
+  guint sent;
+
+  GVariant *results;
+} Peer;
+
+static gchar *
+_peer_check (const gchar * command, gpointer user_data)
+{
+  if (g_str_has_prefix (command, "reject"))
+    return g_strdup ("{\"result\":\"rejected\"}");
+
+  return NULL;
+}
+
+static void
+_peer_answer (GTask * task)
+{
+  Peer *peer = g_task_get_task_data (task);
+  const gchar *command = g_task_get_source_tag (task);
+
+  peer->in_flight--;
+
+  if (g_str_has_prefix (command, "fail"))
+    g_task_return_new_error (task, CHAMGE_BACKEND_ERROR,
+        CHAMGE_BACKEND_ERROR_OPERATION_FAILURE, "peer said \"%s\"", command);
+  else if (g_str_has_prefix (command, "quiet"))
+    g_task_return_pointer (task, NULL, NULL);
+  else
+    g_task_return_pointer (task, g_strconcat ("reply to ", command, NULL),
+        g_free);
+}
+
+static gboolean
+_peer_reply (gpointer user_data)
+{
+  GTask *task = user_data;
+
+  _peer_answer (task);
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_peer_send (const gchar * command, GAsyncReadyCallback callback,
+    gpointer callback_data, gpointer user_data)
+{
+  Peer *peer = user_data;
+  GTask *task;
+
+  /* a synchronous peer answers before it returns */
+  task = g_task_new (NULL, NULL, peer->synchronous ? NULL : callback,
+      callback_data);
+  g_task_set_task_data (task, peer, NULL);
+  g_task_set_source_tag (task, (gpointer) g_intern_string (command));
+
+  peer->sent++;
+  peer->in_flight++;
+  peer->max_in_flight = MAX (peer->max_in_flight, peer->in_flight);
+
+  if (peer->synchronous) {
+    _peer_answer (task);
+    callback (NULL, G_ASYNC_RESULT (task), callback_data);
+    g_object_unref (task);
+    return;
+  }
+
+  /* the later commands are answered first */
+  g_timeout_add (20 - MIN (peer->sent, 10), _peer_reply, task);
+}
+
+static ChamgeReturn
+_peer_finish (GObject * source, GAsyncResult * result, gchar ** response,
+    GError ** error)
+{
+  GError *local_error = NULL;
+
+  *response = g_task_propagate_pointer (G_TASK (result), &local_error);
+  if (local_error != NULL) {
+    g_propagate_error (error, local_error);
+    return CHAMGE_RETURN_FAIL;
+  }
+
+  return CHAMGE_RETURN_OK;
+}
+
+static const ChamgeCommandBatchFuncs peer_funcs = {
+  _peer_check,
+  _peer_send,
+  _peer_finish,
+};
+
+static void
+_batch_done (GObject * source, GAsyncResult * result, gpointer user_data)
+{
+  Peer *peer = user_data;
+  g_autoptr (GError) error = NULL;
+
+  peer->results = chamge_command_batch_run_finish (result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+_run (Peer * peer, const gchar * const *commands, guint max_in_flight)
+{
+  chamge_command_batch_run_async (commands, max_in_flight, &peer_funcs, peer,
+      _batch_done, peer);
+
+  while (peer->results == NULL)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_command_batch_concurrency (void)
+{
+  const gchar *commands[] = { "c0", "c1", "c2", "c3", "c4", "c5", "c6",
+    "c7", NULL
+  };
+  Peer peer = { 0 };
+  ChamgeReturn ret;
+  const gchar *response;
+  guint i;
+
+  _run (&peer, commands, 3);
+
+  g_assert_cmpuint (peer.sent, ==, 8);
+  g_assert_cmpuint (peer.max_in_flight, ==, 3);
+  g_assert_cmpuint (peer.in_flight, ==, 0);
+
+  /* in the order of the commands, however they are answered */
+  g_assert_cmpuint (g_variant_n_children (peer.results), ==, 8);
+  for (i = 0; i < 8; i++) {
+    g_autofree gchar *expected = g_strconcat ("reply to ", commands[i], NULL);
+
+    g_variant_get_child (peer.results, i, "(i&s)", &ret, &response);
+    g_assert_cmpint (ret, ==, CHAMGE_RETURN_OK);
+    g_assert_cmpstr (response, ==, expected);
+  }
+
+  g_variant_unref (peer.results);
+}
+
+static void
+test_command_batch_empty (void)
+{
+  const gchar *commands[] = { NULL };
+  Peer peer = { 0 };
+
+  _run (&peer, commands, 3);
+
+  g_assert_cmpuint (peer.sent, ==, 0);
+  g_assert_cmpuint (g_variant_n_children (peer.results), ==, 0);
+
+  g_variant_unref (peer.results);
+}
+
+static void
+test_command_batch_rejected (void)
+{
+  const gchar *commands[] = { "reject0", "c1", "reject2", "fail3", NULL };
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  Peer peer = { 0 };
+  ChamgeReturn ret;
+  const gchar *response;
+  JsonObject *object;
+
+  _run (&peer, commands, 1);
+
+  /* a rejected command is never sent, nor holds a slot */
+  g_assert_cmpuint (peer.sent, ==, 2);
+  g_assert_cmpuint (peer.max_in_flight, ==, 1);
+
+  g_variant_get_child (peer.results, 0, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_FAIL);
+  g_assert_cmpstr (response, ==, "{\"result\":\"rejected\"}");
+
+  g_variant_get_child (peer.results, 1, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_OK);
+  g_assert_cmpstr (response, ==, "reply to c1");
+
+  g_variant_get_child (peer.results, 2, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_FAIL);
+
+  /* an error is answered with valid JSON, whatever its message */
+  g_variant_get_child (peer.results, 3, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_FAIL);
+  g_assert_true (json_parser_load_from_data (parser, response, -1, &error));
+  g_assert_no_error (error);
+
+  object = json_node_get_object (json_parser_get_root (parser));
+  g_assert_cmpstr (json_object_get_string_member (object, "result"), ==,
+      "peer said \"fail3\"");
+
+  g_variant_unref (peer.results);
+}
+
+static void
+test_command_batch_synchronous (void)
+{
+  const gchar *commands[] = { "c0", "quiet1", "reject2", "fail3", "c4", NULL };
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  Peer peer = { TRUE };
+  ChamgeReturn ret;
+  const gchar *response;
+  JsonObject *object;
+
+  _run (&peer, commands, 2);
+
+  g_assert_cmpuint (peer.sent, ==, 4);
+  g_assert_cmpuint (peer.max_in_flight, ==, 1);
+  g_assert_cmpuint (g_variant_n_children (peer.results), ==, 5);
+
+  g_variant_get_child (peer.results, 0, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_OK);
+  g_assert_cmpstr (response, ==, "reply to c0");
+
+  /* a success without a response is answered with a result as well */
+  g_variant_get_child (peer.results, 1, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_OK);
+  g_assert_true (json_parser_load_from_data (parser, response, -1, &error));
+  g_assert_no_error (error);
+
+  object = json_node_get_object (json_parser_get_root (parser));
+  g_assert_cmpstr (json_object_get_string_member (object, "result"), ==,
+      "ok");
+
+  g_variant_get_child (peer.results, 3, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_FAIL);
+
+  g_variant_get_child (peer.results, 4, "(i&s)", &ret, &response);
+  g_assert_cmpint (ret, ==, CHAMGE_RETURN_OK);
+  g_assert_cmpstr (response, ==, "reply to c4");
+
+  g_variant_unref (peer.results);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/command-batch-concurrency",
+      test_command_batch_concurrency);
+  g_test_add_func ("/chamge/command-batch-empty", test_command_batch_empty);
+  g_test_add_func ("/chamge/command-batch-rejected",
+      test_command_batch_rejected);
+  g_test_add_func ("/chamge/command-batch-synchronous",
+      test_command_batch_synchronous);
+  return g_test_run ();
+}
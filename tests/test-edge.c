@@ -22,6 +22,8 @@
 
 #include <glib.h>
 
+#include "mock-edge-backend.h"
+
 /*
  * md5 ("abc-987-123") == defaa0a0d935c7b52c459159788a8b7c
  * time group: c
@@ -108,6 +110,330 @@ test_edge_instance_lazy (TestFixture * fixture, gconstpointer unused)
   g_assert (state == CHAMGE_NODE_STATE_NULL);
 }
 
+static void
+test_edge_enroll_activate (void)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  ChamgeNodeState state;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  g_assert (chamge_node_enroll_activate (CHAMGE_NODE (edge)) ==
+      CHAMGE_RETURN_OK);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_ACTIVATED);
+
+  g_assert (chamge_node_deactivate (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+  g_assert (chamge_node_delist (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+}
+
+static void
+test_edge_enroll_window (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  ChamgeNodeState state;
+  guint window_ms, slots;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  g_object_get (edge, "enroll-window", &window_ms, "enroll-slots", &slots,
+      NULL);
+  g_assert_cmpuint (window_ms, ==, 100000);
+  g_assert_cmpuint (slots, ==, 16);
+
+  /* the slot of the uid falls within the window, however it is divided */
+  g_object_set (edge, "enroll-window", 100, "enroll-slots", 1000, NULL);
+
+  g_signal_connect (edge, "state-changed", G_CALLBACK (state_changed_quit_cb),
+      fixture);
+
+  g_assert (chamge_node_enroll (CHAMGE_NODE (edge), TRUE) ==
+      CHAMGE_RETURN_ASYNC);
+
+  g_main_loop_run (fixture->loop);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_ENROLLED);
+
+  g_assert (chamge_node_delist (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+}
+
+static void
+test_edge_enroll_later (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  ChamgeNodeState state;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  g_signal_connect (edge, "state-changed", G_CALLBACK (state_changed_quit_cb),
+      fixture);
+
+  chamge_node_enroll_later (CHAMGE_NODE (edge), 10);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_NULL);
+
+  g_main_loop_run (fixture->loop);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_ENROLLED);
+
+  g_assert (chamge_node_delist (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+}
+
+static gboolean
+quit_loop_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_edge_enroll_later_cancel (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  ChamgeEdge *unowned = NULL;
+  ChamgeNodeState state;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  chamge_node_enroll_later (CHAMGE_NODE (edge), 10);
+  g_assert (chamge_node_delist (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+
+  /* a pending enroll does not keep the node alive either */
+  unowned = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+  g_object_add_weak_pointer (G_OBJECT (unowned), (gpointer *) & unowned);
+  chamge_node_enroll_later (CHAMGE_NODE (unowned), 10);
+  g_object_unref (unowned);
+  g_assert_null (unowned);
+
+  g_timeout_add (50, quit_loop_cb, fixture->loop);
+  g_main_loop_run (fixture->loop);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_NULL);
+}
+
+static void
+async_ready_cb (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  GAsyncResult **res = user_data;
+
+  *res = g_object_ref (result);
+}
+
+static void
+state_changed_record_cb (ChamgeEdge * edge, ChamgeNodeState state,
+    TestFixture * fixture)
+{
+  fixture->prev_state = state;
+}
+
+static GAsyncResult *
+wait_for_result (GAsyncResult ** result)
+{
+  while (*result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return *result;
+}
+
+static void
+test_edge_lifecycle_async (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GAsyncResult) busy_result = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeNodeState state;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  g_signal_connect (edge, "state-changed",
+      G_CALLBACK (state_changed_record_cb), fixture);
+
+  chamge_node_enroll_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+
+  /* one transition at a time */
+  chamge_node_delist_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &busy_result);
+  g_assert (chamge_node_delist_finish (CHAMGE_NODE (edge),
+          wait_for_result (&busy_result), &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_BUSY);
+  g_clear_error (&error);
+
+  g_assert (chamge_node_enroll_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_ENROLLED);
+  g_clear_object (&result);
+
+  /* not activated yet */
+  chamge_node_deactivate_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+  g_assert (chamge_node_deactivate_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INACCESSIBLE);
+  g_clear_error (&error);
+  g_clear_object (&result);
+
+  chamge_node_activate_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+  g_assert (chamge_node_activate_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_ACTIVATED);
+  g_clear_object (&result);
+
+  g_object_get (edge, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_ACTIVATED);
+
+  chamge_node_deactivate_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+  g_assert (chamge_node_deactivate_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_ENROLLED);
+  g_clear_object (&result);
+
+  chamge_node_delist_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+  g_assert (chamge_node_delist_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_NULL);
+  g_clear_object (&result);
+
+  /* back up in a single transition */
+  chamge_node_enroll_activate_async (CHAMGE_NODE (edge), NULL, async_ready_cb,
+      &result);
+  g_assert (chamge_node_enroll_activate_finish (CHAMGE_NODE (edge),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_ACTIVATED);
+}
+
+/* a node the arbiter throttles @throttles times */
+#define TEST_TYPE_THROTTLED_NODE (test_throttled_node_get_type ())
+G_DECLARE_FINAL_TYPE (TestThrottledNode, test_throttled_node, TEST,
+    THROTTLED_NODE, ChamgeNode);
+
+struct _TestThrottledNode
+{
+  ChamgeNode parent;
+
+  guint throttles;
+  guint retry_ms;
+  gint n_enroll;
+  gint n_enroll_activate;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (TestThrottledNode, test_throttled_node, CHAMGE_TYPE_NODE)
+/* *INDENT-ON* */
+
+static ChamgeReturn
+test_throttled_node_enroll (ChamgeNode * node)
+{
+  TestThrottledNode *self = TEST_THROTTLED_NODE (node);
+
+  g_atomic_int_inc (&self->n_enroll);
+
+  return CHAMGE_RETURN_OK;
+}
+
+static ChamgeReturn
+test_throttled_node_enroll_activate (ChamgeNode * node)
+{
+  TestThrottledNode *self = TEST_THROTTLED_NODE (node);
+
+  if (g_atomic_int_add (&self->n_enroll_activate, 1) <
+      (gint) self->throttles) {
+    chamge_node_enroll_later (node, self->retry_ms);
+    return CHAMGE_RETURN_ASYNC;
+  }
+
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+test_throttled_node_class_init (TestThrottledNodeClass * klass)
+{
+  ChamgeNodeClass *node_class = CHAMGE_NODE_CLASS (klass);
+
+  node_class->enroll = test_throttled_node_enroll;
+  node_class->enroll_activate = test_throttled_node_enroll_activate;
+}
+
+static void
+test_throttled_node_init (TestThrottledNode * self)
+{
+}
+
+static void
+test_node_enroll_activate_throttled (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_autoptr (TestThrottledNode) node = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GAsyncResult) busy_result = NULL;
+  g_autoptr (GError) error = NULL;
+  ChamgeNodeState state;
+
+  node = g_object_new (TEST_TYPE_THROTTLED_NODE, "uid", DEFAULT_EDGE_UID,
+      NULL);
+  node->throttles = 2;
+  node->retry_ms = 100;
+
+  g_signal_connect (node, "state-changed",
+      G_CALLBACK (state_changed_record_cb), fixture);
+
+  /* the transition is resolved by the retries, as an enroll and activate */
+  chamge_node_enroll_activate_async (CHAMGE_NODE (node), NULL, async_ready_cb,
+      &result);
+  g_timeout_add (50, quit_loop_cb, fixture->loop);
+  g_main_loop_run (fixture->loop);
+  g_assert_null (result);
+
+  chamge_node_enroll_async (CHAMGE_NODE (node), NULL, async_ready_cb,
+      &busy_result);
+  g_assert (chamge_node_enroll_finish (CHAMGE_NODE (node),
+          wait_for_result (&busy_result), &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR, CHAMGE_BACKEND_ERROR_BUSY);
+  g_clear_error (&error);
+
+  g_assert (chamge_node_enroll_activate_finish (CHAMGE_NODE (node),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_OK);
+  g_assert (fixture->prev_state == CHAMGE_NODE_STATE_ACTIVATED);
+  g_assert_cmpint (node->n_enroll_activate, ==, 3);
+  g_assert_cmpint (node->n_enroll, ==, 0);
+  g_clear_object (&result);
+
+  g_object_get (node, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_ACTIVATED);
+
+  /* a delist cancels the transition waiting for its retry */
+  g_assert (chamge_node_delist (CHAMGE_NODE (node)) == CHAMGE_RETURN_OK);
+  node->throttles = G_MAXUINT;
+  node->retry_ms = 60000;
+
+  chamge_node_enroll_activate_async (CHAMGE_NODE (node), NULL, async_ready_cb,
+      &result);
+  g_timeout_add (50, quit_loop_cb, fixture->loop);
+  g_main_loop_run (fixture->loop);
+  g_assert_null (result);
+
+  g_assert (chamge_node_delist (CHAMGE_NODE (node)) == CHAMGE_RETURN_OK);
+  g_assert (chamge_node_enroll_activate_finish (CHAMGE_NODE (node),
+          wait_for_result (&result), &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+  g_object_get (node, "state", &state, NULL);
+  g_assert (state == CHAMGE_NODE_STATE_NULL);
+}
+
 static void
 test_edge_request_target_uri (TestFixture * fixture, gconstpointer unused)
 {
@@ -146,6 +472,180 @@ test_edge_request_target_uri (TestFixture * fixture, gconstpointer unused)
   g_assert_null (target_uri);
 }
 
+static void
+test_edge_request_batch (void)
+{
+  const gchar *const edge_ids[] = { "edge-1", "edge-2", "edge-3", NULL };
+  g_autoptr (ChamgeEdge) edge = NULL;
+  g_autoptr (GVariant) results = NULL;
+  g_autoptr (GError) error = NULL;
+  const gchar *result = NULL;
+  ChamgeReturn ret;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  results = chamge_edge_request_batch (edge, "enroll", edge_ids, &error);
+  g_assert_null (results);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INACCESSIBLE);
+  g_clear_error (&error);
+
+  ret = chamge_node_enroll (CHAMGE_NODE (edge), FALSE);
+  g_assert (ret == CHAMGE_RETURN_OK);
+
+  results = chamge_edge_request_batch (edge, "enroll", edge_ids, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_variant_n_children (results), ==, 3);
+  g_assert_true (g_variant_lookup (results, "edge-2", "&s", &result));
+  g_assert_cmpstr (result, ==, "enrolled");
+  g_clear_pointer (&results, g_variant_unref);
+
+  results = chamge_edge_request_batch (edge, "activate", edge_ids, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_variant_lookup (results, "edge-3", "&s", &result));
+  g_assert_cmpstr (result, ==, "activated");
+  g_clear_pointer (&results, g_variant_unref);
+
+  results = chamge_edge_request_batch (edge, "requestTargetUri", edge_ids,
+      &error);
+  g_assert_null (results);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_NOT_SUPPORTED);
+
+  ret = chamge_node_delist (CHAMGE_NODE (edge));
+  g_assert (ret == CHAMGE_RETURN_OK);
+}
+
+static ChamgeReturn
+command_handler_cb (ChamgeNode * node, const gchar * cmd, gchar ** response,
+    GError ** error, gpointer user_data)
+{
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+command_handler_notify_cb (gpointer user_data)
+{
+  gint *n_notified = user_data;
+
+  (*n_notified)++;
+}
+
+static void
+test_edge_command_handler (void)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  gint n_notified = 0;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+
+  g_assert_true (chamge_edge_add_command_handler (edge, "streamingStart",
+          command_handler_cb, NULL));
+  g_assert_false (chamge_edge_add_command_handler (edge, "streamingStart",
+          command_handler_cb, NULL));
+
+  g_assert_true (chamge_edge_add_command_handler_full (edge, "streamingStop", 1,
+          command_handler_cb, &n_notified, command_handler_notify_cb));
+
+  g_assert_true (chamge_edge_remove_command_handler (edge, "streamingStart"));
+  g_assert_false (chamge_edge_remove_command_handler (edge, "streamingStart"));
+
+  g_assert_true (chamge_edge_remove_command_handler (edge, "streamingStop"));
+  g_assert_cmpint (n_notified, ==, 1);
+
+  /* handlers left behind are released with the edge */
+  g_assert_true (chamge_edge_add_command_handler_full (edge, "streamingStop", 0,
+          command_handler_cb, &n_notified, command_handler_notify_cb));
+  g_clear_object (&edge);
+  g_assert_cmpint (n_notified, ==, 2);
+}
+
+static ChamgeReturn
+command_reenter_cb (ChamgeNode * node, const gchar * cmd, gchar ** response,
+    GError ** error, gpointer user_data)
+{
+  GError **nested_error = user_data;
+  g_autofree gchar *nested_response = NULL;
+
+  /* the command is still in flight while it is handled */
+  g_assert (chamge_mock_edge_backend_receive_command (CHAMGE_EDGE (node),
+          "streamingStart", cmd, &nested_response, nested_error) ==
+      CHAMGE_RETURN_FAIL);
+  g_assert_null (nested_response);
+
+  *response = g_strdup (cmd);
+  return CHAMGE_RETURN_OK;
+}
+
+static ChamgeReturn
+user_command_cb (ChamgeEdge * edge, const gchar * cmd, gchar ** response,
+    GError ** error, gint * n_emitted)
+{
+  (*n_emitted)++;
+  *response = g_strdup (cmd);
+
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+test_edge_command_dispatch (void)
+{
+  g_autoptr (ChamgeEdge) edge = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GError) nested_error = NULL;
+  g_autofree gchar *response = NULL;
+  gint n_emitted = 0;
+
+  edge = chamge_edge_new_full (DEFAULT_EDGE_UID, DEFAULT_BACKEND);
+  g_assert (chamge_node_enroll (CHAMGE_NODE (edge), FALSE) ==
+      CHAMGE_RETURN_OK);
+
+  g_assert_true (chamge_edge_add_command_handler_full (edge, "streamingStart",
+          1, command_reenter_cb, &nested_error, NULL));
+
+  /* a command over max_concurrency is rejected */
+  g_assert (chamge_mock_edge_backend_receive_command (edge, "streamingStart",
+          "start", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert_cmpstr (response, ==, "start");
+  g_assert_error (nested_error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_BUSY);
+  g_clear_pointer (&response, g_free);
+  g_clear_error (&nested_error);
+
+  /* and the handler takes commands again once it returned */
+  g_assert (chamge_mock_edge_backend_receive_command (edge, "streamingStart",
+          "start again", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_cmpstr (response, ==, "start again");
+  g_clear_pointer (&response, g_free);
+  g_clear_error (&nested_error);
+
+  /* an unknown method is rejected while the signal is not connected */
+  g_assert (chamge_mock_edge_backend_receive_command (edge, "streamingStop",
+          "stop", &response, &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_NOT_SUPPORTED);
+  g_assert_null (response);
+  g_clear_error (&error);
+
+  /* and falls back to the signal once it is */
+  g_signal_connect (edge, "user-command", G_CALLBACK (user_command_cb),
+      &n_emitted);
+  g_assert (chamge_mock_edge_backend_receive_command (edge, "streamingStop",
+          "stop", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert_cmpstr (response, ==, "stop");
+  g_assert_cmpint (n_emitted, ==, 1);
+  g_clear_pointer (&response, g_free);
+
+  /* a method with a handler never reaches the signal */
+  g_assert (chamge_mock_edge_backend_receive_command (edge, "streamingStart",
+          "start", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_cmpint (n_emitted, ==, 1);
+
+  g_assert (chamge_node_delist (CHAMGE_NODE (edge)) == CHAMGE_RETURN_OK);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -153,7 +653,21 @@ main (int argc, char *argv[])
   g_test_add_func ("/chamge/edge-instance", test_edge_instance);
   g_test_add ("/chamge/edge-instance-lazy", TestFixture, NULL,
       fixture_setup, test_edge_instance_lazy, fixture_teardown);
+  g_test_add_func ("/chamge/edge-enroll-activate", test_edge_enroll_activate);
+  g_test_add ("/chamge/edge-enroll-window", TestFixture, NULL,
+      fixture_setup, test_edge_enroll_window, fixture_teardown);
+  g_test_add ("/chamge/edge-enroll-later", TestFixture, NULL,
+      fixture_setup, test_edge_enroll_later, fixture_teardown);
+  g_test_add ("/chamge/edge-enroll-later-cancel", TestFixture, NULL,
+      fixture_setup, test_edge_enroll_later_cancel, fixture_teardown);
+  g_test_add ("/chamge/edge-lifecycle-async", TestFixture, NULL,
+      fixture_setup, test_edge_lifecycle_async, fixture_teardown);
+  g_test_add ("/chamge/node-enroll-activate-throttled", TestFixture, NULL,
+      fixture_setup, test_node_enroll_activate_throttled, fixture_teardown);
   g_test_add ("/chamge/edge-request-target-uri", TestFixture, NULL,
       fixture_setup, test_edge_request_target_uri, fixture_teardown);
+  g_test_add_func ("/chamge/edge-request-batch", test_edge_request_batch);
+  g_test_add_func ("/chamge/edge-command-handler", test_edge_command_handler);
+  g_test_add_func ("/chamge/edge-command-dispatch", test_edge_command_dispatch);
   return g_test_run ();
 }
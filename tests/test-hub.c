@@ -22,6 +22,8 @@
 
 #include <glib.h>
 
+#include "mock-hub-backend.h"
+
 /*
  * md5 ("abc-987-123") == defaa0a0d935c7b52c459159788a8b7c
  * time group: c
@@ -108,6 +110,154 @@ test_hub_instance_lazy (TestFixture * fixture, gconstpointer unused)
   g_assert (state == CHAMGE_NODE_STATE_NULL);
 }
 
+static ChamgeReturn
+command_handler_cb (ChamgeNode * node, const gchar * cmd, gchar ** response,
+    GError ** error, gpointer user_data)
+{
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+command_handler_notify_cb (gpointer user_data)
+{
+  gint *n_notified = user_data;
+
+  (*n_notified)++;
+}
+
+static void
+test_hub_command_handler (void)
+{
+  g_autoptr (ChamgeHub) hub = NULL;
+  gint n_notified = 0;
+
+  hub = chamge_hub_new_full (DEFAULT_HUB_UID, DEFAULT_BACKEND);
+
+  g_assert_true (chamge_hub_add_command_handler (hub, "streamingStart",
+          command_handler_cb, NULL));
+  g_assert_false (chamge_hub_add_command_handler (hub, "streamingStart",
+          command_handler_cb, NULL));
+
+  g_assert_true (chamge_hub_add_command_handler_full (hub, "streamingStop", 1,
+          command_handler_cb, &n_notified, command_handler_notify_cb));
+
+  g_assert_true (chamge_hub_remove_command_handler (hub, "streamingStart"));
+  g_assert_false (chamge_hub_remove_command_handler (hub, "streamingStart"));
+
+  g_assert_true (chamge_hub_remove_command_handler (hub, "streamingStop"));
+  g_assert_cmpint (n_notified, ==, 1);
+
+  /* handlers left behind are released with the hub */
+  g_assert_true (chamge_hub_add_command_handler_full (hub, "streamingStop", 0,
+          command_handler_cb, &n_notified, command_handler_notify_cb));
+  g_clear_object (&hub);
+  g_assert_cmpint (n_notified, ==, 2);
+}
+
+static ChamgeReturn
+command_reenter_cb (ChamgeNode * node, const gchar * cmd, gchar ** response,
+    GError ** error, gpointer user_data)
+{
+  GError **nested_error = user_data;
+  g_autofree gchar *nested_response = NULL;
+
+  /* the command is still in flight while it is handled */
+  g_assert (chamge_mock_hub_backend_receive_command (CHAMGE_HUB (node),
+          "streamingStart", cmd, &nested_response, nested_error) ==
+      CHAMGE_RETURN_FAIL);
+  g_assert_null (nested_response);
+
+  *response = g_strdup (cmd);
+  return CHAMGE_RETURN_OK;
+}
+
+static ChamgeReturn
+user_command_cb (ChamgeHub * hub, const gchar * cmd, gchar ** response,
+    GError ** error, gint * n_emitted)
+{
+  (*n_emitted)++;
+  *response = g_strdup (cmd);
+
+  return CHAMGE_RETURN_OK;
+}
+
+static void
+test_hub_command_dispatch (void)
+{
+  g_autoptr (ChamgeHub) hub = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GError) nested_error = NULL;
+  g_autofree gchar *response = NULL;
+  gint n_emitted = 0;
+
+  hub = chamge_hub_new_full (DEFAULT_HUB_UID, DEFAULT_BACKEND);
+  g_assert (chamge_node_enroll (CHAMGE_NODE (hub), FALSE) ==
+      CHAMGE_RETURN_OK);
+
+  g_assert_true (chamge_hub_add_command_handler_full (hub, "streamingStart",
+          1, command_reenter_cb, &nested_error, NULL));
+
+  /* a command over max_concurrency is rejected */
+  g_assert (chamge_mock_hub_backend_receive_command (hub, "streamingStart",
+          "start", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert_cmpstr (response, ==, "start");
+  g_assert_error (nested_error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_BUSY);
+  g_clear_pointer (&response, g_free);
+  g_clear_error (&nested_error);
+
+  /* and the handler takes commands again once it returned */
+  g_assert (chamge_mock_hub_backend_receive_command (hub, "streamingStart",
+          "start again", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_cmpstr (response, ==, "start again");
+  g_clear_pointer (&response, g_free);
+  g_clear_error (&nested_error);
+
+  /* an unknown method is rejected while the signal is not connected */
+  g_assert (chamge_mock_hub_backend_receive_command (hub, "streamingStop",
+          "stop", &response, &error) == CHAMGE_RETURN_FAIL);
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_NOT_SUPPORTED);
+  g_assert_null (response);
+  g_clear_error (&error);
+
+  /* and falls back to the signal once it is */
+  g_signal_connect (hub, "user-command", G_CALLBACK (user_command_cb),
+      &n_emitted);
+  g_assert (chamge_mock_hub_backend_receive_command (hub, "streamingStop",
+          "stop", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_no_error (error);
+  g_assert_cmpstr (response, ==, "stop");
+  g_assert_cmpint (n_emitted, ==, 1);
+  g_clear_pointer (&response, g_free);
+
+  /* a method with a handler never reaches the signal */
+  g_assert (chamge_mock_hub_backend_receive_command (hub, "streamingStart",
+          "start", &response, &error) == CHAMGE_RETURN_OK);
+  g_assert_cmpint (n_emitted, ==, 1);
+
+  g_assert (chamge_node_delist (CHAMGE_NODE (hub)) == CHAMGE_RETURN_OK);
+}
+
+static void
+test_hub_load (void)
+{
+  g_autoptr (ChamgeHub) hub = NULL;
+  guint capacity = 0, load = 0;
+
+  hub = chamge_hub_new_full (DEFAULT_HUB_UID, DEFAULT_BACKEND);
+
+  chamge_hub_get_load (hub, &capacity, &load);
+  g_assert_cmpuint (capacity, ==, 0);
+  g_assert_cmpuint (load, ==, 0);
+
+  chamge_hub_set_load (hub, 16, 3);
+  chamge_hub_get_load (hub, &capacity, &load);
+  g_assert_cmpuint (capacity, ==, 16);
+  g_assert_cmpuint (load, ==, 3);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -115,5 +265,8 @@ main (int argc, char *argv[])
   g_test_add_func ("/chamge/hub-instance", test_hub_instance);
   g_test_add ("/chamge/hub-instance-lazy", TestFixture, NULL,
       fixture_setup, test_hub_instance_lazy, fixture_teardown);
+  g_test_add_func ("/chamge/hub-command-handler", test_hub_command_handler);
+  g_test_add_func ("/chamge/hub-command-dispatch", test_hub_command_dispatch);
+  g_test_add_func ("/chamge/hub-load", test_hub_load);
   return g_test_run ();
 }
@@ -0,0 +1,180 @@
+/**
+ *  tests/test-messages
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <chamge/chamge.h>
+
+#include <glib.h>
+#include <string.h>
+
+#include "messages-generated.h"
+
+/* a little longer than the stack buffer of _to_json () */
+#define LONG_STRING_LENGTH      1000
+
+static void
+test_messages_escape (void)
+{
+  ChamgeMsgResult msg = { 0 };
+  ChamgeMsgResult decoded;
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *json = NULL;
+
+  msg.result = "say \"hi\" \\ \n\t\x01\x1f é";
+  json = chamge_msg_result_to_json (&msg);
+  g_assert_cmpstr (json, ==,
+      "{\"result\":\"say \\\"hi\\\" \\\\ \\u000a\\u0009\\u0001\\u001f é\"}");
+
+  g_assert_true (chamge_msg_result_parse_json (&decoded, parser, json, -1,
+          &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (decoded.result, ==, msg.result);
+}
+
+static void
+test_messages_short_buffer (void)
+{
+  ChamgeMsgThrottled msg = { 0 };
+  const gchar *expected =
+      "{\"result\":\"wait\",\"retryAfterMs\":-1500,\"windowMs\":0}";
+  gchar buf[16];
+  gsize len;
+
+  msg.result = "wait";
+  msg.retry_after_ms = -1500;
+
+  /* like snprintf (), the whole length is returned whatever the size */
+  len = chamge_msg_throttled_encode_json (&msg, NULL, 0);
+  g_assert_cmpuint (len, ==, strlen (expected));
+
+  memset (buf, 'x', sizeof (buf));
+  len = chamge_msg_throttled_encode_json (&msg, buf, sizeof (buf));
+  g_assert_cmpuint (len, ==, strlen (expected));
+  g_assert_cmpuint (strlen (buf), ==, sizeof (buf) - 1);
+  g_assert_true (g_str_has_prefix (expected, buf));
+
+  len = chamge_msg_throttled_encode_json (&msg, buf, 1);
+  g_assert_cmpuint (len, ==, strlen (expected));
+  g_assert_cmpstr (buf, ==, "");
+}
+
+static void
+test_messages_long (void)
+{
+  ChamgeMsgResult msg = { 0 };
+  ChamgeMsgResult decoded;
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GString) expected = g_string_new ("{\"result\":\"");
+  g_autofree gchar *value = g_strnfill (LONG_STRING_LENGTH, 'a');
+  g_autofree gchar *json = NULL;
+
+  /* an escape straddling the end of the stack buffer, past "{\"result\":\"" */
+  value[242] = '\n';
+  msg.result = value;
+
+  g_string_append_len (expected, value, 242);
+  g_string_append (expected, "\\u000a");
+  g_string_append (expected, value + 243);
+  g_string_append (expected, "\"}");
+
+  json = chamge_msg_result_to_json (&msg);
+  g_assert_cmpstr (json, ==, expected->str);
+  g_assert_cmpuint (chamge_msg_result_encode_json (&msg, NULL, 0), ==,
+      expected->len);
+
+  g_assert_true (chamge_msg_result_parse_json (&decoded, parser, json, -1,
+          &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (decoded.result, ==, value);
+}
+
+static void
+test_messages_parse_members (void)
+{
+  ChamgeMsgThrottled msg;
+  g_autoptr (JsonParser) parser = json_parser_new ();
+  g_autoptr (GError) error = NULL;
+
+  /* optional members may be absent or null */
+  g_assert_true (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":\"wait\",\"retryAfterMs\":20,\"windowMs\":null}", -1,
+          &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (msg.result, ==, "wait");
+  g_assert_cmpint (msg.retry_after_ms, ==, 20);
+  g_assert_cmpint (msg.window_ms, ==, 0);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":\"wait\"}", -1, &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_MISSING_PARAMETER);
+  g_assert_cmpstr (error->message, ==, "retryAfterMs is missing");
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":\"wait\",\"retryAfterMs\":null}", -1, &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_MISSING_PARAMETER);
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":\"wait\",\"retryAfterMs\":\"20\"}", -1, &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+  g_assert_cmpstr (error->message, ==, "retryAfterMs must be a number");
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":7,\"retryAfterMs\":20}", -1, &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+  g_assert_cmpstr (error->message, ==, "result must be a string");
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser,
+          "{\"result\":{},\"retryAfterMs\":20}", -1, &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser, "[]", -1,
+          &error));
+  g_assert_error (error, CHAMGE_BACKEND_ERROR,
+      CHAMGE_BACKEND_ERROR_INVALID_PARAMETER);
+  g_clear_error (&error);
+
+  g_assert_false (chamge_msg_throttled_parse_json (&msg, parser, "{", -1,
+          &error));
+  g_assert_nonnull (error);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/messages-escape", test_messages_escape);
+  g_test_add_func ("/chamge/messages-short-buffer",
+      test_messages_short_buffer);
+  g_test_add_func ("/chamge/messages-long", test_messages_long);
+  g_test_add_func ("/chamge/messages-parse-members",
+      test_messages_parse_members);
+  return g_test_run ();
+}
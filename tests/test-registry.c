@@ -0,0 +1,630 @@
+/**
+ *  tests/test-registry
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <chamge/chamge.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+static void
+test_registry_add_remove (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  guint32 generation;
+
+  g_assert_true (chamge_registry_add (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_false (chamge_registry_add (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_true (chamge_registry_add (registry, "hub-1",
+          CHAMGE_DEVICE_TYPE_HUB));
+
+  g_assert_true (chamge_registry_contains (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_false (chamge_registry_contains (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_HUB));
+  g_assert_false (chamge_registry_contains (registry, "edge-2",
+          CHAMGE_DEVICE_TYPE_EDGE));
+
+  g_assert_cmpuint (chamge_registry_count_by_type (registry,
+          CHAMGE_DEVICE_TYPE_EDGE), ==, 1);
+  g_assert_cmpuint (chamge_registry_count_by_type (registry,
+          CHAMGE_DEVICE_TYPE_HUB), ==, 1);
+
+  g_assert_true (chamge_registry_get_generation (registry, "edge-1",
+          &generation));
+  g_assert_true (chamge_registry_remove (registry, "edge-1"));
+  g_assert_false (chamge_registry_remove (registry, "edge-1"));
+  g_assert_false (chamge_registry_contains (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  /* a removed device has no generation left to resume a session of */
+  g_assert_false (chamge_registry_get_generation (registry, "edge-1",
+          &generation));
+  g_assert_cmpuint (chamge_registry_count_by_type (registry,
+          CHAMGE_DEVICE_TYPE_EDGE), ==, 0);
+  g_assert_cmpuint (chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ENROLLED), ==, 1);
+}
+
+static void
+test_registry_state (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_auto (GStrv) ids = NULL;
+  g_autofree gchar *hub_id = NULL;
+  ChamgeDeviceType type;
+  ChamgeDeviceState state;
+  gint64 last_seen = 0;
+
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+
+  g_assert_true (chamge_registry_set_state (registry, "edge-2",
+          CHAMGE_DEVICE_STATE_ACTIVATED));
+  g_assert_false (chamge_registry_set_state (registry, "edge-3",
+          CHAMGE_DEVICE_STATE_ACTIVATED));
+  g_assert_true (chamge_registry_set_hub (registry, "edge-2", "hub-1"));
+
+  g_assert_true (chamge_registry_lookup (registry, "edge-2", &type, &state,
+          &last_seen, &hub_id));
+  g_assert_cmpint (type, ==, CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpint (last_seen, >, 0);
+  g_assert_cmpstr (hub_id, ==, "hub-1");
+
+  ids = chamge_registry_list_by_state (registry,
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpuint (g_strv_length (ids), ==, 1);
+  g_assert_cmpstr (ids[0], ==, "edge-2");
+
+  g_assert_cmpuint (chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ENROLLED), ==, 1);
+
+  /* removing a device drops it from the secondary indexes as well */
+  chamge_registry_remove (registry, "edge-2");
+  g_assert_cmpuint (chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ACTIVATED), ==, 0);
+}
+
+static void
+test_registry_put (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  ChamgeDeviceState state;
+
+  /* straight to activated, without passing through enrolled */
+  g_assert_true (chamge_registry_put (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE, CHAMGE_DEVICE_STATE_ACTIVATED));
+  g_assert_true (chamge_registry_lookup (registry, "edge-1", NULL, &state,
+          NULL, NULL));
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpuint (chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ENROLLED), ==, 0);
+
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_false (chamge_registry_put (registry, "edge-2",
+          CHAMGE_DEVICE_TYPE_EDGE, CHAMGE_DEVICE_STATE_ACTIVATED));
+  g_assert_cmpuint (chamge_registry_count_by_state (registry,
+          CHAMGE_DEVICE_STATE_ACTIVATED), ==, 2);
+  g_assert_cmpuint (chamge_registry_count_by_type (registry,
+          CHAMGE_DEVICE_TYPE_EDGE), ==, 2);
+}
+
+static void
+test_registry_version (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  guint64 version = chamge_registry_get_version (registry);
+
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_cmpuint (chamge_registry_get_version (registry), >, version);
+  version = chamge_registry_get_version (registry);
+
+  /* being seen is not a change */
+  chamge_registry_touch (registry, "edge-1");
+  chamge_registry_set_state (registry, "edge-1", CHAMGE_DEVICE_STATE_ENROLLED);
+  g_assert_cmpuint (chamge_registry_get_version (registry), ==, version);
+
+  chamge_registry_set_state (registry, "edge-1",
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpuint (chamge_registry_get_version (registry), >, version);
+  version = chamge_registry_get_version (registry);
+
+  chamge_registry_set_hub (registry, "edge-1", "hub-1");
+  g_assert_cmpuint (chamge_registry_get_version (registry), >, version);
+  version = chamge_registry_get_version (registry);
+
+  chamge_registry_set_hub (registry, "edge-1", "hub-1");
+  g_assert_cmpuint (chamge_registry_get_version (registry), ==, version);
+
+  chamge_registry_remove (registry, "edge-1");
+  g_assert_cmpuint (chamge_registry_get_version (registry), >, version);
+}
+
+static gboolean
+_collect_page (const ChamgeRegistryDevice * device, gpointer user_data)
+{
+  GPtrArray *page = user_data;
+
+  if (page->len == 2)
+    return FALSE;
+
+  g_ptr_array_add (page, g_strdup (device->id));
+
+  return TRUE;
+}
+
+static void
+test_registry_foreach (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_autoptr (GPtrArray) page = g_ptr_array_new_with_free_func (g_free);
+
+  chamge_registry_add (registry, "edge-3", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "hub-1", CHAMGE_DEVICE_TYPE_HUB);
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+
+  /* devices come in the order of their ids, a page at a time */
+  chamge_registry_foreach (registry, NULL, _collect_page, page);
+  g_assert_cmpuint (page->len, ==, 2);
+  g_assert_cmpstr (g_ptr_array_index (page, 0), ==, "edge-1");
+  g_assert_cmpstr (g_ptr_array_index (page, 1), ==, "edge-2");
+
+  g_ptr_array_set_size (page, 0);
+  chamge_registry_foreach (registry, "edge-2", _collect_page, page);
+  g_assert_cmpuint (page->len, ==, 2);
+  g_assert_cmpstr (g_ptr_array_index (page, 0), ==, "edge-3");
+  g_assert_cmpstr (g_ptr_array_index (page, 1), ==, "hub-1");
+
+  /* the cursor need not be registered */
+  chamge_registry_remove (registry, "edge-3");
+  g_ptr_array_set_size (page, 0);
+  chamge_registry_foreach (registry, "edge-3", _collect_page, page);
+  g_assert_cmpuint (page->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (page, 0), ==, "hub-1");
+}
+
+static gboolean
+_collect_all (const ChamgeRegistryDevice * device, gpointer user_data)
+{
+  g_ptr_array_add (user_data, g_strdup (device->id));
+
+  return TRUE;
+}
+
+static void
+test_registry_snapshot (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_autoptr (GPtrArray) devices = g_ptr_array_new_with_free_func (g_free);
+  guint64 version;
+
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "hub-1", CHAMGE_DEVICE_TYPE_HUB);
+
+  version = chamge_registry_snapshot (registry, _collect_all, devices);
+  g_assert_cmpuint (version, ==, chamge_registry_get_version (registry));
+  g_assert_cmpuint (devices->len, ==, 3);
+  g_assert_cmpstr (g_ptr_array_index (devices, 0), ==, "edge-1");
+  g_assert_cmpstr (g_ptr_array_index (devices, 1), ==, "edge-2");
+  g_assert_cmpstr (g_ptr_array_index (devices, 2), ==, "hub-1");
+
+  /* a change after the snapshot is seen by the next one only */
+  chamge_registry_remove (registry, "edge-2");
+  g_assert_cmpuint (chamge_registry_get_version (registry), >, version);
+
+  g_ptr_array_set_size (devices, 0);
+  version = chamge_registry_snapshot (registry, _collect_all, devices);
+  g_assert_cmpuint (version, ==, chamge_registry_get_version (registry));
+  g_assert_cmpuint (devices->len, ==, 2);
+}
+
+static ChamgeRegistry *
+_open_registry (const gchar * path)
+{
+  ChamgeRegistry *registry = chamge_registry_new ();
+  g_autoptr (GError) error = NULL;
+
+  g_assert_true (chamge_registry_open_journal (registry, path, &error));
+  g_assert_no_error (error);
+
+  return registry;
+}
+
+static void
+_check_restored (ChamgeRegistry * registry, guint32 generation)
+{
+  g_autofree gchar *hub_id = NULL;
+  ChamgeDeviceState state;
+  guint32 restored_generation = 0;
+
+  g_assert_true (chamge_registry_contains (registry, "hub-1",
+          CHAMGE_DEVICE_TYPE_HUB));
+  g_assert_false (chamge_registry_contains (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_true (chamge_registry_lookup (registry, "edge-2", NULL, &state,
+          NULL, &hub_id));
+  g_assert_cmpint (state, ==, CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_cmpstr (hub_id, ==, "hub-1");
+
+  g_assert_true (chamge_registry_get_generation (registry, "edge-2",
+          &restored_generation));
+  g_assert_cmpuint (restored_generation, ==, generation);
+}
+
+static void
+test_registry_journal (void)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *dir = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *snapshot_path = NULL;
+  g_autofree gchar *epoch_path = NULL;
+  g_autofree gchar *epoch = NULL;
+  g_autofree gchar *restored_epoch = NULL;
+  ChamgeRegistry *registry;
+  GStatBuf buf;
+  guint32 generation = 0;
+  FILE *file;
+
+  dir = g_dir_make_tmp ("chamge-registry-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (dir, "registry", NULL);
+  snapshot_path = g_strconcat (path, ".snapshot", NULL);
+  epoch_path = g_strconcat (path, ".epoch", NULL);
+
+  registry = _open_registry (path);
+  epoch = chamge_registry_dup_epoch (registry);
+  chamge_registry_add (registry, "hub-1", CHAMGE_DEVICE_TYPE_HUB);
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_set_state (registry, "edge-2",
+      CHAMGE_DEVICE_STATE_ACTIVATED);
+  chamge_registry_set_hub (registry, "edge-2", "hub-1");
+  chamge_registry_remove (registry, "edge-1");
+
+  /* as adopted from another arbiter */
+  g_assert_true (chamge_registry_set_generation (registry, "edge-2",
+          0x1234abcd));
+  g_assert_false (chamge_registry_set_generation (registry, "edge-1",
+          0x1234abcd));
+  g_assert_true (chamge_registry_get_generation (registry, "edge-2",
+          &generation));
+  g_assert_cmpuint (generation, ==, 0x1234abcd);
+  g_object_unref (registry);
+
+  /* the epoch signs sessions, so only the arbiter may read it */
+  g_assert_cmpint (g_stat (epoch_path, &buf), ==, 0);
+  g_assert_cmpint (buf.st_mode & 0777, ==, 0600);
+
+  /* from the journal only */
+  registry = _open_registry (path);
+  _check_restored (registry, generation);
+
+  /* the devices are not lost, so neither is their epoch */
+  restored_epoch = chamge_registry_dup_epoch (registry);
+  g_assert_cmpstr (restored_epoch, ==, epoch);
+
+  g_assert_true (chamge_registry_compact (registry, &error));
+  g_assert_no_error (error);
+  g_object_unref (registry);
+
+  /* a torn record at the end of the journal is dropped */
+  file = fopen (path, "ab");
+  g_assert_nonnull (file);
+  fwrite ("\x30\x00\x00\x00torn", 1, 8, file);
+  fclose (file);
+
+  /* from the snapshot */
+  registry = _open_registry (path);
+  _check_restored (registry, generation);
+  g_object_unref (registry);
+
+  g_unlink (path);
+  g_unlink (snapshot_path);
+  g_unlink (epoch_path);
+  g_rmdir (dir);
+}
+
+static void
+_device_expired_cb (ChamgeRegistry * registry, const gchar * id,
+    ChamgeDeviceType type, GMainLoop * loop)
+{
+  g_assert_cmpstr (id, ==, "edge-1");
+  g_assert_cmpint (type, ==, CHAMGE_DEVICE_TYPE_EDGE);
+
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+_expiry_timeout_cb (gpointer user_data)
+{
+  g_assert_not_reached ();
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_registry_expiry (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  guint timeout_id;
+
+  chamge_registry_set_expiry (registry, 1);
+  g_assert_cmpuint (chamge_registry_get_expiry (registry), ==, 1);
+
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  g_signal_connect (registry, "device-expired",
+      G_CALLBACK (_device_expired_cb), loop);
+
+  timeout_id = g_timeout_add_seconds (10, _expiry_timeout_cb, NULL);
+  g_main_loop_run (loop);
+  g_source_remove (timeout_id);
+
+  g_assert_false (chamge_registry_contains (registry, "edge-1",
+          CHAMGE_DEVICE_TYPE_EDGE));
+  g_assert_cmpuint (chamge_registry_count_by_type (registry,
+          CHAMGE_DEVICE_TYPE_EDGE), ==, 0);
+}
+
+static void
+_add_hub (ChamgeRegistry * registry, const gchar * hub_id, guint capacity,
+    guint load)
+{
+  g_autofree gchar *uri = g_strconcat ("srt://", hub_id, ":8888", NULL);
+
+  chamge_registry_add (registry, hub_id, CHAMGE_DEVICE_TYPE_HUB);
+  chamge_registry_set_state (registry, hub_id, CHAMGE_DEVICE_STATE_ACTIVATED);
+  g_assert_true (chamge_registry_set_hub_load (registry, hub_id, capacity,
+          load, uri));
+}
+
+static void
+test_registry_assign_least_loaded (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_autofree gchar *uri = NULL;
+  g_autofree gchar *hub_id = NULL;
+  gchar *assigned;
+  guint i;
+
+  /* no hub yet */
+  chamge_registry_add (registry, "edge-0", CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_null (chamge_registry_assign_hub (registry, "edge-0",
+          CHAMGE_HUB_STRATEGY_LEAST_LOADED, NULL));
+
+  _add_hub (registry, "hub-1", 2, 1);
+  _add_hub (registry, "hub-2", 8, 0);
+
+  hub_id = chamge_registry_assign_hub (registry, "edge-0",
+      CHAMGE_HUB_STRATEGY_LEAST_LOADED, &uri);
+  g_assert_cmpstr (hub_id, ==, "hub-2");
+  g_assert_cmpstr (uri, ==, "srt://hub-2:8888");
+
+  for (i = 1; i < 10; i++) {
+    g_autofree gchar *edge_id = g_strdup_printf ("edge-%u", i);
+
+    chamge_registry_add (registry, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+    assigned = chamge_registry_assign_hub (registry, edge_id,
+        CHAMGE_HUB_STRATEGY_LEAST_LOADED, NULL);
+    g_assert_nonnull (assigned);
+    g_free (assigned);
+  }
+
+  /* both hubs are full now */
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-1"), ==, 2);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-2"), ==, 8);
+
+  chamge_registry_add (registry, "edge-10", CHAMGE_DEVICE_TYPE_EDGE);
+  g_assert_null (chamge_registry_assign_hub (registry, "edge-10",
+          CHAMGE_HUB_STRATEGY_LEAST_LOADED, NULL));
+
+  /* an edge leaving makes room for another */
+  chamge_registry_remove (registry, "edge-0");
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-2"), ==, 7);
+  assigned = chamge_registry_assign_hub (registry, "edge-10",
+      CHAMGE_HUB_STRATEGY_LEAST_LOADED, NULL);
+  g_assert_cmpstr (assigned, ==, "hub-2");
+  g_free (assigned);
+
+  /* an assigned edge keeps its hub */
+  assigned = chamge_registry_assign_hub (registry, "edge-10",
+      CHAMGE_HUB_STRATEGY_LEAST_LOADED, NULL);
+  g_assert_cmpstr (assigned, ==, "hub-2");
+  g_free (assigned);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-2"), ==, 8);
+}
+
+static void
+test_registry_assign_weighted (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  guint i;
+
+  _add_hub (registry, "hub-1", 100, 0);
+  _add_hub (registry, "hub-2", 100, 100);
+  _add_hub (registry, "hub-3", 50, 0);
+
+  /* a deactivated hub is never chosen */
+  _add_hub (registry, "hub-4", 100, 0);
+  chamge_registry_set_state (registry, "hub-4", CHAMGE_DEVICE_STATE_ENROLLED);
+
+  for (i = 0; i < 150; i++) {
+    g_autofree gchar *edge_id = g_strdup_printf ("edge-%u", i);
+    g_autofree gchar *hub_id = NULL;
+
+    chamge_registry_add (registry, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+    hub_id = chamge_registry_assign_hub (registry, edge_id,
+        CHAMGE_HUB_STRATEGY_WEIGHTED, NULL);
+    g_assert_nonnull (hub_id);
+  }
+
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-1"), ==,
+      100);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-2"), ==, 0);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-3"), ==, 50);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-4"), ==, 0);
+}
+
+static void
+test_registry_assign_consistent_hash (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  g_autofree gchar *before = NULL;
+  guint i, moved = 0;
+  gchar *hub_id;
+
+  for (i = 0; i < 4; i++) {
+    g_autofree gchar *id = g_strdup_printf ("hub-%u", i);
+    _add_hub (registry, id, 0, 0);
+  }
+
+  for (i = 0; i < 200; i++) {
+    g_autofree gchar *edge_id = g_strdup_printf ("edge-%u", i);
+
+    chamge_registry_add (registry, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+    hub_id = chamge_registry_assign_hub (registry, edge_id,
+        CHAMGE_HUB_STRATEGY_CONSISTENT_HASH, NULL);
+    g_assert_nonnull (hub_id);
+    g_free (hub_id);
+  }
+
+  /* virtual nodes spread the edges over every hub */
+  for (i = 0; i < 4; i++) {
+    g_autofree gchar *id = g_strdup_printf ("hub-%u", i);
+    g_assert_cmpuint (chamge_registry_count_assigned (registry, id), >, 20);
+  }
+
+  /* an edge which comes back lands on the same hub */
+  chamge_registry_lookup (registry, "edge-7", NULL, NULL, NULL, &before);
+  chamge_registry_remove (registry, "edge-7");
+  chamge_registry_add (registry, "edge-7", CHAMGE_DEVICE_TYPE_EDGE);
+  hub_id = chamge_registry_assign_hub (registry, "edge-7",
+      CHAMGE_HUB_STRATEGY_CONSISTENT_HASH, NULL);
+  g_assert_cmpstr (hub_id, ==, before);
+  g_free (hub_id);
+
+  /* a new hub only takes the edges which are moved to it */
+  _add_hub (registry, "hub-4", 0, 0);
+  for (i = 0; i < 200; i++) {
+    g_autofree gchar *edge_id = g_strdup_printf ("edge-%u", i);
+    g_autofree gchar *old = NULL;
+
+    chamge_registry_lookup (registry, edge_id, NULL, NULL, NULL, &old);
+    chamge_registry_remove (registry, edge_id);
+    chamge_registry_add (registry, edge_id, CHAMGE_DEVICE_TYPE_EDGE);
+    hub_id = chamge_registry_assign_hub (registry, edge_id,
+        CHAMGE_HUB_STRATEGY_CONSISTENT_HASH, NULL);
+    if (g_strcmp0 (hub_id, old) != 0) {
+      g_assert_cmpstr (hub_id, ==, "hub-4");
+      moved++;
+    }
+    g_free (hub_id);
+  }
+  g_assert_cmpuint (moved, >, 0);
+  g_assert_cmpuint (moved, <, 100);
+
+  /* the edges of a hub which is gone are assigned again */
+  chamge_registry_remove (registry, "hub-4");
+  hub_id = chamge_registry_assign_hub (registry, "edge-7",
+      CHAMGE_HUB_STRATEGY_CONSISTENT_HASH, NULL);
+  g_assert_cmpstr (hub_id, !=, "hub-4");
+  g_free (hub_id);
+}
+
+static void
+test_registry_assign_lowest_rtt (void)
+{
+  g_autoptr (ChamgeRegistry) registry = chamge_registry_new ();
+  const gchar *hub_ids[] = { "hub-1", "hub-2", "hub-3" };
+  const guint rtts[] = { 40, 5, 12 };
+  g_autofree gchar *uri = NULL;
+  gchar *hub_id;
+
+  _add_hub (registry, "hub-1", 0, 0);
+  _add_hub (registry, "hub-2", 1, 0);
+  _add_hub (registry, "hub-3", 0, 0);
+  chamge_registry_add (registry, "edge-1", CHAMGE_DEVICE_TYPE_EDGE);
+  chamge_registry_add (registry, "edge-2", CHAMGE_DEVICE_TYPE_EDGE);
+
+  /* nothing measured yet, so the least loaded hub */
+  hub_id = chamge_registry_assign_hub (registry, "edge-1",
+      CHAMGE_HUB_STRATEGY_LOWEST_RTT, NULL);
+  g_assert_cmpstr (hub_id, ==, "hub-1");
+  g_free (hub_id);
+
+  g_assert_true (chamge_registry_set_latencies (registry, "edge-1", hub_ids,
+          rtts, G_N_ELEMENTS (hub_ids)));
+  g_assert_true (chamge_registry_set_latencies (registry, "edge-2", hub_ids,
+          rtts, G_N_ELEMENTS (hub_ids)));
+  g_assert_false (chamge_registry_set_latencies (registry, "hub-1", hub_ids,
+          rtts, G_N_ELEMENTS (hub_ids)));
+
+  /* the nearest hub once measured */
+  hub_id = chamge_registry_assign_hub (registry, "edge-1",
+      CHAMGE_HUB_STRATEGY_LOWEST_RTT, &uri);
+  g_assert_cmpstr (hub_id, ==, "hub-2");
+  g_assert_cmpstr (uri, ==, "srt://hub-2:8888");
+  g_free (hub_id);
+  g_assert_cmpuint (chamge_registry_count_assigned (registry, "hub-1"), ==, 0);
+
+  /* the nearest one with room left */
+  hub_id = chamge_registry_assign_hub (registry, "edge-2",
+      CHAMGE_HUB_STRATEGY_LOWEST_RTT, NULL);
+  g_assert_cmpstr (hub_id, ==, "hub-3");
+  g_free (hub_id);
+
+  /* a full hub keeps the edge it has */
+  hub_id = chamge_registry_assign_hub (registry, "edge-1",
+      CHAMGE_HUB_STRATEGY_LOWEST_RTT, NULL);
+  g_assert_cmpstr (hub_id, ==, "hub-2");
+  g_free (hub_id);
+
+  g_assert_null (chamge_registry_dup_hub_uri (registry, "hub-4"));
+  g_free (uri);
+  uri = chamge_registry_dup_hub_uri (registry, "hub-3");
+  g_assert_cmpstr (uri, ==, "srt://hub-3:8888");
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/registry-add-remove", test_registry_add_remove);
+  g_test_add_func ("/chamge/registry-state", test_registry_state);
+  g_test_add_func ("/chamge/registry-put", test_registry_put);
+  g_test_add_func ("/chamge/registry-version", test_registry_version);
+  g_test_add_func ("/chamge/registry-foreach", test_registry_foreach);
+  g_test_add_func ("/chamge/registry-snapshot", test_registry_snapshot);
+  g_test_add_func ("/chamge/registry-journal", test_registry_journal);
+  g_test_add_func ("/chamge/registry-expiry", test_registry_expiry);
+  g_test_add_func ("/chamge/registry-assign-least-loaded",
+      test_registry_assign_least_loaded);
+  g_test_add_func ("/chamge/registry-assign-weighted",
+      test_registry_assign_weighted);
+  g_test_add_func ("/chamge/registry-assign-consistent-hash",
+      test_registry_assign_consistent_hash);
+  g_test_add_func ("/chamge/registry-assign-lowest-rtt",
+      test_registry_assign_lowest_rtt);
+  return g_test_run ();
+}
@@ -0,0 +1,126 @@
+/**
+ *  tests/test-reply-cache
+ *
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *    Author: Jeongseok Kim <jeongseok.kim@sk.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "reply-cache.h"
+
+static void
+test_reply_cache_lookup (void)
+{
+  ChamgeReplyCache *cache = chamge_reply_cache_new (4);
+  g_autofree gchar *response = NULL;
+  gint status = 0;
+
+  g_assert_false (chamge_reply_cache_lookup (cache, "q1", "id-1", &response,
+          &status));
+
+  chamge_reply_cache_insert (cache, "q1", "id-1", "{\"result\":\"enrolled\"}",
+      200);
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", &response,
+          &status));
+  g_assert_cmpstr (response, ==, "{\"result\":\"enrolled\"}");
+  g_assert_cmpint (status, ==, 200);
+
+  /* the same id chosen by another peer is another request */
+  g_assert_false (chamge_reply_cache_lookup (cache, "q2", "id-1", NULL,
+          NULL));
+  g_assert_false (chamge_reply_cache_lookup (cache, NULL, "id-1", NULL,
+          NULL));
+
+  chamge_reply_cache_free (cache);
+}
+
+static void
+test_reply_cache_update (void)
+{
+  ChamgeReplyCache *cache = chamge_reply_cache_new (4);
+  g_autofree gchar *response = NULL;
+  gint status = 0;
+
+  chamge_reply_cache_insert (cache, "q1", "id-1", "first", 503);
+  chamge_reply_cache_insert (cache, "q1", "id-1", "second", 200);
+
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", &response,
+          &status));
+  g_assert_cmpstr (response, ==, "second");
+  g_assert_cmpint (status, ==, 200);
+
+  chamge_reply_cache_free (cache);
+}
+
+static void
+test_reply_cache_eviction (void)
+{
+  ChamgeReplyCache *cache = chamge_reply_cache_new (2);
+
+  chamge_reply_cache_insert (cache, "q1", "id-1", "one", 200);
+  chamge_reply_cache_insert (cache, "q1", "id-2", "two", 200);
+
+  /* id-2 becomes the least recently used */
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", NULL, NULL));
+
+  chamge_reply_cache_insert (cache, "q1", "id-3", "three", 200);
+
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", NULL, NULL));
+  g_assert_false (chamge_reply_cache_lookup (cache, "q1", "id-2", NULL, NULL));
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-3", NULL, NULL));
+
+  /* an update makes a reply the most recently used as well */
+  chamge_reply_cache_insert (cache, "q1", "id-1", "one again", 200);
+  chamge_reply_cache_insert (cache, "q1", "id-4", "four", 200);
+
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", NULL, NULL));
+  g_assert_false (chamge_reply_cache_lookup (cache, "q1", "id-3", NULL, NULL));
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-4", NULL, NULL));
+
+  chamge_reply_cache_free (cache);
+}
+
+static void
+test_reply_cache_null_id (void)
+{
+  ChamgeReplyCache *cache = chamge_reply_cache_new (1);
+  gchar *response = NULL;
+
+  /* a request without a correlation id can't be told from another */
+  chamge_reply_cache_insert (cache, "q1", NULL, "anonymous", 200);
+  g_assert_false (chamge_reply_cache_lookup (cache, "q1", NULL, &response,
+          NULL));
+  g_assert_null (response);
+
+  /* nor does it take the place of another reply */
+  chamge_reply_cache_insert (cache, "q1", "id-1", "one", 200);
+  chamge_reply_cache_insert (cache, "q1", NULL, "anonymous", 200);
+  g_assert_true (chamge_reply_cache_lookup (cache, "q1", "id-1", NULL, NULL));
+
+  chamge_reply_cache_free (cache);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/chamge/reply-cache-lookup", test_reply_cache_lookup);
+  g_test_add_func ("/chamge/reply-cache-update", test_reply_cache_update);
+  g_test_add_func ("/chamge/reply-cache-eviction", test_reply_cache_eviction);
+  g_test_add_func ("/chamge/reply-cache-null-id", test_reply_cache_null_id);
+  return g_test_run ();
+}